@@ -0,0 +1,615 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TinyOCL.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr double kNanosecondsPerSecond = 1e9;
+constexpr size_t kKiB = 1024;
+constexpr size_t kMiB = 1024 * kKiB;
+
+/**
+ * @brief BenchmarkOptions are the command line options of the benchmark.
+ *
+ */
+struct BenchmarkOptions {
+    int repetitions = 5;
+    double min_time = 0.05;
+    std::string filter;
+    std::string output = "TinyOCLBench.json";
+    std::string baseline;
+    double threshold = 10.0;
+};
+
+/**
+ * @brief BenchmarkResult is the outcome of one benchmark, value is the median of the samples.
+ *
+ */
+struct BenchmarkResult {
+    std::string name;
+    std::string unit;
+    bool higher_is_better = false;
+    std::vector<double> samples;
+    uint64_t iterations = 0;
+    double value = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    bool has_baseline = false;
+    double baseline = 0.0;
+    double change_percent = 0.0;
+    bool regression = false;
+};
+
+/**
+ * @brief BenchmarkRunner times operations and collects the results.
+ *
+ * Every sample runs an operation as many times as it takes to fill the minimum sample time, so fast operations are
+ * not dominated by the clock resolution. The first call of an operation is a warmup which is not timed.
+ */
+class BenchmarkRunner final {
+public:
+    explicit BenchmarkRunner(const BenchmarkOptions &options) : options_(options) {}
+
+    bool Enabled(const std::string &name) const
+    {
+        return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+
+    /**
+     * @brief Measure the time of an operation in nanoseconds
+     *
+     * @param name The name of the benchmark
+     * @param operation The operation, returns false on failure
+     * @param finish Called once after the operations of a sample, e.g. to wait for enqueued commands
+     * @return true
+     * @return false
+     */
+    bool MeasureTime(const std::string &name,
+        const std::function<bool()> &operation,
+        const std::function<bool()> &finish = nullptr)
+    {
+        return Measure(name, "ns", false, 0.0, operation, finish);
+    }
+
+    /**
+     * @brief Measure the rate of an operation, the work per operation divided by its time
+     *
+     * @param name The name of the benchmark
+     * @param unit The unit of the rate
+     * @param work The work of one operation in the unit per second, e.g. 1e-9 * bytes for GB/s
+     * @param operation The operation, returns false on failure
+     * @param finish Called once after the operations of a sample, e.g. to wait for enqueued commands
+     * @return true
+     * @return false
+     */
+    bool MeasureRate(const std::string &name,
+        const std::string &unit,
+        double work,
+        const std::function<bool()> &operation,
+        const std::function<bool()> &finish = nullptr)
+    {
+        return Measure(name, unit, true, work, operation, finish);
+    }
+
+    /**
+     * @brief Add a result derived from other results
+     *
+     * @param name The name of the benchmark
+     * @param unit The unit of the value
+     * @param higher_is_better Whether a higher value is an improvement
+     * @param value The value
+     */
+    void AddDerived(const std::string &name, const std::string &unit, bool higher_is_better, double value)
+    {
+        BenchmarkResult result;
+        result.name = name;
+        result.unit = unit;
+        result.higher_is_better = higher_is_better;
+        result.samples = {value};
+        result.value = result.min = result.max = value;
+        Report(result);
+    }
+
+    const BenchmarkResult *Find(const std::string &name) const
+    {
+        for (const auto &result : results_) {
+            if (result.name == name) {
+                return &result;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<BenchmarkResult> &GetResults() { return results_; }
+
+private:
+    bool Measure(const std::string &name,
+        const std::string &unit,
+        bool is_rate,
+        double work,
+        const std::function<bool()> &operation,
+        const std::function<bool()> &finish)
+    {
+        if (!operation() || (finish && !finish())) {
+            std::cout << "Benchmark " << name << " failed" << std::endl;
+            return false;
+        }
+        // Grow the iteration count until one sample takes the minimum time.
+        uint64_t iterations = 1;
+        double seconds = 0.0;
+        while (true) {
+            if (!RunSample(operation, finish, iterations, seconds)) {
+                std::cout << "Benchmark " << name << " failed" << std::endl;
+                return false;
+            }
+            if (seconds >= options_.min_time || iterations >= (uint64_t(1) << 30)) {
+                break;
+            }
+            const double scale = seconds > 0.0 ? options_.min_time / seconds * 1.2 : 10.0;
+            iterations = std::max(iterations + 1, static_cast<uint64_t>(iterations * std::min(scale, 10.0)));
+        }
+        BenchmarkResult result;
+        result.name = name;
+        result.unit = unit;
+        result.higher_is_better = is_rate;
+        result.iterations = iterations;
+        for (int repetition = 0; repetition < options_.repetitions; repetition++) {
+            if (repetition > 0 && !RunSample(operation, finish, iterations, seconds)) {
+                std::cout << "Benchmark " << name << " failed" << std::endl;
+                return false;
+            }
+            const double seconds_per_operation = seconds / iterations;
+            result.samples.emplace_back(
+                is_rate ? work / seconds_per_operation : seconds_per_operation * kNanosecondsPerSecond);
+        }
+        std::vector<double> sorted = result.samples;
+        std::sort(sorted.begin(), sorted.end());
+        const size_t middle = sorted.size() / 2;
+        result.value = sorted.size() % 2 == 0 ? (sorted[middle - 1] + sorted[middle]) / 2 : sorted[middle];
+        result.min = sorted.front();
+        result.max = sorted.back();
+        Report(result);
+        return true;
+    }
+
+    static bool RunSample(const std::function<bool()> &operation,
+        const std::function<bool()> &finish,
+        uint64_t iterations,
+        double &seconds)
+    {
+        const auto start = Clock::now();
+        for (uint64_t i = 0; i < iterations; i++) {
+            if (!operation()) {
+                return false;
+            }
+        }
+        if (finish && !finish()) {
+            return false;
+        }
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return true;
+    }
+
+    void Report(const BenchmarkResult &result)
+    {
+        std::cout << std::left << std::setw(40) << result.name << std::right << std::setw(14) << std::fixed
+                  << std::setprecision(3) << result.value << " " << result.unit << std::endl;
+        results_.emplace_back(result);
+    }
+
+    BenchmarkOptions options_;
+    std::vector<BenchmarkResult> results_;
+};
+
+std::string FormatSize(size_t size)
+{
+    if (size >= kMiB && size % kMiB == 0) {
+        return std::to_string(size / kMiB) + "MiB";
+    }
+    if (size >= kKiB && size % kKiB == 0) {
+        return std::to_string(size / kKiB) + "KiB";
+    }
+    return std::to_string(size) + "B";
+}
+
+// A kernel taking num_args buffer arguments, only the first one is written.
+std::string GetArgsKernelSource(int num_args)
+{
+    std::ostringstream source;
+    source << "__kernel void args" << num_args << "(";
+    for (int i = 0; i < num_args; i++) {
+        source << (i == 0 ? "" : ", ") << "__global float *a" << i;
+    }
+    source << ")\n{\n    if (get_global_id(0) == 0) {\n        a0[0] += 1.0f;\n    }\n}\n";
+    return source.str();
+}
+
+template <size_t... Is>
+bool RunWithArgs(const TinyOCL::Kernel &kernel, cl_mem mem, std::index_sequence<Is...>)
+{
+    return kernel.RunAsync({1}, {}, {}, nullptr, ((void)Is, mem)...);
+}
+
+// Consecutive launches alternate between two buffers, so every argument changes and is bound on every launch
+// instead of being skipped as unchanged.
+template <size_t N>
+std::function<bool()> GetArgsLaunch(const std::shared_ptr<TinyOCL::Kernel> &kernel, cl_mem mem0, cl_mem mem1)
+{
+    return [kernel, mem0, mem1, launch = size_t(0)]() mutable {
+        return RunWithArgs(*kernel, (launch++ % 2 == 0) ? mem0 : mem1, std::make_index_sequence<N>{});
+    };
+}
+
+bool BenchmarkLaunch(BenchmarkRunner &runner)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto finish = [&executor]() { return executor.Finish(); };
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    auto buffer = executor.CreateBuffer(64 * sizeof(float), TinyOCL::BufferMode::DeviceOnly);
+    auto other_buffer = executor.CreateBuffer(64 * sizeof(float), TinyOCL::BufferMode::DeviceOnly);
+    if (!kernel || !buffer || !other_buffer) {
+        std::cout << "Failed to create launch benchmark resources" << std::endl;
+        return false;
+    }
+    cl_mem mem = buffer->GetClMem();
+    bool ret = true;
+    if (runner.Enabled("launch/sync")) {
+        ret &= runner.MeasureTime("launch/sync", [&]() { return kernel->Run({64}, {}, false, mem, mem, mem); });
+    }
+    if (runner.Enabled("launch/async")) {
+        ret &= runner.MeasureTime(
+            "launch/async", [&]() { return kernel->Run({64}, {}, true, mem, mem, mem); }, finish);
+    }
+
+    // The launch time per argument count, the slope between the smallest and largest count is the cost of an
+    // argument.
+    using ArgsLaunch = std::function<bool()> (*)(const std::shared_ptr<TinyOCL::Kernel> &, cl_mem, cl_mem);
+    const std::map<int, ArgsLaunch> launches = {
+        {1, GetArgsLaunch<1>}, {2, GetArgsLaunch<2>}, {4, GetArgsLaunch<4>}, {8, GetArgsLaunch<8>},
+        {16, GetArgsLaunch<16>}};
+    for (const auto &launch : launches) {
+        const std::string name = "set_arg/" + std::to_string(launch.first) + "_args";
+        if (!runner.Enabled(name)) {
+            continue;
+        }
+        auto args_kernel = executor.CreateKernelFromSource(
+            GetArgsKernelSource(launch.first), "args" + std::to_string(launch.first), {});
+        if (!args_kernel) {
+            std::cout << "Failed to create kernel with " << launch.first << " arguments" << std::endl;
+            ret = false;
+            continue;
+        }
+        ret &= runner.MeasureTime(name, launch.second(args_kernel, mem, other_buffer->GetClMem()), finish);
+    }
+    const BenchmarkResult *first = runner.Find("set_arg/1_args");
+    const BenchmarkResult *last = runner.Find("set_arg/16_args");
+    if (first != nullptr && last != nullptr) {
+        runner.AddDerived("set_arg/per_arg", "ns", false, (last->value - first->value) / 15.0);
+    }
+    return ret;
+}
+
+bool BenchmarkMemcpy(BenchmarkRunner &runner)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    const std::vector<std::pair<std::string, TinyOCL::BufferMode>> modes = {
+        {"device_only", TinyOCL::BufferMode::DeviceOnly},
+        {"host_visible", TinyOCL::BufferMode::HostVisiblePersistent}};
+    const std::vector<std::pair<std::string, TinyOCL::MemcpyKind>> kinds = {
+        {"h2d", TinyOCL::MemcpyKind::HostToDevice}, {"d2h", TinyOCL::MemcpyKind::DeviceToHost}};
+    bool ret = true;
+    for (size_t size : {4 * kKiB, 256 * kKiB, 4 * kMiB, 64 * kMiB}) {
+        std::vector<uint8_t> host_data(size, 1);
+        for (const auto &mode : modes) {
+            std::shared_ptr<TinyOCL::Buffer> buffer;
+            for (const auto &kind : kinds) {
+                const std::string name = "memcpy/" + kind.first + "/" + mode.first + "/" + FormatSize(size);
+                if (!runner.Enabled(name)) {
+                    continue;
+                }
+                if (!buffer) {
+                    buffer = executor.CreateBuffer(size, mode.second);
+                }
+                if (!buffer) {
+                    std::cout << "Failed to create buffer of " << size << " bytes" << std::endl;
+                    ret = false;
+                    break;
+                }
+                ret &= runner.MeasureRate(name, "GB/s", size / kNanosecondsPerSecond, [&]() {
+                    return buffer->Memcpy(host_data.data(), size, kind.second);
+                });
+            }
+        }
+    }
+    return ret;
+}
+
+bool BenchmarkCreateBuffer(BenchmarkRunner &runner)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    bool ret = true;
+    for (size_t size : {4 * kKiB, kMiB, 16 * kMiB}) {
+        const std::string name = "create_buffer/" + FormatSize(size);
+        if (!runner.Enabled(name)) {
+            continue;
+        }
+        // Creating and dropping the buffer in one operation measures the allocation and release churn.
+        ret &= runner.MeasureTime(name, [&]() { return executor.CreateBuffer(size) != nullptr; });
+    }
+    return ret;
+}
+
+bool BenchmarkCreateKernel(BenchmarkRunner &runner)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    bool ret = true;
+    if (runner.Enabled("create_kernel/cold")) {
+        // A new build option per operation is a new program variant, which is built and never found in the cache.
+        // The variants are kept by an Executor of their own with a temporary cache directory, so they are released and
+        // their cache entries removed once measured.
+        uint64_t variant = 0;
+        const uint64_t seed = Clock::now().time_since_epoch().count();
+        const std::filesystem::path cache_directory =
+            std::filesystem::temp_directory_path() / ("tinyocl_bench_cache_" + std::to_string(seed));
+        TinyOCL::ExecutorOptions options;
+        options.program_cache_directory = cache_directory.string();
+        auto cold_executor = TinyOCL::Executor::Create(options);
+        if (!cold_executor) {
+            std::cout << "Failed to create the Executor of the cold kernels" << std::endl;
+            ret = false;
+        } else {
+            ret &= runner.MeasureTime("create_kernel/cold", [&]() {
+                const std::string option =
+                    "-DTINYOCL_BENCH_VARIANT=" + std::to_string(seed) + "_" + std::to_string(variant++);
+                return cold_executor->CreateKernel("cl/calc.cl", "add", {option}) != nullptr;
+            });
+        }
+        cold_executor.reset();
+        std::error_code error;
+        std::filesystem::remove_all(cache_directory, error);
+    }
+    if (runner.Enabled("create_kernel/warm")) {
+        ret &= runner.MeasureTime(
+            "create_kernel/warm", [&]() { return executor.CreateKernel("cl/calc.cl", "add", {}) != nullptr; });
+    }
+    return ret;
+}
+
+bool BenchmarkAdd(BenchmarkRunner &runner)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    if (!kernel) {
+        std::cout << "Failed to create add kernel" << std::endl;
+        return false;
+    }
+    bool ret = true;
+    for (size_t count : {size_t(1) << 16, size_t(1) << 20, size_t(1) << 24}) {
+        const std::string name = "add/" + std::to_string(count);
+        if (!runner.Enabled(name)) {
+            continue;
+        }
+        std::vector<float> host_a(count, 1.0f);
+        std::vector<float> host_b(count, 2.0f);
+        std::vector<float> host_result(count, 0.0f);
+        auto a = executor.CreateBuffer(count * sizeof(float), TinyOCL::BufferMode::DeviceOnly);
+        auto b = executor.CreateBuffer(count * sizeof(float), TinyOCL::BufferMode::DeviceOnly);
+        auto result = executor.CreateBuffer(count * sizeof(float), TinyOCL::BufferMode::DeviceOnly);
+        if (!a || !b || !result) {
+            std::cout << "Failed to create add buffers of " << count << " elements" << std::endl;
+            ret = false;
+            continue;
+        }
+        // End to end: upload both inputs, add and download the result, two loads and one store per element.
+        const size_t size = count * sizeof(float);
+        ret &= runner.MeasureRate(name, "GB/s", 3.0 * size / kNanosecondsPerSecond, [&]() {
+            return a->Memcpy(host_a.data(), size, TinyOCL::MemcpyKind::HostToDevice) &&
+                   b->Memcpy(host_b.data(), size, TinyOCL::MemcpyKind::HostToDevice) &&
+                   kernel->Run({count}, {}, true, a->GetClMem(), b->GetClMem(), result->GetClMem()) &&
+                   result->Memcpy(host_result.data(), size, TinyOCL::MemcpyKind::DeviceToHost);
+        });
+        if (host_result[count - 1] != 3.0f) {
+            std::cout << "Wrong add result: " << host_result[count - 1] << std::endl;
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+bool LoadBaseline(const std::string &path, std::map<std::string, double> &baseline)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cout << "Failed to open baseline file: " << path << std::endl;
+        return false;
+    }
+    // Every result is written on one line, so the baseline is read line by line.
+    const std::regex result_regex(R"re("name": "([^"]*)".*"value": ([-+0-9.eE]+))re");
+    std::string line;
+    std::smatch match;
+    while (std::getline(file, line)) {
+        if (std::regex_search(line, match, result_regex)) {
+            baseline[match[1].str()] = std::strtod(match[2].str().c_str(), nullptr);
+        }
+    }
+    if (baseline.empty()) {
+        std::cout << "No results in baseline file: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int CompareBaseline(
+    std::vector<BenchmarkResult> &results, const std::map<std::string, double> &baseline, double threshold)
+{
+    int regressions = 0;
+    std::cout << std::endl
+              << "Comparison with baseline, threshold " << std::defaultfloat << threshold << "%" << std::endl;
+    for (auto &result : results) {
+        auto baseline_iter = baseline.find(result.name);
+        if (baseline_iter == baseline.end() || baseline_iter->second == 0.0) {
+            continue;
+        }
+        result.has_baseline = true;
+        result.baseline = baseline_iter->second;
+        result.change_percent = (result.value - result.baseline) / std::fabs(result.baseline) * 100.0;
+        const double worse = result.higher_is_better ? -result.change_percent : result.change_percent;
+        result.regression = worse > threshold;
+        regressions += result.regression ? 1 : 0;
+        std::cout << std::left << std::setw(40) << result.name << std::right << std::setw(14) << std::fixed
+                  << std::setprecision(3) << result.baseline << " -> " << std::setw(14) << result.value << " "
+                  << result.unit << std::showpos << std::setw(10) << std::setprecision(1) << result.change_percent
+                  << std::noshowpos << "%" << (result.regression ? "  REGRESSION" : "") << std::endl;
+    }
+    std::cout << regressions << " regression(s)" << std::endl;
+    return regressions;
+}
+
+std::string EscapeJson(const std::string &value)
+{
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+bool WriteJson(const std::string &path, const BenchmarkOptions &options, const std::vector<BenchmarkResult> &results)
+{
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cout << "Failed to open output file: " << path << std::endl;
+        return false;
+    }
+    file << std::setprecision(9);
+    file << "{\n";
+    file << "  \"benchmark\": \"TinyOCLBench\",\n";
+#ifdef TINYOCL_VERSION_STRING
+    file << "  \"version\": \"" << TINYOCL_VERSION_STRING << "\",\n";
+#endif
+    file << "  \"timestamp\": " << std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) << ",\n";
+    file << "  \"device_count\": " << TinyOCL::Executor::GetInstance().GetDeviceCount() << ",\n";
+    TinyOCL::DeviceInfo device_info;
+    if (TinyOCL::Executor::GetInstance().GetDeviceInfo(0, device_info)) {
+        file << "  \"device\": \"" << EscapeJson(device_info.name) << "\",\n";
+        file << "  \"platform\": \"" << EscapeJson(device_info.platform) << "\",\n";
+    }
+    file << "  \"repetitions\": " << options.repetitions << ",\n";
+    file << "  \"min_time\": " << options.min_time << ",\n";
+    file << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult &result = results[i];
+        file << "    {\"name\": \"" << EscapeJson(result.name) << "\", \"unit\": \"" << EscapeJson(result.unit)
+             << "\", \"higher_is_better\": " << (result.higher_is_better ? "true" : "false")
+             << ", \"value\": " << result.value << ", \"min\": " << result.min << ", \"max\": " << result.max
+             << ", \"iterations\": " << result.iterations << ", \"samples\": " << result.samples.size();
+        if (result.has_baseline) {
+            file << ", \"baseline\": " << result.baseline << ", \"change_percent\": " << result.change_percent
+                 << ", \"regression\": " << (result.regression ? "true" : "false");
+        }
+        file << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+    return true;
+}
+
+void PrintUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --output <file>        Write the results as JSON, default TinyOCLBench.json\n"
+              << "  --baseline <file>      Compare with the results of an earlier run\n"
+              << "  --threshold <percent>  Slowdown reported as regression, default 10\n"
+              << "  --filter <text>        Only run benchmarks whose name contains the text\n"
+              << "  --repetitions <n>      Samples per benchmark, default 5\n"
+              << "  --min-time <seconds>   Minimum time of a sample, default 0.05\n"
+              << "The exit code is 1 on failure and 2 when the baseline comparison finds a regression." << std::endl;
+}
+
+bool ParseOptions(int argc, char **argv, BenchmarkOptions &options)
+{
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::cout << "Missing value of " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--output") {
+            options.output = value;
+        } else if (arg == "--baseline") {
+            options.baseline = value;
+        } else if (arg == "--threshold") {
+            options.threshold = std::strtod(value.c_str(), nullptr);
+        } else if (arg == "--filter") {
+            options.filter = value;
+        } else if (arg == "--repetitions") {
+            options.repetitions = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--min-time") {
+            options.min_time = std::max(0.0, std::strtod(value.c_str(), nullptr));
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    BenchmarkOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    std::map<std::string, double> baseline;
+    if (!options.baseline.empty() && !LoadBaseline(options.baseline, baseline)) {
+        return 1;
+    }
+    if (TinyOCL::Executor::GetInstance().GetDeviceCount() == 0) {
+        std::cout << "No OpenCL device available" << std::endl;
+        return 1;
+    }
+
+    BenchmarkRunner runner(options);
+    bool ret = true;
+    ret &= BenchmarkLaunch(runner);
+    ret &= BenchmarkMemcpy(runner);
+    ret &= BenchmarkCreateBuffer(runner);
+    ret &= BenchmarkCreateKernel(runner);
+    ret &= BenchmarkAdd(runner);
+
+    int regressions = 0;
+    if (!baseline.empty()) {
+        regressions = CompareBaseline(runner.GetResults(), baseline, options.threshold);
+    }
+    if (!WriteJson(options.output, options, runner.GetResults())) {
+        return 1;
+    }
+    if (!ret) {
+        return 1;
+    }
+    return regressions > 0 ? 2 : 0;
+}
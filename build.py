@@ -25,6 +25,7 @@ def get_args() -> argparse.ArgumentParser:
     parser.add_argument("--clean", action="store_true", help="Clean the build directory")
     parser.add_argument("--example", action="store_true", help="Build the example")
     parser.add_argument("--test", action="store_true", help="Build the test")
+    parser.add_argument("--bench", action="store_true", help="Build the benchmark")
     args = parser.parse_args()
     return args
 
@@ -42,6 +43,8 @@ def get_options(args) -> List[str]:
         options += ["-DENABLE_EXAMPLE=ON"]
     if args.test:
         options += ["-DENABLE_TEST=ON"]
+    if args.bench:
+        options += ["-DENABLE_BENCHMARK=ON"]
     return options
 
 if __name__ == "__main__":
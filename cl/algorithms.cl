@@ -0,0 +1,406 @@
+// Built-in algorithm kernels of TinyOCL::Algorithms, built with -DWG_SIZE=<work group size>.
+// Every block kernel runs WG_SIZE work items which load 4 consecutive elements each, so a work group covers a tile
+// of TILE_SIZE elements. Counts and indices are 32-bit, the host limits the element count accordingly.
+// The op arguments of the kernels are the values of TransformOp and ReduceOp.
+
+#ifndef WG_SIZE
+#define WG_SIZE 256
+#endif
+#define TILE_SIZE (WG_SIZE * 4)
+#define RADIX_BITS 4
+#define RADIX (1 << RADIX_BITS)
+#define HISTOGRAM_LOCAL_BINS 1024
+
+inline float ApplyTransform(float a, float b, int op)
+{
+    switch (op) {
+        case 0: return a + b;
+        case 1: return a - b;
+        case 2: return a * b;
+        case 3: return a / b;
+        case 4: return fmin(a, b);
+        default: return fmax(a, b);
+    }
+}
+
+inline float4 ApplyTransform4(float4 a, float4 b, int op)
+{
+    switch (op) {
+        case 0: return a + b;
+        case 1: return a - b;
+        case 2: return a * b;
+        case 3: return a / b;
+        case 4: return fmin(a, b);
+        default: return fmax(a, b);
+    }
+}
+
+inline float Combine(float a, float b, int op)
+{
+    return op == 0 ? a + b : (op == 1 ? fmin(a, b) : fmax(a, b));
+}
+
+inline float4 Combine4(float4 a, float4 b, int op)
+{
+    return op == 0 ? a + b : (op == 1 ? fmin(a, b) : fmax(a, b));
+}
+
+inline float ReduceIdentity(int op)
+{
+    return op == 0 ? 0.0f : (op == 1 ? INFINITY : -INFINITY);
+}
+
+__kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+void TransformBuffer(__global const float *a, __global const float *b, __global float *output, uint count, int op)
+{
+    const uint i = get_global_id(0);
+    if (i * 4 + 4 <= count) {
+        vstore4(ApplyTransform4(vload4(i, a), vload4(i, b), op), i, output);
+        return;
+    }
+    for (uint j = i * 4; j < count; ++j) {
+        output[j] = ApplyTransform(a[j], b[j], op);
+    }
+}
+
+__kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+void TransformScalar(__global const float *a, float b, __global float *output, uint count, int op)
+{
+    const uint i = get_global_id(0);
+    if (i * 4 + 4 <= count) {
+        vstore4(ApplyTransform4(vload4(i, a), (float4)(b), op), i, output);
+        return;
+    }
+    for (uint j = i * 4; j < count; ++j) {
+        output[j] = ApplyTransform(a[j], b, op);
+    }
+}
+
+// Every work item folds a grid-stride range of float4, the work group folds the partial results as a tree in local
+// memory and one atomic per work group merges them into the result, which the host initializes to the identity.
+__kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+void Reduce(__global const float *input, uint count, int op, __global float *result)
+{
+    __local float partial[WG_SIZE];
+    const uint lid = get_local_id(0);
+    const uint gid = get_global_id(0);
+    const uint stride = get_global_size(0);
+    const uint num_vectors = count / 4;
+    float4 acc4 = (float4)(ReduceIdentity(op));
+    for (uint i = gid; i < num_vectors; i += stride) {
+        acc4 = Combine4(acc4, vload4(i, input), op);
+    }
+    float acc = Combine(Combine(acc4.x, acc4.y, op), Combine(acc4.z, acc4.w, op), op);
+    if (gid < count - num_vectors * 4) {
+        acc = Combine(acc, input[num_vectors * 4 + gid], op);
+    }
+    partial[lid] = acc;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint s = WG_SIZE / 2; s > 0; s >>= 1) {
+        if (lid < s) {
+            partial[lid] = Combine(partial[lid], partial[lid + s], op);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) {
+        volatile __global uint *target = (volatile __global uint *)result;
+        uint expected = *target;
+        for (;;) {
+            const uint desired = as_uint(Combine(as_float(expected), partial[0], op));
+            const uint previous = atomic_cmpxchg(target, expected, desired);
+            if (previous == expected) {
+                break;
+            }
+            expected = previous;
+        }
+    }
+}
+
+// ScanBlocks scans every tile and writes the tile totals to block_sums, the host scans block_sums recursively and
+// AddBlockOffsets adds the scanned totals to the tiles. With predicate set the elements are replaced by 1 if they are
+// not 0, which turns the scan into the output positions of a stream compaction.
+#define DEFINE_SCAN(T, T4, NAME)                                                                                    \
+    __kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))                                                   \
+    void ScanBlocks##NAME(__global const T *input,                                                                  \
+        __global T *output,                                                                                         \
+        uint count,                                                                                                 \
+        __global T *block_sums,                                                                                     \
+        uint inclusive,                                                                                             \
+        uint predicate)                                                                                             \
+    {                                                                                                               \
+        __local T totals[WG_SIZE];                                                                                  \
+        const uint lid = get_local_id(0);                                                                           \
+        const uint group = get_group_id(0);                                                                         \
+        const uint base = group * TILE_SIZE + lid * 4;                                                              \
+        T v0 = 0;                                                                                                   \
+        T v1 = 0;                                                                                                   \
+        T v2 = 0;                                                                                                   \
+        T v3 = 0;                                                                                                   \
+        if (base + 4 <= count) {                                                                                    \
+            const T4 v = vload4(base / 4, input);                                                                   \
+            v0 = v.x;                                                                                               \
+            v1 = v.y;                                                                                               \
+            v2 = v.z;                                                                                               \
+            v3 = v.w;                                                                                               \
+        } else {                                                                                                    \
+            v0 = base < count ? input[base] : 0;                                                                    \
+            v1 = base + 1 < count ? input[base + 1] : 0;                                                            \
+            v2 = base + 2 < count ? input[base + 2] : 0;                                                            \
+        }                                                                                                           \
+        if (predicate) {                                                                                            \
+            v0 = v0 != 0 ? 1 : 0;                                                                                   \
+            v1 = v1 != 0 ? 1 : 0;                                                                                   \
+            v2 = v2 != 0 ? 1 : 0;                                                                                   \
+            v3 = v3 != 0 ? 1 : 0;                                                                                   \
+        }                                                                                                           \
+        const T s1 = v0 + v1;                                                                                       \
+        const T s2 = s1 + v2;                                                                                       \
+        const T s3 = s2 + v3;                                                                                       \
+        totals[lid] = s3;                                                                                           \
+        barrier(CLK_LOCAL_MEM_FENCE);                                                                               \
+        for (uint offset = 1; offset < WG_SIZE; offset <<= 1) {                                                     \
+            const T addend = lid >= offset ? totals[lid - offset] : 0;                                              \
+            barrier(CLK_LOCAL_MEM_FENCE);                                                                           \
+            totals[lid] += addend;                                                                                  \
+            barrier(CLK_LOCAL_MEM_FENCE);                                                                           \
+        }                                                                                                           \
+        const T prefix = lid > 0 ? totals[lid - 1] : 0;                                                             \
+        T4 result;                                                                                                  \
+        if (inclusive) {                                                                                            \
+            result.x = prefix + v0;                                                                                 \
+            result.y = prefix + s1;                                                                                 \
+            result.z = prefix + s2;                                                                                 \
+            result.w = prefix + s3;                                                                                 \
+        } else {                                                                                                    \
+            result.x = prefix;                                                                                      \
+            result.y = prefix + v0;                                                                                 \
+            result.z = prefix + s1;                                                                                 \
+            result.w = prefix + s2;                                                                                 \
+        }                                                                                                           \
+        if (base + 4 <= count) {                                                                                    \
+            vstore4(result, base / 4, output);                                                                      \
+        } else {                                                                                                    \
+            if (base < count) {                                                                                     \
+                output[base] = result.x;                                                                            \
+            }                                                                                                       \
+            if (base + 1 < count) {                                                                                 \
+                output[base + 1] = result.y;                                                                        \
+            }                                                                                                       \
+            if (base + 2 < count) {                                                                                 \
+                output[base + 2] = result.z;                                                                        \
+            }                                                                                                       \
+        }                                                                                                           \
+        if (lid == WG_SIZE - 1) {                                                                                   \
+            block_sums[group] = totals[lid];                                                                        \
+        }                                                                                                           \
+    }                                                                                                               \
+                                                                                                                    \
+    __kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))                                                   \
+    void AddBlockOffsets##NAME(__global T *output, uint count, __global const T *block_offsets)                     \
+    {                                                                                                               \
+        const uint group = get_group_id(0);                                                                         \
+        if (group == 0) {                                                                                           \
+            return;                                                                                                 \
+        }                                                                                                           \
+        const T offset = block_offsets[group];                                                                      \
+        const uint base = group * TILE_SIZE + get_local_id(0) * 4;                                                  \
+        if (base + 4 <= count) {                                                                                    \
+            vstore4(vload4(base / 4, output) + (T4)(offset), base / 4, output);                                     \
+            return;                                                                                                 \
+        }                                                                                                           \
+        for (uint i = base; i < count; ++i) {                                                                       \
+            output[i] += offset;                                                                                    \
+        }                                                                                                           \
+    }
+
+DEFINE_SCAN(float, float4, Float)
+DEFINE_SCAN(uint, uint4, Uint)
+
+__kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+void CompactScatter(__global const uint *input,
+    __global const uint *flags,
+    __global const uint *positions,
+    uint count,
+    __global uint *output,
+    __global uint *output_count)
+{
+    const uint base = get_global_id(0) * 4;
+    for (uint i = base; i < base + 4 && i < count; ++i) {
+        const uint keep = flags[i] != 0 ? 1 : 0;
+        if (keep) {
+            output[positions[i]] = input[i];
+        }
+        if (i == count - 1) {
+            *output_count = positions[i] + keep;
+        }
+    }
+}
+
+// RadixCount writes the digit histogram of every tile digit-major, so that the exclusive scan of tile_counts is the
+// first output position of every digit of every tile.
+__kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+void RadixCount(__global const uint *keys, uint count, uint shift, __global uint *tile_counts)
+{
+    __local uint histogram[RADIX];
+    const uint lid = get_local_id(0);
+    const uint tile = get_group_id(0);
+    if (lid < RADIX) {
+        histogram[lid] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const uint base = tile * TILE_SIZE + lid * 4;
+    if (base + 4 <= count) {
+        const uint4 key = vload4(base / 4, keys);
+        atomic_inc(&histogram[(key.x >> shift) & (RADIX - 1)]);
+        atomic_inc(&histogram[(key.y >> shift) & (RADIX - 1)]);
+        atomic_inc(&histogram[(key.z >> shift) & (RADIX - 1)]);
+        atomic_inc(&histogram[(key.w >> shift) & (RADIX - 1)]);
+    } else {
+        for (uint i = base; i < count; ++i) {
+            atomic_inc(&histogram[(keys[i] >> shift) & (RADIX - 1)]);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (lid < RADIX) {
+        tile_counts[lid * get_num_groups(0) + tile] = histogram[lid];
+    }
+}
+
+// RadixScatter sorts every tile stably by the digit in local memory, then writes the runs of equal digits to their
+// positions, so that consecutive work items write consecutive addresses.
+__kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+void RadixScatter(__global const uint *keys,
+    __global const uint *values,
+    uint count,
+    uint shift,
+    __global const uint *tile_offsets,
+    __global uint *sorted_keys,
+    __global uint *sorted_values,
+    uint has_values)
+{
+    __local uint ranks[RADIX * WG_SIZE];
+    __local uint totals[WG_SIZE];
+    __local uint local_keys[TILE_SIZE];
+    __local uint local_values[TILE_SIZE];
+    const uint lid = get_local_id(0);
+    const uint tile = get_group_id(0);
+    const uint tile_base = tile * TILE_SIZE;
+    const uint base = tile_base + lid * 4;
+    uint key[4];
+    uint value[4];
+    uint digit[4];
+    for (uint k = 0; k < 4; ++k) {
+        const uint valid = base + k < count;
+        key[k] = valid ? keys[base + k] : 0;
+        value[k] = valid && has_values ? values[base + k] : 0;
+        digit[k] = valid ? (key[k] >> shift) & (RADIX - 1) : RADIX;
+    }
+    // ranks[d * WG_SIZE + lid] counts the keys of digit d of this work item.
+    for (uint d = 0; d < RADIX; ++d) {
+        ranks[d * WG_SIZE + lid] = 0;
+    }
+    for (uint k = 0; k < 4; ++k) {
+        if (digit[k] < RADIX) {
+            ranks[digit[k] * WG_SIZE + lid] += 1;
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    // The exclusive scan of ranks in this digit-major order is the position of every run in the sorted tile.
+    uint sum = 0;
+    for (uint j = 0; j < RADIX; ++j) {
+        sum += ranks[lid * RADIX + j];
+    }
+    totals[lid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint offset = 1; offset < WG_SIZE; offset <<= 1) {
+        const uint addend = lid >= offset ? totals[lid - offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        totals[lid] += addend;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    uint running = lid > 0 ? totals[lid - 1] : 0;
+    for (uint j = 0; j < RADIX; ++j) {
+        const uint digit_count = ranks[lid * RADIX + j];
+        ranks[lid * RADIX + j] = running;
+        running += digit_count;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint k = 0; k < 4; ++k) {
+        if (digit[k] == RADIX) {
+            continue;
+        }
+        uint position = ranks[digit[k] * WG_SIZE + lid];
+        for (uint m = 0; m < k; ++m) {
+            position += digit[m] == digit[k] ? 1 : 0;
+        }
+        local_keys[position] = key[k];
+        local_values[position] = value[k];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    // ranks[d * WG_SIZE] is now the position of the first key of digit d in the sorted tile.
+    const uint tile_count = min((uint)TILE_SIZE, count - tile_base);
+    for (uint j = lid; j < tile_count; j += WG_SIZE) {
+        const uint sorted_key = local_keys[j];
+        const uint d = (sorted_key >> shift) & (RADIX - 1);
+        const uint destination = tile_offsets[d * get_num_groups(0) + tile] + j - ranks[d * WG_SIZE];
+        sorted_keys[destination] = sorted_key;
+        if (has_values) {
+            sorted_values[destination] = local_values[j];
+        }
+    }
+}
+
+// Up to HISTOGRAM_LOCAL_BINS bins are counted with local atomics and merged with one global atomic per bin and work
+// group, more bins are counted with global atomics directly.
+__kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+void Histogram(__global const float *input, uint count, uint num_bins, float lower, float scale, __global uint *bins)
+{
+    __local uint local_bins[HISTOGRAM_LOCAL_BINS];
+    const uint lid = get_local_id(0);
+    const uint gid = get_global_id(0);
+    const uint stride = get_global_size(0);
+    const uint use_local = num_bins <= HISTOGRAM_LOCAL_BINS;
+    if (use_local) {
+        for (uint i = lid; i < num_bins; i += WG_SIZE) {
+            local_bins[i] = 0;
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    // The items are the float4 of the input followed by the remaining single values.
+    const uint num_vectors = count / 4;
+    const uint num_items = num_vectors + count % 4;
+    for (uint i = gid; i < num_items; i += stride) {
+        float value[4];
+        uint num_values = 1;
+        if (i < num_vectors) {
+            const float4 v = vload4(i, input);
+            value[0] = v.x;
+            value[1] = v.y;
+            value[2] = v.z;
+            value[3] = v.w;
+            num_values = 4;
+        } else {
+            value[0] = input[num_vectors * 3 + i];
+        }
+        for (uint k = 0; k < num_values; ++k) {
+            const float position = (value[k] - lower) * scale;
+            if (!(position >= 0.0f && position < (float)num_bins)) {
+                continue;
+            }
+            const uint bin = min((uint)position, num_bins - 1);
+            if (use_local) {
+                atomic_inc(&local_bins[bin]);
+            } else {
+                atomic_inc(&bins[bin]);
+            }
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (use_local) {
+        for (uint i = lid; i < num_bins; i += WG_SIZE) {
+            if (local_bins[i] != 0) {
+                atomic_add(&bins[i], local_bins[i]);
+            }
+        }
+    }
+}
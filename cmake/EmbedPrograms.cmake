@@ -0,0 +1,99 @@
+# Embeds OpenCL programs into the library as the registry of internal/EmbeddedPrograms.h.
+#
+# tinyocl_list_programs(<var> <base_dir> <file>...)
+#   Appends "<name>|<file>" entries to <var>, every program is named by its path relative to <base_dir>.
+#
+# tinyocl_embed_programs(<output> [CONFIGURE] PROGRAMS <entry>...)
+#   Generates the C++ source <output> from the entries of tinyocl_list_programs. The source is generated by a build
+#   step which reruns when a program changes, or at configure time with CONFIGURE. Files ending with .bin are
+#   embedded as program binaries, all other files as program sources.
+#
+# In script mode (cmake -P) the variables OUTPUT and PROGRAMS, the entries joined by "|", generate the source.
+
+set(TINYOCL_EMBED_PROGRAMS_SCRIPT ${CMAKE_CURRENT_LIST_FILE})
+
+function(tinyocl_list_programs var base_dir)
+    set(entries ${${var}})
+    foreach(file ${ARGN})
+        get_filename_component(file ${file} ABSOLUTE)
+        file(RELATIVE_PATH name ${base_dir} ${file})
+        list(APPEND entries "${name}|${file}")
+    endforeach()
+    set(${var} ${entries} PARENT_SCOPE)
+endfunction()
+
+function(_tinyocl_generate_embedded_programs output entries)
+    set(programs "")
+    set(table "")
+    set(index 0)
+    # 16 bytes per line, the regular expressions of CMake have no repetition counts.
+    string(REPEAT "0x[0-9a-f][0-9a-f]," 16 line_pattern)
+    foreach(entry ${entries})
+        string(REPLACE "|" ";" entry ${entry})
+        list(GET entry 0 name)
+        list(GET entry 1 file)
+        file(READ ${file} hex HEX)
+        string(LENGTH "${hex}" hex_length)
+        math(EXPR size "${hex_length} / 2")
+        if (file MATCHES "\\.bin$")
+            set(binary true)
+        else()
+            set(binary false)
+            # Sources are zero-terminated so they can be passed on as C strings.
+            string(APPEND hex "00")
+        endif()
+        string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+        string(REGEX REPLACE "(${line_pattern})" "\\1\n    " bytes "${bytes}")
+        string(APPEND programs "// ${name}\nconst unsigned char kProgram${index}[] = {\n    ${bytes}\n};\n\n")
+        string(APPEND table "    {\"${name}\", kProgram${index}, ${size}, ${binary}},\n")
+        math(EXPR index "${index} + 1")
+    endforeach()
+    set(content "// Generated by cmake/EmbedPrograms.cmake, do not edit.\n\n")
+    string(APPEND content "#include \"EmbeddedPrograms.h\"\n\nnamespace TinyOCL {\n\n")
+    string(APPEND content "namespace {\n${programs}}  // namespace\n\n")
+    string(APPEND content "const EmbeddedProgram kEmbeddedPrograms[] = {\n")
+    string(APPEND content "${table}    {nullptr, nullptr, 0, false},\n};\n\n")
+    string(APPEND content "}  // namespace TinyOCL\n")
+    # Only touch the output when it changes, so an unchanged registry is not recompiled.
+    file(WRITE ${output}.tmp "${content}")
+    configure_file(${output}.tmp ${output} COPYONLY)
+    file(REMOVE ${output}.tmp)
+endfunction()
+
+function(tinyocl_embed_programs output)
+    cmake_parse_arguments(EMBED "CONFIGURE" "" "PROGRAMS" ${ARGN})
+    set(files "")
+    foreach(entry ${EMBED_PROGRAMS})
+        string(REPLACE "|" ";" entry ${entry})
+        list(GET entry 1 file)
+        list(APPEND files ${file})
+    endforeach()
+    if (EMBED_CONFIGURE)
+        _tinyocl_generate_embedded_programs(${output} "${EMBED_PROGRAMS}")
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${files} ${TINYOCL_EMBED_PROGRAMS_SCRIPT})
+    else()
+        string(REPLACE ";" "|" programs "${EMBED_PROGRAMS}")
+        add_custom_command(OUTPUT ${output}
+            COMMAND ${CMAKE_COMMAND} -DOUTPUT=${output} -DPROGRAMS=${programs} -P ${TINYOCL_EMBED_PROGRAMS_SCRIPT}
+            DEPENDS ${files} ${TINYOCL_EMBED_PROGRAMS_SCRIPT}
+            COMMENT "Embedding OpenCL programs"
+            VERBATIM
+        )
+    endif()
+endfunction()
+
+if (CMAKE_SCRIPT_MODE_FILE AND DEFINED OUTPUT)
+    # The entries were joined by "|", every pair of fields is one "<name>|<file>" entry again.
+    string(REPLACE "|" ";" fields "${PROGRAMS}")
+    set(entries "")
+    list(LENGTH fields num_fields)
+    set(index 0)
+    while(index LESS num_fields)
+        list(GET fields ${index} name)
+        math(EXPR index "${index} + 1")
+        list(GET fields ${index} file)
+        math(EXPR index "${index} + 1")
+        list(APPEND entries "${name}|${file}")
+    endwhile()
+    _tinyocl_generate_embedded_programs(${OUTPUT} "${entries}")
+endif()
@@ -8,325 +8,2722 @@
 #ifndef __TINYOCL_TINYOCL_H__
 #define __TINYOCL_TINYOCL_H__
 
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <set>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <CL/cl.h>
 
 namespace TinyOCL {
 
 /**
- * @brief Kernel is a class that represents the function to be executed on the device.
- * 
+ * @brief Event is a class that represents the completion status of an enqueued command.
+ *
  */
-class Kernel final {
+class Event final {
 public:
     /**
-     * @brief Implementation of Kernel
+     * @brief Construct an empty Event object
      *
      */
-    class KernelImpl;
+    Event() = default;
 
     /**
-     * @brief Construct a new Kernel object
-     * 
-     * @param impl 
+     * @brief Construct a new Event object, the Event takes the ownership of the cl_event
+     *
+     * @param event
      */
-    explicit Kernel(KernelImpl *impl);
+    explicit Event(cl_event event);
 
     /**
-     * @brief Destroy the Kernel object
-     * 
+     * @brief Destroy the Event object
+     *
      */
-    ~Kernel() = default;
+    ~Event();
 
     /**
-     * @brief Delete default constructor
-     * 
+     * @brief Copy constructor, the cl_event is retained
+     *
      */
-    Kernel() = delete;
+    Event(const Event &other);
 
     /**
-     * @brief Delete copy constructor
-     * 
+     * @brief Copy assignment operator, the cl_event is retained
+     *
+     * @return Event&
      */
-    Kernel(const Kernel &) = delete;
+    Event &operator=(const Event &other);
 
     /**
-     * @brief Delete copy assignment operator
-     * 
-     * @return Kernel& 
+     * @brief Move constructor
+     *
      */
-    Kernel &operator=(const Kernel &) = delete;
+    Event(Event &&other) noexcept;
 
     /**
-     * @brief Delete move constructor
-     * 
+     * @brief Move assignment operator
+     *
+     * @return Event&
      */
-    Kernel(Kernel &&) = delete;
+    Event &operator=(Event &&other) noexcept;
 
     /**
-     * @brief Delete move assignment operator
-     * 
-     * @return Kernel& 
+     * @brief Get the Cl Event object
+     *
+     * @return cl_event
      */
-    Kernel &operator=(Kernel &&) = delete;
+    cl_event GetClEvent() const;
 
     /**
-     * @brief Run the kernel
-     * @tparam T The type of the argument
-     * @tparam Ts The types of the arguments
-     * @param global_size The number of work items in each dimension
-     * @param local_size The number of work items in each work group
-     * @param async Whether to run the kernel asynchronously
-     * @param arg The argument
-     * @param args The arguments
+     * @brief Whether the Event holds a cl_event
+     *
      * @return true
      * @return false
      */
-    template <typename T, typename... Ts>
-    bool Run(
-        const std::vector<size_t> &global_size, const std::vector<size_t> &local_size, bool async, T arg, Ts... args) const
-    {
-        bool ret = SetArg(0, arg, args...);
-        if (!ret) {
-            return false;
-        }
-        return RunImpl(global_size, local_size, async);
-    }
+    bool IsValid() const;
 
-private:
     /**
-     * @brief Set the argument of the kernel
+     * @brief Whether the command has completed, an empty Event is always complete
      *
-     * @tparam T The type of the argument
-     * @tparam Ts The types of the arguments
-     * @param index The index of the argument
-     * @param arg The argument
-     * @param args The arguments
      * @return true
      * @return false
      */
-    template <typename T, typename... Ts>
-    bool SetArg(uint32_t index, T arg, Ts... args) const
-    {
-        bool ret = SetArgImpl(index, sizeof(T), &arg);
-        if (!ret) {
-            return false;
-        }
-        if constexpr (sizeof...(args) > 0) {
-            return SetArg(index + 1, args...);
-        }
-        return true;
-    }
+    bool IsComplete() const;
 
     /**
-     * @brief Set the argument of the kernel
+     * @brief Wait for the command to complete
      *
-     * @param index The index of the argument
-     * @param arg_size The size of the argument
-     * @param arg_value The value of the argument
      * @return true
      * @return false
      */
-    bool SetArgImpl(uint32_t index, size_t arg_size, const void *arg_value) const;
+    bool Wait() const;
 
     /**
-     * @brief Run the kernel
+     * @brief Wait for all the commands to complete
      *
-     * @param global_size The number of work items in each dimension
-     * @param local_size The number of work items in each work group
-     * @param async Whether to run the kernel asynchronously
+     * @param events The events to wait for
      * @return true
      * @return false
      */
-    bool RunImpl(const std::vector<size_t> &global_size, const std::vector<size_t> &local_size, bool async) const;
+    static bool WaitAll(const std::vector<Event> &events);
 
+private:
     /**
-     * @brief The pointer to the implementation of Kernel
+     * @brief The OpenCL event
      *
      */
-    std::unique_ptr<KernelImpl> impl_;
+    cl_event event_{nullptr};
 };
 
 /**
- * @brief MemcpyKind is an enum class that represents the kind of memcopy.
+ * @brief QueueType is an enum class that represents the usage of a command queue.
  *
  */
-enum class MemcpyKind {
-    HostToDevice,
-    DeviceToHost,
+enum class QueueType {
+    Compute,
+    Copy,
 };
 
 /**
- * @brief Buffer is a class that represents the memory object on the device.
- * 
+ * @brief QueuePoolConfig is the configuration of the command queue pool.
+ *
  */
-class Buffer final {
+struct QueuePoolConfig {
+    /**
+     * @brief The number of compute queues, including the in-order default queue
+     *
+     */
+    uint32_t compute_queues = 1;
+
+    /**
+     * @brief The number of copy queues, copy queues fall back to compute queues if 0
+     *
+     */
+    uint32_t copy_queues = 0;
+
+    /**
+     * @brief Whether the queues other than the default queue execute out of order
+     *
+     */
+    bool out_of_order = false;
+};
+
+/**
+ * @brief DeviceType is an enum class that represents the type of an OpenCL device.
+ *
+ */
+enum class DeviceType {
+    GPU,
+    Accelerator,
+    CPU,
+};
+
+/**
+ * @brief DeviceSelection is the policy choosing the devices of the Executor.
+ *
+ * The types are tried in order, the Executor uses the devices passing the filters on the first platform which has
+ * such devices of the type. The environment variables TINYOCL_DEVICE_TYPE (a comma separated list of gpu,
+ * accelerator and cpu), TINYOCL_DEVICE_VENDOR, TINYOCL_DEVICE_NAME and TINYOCL_DEVICE_MIN_COMPUTE_UNITS override the
+ * corresponding fields.
+ */
+struct DeviceSelection {
+    /**
+     * @brief The device types in order of preference
+     *
+     */
+    std::vector<DeviceType> types = {DeviceType::GPU, DeviceType::Accelerator, DeviceType::CPU};
+
+    /**
+     * @brief A case-insensitive part of the device or platform vendor, empty to accept any vendor
+     *
+     */
+    std::string vendor;
+
+    /**
+     * @brief A case-insensitive part of the device name, empty to accept any device
+     *
+     */
+    std::string name;
+
+    /**
+     * @brief The minimum number of compute units of a device
+     *
+     */
+    uint32_t min_compute_units = 1;
+};
+
+/**
+ * @brief DeviceInfo describes a device of the Executor.
+ *
+ */
+struct DeviceInfo {
+    std::string name;
+    std::string vendor;
+    std::string platform;
+    DeviceType type = DeviceType::GPU;
+    uint32_t compute_units = 0;
+};
+
+/**
+ * @brief SchedulePolicy is an enum class that represents how kernel launches are placed across devices.
+ *
+ */
+enum class SchedulePolicy {
+    FirstDevice,
+    RoundRobin,
+    LeastOutstanding,
+};
+
+/**
+ * @brief Queue is a class that represents a command queue of the Executor.
+ *
+ */
+class Queue final {
 public:
     /**
-     * @brief Implementation of Buffer
+     * @brief Implementation of Queue
      *
      */
-    class BufferImpl;
+    class QueueImpl;
 
     /**
-     * @brief Construct a new Buffer object
+     * @brief Construct a new Queue object
      *
      * @param impl
      */
-    explicit Buffer(BufferImpl *impl);
+    explicit Queue(QueueImpl *impl);
 
     /**
-     * @brief Destroy the Buffer object
+     * @brief Destroy the Queue object
      *
      */
-    ~Buffer() = default;
+    ~Queue();
 
     /**
      * @brief Delete default constructor
      *
      */
-    Buffer() = delete;
+    Queue() = delete;
 
     /**
      * @brief Delete copy constructor
      *
      */
-    Buffer(const Buffer &) = delete;
+    Queue(const Queue &) = delete;
 
     /**
      * @brief Delete copy assignment operator
      *
-     * @return Buffer&
+     * @return Queue&
      */
-    Buffer &operator=(const Buffer &) = delete;
+    Queue &operator=(const Queue &) = delete;
 
     /**
      * @brief Delete move constructor
      *
      */
-    Buffer(Buffer &&) = delete;
+    Queue(Queue &&) = delete;
 
     /**
      * @brief Delete move assignment operator
      *
-     * @return Buffer&
+     * @return Queue&
      */
-    Buffer &operator=(Buffer &&) = delete;
+    Queue &operator=(Queue &&) = delete;
 
     /**
-     * @brief Get the Cl Mem object
-     * 
-     * @return cl_mem 
+     * @brief Get the Cl Command Queue object
+     *
+     * @return cl_command_queue
      */
-    cl_mem GetClMem() const;
+    cl_command_queue GetClCommandQueue() const;
 
     /**
-     * @brief Get the Host Ptr
-     * 
-     * @return T The host pointer
+     * @brief Get the queue type
+     *
+     * @return QueueType
      */
-    template <typename T, typename = std::enable_if_t<std::is_pointer<T>::value>>
-    T GetHostPtr() const
-    {
-        static_assert(std::is_pointer<T>::value, "T must be a pointer type");
-        return static_cast<T>(GetHostPtrImpl());
-    }
+    QueueType GetType() const;
 
     /**
-     * @brief Get the buffer size
-     * 
-     * @return size_t 
+     * @brief Submit the enqueued commands to the device
+     *
+     * @return true
+     * @return false
      */
-    size_t GetSize() const;
+    bool Flush() const;
 
     /**
-     * @brief Memcpy
-     * 
-     * @param host_ptr The host pointer
-     * @param size The size of the memory to be copied
-     * @param kind The kind of the memory copy
-     * @return true 
-     * @return false 
+     * @brief Wait for the enqueued commands to complete
+     *
+     * @return true
+     * @return false
      */
-    bool Memcpy(void *host_ptr, size_t size, MemcpyKind kind) const;
+    bool Finish() const;
 
 private:
     /**
-     * @brief Get the host pointer
-     * 
-     * @return void* The host pointer
-     */
-    void *GetHostPtrImpl() const;
-
-    /**
-     * @brief The pointer to the implementation of Buffer
+     * @brief The pointer to the implementation of Queue
      *
      */
-    std::unique_ptr<BufferImpl> impl_;
+    std::unique_ptr<QueueImpl> impl_;
 };
 
 /**
- * @brief Executor is a class that manages the Kernel objects and Buffer objects.
- * 
+ * @brief KernelArgKind is an enum class that represents what a kernel argument value holds.
+ *
  */
-class Executor final {
+enum class KernelArgKind {
+    Value,
+    MemObject,
+    Sampler,
+};
+
+/**
+ * @brief KernelArg is the size and address of a kernel argument value, a local memory argument has no value
+ *
+ */
+struct KernelArg {
+    size_t size;
+    const void *value;
+    KernelArgKind kind{KernelArgKind::Value};
+};
+
+/**
+ * @brief Make the KernelArg of an argument, cl_mem and cl_sampler arguments are marked as such
+ *
+ * @tparam T The type of the argument
+ * @param arg The argument, it must outlive the KernelArg
+ * @return KernelArg
+ */
+template <typename T>
+KernelArg MakeKernelArg(const T &arg)
+{
+    if constexpr (std::is_same_v<T, cl_mem>) {
+        return KernelArg{sizeof(T), &arg, KernelArgKind::MemObject};
+    } else if constexpr (std::is_same_v<T, cl_sampler>) {
+        return KernelArg{sizeof(T), &arg, KernelArgKind::Sampler};
+    } else {
+        return KernelArg{sizeof(T), &arg};
+    }
+}
+
+/**
+ * @brief Kernel is a class that represents the function to be executed on the device.
+ *
+ * The arguments are bound per launch on a kernel instance owned by the calling launch, so the same Kernel can be run
+ * from multiple threads concurrently.
+ */
+class Kernel final {
 public:
     /**
-     * @brief Get the Instance object
+     * @brief Implementation of Kernel
+     *
+     */
+    class KernelImpl;
+
+    /**
+     * @brief Construct a new Kernel object
      * 
-     * @return Executor& 
+     * @param impl 
      */
-    static Executor &GetInstance();
+    explicit Kernel(KernelImpl *impl);
 
     /**
-     * @brief Destroy the Executor object
+     * @brief Destroy the Kernel object
      * 
      */
-    ~Executor() = default;
+    ~Kernel() = default;
+
+    /**
+     * @brief Delete default constructor
+     * 
+     */
+    Kernel() = delete;
 
     /**
      * @brief Delete copy constructor
      * 
      */
-    Executor(const Executor &) = delete;
+    Kernel(const Kernel &) = delete;
 
     /**
      * @brief Delete copy assignment operator
      * 
-     * @return Executor& 
+     * @return Kernel& 
      */
-    Executor &operator=(const Executor &) = delete;
+    Kernel &operator=(const Kernel &) = delete;
 
     /**
-     * @brief Create a Kernel object
+     * @brief Delete move constructor
      * 
-     * @param program_name The name of the program
-     * @param kernel_name The name of the kernel
-     * @param build_options The build options
-     * @return std::shared_ptr<Kernel> 
      */
-    std::shared_ptr<Kernel> CreateKernel(const std::string &program_name,
-        const std::string &kernel_name,
-        const std::set<std::string> &build_options) const;
+    Kernel(Kernel &&) = delete;
 
     /**
-     * @brief Create a Buffer object
-     *
-     * @param size The size of the buffer
-     * @return std::shared_ptr<Buffer>
+     * @brief Delete move assignment operator
+     * 
+     * @return Kernel& 
      */
-    std::shared_ptr<Buffer> CreateBuffer(size_t size) const;
+    Kernel &operator=(Kernel &&) = delete;
+
+    /**
+     * @brief Run the kernel
+     * @tparam Ts The types of the arguments
+     * @param global_size The number of work items in each dimension
+     * @param local_size The number of work items in each work group
+     * @param async Whether to run the kernel asynchronously
+     * @param args The arguments bound to the indices not bound by SetPersistentArg
+     * @return true
+     * @return false
+     */
+    template <typename... Ts>
+    bool Run(
+        const std::vector<size_t> &global_size, const std::vector<size_t> &local_size, bool async, Ts... args) const
+    {
+        const std::array<KernelArg, sizeof...(Ts)> kernel_args = {MakeKernelArg(args)...};
+        return RunImpl(kernel_args.data(), kernel_args.size(), global_size, local_size, async);
+    }
+
+    /**
+     * @brief Enqueue the kernel without waiting for it
+     * @tparam Ts The types of the arguments
+     * @param global_size The number of work items in each dimension
+     * @param local_size The number of work items in each work group
+     * @param wait_events The events to wait for before the kernel starts
+     * @param event The event of the kernel, can be nullptr
+     * @param args The arguments bound to the indices not bound by SetPersistentArg
+     * @return true
+     * @return false
+     */
+    template <typename... Ts>
+    bool RunAsync(const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<Event> &wait_events,
+        Event *event,
+        Ts... args) const
+    {
+        const std::array<KernelArg, sizeof...(Ts)> kernel_args = {MakeKernelArg(args)...};
+        return RunAsyncImpl(
+            nullptr, kernel_args.data(), kernel_args.size(), global_size, local_size, wait_events, event);
+    }
+
+    /**
+     * @brief Enqueue the kernel on a queue without waiting for it
+     * @tparam Ts The types of the arguments
+     * @param queue The queue to enqueue the kernel on
+     * @param global_size The number of work items in each dimension
+     * @param local_size The number of work items in each work group
+     * @param wait_events The events to wait for before the kernel starts
+     * @param event The event of the kernel, can be nullptr
+     * @param args The arguments bound to the indices not bound by SetPersistentArg
+     * @return true
+     * @return false
+     */
+    template <typename... Ts>
+    bool RunAsync(const Queue &queue,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<Event> &wait_events,
+        Event *event,
+        Ts... args) const
+    {
+        const std::array<KernelArg, sizeof...(Ts)> kernel_args = {MakeKernelArg(args)...};
+        return RunAsyncImpl(
+            &queue, kernel_args.data(), kernel_args.size(), global_size, local_size, wait_events, event);
+    }
+
+    /**
+     * @brief Bind the launches without an explicit queue to a device
+     *
+     * @param device The device index, negative to let the SchedulePolicy of the Executor decide
+     */
+    void SetDeviceAffinity(int32_t device) const;
+
+    /**
+     * @brief Bind an argument once for all the following launches
+     *
+     * The arguments passed to Run and RunAsync are bound to the remaining indices in order.
+     *
+     * @tparam T The type of the argument
+     * @param index The index of the argument
+     * @param arg The argument
+     * @return true
+     * @return false
+     */
+    template <typename T>
+    bool SetPersistentArg(uint32_t index, T arg) const
+    {
+        return SetPersistentArgImpl(index, MakeKernelArg(arg));
+    }
+
+    /**
+     * @brief Remove all the arguments bound by SetPersistentArg
+     *
+     */
+    void ClearPersistentArgs() const;
+
+    /**
+     * @brief Benchmark the local sizes the kernel can run with on every device and keep the fastest one
+     *
+     * The following launches with the same global size and an empty local size use the tuned local size. The kernel
+     * is launched several times for every candidate, so it has to be safe to run repeatedly on the given arguments.
+     *
+     * @tparam Ts The types of the arguments
+     * @param global_size The number of work items in each dimension
+     * @param args The arguments bound to the indices not bound by SetPersistentArg
+     * @return true
+     * @return false
+     */
+    template <typename... Ts>
+    bool Tune(const std::vector<size_t> &global_size, Ts... args) const
+    {
+        const std::array<KernelArg, sizeof...(Ts)> kernel_args = {MakeKernelArg(args)...};
+        return TuneImpl(kernel_args.data(), kernel_args.size(), global_size);
+    }
+
+    /**
+     * @brief Get the local size tuned for a global size
+     *
+     * @param global_size The number of work items in each dimension
+     * @param device The device index
+     * @return std::vector<size_t> The tuned local size, empty if not tuned or the driver choice was the fastest
+     */
+    std::vector<size_t> GetTunedLocalSize(const std::vector<size_t> &global_size, uint32_t device = 0) const;
+
+private:
+    friend class CommandGraph;
+
+    /**
+     * @brief Tune the local size of the kernel
+     *
+     * @param args The arguments
+     * @param num_args The number of arguments
+     * @param global_size The number of work items in each dimension
+     * @return true
+     * @return false
+     */
+    bool TuneImpl(const KernelArg *args, size_t num_args, const std::vector<size_t> &global_size) const;
+
+    /**
+     * @brief Bind an argument once for all the following launches
+     *
+     * @param index The index of the argument
+     * @param arg The argument
+     * @return true
+     * @return false
+     */
+    bool SetPersistentArgImpl(uint32_t index, const KernelArg &arg) const;
+
+    /**
+     * @brief Run the kernel
+     *
+     * @param args The arguments
+     * @param num_args The number of arguments
+     * @param global_size The number of work items in each dimension
+     * @param local_size The number of work items in each work group
+     * @param async Whether to run the kernel asynchronously
+     * @return true
+     * @return false
+     */
+    bool RunImpl(const KernelArg *args,
+        size_t num_args,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        bool async) const;
+
+    /**
+     * @brief Enqueue the kernel
+     *
+     * @param queue The queue to enqueue the kernel on, nullptr for the default queue
+     * @param args The arguments
+     * @param num_args The number of arguments
+     * @param global_size The number of work items in each dimension
+     * @param local_size The number of work items in each work group
+     * @param wait_events The events to wait for before the kernel starts
+     * @param event The event of the kernel, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool RunAsyncImpl(const Queue *queue,
+        const KernelArg *args,
+        size_t num_args,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+
+    /**
+     * @brief The pointer to the implementation of Kernel
+     *
+     */
+    std::unique_ptr<KernelImpl> impl_;
+};
+
+/**
+ * @brief MemcpyKind is an enum class that represents the kind of memcopy.
+ *
+ */
+enum class MemcpyKind {
+    HostToDevice,
+    DeviceToHost,
+};
+
+/**
+ * @brief BufferMode is an enum class that represents how the host accesses a buffer.
+ *
+ */
+enum class BufferMode {
+    /**
+     * @brief The buffer stays mapped for its whole lifetime and GetHostPtr returns the mapped pointer
+     *
+     */
+    HostVisiblePersistent,
+
+    /**
+     * @brief The buffer is only accessed by kernels and Memcpy, it is never mapped
+     *
+     */
+    DeviceOnly,
+
+    /**
+     * @brief The buffer is allocated in host accessible memory and mapped on demand by Buffer::Map
+     *
+     */
+    MapOnDemand,
+};
+
+/**
+ * @brief MapAccess is an enum class that represents the host access of a mapping.
+ *
+ */
+enum class MapAccess {
+    Read,
+    Write,
+    ReadWrite,
+    /**
+     * @brief The host overwrites the whole mapped region, its previous content is not copied to the host
+     *
+     */
+    WriteInvalidate,
+};
+
+/**
+ * @brief BufferMapping is a scoped view of a mapped buffer region, the region is unmapped when it is destroyed.
+ *
+ * The mapping holds a reference to the buffer and the queue until it is unmapped, so it may outlive the Buffer it
+ * comes from. It must be destroyed or unmapped before kernels use the region.
+ */
+class BufferMapping final {
+public:
+    /**
+     * @brief Construct an empty BufferMapping object
+     *
+     */
+    BufferMapping() = default;
+
+    /**
+     * @brief Construct a new BufferMapping object, the BufferMapping takes the ownership of the mapping and retains the
+     * queue and the buffer
+     *
+     * @param queue The queue the buffer is mapped on
+     * @param buffer The mapped buffer
+     * @param ptr The mapped pointer
+     * @param size The size of the mapped region
+     */
+    explicit BufferMapping(cl_command_queue queue, cl_mem buffer, void *ptr, size_t size);
+
+    /**
+     * @brief Destroy the BufferMapping object
+     *
+     */
+    ~BufferMapping();
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    BufferMapping(const BufferMapping &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return BufferMapping&
+     */
+    BufferMapping &operator=(const BufferMapping &) = delete;
+
+    /**
+     * @brief Move constructor
+     *
+     */
+    BufferMapping(BufferMapping &&other) noexcept;
+
+    /**
+     * @brief Move assignment operator, the current mapping is unmapped
+     *
+     * @return BufferMapping&
+     */
+    BufferMapping &operator=(BufferMapping &&other) noexcept;
+
+    /**
+     * @brief Get the mapped pointer
+     *
+     * @return T The mapped pointer, nullptr if the mapping is empty
+     */
+    template <typename T, typename = std::enable_if_t<std::is_pointer<T>::value>>
+    T GetPtr() const
+    {
+        return static_cast<T>(ptr_);
+    }
+
+    /**
+     * @brief Get the size of the mapped region
+     *
+     * @return size_t
+     */
+    size_t GetSize() const;
+
+    /**
+     * @brief Whether the BufferMapping holds a mapping
+     *
+     * @return true
+     * @return false
+     */
+    bool IsValid() const;
+
+    /**
+     * @brief Unmap the region and wait for the unmap to complete, the mapping becomes empty
+     *
+     * @return true
+     * @return false
+     */
+    bool Unmap();
+
+private:
+    cl_command_queue queue_{nullptr};
+    cl_mem buffer_{nullptr};
+    void *ptr_{nullptr};
+    size_t size_{0};
+};
+
+/**
+ * @brief BufferRect describes a 2D or 3D region of a buffer and of the host memory for rectangular copies.
+ *
+ * The x coordinates are in bytes, the y coordinates in rows and the z coordinates in slices. A zero pitch is computed
+ * from the region as tightly packed.
+ */
+struct BufferRect {
+    /**
+     * @brief The origin of the region in the buffer
+     *
+     */
+    std::array<size_t, 3> buffer_origin = {0, 0, 0};
+
+    /**
+     * @brief The origin of the region in the host memory
+     *
+     */
+    std::array<size_t, 3> host_origin = {0, 0, 0};
+
+    /**
+     * @brief The width in bytes, the height in rows and the depth in slices of the region
+     *
+     */
+    std::array<size_t, 3> region = {0, 1, 1};
+
+    /**
+     * @brief The length of each row of the buffer in bytes
+     *
+     */
+    size_t buffer_row_pitch = 0;
+
+    /**
+     * @brief The length of each slice of the buffer in bytes
+     *
+     */
+    size_t buffer_slice_pitch = 0;
+
+    /**
+     * @brief The length of each row of the host memory in bytes
+     *
+     */
+    size_t host_row_pitch = 0;
+
+    /**
+     * @brief The length of each slice of the host memory in bytes
+     *
+     */
+    size_t host_slice_pitch = 0;
+};
+
+/**
+ * @brief Buffer is a class that represents the memory object on the device.
+ * 
+ */
+class Buffer final {
+public:
+    /**
+     * @brief Implementation of Buffer
+     *
+     */
+    class BufferImpl;
+
+    /**
+     * @brief Construct a new Buffer object
+     *
+     * @param impl
+     */
+    explicit Buffer(BufferImpl *impl);
+
+    /**
+     * @brief Destroy the Buffer object
+     *
+     */
+    ~Buffer() = default;
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    Buffer() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    Buffer(const Buffer &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return Buffer&
+     */
+    Buffer &operator=(const Buffer &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    Buffer(Buffer &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return Buffer&
+     */
+    Buffer &operator=(Buffer &&) = delete;
+
+    /**
+     * @brief Get the Cl Mem object
+     * 
+     * @return cl_mem 
+     */
+    cl_mem GetClMem() const;
+
+    /**
+     * @brief Get the Host Ptr
+     * 
+     * @return T The host pointer, nullptr unless the buffer is BufferMode::HostVisiblePersistent
+     */
+    template <typename T, typename = std::enable_if_t<std::is_pointer<T>::value>>
+    T GetHostPtr() const
+    {
+        static_assert(std::is_pointer<T>::value, "T must be a pointer type");
+        return static_cast<T>(GetHostPtrImpl());
+    }
+
+    /**
+     * @brief Get the buffer size
+     * 
+     * @return size_t 
+     */
+    size_t GetSize() const;
+
+    /**
+     * @brief Get the mode of the buffer
+     *
+     * @return BufferMode
+     */
+    BufferMode GetMode() const;
+
+    /**
+     * @brief Map a region of the buffer for host access until the returned mapping is destroyed
+     *
+     * The buffer must not be BufferMode::DeviceOnly. The map blocks until the region is accessible.
+     *
+     * @param offset The offset in bytes of the region
+     * @param size The size of the region
+     * @param access The host access, MapAccess::WriteInvalidate when the whole region is overwritten
+     * @return BufferMapping The mapping, empty on failure
+     */
+    BufferMapping Map(size_t offset, size_t size, MapAccess access) const;
+
+    /**
+     * @brief Memcpy
+     * 
+     * @param host_ptr The host pointer
+     * @param size The size of the memory to be copied
+     * @param kind The kind of the memory copy
+     * @return true 
+     * @return false 
+     */
+    bool Memcpy(void *host_ptr, size_t size, MemcpyKind kind) const;
+
+    /**
+     * @brief Memcpy after the wait events complete
+     *
+     * The copy is non-blocking when event is not nullptr, host_ptr must stay valid until the event completes.
+     *
+     * @param host_ptr The host pointer
+     * @param size The size of the memory to be copied
+     * @param kind The kind of the memory copy
+     * @param wait_events The events to wait for before the copy starts
+     * @param event The event of the copy, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Memcpy(void *host_ptr,
+        size_t size,
+        MemcpyKind kind,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+
+    /**
+     * @brief Memcpy on a queue after the wait events complete
+     *
+     * The copy is non-blocking when event is not nullptr, host_ptr must stay valid until the event completes.
+     *
+     * @param queue The queue to enqueue the copy on
+     * @param host_ptr The host pointer
+     * @param size The size of the memory to be copied
+     * @param kind The kind of the memory copy
+     * @param wait_events The events to wait for before the copy starts
+     * @param event The event of the copy, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Memcpy(const Queue &queue,
+        void *host_ptr,
+        size_t size,
+        MemcpyKind kind,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+
+    /**
+     * @brief Memcpy a part of the buffer after the wait events complete
+     *
+     * The copy is non-blocking when event is not nullptr, host_ptr must stay valid until the event completes.
+     *
+     * @param host_ptr The host pointer
+     * @param size The size of the memory to be copied
+     * @param offset The offset in bytes of the part in the buffer
+     * @param kind The kind of the memory copy
+     * @param wait_events The events to wait for before the copy starts
+     * @param event The event of the copy, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Memcpy(void *host_ptr,
+        size_t size,
+        size_t offset,
+        MemcpyKind kind,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+
+    /**
+     * @brief Memcpy a part of the buffer on a queue after the wait events complete
+     *
+     * The copy is non-blocking when event is not nullptr, host_ptr must stay valid until the event completes.
+     *
+     * @param queue The queue to enqueue the copy on
+     * @param host_ptr The host pointer
+     * @param size The size of the memory to be copied
+     * @param offset The offset in bytes of the part in the buffer
+     * @param kind The kind of the memory copy
+     * @param wait_events The events to wait for before the copy starts
+     * @param event The event of the copy, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Memcpy(const Queue &queue,
+        void *host_ptr,
+        size_t size,
+        size_t offset,
+        MemcpyKind kind,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+
+    /**
+     * @brief Memcpy a 2D or 3D region after the wait events complete, such as a tile of an image
+     *
+     * The copy is non-blocking when event is not nullptr, host_ptr must stay valid until the event completes.
+     *
+     * @param host_ptr The host pointer
+     * @param rect The region in the buffer and in the host memory
+     * @param kind The kind of the memory copy
+     * @param wait_events The events to wait for before the copy starts
+     * @param event The event of the copy, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool MemcpyRect(void *host_ptr,
+        const BufferRect &rect,
+        MemcpyKind kind,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+
+    /**
+     * @brief Copy from another buffer on the device after the wait events complete
+     *
+     * The copy is non-blocking when event is not nullptr. The ranges must not overlap if src is this buffer.
+     *
+     * @param src The source buffer
+     * @param size The size of the memory to be copied
+     * @param src_offset The offset in bytes in the source buffer
+     * @param dst_offset The offset in bytes in this buffer
+     * @param wait_events The events to wait for before the copy starts
+     * @param event The event of the copy, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool CopyFrom(const Buffer &src,
+        size_t size,
+        size_t src_offset,
+        size_t dst_offset,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+
+    /**
+     * @brief Fill a part of the buffer with a repeated pattern after the wait events complete
+     *
+     * Patterns of 1, 2, 4, ..., 128 bytes are filled on the device by clEnqueueFillBuffer, other patterns are
+     * written once and doubled by device copies. The fill is non-blocking when event is not nullptr, the pattern is
+     * copied before Fill returns.
+     *
+     * @param pattern The pattern
+     * @param pattern_size The size of the pattern
+     * @param offset The offset in bytes of the part, a multiple of pattern_size
+     * @param size The size of the part, a multiple of pattern_size
+     * @param wait_events The events to wait for before the fill starts
+     * @param event The event of the fill, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Fill(const void *pattern,
+        size_t pattern_size,
+        size_t offset,
+        size_t size,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+
+private:
+    /**
+     * @brief Get the host pointer
+     * 
+     * @return void* The host pointer
+     */
+    void *GetHostPtrImpl() const;
+
+    /**
+     * @brief The pointer to the implementation of Buffer
+     *
+     */
+    std::unique_ptr<BufferImpl> impl_;
+};
+
+/**
+ * @brief BufferArena is a class that hands out sub-buffers of one large buffer with a bump pointer.
+ *
+ * The temporaries of a frame or a request are allocated from the arena and freed all at once by Reset, which costs
+ * one clCreateBuffer for the arena instead of one per temporary. The buffers allocated before a Reset must no longer
+ * be used by the host or by new commands, and all of them must be released before the arena.
+ */
+class BufferArena final {
+public:
+    /**
+     * @brief Implementation of BufferArena
+     *
+     */
+    class BufferArenaImpl;
+
+    /**
+     * @brief Construct a new BufferArena object
+     *
+     * @param impl
+     */
+    explicit BufferArena(BufferArenaImpl *impl);
+
+    /**
+     * @brief Destroy the BufferArena object
+     *
+     */
+    ~BufferArena();
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    BufferArena() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    BufferArena(const BufferArena &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return BufferArena&
+     */
+    BufferArena &operator=(const BufferArena &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    BufferArena(BufferArena &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return BufferArena&
+     */
+    BufferArena &operator=(BufferArena &&) = delete;
+
+    /**
+     * @brief Allocate a sub-buffer, its origin is aligned to the CL_DEVICE_MEM_BASE_ADDR_ALIGN of all devices
+     *
+     * @param size The size of the sub-buffer
+     * @return std::shared_ptr<Buffer> nullptr if the arena is full
+     */
+    std::shared_ptr<Buffer> Allocate(size_t size) const;
+
+    /**
+     * @brief Free all the sub-buffers at once, the next Allocate starts from the beginning of the arena again
+     *
+     */
+    void Reset() const;
+
+    /**
+     * @brief Get the size of the arena
+     *
+     * @return size_t
+     */
+    size_t GetCapacity() const;
+
+    /**
+     * @brief Get the number of bytes allocated since the last Reset, including the alignment padding
+     *
+     * @return size_t
+     */
+    size_t GetUsedSize() const;
+
+private:
+    /**
+     * @brief The pointer to the implementation of BufferArena
+     *
+     */
+    std::unique_ptr<BufferArenaImpl> impl_;
+};
+
+/**
+ * @brief HostSpan is a view of contiguous host elements, like std::span of C++20.
+ *
+ * @tparam T The element type, const for read-only views
+ */
+template <typename T>
+class HostSpan final {
+public:
+    /**
+     * @brief Construct a new HostSpan object
+     *
+     * @param data The first element
+     * @param size The number of elements
+     */
+    HostSpan(T *data, size_t size) : data_(data), size_(size) {}
+
+    /**
+     * @brief Construct a HostSpan over a contiguous container such as std::vector or std::array
+     *
+     * @tparam Container The container type
+     * @param container The container
+     */
+    template <typename Container,
+        typename = std::enable_if_t<std::is_convertible<decltype(std::declval<Container &>().data()), T *>::value>>
+    HostSpan(Container &container) : data_(container.data()), size_(container.size())
+    {
+    }
+
+    /**
+     * @brief Construct a read-only HostSpan from a writable one
+     *
+     * @tparam U The element type of the other span
+     * @param other The other span
+     */
+    template <typename U, typename = std::enable_if_t<std::is_convertible<U *, T *>::value>>
+    HostSpan(const HostSpan<U> &other) : data_(other.data()), size_(other.size())
+    {
+    }
+
+    /**
+     * @brief Get the first element
+     *
+     * @return T*
+     */
+    T *data() const { return data_; }
+
+    /**
+     * @brief Get the number of elements
+     *
+     * @return size_t
+     */
+    size_t size() const { return size_; }
+
+private:
+    T *data_;
+    size_t size_;
+};
+
+/**
+ * @brief TypedBuffer is a typed view of a Buffer whose sizes and offsets are counted in elements.
+ *
+ * @tparam T The element type, it must be trivially copyable
+ */
+template <typename T>
+class TypedBuffer final {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+    /**
+     * @brief Construct a new TypedBuffer object
+     *
+     * @param buffer The buffer, its size should be a multiple of sizeof(T)
+     */
+    explicit TypedBuffer(std::shared_ptr<Buffer> buffer) : buffer_(std::move(buffer)) {}
+
+    /**
+     * @brief Get the underlying Buffer
+     *
+     * @return const std::shared_ptr<Buffer>&
+     */
+    const std::shared_ptr<Buffer> &GetBuffer() const { return buffer_; }
+
+    /**
+     * @brief Get the Cl Mem object
+     *
+     * @return cl_mem
+     */
+    cl_mem GetClMem() const { return buffer_->GetClMem(); }
+
+    /**
+     * @brief Get the number of elements
+     *
+     * @return size_t
+     */
+    size_t GetCount() const { return buffer_->GetSize() / sizeof(T); }
+
+    /**
+     * @brief Get the host view of the elements
+     *
+     * @return HostSpan<T> The view, empty unless the buffer is BufferMode::HostVisiblePersistent
+     */
+    HostSpan<T> GetHostSpan() const
+    {
+        T *data = buffer_->GetHostPtr<T *>();
+        return HostSpan<T>(data, data == nullptr ? 0 : GetCount());
+    }
+
+    /**
+     * @brief Set every element to a value after the wait events complete
+     *
+     * The fill is non-blocking when event is not nullptr.
+     *
+     * @param value The value
+     * @param wait_events The events to wait for before the fill starts
+     * @param event The event of the fill, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Fill(const T &value, const std::vector<Event> &wait_events = {}, Event *event = nullptr) const
+    {
+        return buffer_->Fill(&value, sizeof(T), 0, GetCount() * sizeof(T), wait_events, event);
+    }
+
+    /**
+     * @brief Copy host elements into the buffer after the wait events complete
+     *
+     * The copy is non-blocking when event is not nullptr, the elements must stay valid until the event completes.
+     *
+     * @param data The host elements
+     * @param offset The index of the first element written in the buffer
+     * @param wait_events The events to wait for before the copy starts
+     * @param event The event of the copy, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Upload(HostSpan<const T> data,
+        size_t offset = 0,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const
+    {
+        return buffer_->Memcpy(const_cast<T *>(data.data()),
+            data.size() * sizeof(T),
+            offset * sizeof(T),
+            MemcpyKind::HostToDevice,
+            wait_events,
+            event);
+    }
+
+    /**
+     * @brief Copy elements of the buffer to the host after the wait events complete
+     *
+     * The copy is non-blocking when event is not nullptr, the elements must stay valid until the event completes.
+     *
+     * @param data The host elements
+     * @param offset The index of the first element read from the buffer
+     * @param wait_events The events to wait for before the copy starts
+     * @param event The event of the copy, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Download(HostSpan<T> data,
+        size_t offset = 0,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const
+    {
+        return buffer_->Memcpy(
+            data.data(), data.size() * sizeof(T), offset * sizeof(T), MemcpyKind::DeviceToHost, wait_events, event);
+    }
+
+private:
+    std::shared_ptr<Buffer> buffer_;
+};
+
+/**
+ * @brief GraphArgPatch is a new value of a kernel argument recorded in a CommandGraph.
+ *
+ */
+struct GraphArgPatch {
+    uint32_t node;
+    uint32_t index;
+    KernelArg arg;
+};
+
+/**
+ * @brief CommandGraph is a class that records kernel launches and copies once and replays them.
+ *
+ * The commands are replayed in recording order on an in-order queue. A graph of kernel launches only is replayed as
+ * a cl_khr_command_buffer when the device supports it, otherwise the prebound commands are enqueued one by one.
+ * Patches which change an argument update the command buffer in place with cl_khr_command_buffer_mutable_dispatch,
+ * or record it again on devices without it, patches equal to the current value are skipped.
+ * When profiling is enabled, every replayed command is profiled under its kernel or copy name, and a command buffer
+ * replay as a whole under "CommandGraph".
+ */
+class CommandGraph final {
+public:
+    /**
+     * @brief Implementation of CommandGraph
+     *
+     */
+    class CommandGraphImpl;
+
+    /**
+     * @brief Construct a new CommandGraph object
+     *
+     * @param impl
+     */
+    explicit CommandGraph(CommandGraphImpl *impl);
+
+    /**
+     * @brief Destroy the CommandGraph object
+     *
+     */
+    ~CommandGraph();
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    CommandGraph() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    CommandGraph(const CommandGraph &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return CommandGraph&
+     */
+    CommandGraph &operator=(const CommandGraph &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    CommandGraph(CommandGraph &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return CommandGraph&
+     */
+    CommandGraph &operator=(CommandGraph &&) = delete;
+
+    /**
+     * @brief Record a kernel launch, the arguments are bound once at recording
+     * @tparam Ts The types of the arguments
+     * @param kernel The kernel
+     * @param global_size The number of work items in each dimension
+     * @param local_size The number of work items in each work group
+     * @param dependencies The recorded nodes the launch depends on
+     * @param node The node of the launch, can be nullptr
+     * @param args The arguments bound to the indices not bound by Kernel::SetPersistentArg
+     * @return true
+     * @return false
+     */
+    template <typename... Ts>
+    bool RecordKernel(const Kernel &kernel,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<uint32_t> &dependencies,
+        uint32_t *node,
+        Ts... args) const
+    {
+        const std::array<KernelArg, sizeof...(Ts)> kernel_args = {MakeKernelArg(args)...};
+        return RecordKernelImpl(
+            kernel, kernel_args.data(), kernel_args.size(), global_size, local_size, dependencies, node);
+    }
+
+    /**
+     * @brief Record a copy between a buffer and host memory, host_ptr must stay valid while the graph is replayed
+     *
+     * @param buffer The buffer
+     * @param host_ptr The host pointer
+     * @param size The size of the memory to be copied
+     * @param kind The kind of the memory copy
+     * @param dependencies The recorded nodes the copy depends on
+     * @param node The node of the copy, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool RecordMemcpy(const Buffer &buffer,
+        void *host_ptr,
+        size_t size,
+        MemcpyKind kind,
+        const std::vector<uint32_t> &dependencies,
+        uint32_t *node) const;
+
+    /**
+     * @brief Validate the recorded nodes and stop recording
+     *
+     * @return true
+     * @return false
+     */
+    bool Finalize() const;
+
+    /**
+     * @brief Enqueue the recorded nodes
+     *
+     * The patches replace the recorded arguments for this and the following replays.
+     *
+     * @param patches The kernel arguments to replace before the replay
+     * @param wait_events The events to wait for before the replay starts
+     * @param event The event of the replay, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Replay(const std::vector<GraphArgPatch> &patches, const std::vector<Event> &wait_events, Event *event) const;
+
+    /**
+     * @brief Check whether the graph is replayed as a cl_khr_command_buffer
+     *
+     * @return true
+     * @return false
+     */
+    bool IsCommandBuffer() const;
+
+private:
+    /**
+     * @brief Record a kernel launch
+     *
+     * @param kernel The kernel
+     * @param args The arguments
+     * @param num_args The number of arguments
+     * @param global_size The number of work items in each dimension
+     * @param local_size The number of work items in each work group
+     * @param dependencies The recorded nodes the launch depends on
+     * @param node The node of the launch, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool RecordKernelImpl(const Kernel &kernel,
+        const KernelArg *args,
+        size_t num_args,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<uint32_t> &dependencies,
+        uint32_t *node) const;
+
+    /**
+     * @brief The pointer to the implementation of CommandGraph
+     *
+     */
+    std::unique_ptr<CommandGraphImpl> impl_;
+};
+
+/**
+ * @brief BufferPoolConfig is the configuration of the buffer pool.
+ *
+ */
+struct BufferPoolConfig {
+    /**
+     * @brief Whether released buffers are cached for reuse
+     *
+     */
+    bool enable = true;
+
+    /**
+     * @brief The size classes in bytes, power-of-two size classes are used if empty
+     *
+     */
+    std::vector<size_t> size_classes;
+
+    /**
+     * @brief The maximum number of bytes kept in the free lists
+     *
+     */
+    size_t max_cached_bytes = 256 * 1024 * 1024;
+};
+
+/**
+ * @brief BufferPoolStatistics is the snapshot of the buffer pool counters.
+ *
+ */
+struct BufferPoolStatistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t in_use_buffers = 0;
+    size_t in_use_bytes = 0;
+    size_t cached_buffers = 0;
+    size_t cached_bytes = 0;
+    size_t peak_bytes = 0;
+};
+
+/**
+ * @brief KernelProfile is the device time statistics of the commands with the same name, in nanoseconds.
+ *
+ * Kernel launches are named after the kernel and copies after the MemcpyKind. The percentiles cover the latest 4096
+ * commands of the name.
+ */
+struct KernelProfile {
+    std::string name;
+    uint64_t count{0};
+    uint64_t total_ns{0};
+    uint64_t p50_ns{0};
+    uint64_t p95_ns{0};
+    uint64_t p99_ns{0};
+    uint64_t average_queue_delay_ns{0};
+};
+
+/**
+ * @brief StreamConfig is the configuration of a StreamingPipeline.
+ *
+ */
+struct StreamConfig {
+    /**
+     * @brief The number of input bytes of each chunk
+     *
+     */
+    size_t chunk_size = 0;
+
+    /**
+     * @brief The number of output bytes of each chunk, the same as chunk_size if 0
+     *
+     */
+    size_t output_chunk_size = 0;
+
+    /**
+     * @brief The number of chunks in flight, each one owns an input and an output staging buffer
+     *
+     */
+    uint32_t num_stages = 3;
+
+    /**
+     * @brief The device index
+     *
+     */
+    uint32_t device = 0;
+};
+
+/**
+ * @brief StreamChunk describes the chunk passed to the launch function of a StreamingPipeline.
+ *
+ */
+struct StreamChunk {
+    /**
+     * @brief The index of the chunk
+     *
+     */
+    size_t index = 0;
+
+    /**
+     * @brief The offset in bytes of the chunk in the input
+     *
+     */
+    size_t input_offset = 0;
+
+    /**
+     * @brief The number of input bytes of the chunk, smaller than chunk_size for the last chunk
+     *
+     */
+    size_t input_size = 0;
+
+    /**
+     * @brief The offset in bytes of the chunk in the output
+     *
+     */
+    size_t output_offset = 0;
+
+    /**
+     * @brief The number of output bytes of the chunk, smaller than output_chunk_size for the last chunk
+     *
+     */
+    size_t output_size = 0;
+};
+
+/**
+ * @brief StreamStatistics is the timing of the last StreamingPipeline::Run.
+ *
+ * The upload, compute and download times are the sums of the device times of the commands, so the pipeline overlaps
+ * well when elapsed_ns is close to the largest of them.
+ */
+struct StreamStatistics {
+    uint64_t chunks = 0;
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    uint64_t elapsed_ns = 0;
+    uint64_t upload_ns = 0;
+    uint64_t compute_ns = 0;
+    uint64_t download_ns = 0;
+};
+
+/**
+ * @brief StreamLaunch enqueues the work of one chunk on the queue, it must wait for wait_events and set event.
+ *
+ */
+using StreamLaunch = std::function<bool(const Queue &queue,
+    const Buffer &input,
+    const Buffer &output,
+    const StreamChunk &chunk,
+    const std::vector<Event> &wait_events,
+    Event *event)>;
+
+/**
+ * @brief StreamingPipeline is a class that processes host data larger than device memory chunk by chunk.
+ *
+ * The chunks rotate over num_stages pairs of staging buffers. The pipeline owns an upload, a compute and a download
+ * queue, independent of the queue pool, and the chunks are chained by events only, so the upload, compute and
+ * download of consecutive chunks overlap.
+ */
+class StreamingPipeline final {
+public:
+    /**
+     * @brief Implementation of StreamingPipeline
+     *
+     */
+    class StreamingPipelineImpl;
+
+    /**
+     * @brief Construct a new StreamingPipeline object
+     *
+     * @param impl
+     */
+    explicit StreamingPipeline(StreamingPipelineImpl *impl);
+
+    /**
+     * @brief Destroy the StreamingPipeline object
+     *
+     */
+    ~StreamingPipeline();
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    StreamingPipeline() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    StreamingPipeline(const StreamingPipeline &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return StreamingPipeline&
+     */
+    StreamingPipeline &operator=(const StreamingPipeline &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    StreamingPipeline(StreamingPipeline &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return StreamingPipeline&
+     */
+    StreamingPipeline &operator=(StreamingPipeline &&) = delete;
+
+    /**
+     * @brief Process the input chunk by chunk and wait for the output
+     *
+     * @param input The host input
+     * @param input_size The size of the input
+     * @param output The host output
+     * @param output_size The size of the output, it must have one output chunk per input chunk
+     * @param launch The function that enqueues the work of a chunk
+     * @return true
+     * @return false
+     */
+    bool Run(const void *input, size_t input_size, void *output, size_t output_size, const StreamLaunch &launch) const;
+
+    /**
+     * @brief Get the timing of the last Run
+     *
+     * @return StreamStatistics
+     */
+    StreamStatistics GetStatistics() const;
+
+private:
+    /**
+     * @brief The pointer to the implementation of StreamingPipeline
+     *
+     */
+    std::unique_ptr<StreamingPipelineImpl> impl_;
+};
+
+/**
+ * @brief TransformOp is an enum class that represents the elementwise operation of Algorithms::Transform.
+ *
+ */
+enum class TransformOp {
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Min,
+    Max,
+};
+
+/**
+ * @brief ReduceOp is an enum class that represents the operation of Algorithms::Reduce.
+ *
+ */
+enum class ReduceOp {
+    Sum,
+    Min,
+    Max,
+};
+
+/**
+ * @brief Algorithms is a class that runs the built-in data-parallel primitives on buffers.
+ *
+ * The kernels are embedded in the library and built once per work group size, which is the largest power of two up
+ * to 256 the device supports. Every work item processes 4 consecutive elements as a float4 or uint4, element counts
+ * are limited to 2^31. All the commands run in order on the in-order default queue of the device and share scratch
+ * buffers owned by the Algorithms object. A call is non-blocking when event is not nullptr, the buffers must then
+ * stay valid until the event completes.
+ */
+class Algorithms final {
+public:
+    /**
+     * @brief Implementation of Algorithms
+     *
+     */
+    class AlgorithmsImpl;
+
+    /**
+     * @brief Construct a new Algorithms object
+     *
+     * @param impl
+     */
+    explicit Algorithms(AlgorithmsImpl *impl);
+
+    /**
+     * @brief Destroy the Algorithms object
+     *
+     */
+    ~Algorithms();
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    Algorithms() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    Algorithms(const Algorithms &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return Algorithms&
+     */
+    Algorithms &operator=(const Algorithms &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    Algorithms(Algorithms &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return Algorithms&
+     */
+    Algorithms &operator=(Algorithms &&) = delete;
+
+    /**
+     * @brief Compute output[i] = a[i] op b[i] on float elements, output may be a or b
+     *
+     * @param a The first operand
+     * @param b The second operand
+     * @param output The result
+     * @param count The number of elements
+     * @param op The operation
+     * @param wait_events The events to wait for before the computation starts
+     * @param event The event of the computation, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Transform(const Buffer &a,
+        const Buffer &b,
+        const Buffer &output,
+        size_t count,
+        TransformOp op,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const;
+
+    /**
+     * @brief Compute output[i] = a[i] op b on float elements, output may be a
+     *
+     * @param a The first operand
+     * @param b The scalar second operand
+     * @param output The result
+     * @param count The number of elements
+     * @param op The operation
+     * @param wait_events The events to wait for before the computation starts
+     * @param event The event of the computation, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Transform(const Buffer &a,
+        float b,
+        const Buffer &output,
+        size_t count,
+        TransformOp op,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const;
+
+    /**
+     * @brief Reduce float elements to the first float of result
+     *
+     * The work groups reduce their elements as a tree and merge the partial results with atomics, so the rounding of
+     * ReduceOp::Sum can differ between runs.
+     *
+     * @param input The elements
+     * @param count The number of elements
+     * @param op The operation
+     * @param result The result buffer
+     * @param wait_events The events to wait for before the reduction starts
+     * @param event The event of the reduction, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Reduce(const Buffer &input,
+        size_t count,
+        ReduceOp op,
+        const Buffer &result,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const;
+
+    /**
+     * @brief Reduce float elements and wait for the result
+     *
+     * @param input The elements
+     * @param count The number of elements
+     * @param op The operation
+     * @param result The result
+     * @return true
+     * @return false
+     */
+    bool Reduce(const Buffer &input, size_t count, ReduceOp op, float *result) const;
+
+    /**
+     * @brief Compute the inclusive prefix sums of float elements, output may be input
+     *
+     * @param input The elements
+     * @param output The prefix sums, output[i] = input[0] + ... + input[i]
+     * @param count The number of elements
+     * @param wait_events The events to wait for before the scan starts
+     * @param event The event of the scan, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool InclusiveScan(const Buffer &input,
+        const Buffer &output,
+        size_t count,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const;
+
+    /**
+     * @brief Compute the exclusive prefix sums of float elements, output may be input
+     *
+     * @param input The elements
+     * @param output The prefix sums, output[0] = 0 and output[i] = input[0] + ... + input[i - 1]
+     * @param count The number of elements
+     * @param wait_events The events to wait for before the scan starts
+     * @param event The event of the scan, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool ExclusiveScan(const Buffer &input,
+        const Buffer &output,
+        size_t count,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const;
+
+    /**
+     * @brief Sort uint32_t keys in ascending order with a stable least significant digit radix sort
+     *
+     * @param keys The keys, sorted in place
+     * @param count The number of keys
+     * @param key_bits The number of low bits the keys use, fewer bits take fewer passes
+     * @param wait_events The events to wait for before the sort starts
+     * @param event The event of the sort, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool RadixSort(const Buffer &keys,
+        size_t count,
+        uint32_t key_bits = 32,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const;
+
+    /**
+     * @brief Sort uint32_t keys in ascending order and move 4 byte values along with them
+     *
+     * @param keys The keys, sorted in place
+     * @param values The values, permuted in place like the keys
+     * @param count The number of keys
+     * @param key_bits The number of low bits the keys use, fewer bits take fewer passes
+     * @param wait_events The events to wait for before the sort starts
+     * @param event The event of the sort, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool RadixSortByKey(const Buffer &keys,
+        const Buffer &values,
+        size_t count,
+        uint32_t key_bits = 32,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const;
+
+    /**
+     * @brief Count float elements into num_bins equal bins of [lower, upper), other elements are ignored
+     *
+     * @param input The elements
+     * @param count The number of elements
+     * @param lower The lower bound of the first bin
+     * @param upper The upper bound of the last bin
+     * @param bins The uint32_t counts of the bins, overwritten
+     * @param num_bins The number of bins
+     * @param wait_events The events to wait for before the histogram starts
+     * @param event The event of the histogram, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Histogram(const Buffer &input,
+        size_t count,
+        float lower,
+        float upper,
+        const Buffer &bins,
+        uint32_t num_bins,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const;
+
+    /**
+     * @brief Copy the 4 byte elements whose flag is not 0 to the front of output, keeping their order
+     *
+     * @param input The elements
+     * @param flags The uint32_t flags of the elements
+     * @param count The number of elements
+     * @param output The kept elements, it must hold count elements
+     * @param output_count The uint32_t number of kept elements
+     * @param wait_events The events to wait for before the compaction starts
+     * @param event The event of the compaction, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool StreamCompact(const Buffer &input,
+        const Buffer &flags,
+        size_t count,
+        const Buffer &output,
+        const Buffer &output_count,
+        const std::vector<Event> &wait_events = {},
+        Event *event = nullptr) const;
+
+    /**
+     * @brief Get the work group size the kernels are built for
+     *
+     * @return uint32_t
+     */
+    uint32_t GetWorkGroupSize() const;
+
+private:
+    /**
+     * @brief The pointer to the implementation of Algorithms
+     *
+     */
+    std::unique_ptr<AlgorithmsImpl> impl_;
+};
+
+/**
+ * @brief TaskFunction is the body of a task, it runs on a worker thread of a TaskRuntime and must not throw.
+ *
+ * It returns whether it succeeded. Device work enqueued without waiting is handed over by setting the event, the task
+ * then completes when the event completes instead of when the function returns, so the worker is not blocked. The
+ * queue of the event is flushed by the TaskRuntime.
+ */
+using TaskFunction = std::function<bool(Event &event)>;
+
+/**
+ * @brief TaskRuntimeConfig is the configuration of a TaskRuntime.
+ *
+ */
+struct TaskRuntimeConfig {
+    /**
+     * @brief The number of worker threads, 0 for the number of hardware threads
+     *
+     */
+    uint32_t num_threads = 0;
+};
+
+/**
+ * @brief TaskRuntimeStatistics is the snapshot of the TaskRuntime counters.
+ *
+ */
+struct TaskRuntimeStatistics {
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    uint64_t stolen = 0;
+    uint64_t event_dependencies = 0;
+};
+
+/**
+ * @brief Task is a handle of a task submitted to a TaskRuntime, an empty Task is complete.
+ *
+ */
+class Task final {
+public:
+    /**
+     * @brief Implementation of Task
+     *
+     */
+    class TaskImpl;
+
+    /**
+     * @brief Construct an empty Task object
+     *
+     */
+    Task() = default;
+
+    /**
+     * @brief Construct a new Task object
+     *
+     * @param impl
+     */
+    explicit Task(std::shared_ptr<TaskImpl> impl);
+
+    /**
+     * @brief Whether the Task refers to a task
+     *
+     * @return true
+     * @return false
+     */
+    bool IsValid() const;
+
+    /**
+     * @brief Whether the task has completed, including the device work it handed over
+     *
+     * @return true
+     * @return false
+     */
+    bool IsComplete() const;
+
+    /**
+     * @brief Wait for the task to complete
+     *
+     * Tasks should depend on each other instead of waiting, a task waiting inside a worker blocks the worker.
+     *
+     * @return true The task succeeded
+     * @return false The task, its device work or one of its dependencies failed
+     */
+    bool Wait() const;
+
+private:
+    friend class TaskRuntime;
+
+    /**
+     * @brief The pointer to the implementation of Task
+     *
+     */
+    std::shared_ptr<TaskImpl> impl_;
+};
+
+/**
+ * @brief TaskRuntime is a class that runs host tasks on a work-stealing thread pool.
+ *
+ * A task runs once the tasks and the OpenCL events it depends on have completed. Events are tracked with
+ * clSetEventCallback, so no worker blocks while device work is in flight and the host and device stages of
+ * independent requests overlap. A task whose dependency failed is not run and fails as well. Kernel::Run with
+ * async=false and other blocking calls inside a task block its worker, use the asynchronous calls and hand the event
+ * to the TaskFunction instead. The TaskRuntime waits for all its tasks when it is destroyed.
+ */
+class TaskRuntime final {
+public:
+    /**
+     * @brief Implementation of TaskRuntime
+     *
+     */
+    class TaskRuntimeImpl;
+
+    /**
+     * @brief Construct a new TaskRuntime object
+     *
+     * @param impl
+     */
+    explicit TaskRuntime(TaskRuntimeImpl *impl);
+
+    /**
+     * @brief Destroy the TaskRuntime object, the submitted tasks are completed first
+     *
+     */
+    ~TaskRuntime();
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    TaskRuntime() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    TaskRuntime(const TaskRuntime &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return TaskRuntime&
+     */
+    TaskRuntime &operator=(const TaskRuntime &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    TaskRuntime(TaskRuntime &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return TaskRuntime&
+     */
+    TaskRuntime &operator=(TaskRuntime &&) = delete;
+
+    /**
+     * @brief Submit a task, it may be submitted from another task
+     *
+     * The queues of the events are flushed so that their commands are submitted to the device, a user event must be
+     * set complete by the application.
+     *
+     * @param function The body of the task
+     * @param tasks The tasks to complete first
+     * @param events The commands to complete first
+     * @return Task An empty Task if the runtime is invalid
+     */
+    Task Submit(TaskFunction function,
+        const std::vector<Task> &tasks = {},
+        const std::vector<Event> &events = {}) const;
+
+    /**
+     * @brief Wait for all the submitted tasks to complete, it must not be called from a task
+     *
+     * @return true
+     * @return false A task failed since the previous WaitAll
+     */
+    bool WaitAll() const;
+
+    /**
+     * @brief Get the counters of the runtime
+     *
+     * @return TaskRuntimeStatistics
+     */
+    TaskRuntimeStatistics GetStatistics() const;
+
+private:
+    /**
+     * @brief The pointer to the implementation of TaskRuntime
+     *
+     */
+    std::unique_ptr<TaskRuntimeImpl> impl_;
+};
+
+/**
+ * @brief ProgramSpec is a program variant to be built.
+ *
+ */
+struct ProgramSpec {
+    std::string program_name;
+    std::set<std::string> build_options;
+};
+
+/**
+ * @brief KernelSpec is a kernel of a program variant to be created.
+ *
+ */
+struct KernelSpec {
+    std::string program_name;
+    std::string kernel_name;
+    std::set<std::string> build_options;
+};
+
+/**
+ * @brief WarmupConfig declares the programs and kernels prebuilt by a warmup.
+ *
+ */
+struct WarmupConfig {
+    /**
+     * @brief The program variants to build
+     *
+     */
+    std::vector<ProgramSpec> programs;
+
+    /**
+     * @brief The kernels to create, their program variants are built as well
+     *
+     */
+    std::vector<KernelSpec> kernels;
+};
+
+/**
+ * @brief StartupTiming is the wall time of one startup stage of an Executor, in nanoseconds.
+ *
+ * The stages are "platform query", "partition devices", "context", "queues" and "managers" while the Executor
+ * initializes, "build <program> [<build options>]" for every program variant built and "kernel <program>:<kernel>"
+ * for every kernel created. The start is relative to the start of the initialization, builds overlap when they run
+ * on worker threads. Only the first 1024 stages are kept.
+ */
+struct StartupTiming {
+    std::string stage;
+    uint64_t start_ns{0};
+    uint64_t duration_ns{0};
+    bool success{false};
+};
+
+/**
+ * @brief ExecutorOptions is the configuration an Executor is initialized with.
+ *
+ */
+struct ExecutorOptions {
+    /**
+     * @brief The policy choosing the devices
+     *
+     */
+    DeviceSelection device_selection;
+
+    /**
+     * @brief Split the first device into sub-devices of this many compute units, 0 to keep the devices whole
+     *
+     * The environment variable TINYOCL_PARTITION_EQUALLY overrides it.
+     */
+    uint32_t partition_compute_units = 0;
+
+    /**
+     * @brief The command queues of every device
+     *
+     */
+    QueuePoolConfig queues;
+
+    /**
+     * @brief The buffer pool
+     *
+     */
+    BufferPoolConfig buffer_pool;
+
+    /**
+     * @brief How kernel launches are placed across the devices
+     *
+     */
+    SchedulePolicy schedule_policy = SchedulePolicy::FirstDevice;
+
+    /**
+     * @brief The directory of the program binary and tuning caches, empty to use TINYOCL_PROGRAM_CACHE_DIR
+     *
+     */
+    std::string program_cache_directory;
+
+    /**
+     * @brief Whether kernel profiling starts enabled
+     *
+     * The queues record device timestamps in either case, the local size tuning and the streaming statistics need
+     * them, so this option only controls the collection and can be changed later with Executor::EnableProfiling.
+     */
+    bool profiling = false;
+};
+
+/**
+ * @brief Executor is a class that manages the Kernel objects and Buffer objects.
+ * 
+ */
+class Executor final {
+public:
+    /**
+     * @brief Get the Instance object
+     * 
+     * @return Executor& 
+     */
+    static Executor &GetInstance();
+
+    /**
+     * @brief Create an independent Executor with its own context, queues and managers
+     *
+     * Objects created by an Executor, such as kernels, buffers and queues, must be released before it is destroyed.
+     * Destroying an Executor waits for its queues to finish.
+     *
+     * @param options The options
+     * @return std::shared_ptr<Executor> nullptr if the Executor fails to initialize
+     */
+    static std::shared_ptr<Executor> Create(const ExecutorOptions &options);
+
+    /**
+     * @brief Initialize the Executor returned by GetInstance on a background thread and prebuild programs and kernels
+     *
+     * GetInstance called meanwhile waits for the initialization only, CreateKernel of a program being prebuilt waits
+     * for its build only. The kernels are kept by the Executor, so creating them later skips the build and the
+     * kernel creation. A warmup still running when the process exits is completed during the exit, before the
+     * instance is destroyed, so it must not be called from the destructor of a static object.
+     *
+     * @param config The programs and kernels to prebuild
+     * @return std::shared_future<bool> true once everything is initialized and prebuilt
+     */
+    static std::shared_future<bool> Warmup(const WarmupConfig &config);
+
+    /**
+     * @brief Set the options of the Executor returned by GetInstance
+     *
+     * The instance is initialized when GetInstance is first called, so the options must be set before that.
+     *
+     * @param options The options
+     * @return true
+     * @return false The instance is already initialized
+     */
+    static bool SetDefaultOptions(const ExecutorOptions &options);
+
+    /**
+     * @brief Set the device selection of the Executor returned by GetInstance
+     *
+     * The devices are chosen when the instance is initialized, so the selection must be set before GetInstance is
+     * called for the first time.
+     *
+     * @param selection The device selection
+     * @return true
+     * @return false The instance is already initialized
+     */
+    static bool SetDeviceSelection(const DeviceSelection &selection);
+
+    /**
+     * @brief Destroy the Executor object
+     * 
+     */
+    ~Executor();
+
+    /**
+     * @brief Delete copy constructor
+     * 
+     */
+    Executor(const Executor &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     * 
+     * @return Executor& 
+     */
+    Executor &operator=(const Executor &) = delete;
+
+    /**
+     * @brief Create a Kernel object
+     * 
+     * The program name is resolved to a source registered with AddProgramSource or a program embedded into the
+     * library at build time first, e.g. "cl/calc.cl", and otherwise to a .cl or .bin file relative to the working
+     * directory.
+     * 
+     * @param program_name The name of the program
+     * @param kernel_name The name of the kernel
+     * @param build_options The build options
+     * @return std::shared_ptr<Kernel> 
+     */
+    std::shared_ptr<Kernel> CreateKernel(const std::string &program_name,
+        const std::string &kernel_name,
+        const std::set<std::string> &build_options) const;
+
+    /**
+     * @brief Create a Kernel object from a program source kept in memory
+     *
+     * Kernels created from the same source share one program.
+     *
+     * @param source The OpenCL C source of the program
+     * @param kernel_name The name of the kernel
+     * @param build_options The build options
+     * @return std::shared_ptr<Kernel>
+     */
+    std::shared_ptr<Kernel> CreateKernelFromSource(const std::string &source,
+        const std::string &kernel_name,
+        const std::set<std::string> &build_options) const;
+
+    /**
+     * @brief Register a program source kept in memory under a name used by CreateKernel and PrecompileAsync
+     *
+     * A name keeps its source once registered, so registering the same source again succeeds while a different
+     * source, or the name of an embedded program with a different source, is rejected.
+     *
+     * @param program_name The name of the program
+     * @param source The OpenCL C source of the program
+     * @return true
+     * @return false
+     */
+    bool AddProgramSource(const std::string &program_name, const std::string &source) const;
+
+    /**
+     * @brief Build programs on worker threads
+     *
+     * Every future becomes true once its program is built, CreateKernel on a program being built waits for it while
+     * other programs stay available. Requests for the same program variant share one build.
+     *
+     * @param programs The programs to build
+     * @return std::vector<std::shared_future<bool>> One future per program
+     */
+    std::vector<std::shared_future<bool>> PrecompileAsync(const std::vector<ProgramSpec> &programs) const;
+
+    /**
+     * @brief Prebuild programs and kernels on a background thread
+     *
+     * The program variants are built on worker threads, the kernels are created once their programs are built.
+     *
+     * @param config The programs and kernels to prebuild
+     * @return std::shared_future<bool> true once everything is prebuilt
+     */
+    std::shared_future<bool> Prebuild(const WarmupConfig &config) const;
+
+    /**
+     * @brief Get the startup timing breakdown, the initialization stages followed by the builds and kernel creations
+     *
+     * @return std::vector<StartupTiming> The first stages in the order they finished
+     */
+    std::vector<StartupTiming> GetStartupTimings() const;
+
+    /**
+     * @brief Create a Buffer object
+     *
+     * @param size The size of the buffer
+     * @return std::shared_ptr<Buffer>
+     */
+    std::shared_ptr<Buffer> CreateBuffer(size_t size) const;
+
+    /**
+     * @brief Create a Buffer object with a host access mode
+     *
+     * Buffers are pooled per mode, a released buffer is only reused by buffers of the same mode.
+     *
+     * @param size The size of the buffer
+     * @param mode The host access mode
+     * @return std::shared_ptr<Buffer>
+     */
+    std::shared_ptr<Buffer> CreateBuffer(size_t size, BufferMode mode) const;
+
+    /**
+     * @brief Create a TypedBuffer object
+     *
+     * @tparam T The element type, it must be trivially copyable
+     * @param count The number of elements
+     * @param mode The host access mode
+     * @return std::shared_ptr<TypedBuffer<T>>
+     */
+    template <typename T>
+    std::shared_ptr<TypedBuffer<T>> CreateTypedBuffer(
+        size_t count, BufferMode mode = BufferMode::HostVisiblePersistent) const
+    {
+        if (count == 0 || count > SIZE_MAX / sizeof(T)) {
+            std::cout << "Invalid element count: " << count << std::endl;
+            return nullptr;
+        }
+        std::shared_ptr<Buffer> buffer = CreateBuffer(count * sizeof(T), mode);
+        if (buffer == nullptr || buffer->GetClMem() == nullptr) {
+            return nullptr;
+        }
+        return std::make_shared<TypedBuffer<T>>(std::move(buffer));
+    }
+
+    /**
+     * @brief Create a Buffer object which uses existing host memory without copying it
+     *
+     * The memory must be aligned to the CL_DEVICE_MEM_BASE_ADDR_ALIGN of all devices, page aligned memory is enough
+     * on common devices, and must stay valid until the buffer is released and the commands using it complete. The
+     * buffer is BufferMode::MapOnDemand, Map it to synchronize the memory with the device before the host accesses it.
+     *
+     * @param host_ptr The host memory
+     * @param size The size of the host memory
+     * @return std::shared_ptr<Buffer> nullptr if the memory is misaligned
+     */
+    std::shared_ptr<Buffer> WrapHostMemory(void *host_ptr, size_t size) const;
+
+    /**
+     * @brief Create a BufferArena object
+     *
+     * @param capacity The size of the arena
+     * @param mode The host access mode of the arena and its sub-buffers
+     * @return std::shared_ptr<BufferArena>
+     */
+    std::shared_ptr<BufferArena> CreateBufferArena(size_t capacity, BufferMode mode) const;
+
+    /**
+     * @brief Create a read-only Buffer object over a memory-mapped range of a file
+     *
+     * The pages are loaded lazily and the file stays mapped until the runtime releases the buffer. The offset modulo
+     * the page size must be aligned like the memory of WrapHostMemory, so page aligned offsets always work.
+     *
+     * @param path The file path
+     * @param offset The offset in bytes of the range
+     * @param size The size of the range, 0 to map until the end of the file
+     * @return std::shared_ptr<Buffer>
+     */
+    std::shared_ptr<Buffer> MapFile(const std::string &path, size_t offset, size_t size) const;
+
+    /**
+     * @brief Configure the buffer pool
+     *
+     * @param config The buffer pool configuration
+     */
+    void ConfigureBufferPool(const BufferPoolConfig &config) const;
+
+    /**
+     * @brief Release cached buffers until at most max_cached_bytes stay in the buffer pool
+     *
+     * @param max_cached_bytes The number of bytes allowed to stay cached, 0 flushes the pool
+     */
+    void TrimBufferPool(size_t max_cached_bytes = 0) const;
+
+    /**
+     * @brief Get the buffer pool statistics
+     *
+     * @return BufferPoolStatistics
+     */
+    BufferPoolStatistics GetBufferPoolStatistics() const;
+
+    /**
+     * @brief Recreate the command queue pool of every device, the default queues are kept
+     *
+     * @param config The queue pool configuration
+     * @return true
+     * @return false
+     */
+    bool ConfigureQueues(const QueuePoolConfig &config) const;
+
+    /**
+     * @brief Get a queue of the pool, the index wraps around the number of queues of the type
+     *
+     * @param type The queue type
+     * @param index The queue index, e.g. a stream id
+     * @param device The device index
+     * @return std::shared_ptr<Queue>
+     */
+    std::shared_ptr<Queue> GetQueue(QueueType type, uint32_t index, uint32_t device = 0) const;
+
+    /**
+     * @brief Get the number of devices
+     *
+     * @return uint32_t
+     */
+    uint32_t GetDeviceCount() const;
+
+    /**
+     * @brief Get the description of a device
+     *
+     * @param device The device index
+     * @param info The description of the device
+     * @return true
+     * @return false
+     */
+    bool GetDeviceInfo(uint32_t device, DeviceInfo &info) const;
+
+    /**
+     * @brief Set how kernel launches without an explicit queue or affinity are placed across devices
+     *
+     * Launches placed on different devices are not ordered, chain them with events.
+     *
+     * @param policy The schedule policy
+     */
+    void SetSchedulePolicy(SchedulePolicy policy) const;
+
+    /**
+     * @brief Set the directory of the compiled program binary cache
+     *
+     * Programs built from source are stored there and loaded from there on later builds with the same source, build
+     * options, devices and TinyOCL version. The local sizes found by Kernel::Tune are kept there as well. The default
+     * is the TINYOCL_PROGRAM_CACHE_DIR environment variable.
+     *
+     * @param directory The cache directory, empty to disable the cache
+     */
+    void SetProgramCacheDirectory(const std::string &directory) const;
+
+    /**
+     * @brief Turn the collection of the device timestamps of kernel launches and copies on or off
+     *
+     * @param enable
+     */
+    void EnableProfiling(bool enable) const;
+
+    /**
+     * @brief Get the profiling statistics of every kernel and copy kind, sorted by total time in descending order
+     *
+     * @return std::vector<KernelProfile>
+     */
+    std::vector<KernelProfile> GetKernelProfiles() const;
+
+    /**
+     * @brief Write the latest 65536 profiled commands as a Chrome trace JSON file, one track per queue
+     *
+     * @param path The file path
+     * @return true
+     * @return false
+     */
+    bool DumpChromeTrace(const std::string &path) const;
+
+    /**
+     * @brief Drop the collected profiling statistics and commands
+     *
+     */
+    void ResetProfiling() const;
+
+    /**
+     * @brief Create a command graph replayed on the default queue of a device
+     *
+     * @param device The device index
+     * @return std::shared_ptr<CommandGraph>
+     */
+    std::shared_ptr<CommandGraph> CreateCommandGraph(uint32_t device = 0) const;
+
+    /**
+     * @brief Create a streaming pipeline with its staging buffers
+     *
+     * @param config The pipeline configuration
+     * @return std::shared_ptr<StreamingPipeline>
+     */
+    std::shared_ptr<StreamingPipeline> CreateStreamingPipeline(const StreamConfig &config) const;
+
+    /**
+     * @brief Create the built-in algorithms of a device, the embedded kernels are built on the first call
+     *
+     * @param device The device index
+     * @return std::shared_ptr<Algorithms>
+     */
+    std::shared_ptr<Algorithms> CreateAlgorithms(uint32_t device = 0) const;
+
+    /**
+     * @brief Create a task runtime with its worker threads
+     *
+     * @param config The runtime configuration
+     * @return std::shared_ptr<TaskRuntime>
+     */
+    std::shared_ptr<TaskRuntime> CreateTaskRuntime(const TaskRuntimeConfig &config = TaskRuntimeConfig()) const;
+
+    /**
+     * @brief Wait for all the queues to finish
+     *
+     * @return true
+     * @return false
+     */
+    bool Finish() const;
 
 private:
     /** 
      * @brief Construct a new Executor object
      * 
+     * @param options The options
      */
-    Executor();
+    explicit Executor(const ExecutorOptions &options);
 
     /**
      * @brief The implementation of Executor
@@ -0,0 +1,36 @@
+#ifndef __TINYOCL_ALGORITHMKERNELS_H__
+#define __TINYOCL_ALGORITHMKERNELS_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace TinyOCL {
+/**
+ * @brief The name the algorithm program is embedded under, its source is cl/algorithms.cl
+ *
+ * The op arguments of the kernels are the values of TransformOp and ReduceOp.
+ */
+constexpr char kAlgorithmsProgramName[] = "cl/algorithms.cl";
+
+/**
+ * @brief The number of elements every work item of the block kernels loads as one float4 or uint4
+ *
+ */
+constexpr uint32_t kAlgorithmsElementsPerWorkItem = 4;
+
+/**
+ * @brief The radix sort digit width in bits
+ *
+ */
+constexpr uint32_t kAlgorithmsRadixBits = 4;
+
+/**
+ * @brief The local memory per work item of RadixScatter, the kernel using the most local memory
+ *
+ * 16 digit counters, 4 keys, 4 values and 1 thread total of 4 bytes each.
+ */
+constexpr size_t kAlgorithmsLocalMemoryPerWorkItem = 100;
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_ALGORITHMKERNELS_H__
@@ -8,14 +8,49 @@
 #ifndef __TINYOCL_BUFFERMANAGER_H__
 #define __TINYOCL_BUFFERMANAGER_H__
 
+#include <functional>
+#include <map>
 #include <mutex>
-#include <unordered_set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <CL/cl.h>
+#include "TinyOCL.h"
 
 namespace TinyOCL {
+/**
+ * @brief BufferBlock is an OpenCL buffer owned by BufferManager, only BufferMode::HostVisiblePersistent is mapped.
+ * A cached block keeps the markers enqueued when it was released until they complete.
+ * 
+ */
+struct BufferBlock final {
+    cl_mem buffer{nullptr};
+    void *host_ptr{nullptr};
+    size_t capacity{0};
+    BufferMode mode{BufferMode::HostVisiblePersistent};
+    bool pooled{true};
+    std::vector<cl_event> release_markers;
+};
+
+/**
+ * @brief ReleaseMarker enqueues a marker on every queue which may still use a released buffer and returns the marker
+ * events, the buffer is not reused before they complete.
+ *
+ */
+using ReleaseMarker = std::function<bool(std::vector<cl_event> &markers)>;
+
 /**
  * @brief BufferManager is a class that manages OpenCL buffers.
  * 
+ * Released buffers stay mapped and are cached in per size class and mode free lists, so that a later Create of the
+ * same size class and mode reuses them instead of going through clCreateBuffer and clEnqueueMapBuffer again.
+ * 
+ * A buffer is released as soon as its owner drops it, while a RunAsync or a non-blocking copy may still be queued
+ * on it. Handing it to the next owner then would let the device and the new owner, through the mapped host pointer
+ * of BufferMode::HostVisiblePersistent, write it at the same time. Release therefore enqueues a marker on every
+ * queue of the executor, and Create only reuses cached buffers whose markers have completed. Commands enqueued on
+ * queues the executor no longer tracks, such as pool queues dropped by ConfigureQueues, are not covered.
+ * 
  */
 class BufferManager final {
 public:
@@ -24,8 +59,9 @@ public:
      * 
      * @param context OpenCL context
      * @param queue OpenCL command queue
+     * @param alignment The largest CL_DEVICE_MEM_BASE_ADDR_ALIGN of the devices in bytes
      */
-    explicit BufferManager(cl_context context, cl_command_queue queue);
+    explicit BufferManager(cl_context context, cl_command_queue queue, size_t alignment);
 
     /**
      * @brief Destroy the BufferManager object
@@ -66,27 +102,149 @@ public:
     BufferManager &operator=(BufferManager &&) = delete;
 
     /**
-     * @brief Create a new buffer
+     * @brief Create a new buffer, or reuse a cached one of the same size class
      * 
      * @param size Buffer size
+     * @param mode The host access mode
+     * @param host_ptr The host pointer of the mapped buffer, nullptr unless mode is HostVisiblePersistent
+     * @return cl_mem 
+     */
+    cl_mem Create(size_t size, BufferMode mode, void **host_ptr);
+
+    /**
+     * @brief Create a new buffer which is never pooled, it is destroyed when released
+     * 
+     * @param size Buffer size
+     * @param mode The host access mode
+     * @param host_ptr The host pointer of the mapped buffer, nullptr unless mode is HostVisiblePersistent
+     * @return cl_mem 
+     */
+    cl_mem CreateUnpooled(size_t size, BufferMode mode, void **host_ptr);
+
+    /**
+     * @brief Create a sub-buffer of a buffer, the sub-buffer is never pooled
+     * 
+     * @param parent The parent buffer
+     * @param origin The offset of the sub-buffer in the parent, aligned to GetAlignment
+     * @param size The size of the sub-buffer
      * @return cl_mem 
      */
-    cl_mem Create(size_t size);
+    cl_mem CreateSubBuffer(cl_mem parent, size_t origin, size_t size);
+
+    /**
+     * @brief Create a buffer which uses existing host memory, the buffer is never pooled
+     * 
+     * @param host_ptr The host memory, aligned to GetAlignment
+     * @param size The size of the host memory
+     * @param flags Additional cl_mem_flags, CL_MEM_USE_HOST_PTR is always added
+     * @return cl_mem 
+     */
+    cl_mem Wrap(void *host_ptr, size_t size, cl_mem_flags flags);
+
+    /**
+     * @brief Get the alignment of host memory and sub-buffer origins required by all the devices
+     * 
+     * @return size_t 
+     */
+    size_t GetAlignment() const;
 
     /**
-     * @brief Release a buffer
+     * @brief Set how release markers are enqueued, by default a marker is only enqueued on the queue of the manager
+     * 
+     * @param marker 
+     */
+    void SetReleaseMarker(ReleaseMarker marker);
+
+    /**
+     * @brief Release a buffer, the buffer is cached if the pool has room for it
      * 
      * @param buffer 
      */
     void Release(cl_mem buffer);
 
+    /**
+     * @brief Set the pool configuration, cached buffers which no longer fit are destroyed
+     * 
+     * @param config Pool configuration
+     */
+    void SetConfig(const BufferPoolConfig &config);
+
+    /**
+     * @brief Destroy cached buffers until at most max_cached_bytes are cached
+     * 
+     * @param max_cached_bytes The number of bytes allowed to stay cached
+     */
+    void Trim(size_t max_cached_bytes);
+
+    /**
+     * @brief Destroy all cached buffers
+     * 
+     */
+    void Flush();
+
+    /**
+     * @brief Get the pool statistics
+     * 
+     * @return BufferPoolStatistics 
+     */
+    BufferPoolStatistics GetStatistics();
+
 private:
+    /**
+     * @brief Get the size class of a buffer size
+     * 
+     * @param size Buffer size
+     * @return size_t 
+     */
+    size_t GetSizeClass(size_t size) const;
+
+    /**
+     * @brief Take a cached buffer whose release markers have completed
+     * 
+     * @param free_list The free list of the size class and mode
+     * @param block The cached buffer
+     * @return true 
+     * @return false No cached buffer is idle yet
+     */
+    bool TakeIdle(std::vector<BufferBlock> &free_list, BufferBlock *block);
+
+    /**
+     * @brief Create and map a new buffer
+     * 
+     * @param capacity Buffer size
+     * @param mode The host access mode
+     * @param block The created buffer
+     * @return true 
+     * @return false 
+     */
+    bool Allocate(size_t capacity, BufferMode mode, BufferBlock *block);
+
+    /**
+     * @brief Unmap and release a buffer and its release markers
+     * 
+     * @param block 
+     */
+    void Destroy(const BufferBlock &block);
+
+    /**
+     * @brief Destroy cached buffers, largest size classes first
+     * 
+     * @param max_cached_bytes The number of bytes allowed to stay cached
+     */
+    void TrimLocked(size_t max_cached_bytes);
+
     cl_context context_;
     cl_command_queue queue_;
-    std::unordered_set<cl_mem> buffers_;
+    size_t alignment_;
+    BufferPoolConfig config_;
+    ReleaseMarker release_marker_;
+    std::unordered_map<cl_mem, BufferBlock> buffers_;
+    // Keyed by size class first so that TrimLocked walks the largest size classes first.
+    std::map<std::pair<size_t, BufferMode>, std::vector<BufferBlock>> free_lists_;
+    BufferPoolStatistics statistics_;
     std::mutex mutex_;
 };
 
 }  // namespace TinyOCL
 
-#endif  //__TINYOCL_BUFFERMANAGER_H__
\ No newline at end of file
+#endif  //__TINYOCL_BUFFERMANAGER_H__
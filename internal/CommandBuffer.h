@@ -0,0 +1,242 @@
+#ifndef __TINYOCL_COMMANDBUFFER_H__
+#define __TINYOCL_COMMANDBUFFER_H__
+
+#include <cstdint>
+#include <vector>
+#include <CL/cl.h>
+
+namespace TinyOCL {
+/**
+ * @brief CommandBuffer is a class that records kernel launches into a cl_khr_command_buffer.
+ *
+ * The entry points of the extension are loaded at runtime, so the class builds against headers without the
+ * extension and Init fails on the devices which do not support it. The command buffer is created for simultaneous
+ * use when the device allows it, and with mutable kernel arguments when the device supports revision 0.9.5 or later
+ * of cl_khr_command_buffer_mutable_dispatch.
+ */
+class CommandBuffer final {
+public:
+    /**
+     * @brief Construct a new CommandBuffer object
+     *
+     * @param queue The in-order queue the command buffer is recorded for and enqueued on
+     */
+    explicit CommandBuffer(cl_command_queue queue);
+
+    /**
+     * @brief Destroy the CommandBuffer object
+     *
+     */
+    ~CommandBuffer();
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    CommandBuffer() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    CommandBuffer(const CommandBuffer &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return CommandBuffer&
+     */
+    CommandBuffer &operator=(const CommandBuffer &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    CommandBuffer(CommandBuffer &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return CommandBuffer&
+     */
+    CommandBuffer &operator=(CommandBuffer &&) = delete;
+
+    /**
+     * @brief Check whether the device of a queue supports cl_khr_command_buffer
+     *
+     * @param queue
+     * @return true
+     * @return false
+     */
+    static bool IsSupported(cl_command_queue queue);
+
+    /**
+     * @brief Load the entry points of the extension and create the command buffer
+     *
+     * @return true
+     * @return false
+     */
+    bool Init();
+
+    /**
+     * @brief Record a kernel launch with the arguments currently set on the kernel
+     *
+     * @param kernel The kernel
+     * @param global_size The number of work items in each dimension
+     * @param local_size The number of work items in each work group, empty to let the driver decide
+     * @param dependencies The indices of the recorded launches this launch waits for
+     * @return true
+     * @return false
+     */
+    bool RecordKernel(cl_kernel kernel,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<uint32_t> &dependencies);
+
+    /**
+     * @brief Finish recording
+     *
+     * @return true
+     * @return false
+     */
+    bool Finalize();
+
+    /**
+     * @brief Enqueue the recorded launches
+     *
+     * @param wait_events The events to wait for before the first launch starts
+     * @param event The event of the last launch, can be nullptr
+     * @return true
+     * @return false
+     */
+    bool Enqueue(const std::vector<cl_event> &wait_events, cl_event *event);
+
+    /**
+     * @brief Whether the command buffer can be enqueued again while a previous enqueue is pending
+     *
+     * @return true
+     * @return false
+     */
+    bool IsSimultaneousUse() const;
+
+    /**
+     * @brief Whether the arguments of the recorded launches can be updated without recording them again
+     *
+     * @return true
+     * @return false
+     */
+    bool IsMutable() const;
+
+    /**
+     * @brief Update an argument of a recorded launch for the following enqueues
+     *
+     * @param command The index of the recorded launch
+     * @param index The index of the argument
+     * @param size The size of the argument
+     * @param value The value of the argument, nullptr for local memory
+     * @return true
+     * @return false
+     */
+    bool UpdateKernelArg(uint32_t command, cl_uint index, size_t size, const void *value);
+
+private:
+    // Tokens of cl_khr_command_buffer and cl_khr_command_buffer_mutable_dispatch, which the headers may not have.
+    static constexpr cl_uint kDeviceCommandBufferCapabilities = 0x12A9;
+    static constexpr cl_ulong kCapabilitySimultaneousUse = 1 << 2;
+    static constexpr cl_ulong kCommandBufferFlags = 0x1293;
+    static constexpr cl_ulong kFlagSimultaneousUse = 1 << 0;
+    static constexpr cl_ulong kFlagMutable = 1 << 1;
+    static constexpr cl_uint kDeviceMutableDispatchCapabilities = 0x12B0;
+    static constexpr cl_ulong kMutableDispatchUpdatableFields = 0x12B1;
+    static constexpr cl_ulong kMutableDispatchArguments = 1 << 3;
+    static constexpr cl_uint kStructureTypeMutableDispatchConfig = 0;
+    static constexpr cl_uint kDeviceExtensionsWithVersion = 0x1060;
+    // The update entry point took a single chained config before revision 0.9.5.
+    static constexpr cl_uint kMutableDispatchMinVersion = (0 << 22) | (9 << 12) | 5;
+
+    using SyncPoint = cl_uint;
+    using CommandBufferHandle = void *;
+    using MutableCommand = void *;
+    struct ExtensionVersion {
+        cl_uint version;
+        char name[64];
+    };
+    struct MutableDispatchArg {
+        cl_uint arg_index;
+        size_t arg_size;
+        const void *arg_value;
+    };
+    struct MutableDispatchConfig {
+        MutableCommand command;
+        cl_uint num_args;
+        cl_uint num_svm_args;
+        cl_uint num_exec_infos;
+        cl_uint work_dim;
+        const MutableDispatchArg *arg_list;
+        const MutableDispatchArg *arg_svm_list;
+        const void *exec_info_list;
+        const size_t *global_work_offset;
+        const size_t *global_work_size;
+        const size_t *local_work_size;
+    };
+    using CreateCommandBufferFn = CommandBufferHandle(CL_API_CALL *)(
+        cl_uint num_queues, const cl_command_queue *queues, const cl_ulong *properties, cl_int *errcode_ret);
+    using CommandNDRangeKernelFn = cl_int(CL_API_CALL *)(CommandBufferHandle command_buffer,
+        cl_command_queue command_queue,
+        const cl_ulong *properties,
+        cl_kernel kernel,
+        cl_uint work_dim,
+        const size_t *global_work_offset,
+        const size_t *global_work_size,
+        const size_t *local_work_size,
+        cl_uint num_sync_points_in_wait_list,
+        const SyncPoint *sync_point_wait_list,
+        SyncPoint *sync_point,
+        void **mutable_handle);
+    using FinalizeCommandBufferFn = cl_int(CL_API_CALL *)(CommandBufferHandle command_buffer);
+    using EnqueueCommandBufferFn = cl_int(CL_API_CALL *)(cl_uint num_queues,
+        cl_command_queue *queues,
+        CommandBufferHandle command_buffer,
+        cl_uint num_events_in_wait_list,
+        const cl_event *event_wait_list,
+        cl_event *event);
+    using ReleaseCommandBufferFn = cl_int(CL_API_CALL *)(CommandBufferHandle command_buffer);
+    using UpdateMutableCommandsFn = cl_int(CL_API_CALL *)(
+        CommandBufferHandle command_buffer, cl_uint num_configs, const cl_uint *config_types, const void **configs);
+
+    /**
+     * @brief Check whether a device supports an extension
+     *
+     * @param device The device
+     * @param name The name of the extension
+     * @return true
+     * @return false
+     */
+    static bool HasExtension(cl_device_id device, const char *name);
+
+    /**
+     * @brief Check whether a device supports updating the arguments of recorded launches
+     *
+     * @param device The device
+     * @return true
+     * @return false
+     */
+    static bool SupportsMutableArguments(cl_device_id device);
+
+    cl_command_queue queue_;
+    CommandBufferHandle command_buffer_{nullptr};
+    std::vector<SyncPoint> sync_points_;
+    std::vector<MutableCommand> mutable_commands_;
+    bool simultaneous_use_{false};
+    bool mutable_{false};
+    CreateCommandBufferFn create_{nullptr};
+    CommandNDRangeKernelFn command_ndrange_kernel_{nullptr};
+    FinalizeCommandBufferFn finalize_{nullptr};
+    EnqueueCommandBufferFn enqueue_{nullptr};
+    ReleaseCommandBufferFn release_{nullptr};
+    UpdateMutableCommandsFn update_mutable_commands_{nullptr};
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_COMMANDBUFFER_H__
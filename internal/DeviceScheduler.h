@@ -0,0 +1,141 @@
+#ifndef __TINYOCL_DEVICESCHEDULER_H__
+#define __TINYOCL_DEVICESCHEDULER_H__
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <CL/cl.h>
+#include "TinyOCL.h"
+
+namespace TinyOCL {
+/**
+ * @brief Placement is the device picked for a launch by DeviceScheduler.
+ * 
+ */
+struct Placement final {
+    uint32_t device{0};
+    bool tracked{false};
+};
+
+/**
+ * @brief DeviceScheduler is a class that places kernel launches across the devices of the Executor.
+ * 
+ */
+class DeviceScheduler final {
+public:
+    /**
+     * @brief Construct a new DeviceScheduler object
+     * 
+     * @param num_devices The number of devices
+     */
+    explicit DeviceScheduler(uint32_t num_devices);
+
+    /**
+     * @brief Destroy the DeviceScheduler object
+     * 
+     */
+    ~DeviceScheduler() = default;
+
+    /**
+     * @brief Delete default constructor
+     * 
+     */
+    DeviceScheduler() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     * 
+     */
+    DeviceScheduler(const DeviceScheduler &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     * 
+     * @return DeviceScheduler& 
+     */
+    DeviceScheduler &operator=(const DeviceScheduler &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     * 
+     */
+    DeviceScheduler(DeviceScheduler &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     * 
+     * @return DeviceScheduler& 
+     */
+    DeviceScheduler &operator=(DeviceScheduler &&) = delete;
+
+    /**
+     * @brief Set the schedule policy
+     * 
+     * @param policy 
+     */
+    void SetPolicy(SchedulePolicy policy);
+
+    /**
+     * @brief Get the number of devices
+     * 
+     * @return uint32_t 
+     */
+    uint32_t GetDeviceCount() const;
+
+    /**
+     * @brief Pick the device of a launch
+     * 
+     * Under SchedulePolicy::LeastOutstanding the launch is counted as outstanding and the placement is tracked, the
+     * caller must then hand the event of the launch to Track.
+     * 
+     * @param affinity The device index the launch is bound to, negative to let the policy decide
+     * @return Placement
+     */
+    Placement Schedule(int32_t affinity);
+
+    /**
+     * @brief Mark a tracked launch as complete once its event completes
+     * 
+     * @param placement The placement returned by Schedule
+     * @param event The event of the launch, nullptr if the launch failed
+     */
+    void Track(const Placement &placement, cl_event event);
+
+    /**
+     * @brief Get the number of launches of a device which have not completed
+     * 
+     * @param device The device index
+     * @return uint32_t 
+     */
+    uint32_t GetOutstanding(uint32_t device) const;
+
+private:
+    using Counters = std::vector<std::atomic<uint32_t>>;
+
+    /**
+     * @brief CompletionContext is the user data of the event callback, it keeps the counters alive.
+     * 
+     */
+    struct CompletionContext final {
+        std::shared_ptr<Counters> outstanding;
+        uint32_t device;
+    };
+
+    /**
+     * @brief The event callback of tracked launches
+     * 
+     * @param event 
+     * @param status 
+     * @param user_data 
+     */
+    static void CL_CALLBACK OnComplete(cl_event event, cl_int status, void *user_data);
+
+    uint32_t num_devices_;
+    std::atomic<SchedulePolicy> policy_{SchedulePolicy::FirstDevice};
+    std::atomic<uint32_t> next_device_{0};
+    std::shared_ptr<Counters> outstanding_;
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_DEVICESCHEDULER_H__
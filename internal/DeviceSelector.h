@@ -0,0 +1,109 @@
+#ifndef __TINYOCL_DEVICESELECTOR_H__
+#define __TINYOCL_DEVICESELECTOR_H__
+
+#include <string>
+#include <vector>
+#include <CL/cl.h>
+#include "TinyOCL.h"
+
+namespace TinyOCL {
+/**
+ * @brief DeviceSelector is a class that chooses the devices of the Executor by a DeviceSelection.
+ *
+ */
+class DeviceSelector final {
+public:
+    /**
+     * @brief Construct a new DeviceSelector object, the environment variables override the selection
+     *
+     * @param selection The device selection
+     */
+    explicit DeviceSelector(const DeviceSelection &selection);
+
+    /**
+     * @brief Destroy the DeviceSelector object
+     *
+     */
+    ~DeviceSelector() = default;
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    DeviceSelector() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    DeviceSelector(const DeviceSelector &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return DeviceSelector&
+     */
+    DeviceSelector &operator=(const DeviceSelector &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    DeviceSelector(DeviceSelector &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return DeviceSelector&
+     */
+    DeviceSelector &operator=(DeviceSelector &&) = delete;
+
+    /**
+     * @brief Select the devices, all of them belong to one platform
+     *
+     * @param devices The selected devices
+     * @return true
+     * @return false No device matches the selection
+     */
+    bool Select(std::vector<cl_device_id> &devices) const;
+
+    /**
+     * @brief Get the description of a device
+     *
+     * @param device
+     * @param info
+     * @return true
+     * @return false
+     */
+    static bool GetDeviceInfo(cl_device_id device, DeviceInfo &info);
+
+    /**
+     * @brief Get the name of a device type
+     *
+     * @param type
+     * @return const char*
+     */
+    static const char *GetTypeName(DeviceType type);
+
+private:
+    /**
+     * @brief Apply the environment variables to the selection
+     *
+     */
+    void ApplyEnvironment();
+
+    /**
+     * @brief Check a device against the vendor, name and compute unit filters
+     *
+     * @param info The description of the device
+     * @return true
+     * @return false
+     */
+    bool Matches(const DeviceInfo &info) const;
+
+    DeviceSelection selection_;
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_DEVICESELECTOR_H__
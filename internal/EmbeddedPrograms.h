@@ -0,0 +1,37 @@
+#ifndef __TINYOCL_EMBEDDEDPROGRAMS_H__
+#define __TINYOCL_EMBEDDEDPROGRAMS_H__
+
+#include <cstddef>
+#include <string>
+
+namespace TinyOCL {
+/**
+ * @brief EmbeddedProgram is a program source or binary compiled into the library.
+ *
+ */
+struct EmbeddedProgram {
+    const char *name;
+    const unsigned char *data;
+    size_t size;
+    bool binary;
+};
+
+/**
+ * @brief The embedded programs, terminated by an entry with a null name
+ *
+ * The table is generated by cmake/EmbedPrograms.cmake, every program is named by its path relative to the source
+ * directory it was embedded from, e.g. "cl/calc.cl". Sources are followed by a terminating zero not counted in size.
+ */
+extern const EmbeddedProgram kEmbeddedPrograms[];
+
+/**
+ * @brief Find an embedded program by name
+ *
+ * @param program_name
+ * @return const EmbeddedProgram* The program, nullptr if no program of that name is embedded
+ */
+const EmbeddedProgram *FindEmbeddedProgram(const std::string &program_name);
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_EMBEDDEDPROGRAMS_H__
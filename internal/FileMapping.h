@@ -0,0 +1,105 @@
+#ifndef __TINYOCL_FILEMAPPING_H__
+#define __TINYOCL_FILEMAPPING_H__
+
+#include <string>
+#include <CL/cl.h>
+
+namespace TinyOCL {
+/**
+ * @brief FileMapping is a class that maps a range of a file read-only into memory.
+ *
+ * The pages are loaded lazily by the operating system when they are first accessed.
+ */
+class FileMapping final {
+public:
+    /**
+     * @brief Construct an empty FileMapping object
+     *
+     */
+    FileMapping() = default;
+
+    /**
+     * @brief Destroy the FileMapping object, the file is unmapped
+     *
+     */
+    ~FileMapping();
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    FileMapping(const FileMapping &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return FileMapping&
+     */
+    FileMapping &operator=(const FileMapping &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    FileMapping(FileMapping &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return FileMapping&
+     */
+    FileMapping &operator=(FileMapping &&) = delete;
+
+    /**
+     * @brief Map a range of a file
+     *
+     * @param path The file path
+     * @param offset The offset in bytes of the range
+     * @param size The size of the range, 0 to map until the end of the file
+     * @return true
+     * @return false
+     */
+    bool Open(const std::string &path, size_t offset, size_t size);
+
+    /**
+     * @brief Get the address of the range
+     *
+     * @return void*
+     */
+    void *GetData() const;
+
+    /**
+     * @brief Get the size of the range
+     *
+     * @return size_t
+     */
+    size_t GetSize() const;
+
+    /**
+     * @brief The destructor callback of a cl_mem that uses the mapped range, it deletes the FileMapping
+     *
+     * @param buffer
+     * @param user_data The FileMapping
+     */
+    static void CL_CALLBACK OnBufferDestroyed(cl_mem buffer, void *user_data);
+
+private:
+    /**
+     * @brief Unmap the file
+     *
+     */
+    void Close();
+
+    void *base_{nullptr};
+    size_t mapped_size_{0};
+    size_t page_offset_{0};
+    size_t size_{0};
+#ifdef _WIN32
+    void *file_{nullptr};
+    void *mapping_{nullptr};
+#endif
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_FILEMAPPING_H__
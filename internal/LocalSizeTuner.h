@@ -0,0 +1,158 @@
+#ifndef __TINYOCL_LOCALSIZETUNER_H__
+#define __TINYOCL_LOCALSIZETUNER_H__
+
+#include <atomic>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <CL/cl.h>
+
+namespace TinyOCL {
+/**
+ * @brief LocalSizeTuner is a class that keeps the fastest local sizes found by Kernel::Tune.
+ *
+ * The local sizes are keyed by device, program variant, program content, kernel and global size, and are appended
+ * to local_sizes.txt in the cache directory so that later processes reuse them. The file is compacted when it is
+ * loaded with more outdated lines than entries.
+ */
+class LocalSizeTuner final {
+public:
+    /**
+     * @brief Construct a new LocalSizeTuner object
+     *
+     * @param devices The devices of the context
+     */
+    explicit LocalSizeTuner(const std::vector<cl_device_id> &devices);
+
+    /**
+     * @brief Destroy the LocalSizeTuner object
+     *
+     */
+    ~LocalSizeTuner() = default;
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    LocalSizeTuner() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    LocalSizeTuner(const LocalSizeTuner &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return LocalSizeTuner&
+     */
+    LocalSizeTuner &operator=(const LocalSizeTuner &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    LocalSizeTuner(LocalSizeTuner &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return LocalSizeTuner&
+     */
+    LocalSizeTuner &operator=(LocalSizeTuner &&) = delete;
+
+    /**
+     * @brief Set the directory of local_sizes.txt and load the local sizes stored there
+     *
+     * @param directory The cache directory, empty to keep the local sizes in memory only
+     */
+    void SetDirectory(const std::string &directory);
+
+    /**
+     * @brief Get the hash of a kernel on a device, which GetKey continues from
+     *
+     * @param device The device index
+     * @param kernel_key The program variant and kernel name
+     * @return uint64_t
+     */
+    uint64_t GetSeed(uint32_t device, const std::string &kernel_key) const;
+
+    /**
+     * @brief Get the key of a kernel on a device for a global size
+     *
+     * @param seed The seed returned by GetSeed
+     * @param global_size
+     * @return uint64_t
+     */
+    static uint64_t GetKey(uint64_t seed, const std::vector<size_t> &global_size);
+
+    /**
+     * @brief Get the device index of a device
+     *
+     * @param device
+     * @return int32_t The device index, -1 if the device is not in the context
+     */
+    int32_t GetDeviceIndex(cl_device_id device) const;
+
+    /**
+     * @brief Check whether no local size is known yet
+     *
+     * @return true
+     * @return false
+     */
+    bool IsEmpty() const;
+
+    /**
+     * @brief Find a tuned local size
+     *
+     * @param key The key returned by GetKey
+     * @param local_size The tuned local size, empty when the driver choice was the fastest
+     * @return true
+     * @return false
+     */
+    bool Find(uint64_t key, std::vector<size_t> *local_size) const;
+
+    /**
+     * @brief Store a tuned local size
+     *
+     * @param key The key returned by GetKey
+     * @param local_size The tuned local size, empty when the driver choice was the fastest
+     */
+    void Store(uint64_t key, const std::vector<size_t> &local_size);
+
+    /**
+     * @brief Get the local sizes worth benchmarking for a kernel
+     *
+     * The candidates divide the global size, fit the kernel and device work group limits and are multiples of the
+     * preferred work group size multiple unless the whole global size is smaller.
+     *
+     * @param device The device index
+     * @param kernel
+     * @param global_size
+     * @return std::vector<std::vector<size_t>>
+     */
+    std::vector<std::vector<size_t>> GetCandidates(
+        uint32_t device, cl_kernel kernel, const std::vector<size_t> &global_size) const;
+
+private:
+    /**
+     * @brief Rewrite local_sizes.txt with one line per known local size
+     *
+     */
+    void Compact();
+
+    static constexpr size_t kMaxCandidates = 64;
+
+    std::vector<cl_device_id> devices_;
+    std::vector<uint64_t> device_seeds_;
+    std::string path_;
+    std::unordered_map<uint64_t, std::vector<size_t>> local_sizes_;
+    std::atomic<bool> empty_{true};
+    mutable std::shared_mutex mutex_;
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_LOCALSIZETUNER_H__
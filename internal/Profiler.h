@@ -0,0 +1,164 @@
+#ifndef __TINYOCL_PROFILER_H__
+#define __TINYOCL_PROFILER_H__
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <CL/cl.h>
+#include "TinyOCL.h"
+
+namespace TinyOCL {
+/**
+ * @brief Profiler is a class that collects the device timestamps of the commands enqueued by the Executor.
+ *
+ * The timestamps are read in the completion callback of each tracked event. Every name keeps its count and totals
+ * plus the latest samples for the percentiles, and the latest records are kept for the Chrome trace.
+ */
+class Profiler final {
+public:
+    /**
+     * @brief Construct a new Profiler object
+     *
+     */
+    Profiler();
+
+    /**
+     * @brief Destroy the Profiler object
+     *
+     */
+    ~Profiler() = default;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    Profiler(const Profiler &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return Profiler&
+     */
+    Profiler &operator=(const Profiler &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    Profiler(Profiler &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return Profiler&
+     */
+    Profiler &operator=(Profiler &&) = delete;
+
+    /**
+     * @brief Turn the collection on or off
+     *
+     * @param enable
+     */
+    void Enable(bool enable);
+
+    /**
+     * @brief Check whether the commands have to be tracked
+     *
+     * @return true
+     * @return false
+     */
+    bool IsEnabled() const;
+
+    /**
+     * @brief Collect the timestamps of a command once its event completes
+     *
+     * @param name The name of the command
+     * @param queue The queue the command is enqueued on
+     * @param event The event of the command, it is not released
+     */
+    void Track(const std::string &name, cl_command_queue queue, cl_event event);
+
+    /**
+     * @brief Get the statistics of every name, sorted by total time in descending order
+     *
+     * @return std::vector<KernelProfile>
+     */
+    std::vector<KernelProfile> GetProfiles() const;
+
+    /**
+     * @brief Write the latest records as a Chrome trace JSON file
+     *
+     * @param path The file path
+     * @return true
+     * @return false
+     */
+    bool DumpChromeTrace(const std::string &path) const;
+
+    /**
+     * @brief Drop the collected statistics and records
+     *
+     */
+    void Reset();
+
+private:
+    static constexpr size_t kMaxSamples = 4096;
+    static constexpr size_t kMaxRecords = 65536;
+
+    struct Record final {
+        std::string name;
+        uint32_t queue;
+        cl_ulong queued;
+        cl_ulong submit;
+        cl_ulong start;
+        cl_ulong end;
+    };
+
+    struct Aggregate final {
+        uint64_t count{0};
+        uint64_t total_ns{0};
+        uint64_t total_queue_delay_ns{0};
+        std::vector<uint64_t> samples;
+    };
+
+    /**
+     * @brief State is shared with the event callbacks, which may run after the Profiler is destroyed.
+     *
+     */
+    struct State final {
+        mutable std::mutex mutex;
+        std::map<std::string, Aggregate> aggregates;
+        std::vector<Record> records;
+        uint64_t num_records{0};
+        std::unordered_map<cl_command_queue, uint32_t> queue_ids;
+    };
+
+    /**
+     * @brief CompletionContext is the user data of the event callback.
+     *
+     */
+    struct CompletionContext final {
+        std::shared_ptr<State> state;
+        std::string name;
+        cl_command_queue queue;
+    };
+
+    /**
+     * @brief The event callback of tracked commands
+     *
+     * @param event
+     * @param status
+     * @param user_data
+     */
+    static void CL_CALLBACK OnComplete(cl_event event, cl_int status, void *user_data);
+
+    std::atomic<bool> enabled_{false};
+    std::shared_ptr<State> state_;
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_PROFILER_H__
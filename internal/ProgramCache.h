@@ -0,0 +1,148 @@
+#ifndef __TINYOCL_PROGRAMCACHE_H__
+#define __TINYOCL_PROGRAMCACHE_H__
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <CL/cl.h>
+
+namespace TinyOCL {
+/**
+ * @brief ProgramCache is a class that stores compiled program binaries in a directory.
+ * 
+ * Entries are keyed by a hash of the program source, the build options, the name and driver version of every device
+ * and the TinyOCL version, so that a stale binary is never picked up after any of them changes.
+ * 
+ */
+class ProgramCache final {
+public:
+    /**
+     * @brief Construct a new ProgramCache object, the directory is read from TINYOCL_PROGRAM_CACHE_DIR
+     * 
+     * @param devices OpenCL devices the programs are built for
+     */
+    explicit ProgramCache(const std::vector<cl_device_id> &devices);
+
+    /**
+     * @brief Destroy the ProgramCache object
+     * 
+     */
+    ~ProgramCache() = default;
+
+    /**
+     * @brief Delete default constructor
+     * 
+     */
+    ProgramCache() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     * 
+     */
+    ProgramCache(const ProgramCache &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     * 
+     * @return ProgramCache& 
+     */
+    ProgramCache &operator=(const ProgramCache &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     * 
+     */
+    ProgramCache(ProgramCache &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     * 
+     * @return ProgramCache& 
+     */
+    ProgramCache &operator=(ProgramCache &&) = delete;
+
+    /**
+     * @brief Set the cache directory
+     * 
+     * @param directory The cache directory, empty to disable the cache
+     */
+    void SetDirectory(const std::string &directory);
+
+    /**
+     * @brief Whether the cache is enabled
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool IsEnabled();
+
+    /**
+     * @brief Get the key of a program
+     * 
+     * @param source The program source
+     * @param build_options The build options
+     * @return std::string 
+     */
+    std::string GetKey(const std::string &source, const std::string &build_options) const;
+
+    /**
+     * @brief Load the binaries of a program, one per device
+     * 
+     * A malformed or truncated entry is a miss and is removed.
+     * 
+     * @param key The key of the program
+     * @param binaries The binaries
+     * @return true 
+     * @return false 
+     */
+    bool Load(const std::string &key, std::vector<std::vector<uint8_t>> &binaries);
+
+    /**
+     * @brief Store the binaries of a built program
+     * 
+     * The entry is written to a temporary file and renamed, so concurrent processes never read a partial entry.
+     * 
+     * @param key The key of the program
+     * @param program The built program
+     * @return true 
+     * @return false 
+     */
+    bool Store(const std::string &key, cl_program program);
+
+    /**
+     * @brief Remove an entry which failed to load
+     * 
+     * @param key The key of the program
+     */
+    void Remove(const std::string &key);
+
+private:
+    /**
+     * @brief Get the path of an entry
+     * 
+     * @param key The key of the program
+     * @return std::string 
+     */
+    std::string GetPath(const std::string &key);
+
+    /**
+     * @brief Read the binaries of an entry, every size is checked against the length of the file
+     * 
+     * @param path The path of the entry
+     * @param file_size The length of the file
+     * @param binaries The binaries
+     * @return true 
+     * @return false The entry is malformed or truncated
+     */
+    bool ReadEntry(const std::string &path, uint64_t file_size, std::vector<std::vector<uint8_t>> &binaries);
+
+    std::vector<cl_device_id> devices_;
+    std::string device_signature_;
+    std::string directory_;
+    std::mutex mutex_;
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_PROGRAMCACHE_H__
@@ -8,23 +8,44 @@
 #ifndef __TINYOCL_PROGRAMMANAGER_H__
 #define __TINYOCL_PROGRAMMANAGER_H__
 
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <CL/cl.h>
+#include "ProgramCache.h"
+#include "ThreadPool.h"
 
 namespace TinyOCL {
 /**
  * @brief ProgramWithKernels is a class that manages OpenCL programs and kernels.
  * 
+ * The program is set once before built is fulfilled, the kernels are guarded by mutex.
+ * 
  */
 struct ProgramWithKernels final {
     std::unique_ptr<_cl_program, decltype(&clReleaseProgram)> program{nullptr, clReleaseProgram};
     std::unordered_map<std::string, std::unique_ptr<_cl_kernel, decltype(&clReleaseKernel)>> kernels;
+    std::promise<bool> built;
+    std::shared_future<bool> ready;
+    std::mutex mutex;
+    // The hash of the source or binary the program is built from, set before the entry is fulfilled.
+    uint64_t content_hash{0};
 };
 
+/**
+ * @brief BuildObserver is notified of every program variant built and every kernel created, with the name of the
+ * stage, its start and whether it succeeded. It is called on the thread doing the work.
+ *
+ */
+using BuildObserver =
+    std::function<void(const std::string &stage, std::chrono::steady_clock::time_point start, bool success)>;
+
 /**
  * @brief ProgramManager is a class that manages OpenCL programs.
  * 
@@ -34,10 +55,10 @@ public:
     /**
      * @brief Construct a new Program Manager object
      * 
-     * @param device OpenCL device
+     * @param devices OpenCL devices, programs are built for all of them
      * @param context OpenCL context
      */
-    explicit ProgramManager(cl_device_id device, cl_context context);
+    explicit ProgramManager(const std::vector<cl_device_id> &devices, cl_context context);
 
     /**
      * @brief Destroy the Program Manager object
@@ -78,7 +99,7 @@ public:
     ProgramManager &operator=(ProgramManager &&) = delete;
 
     /**
-     * @brief Build a program
+     * @brief Build a program variant, every distinct set of build options of a program is a separate variant
      * 
      * @param program_name
      * @param build_options 
@@ -88,34 +109,168 @@ public:
     bool BuildProgram(const std::string &program_name, const std::set<std::string> &build_options);
 
     /**
-     * @brief Get a kernel
+     * @brief Build a program variant on the worker threads
+     * 
+     * Requests for a variant which is already built or being built share the same result.
+     * 
+     * @param program_name
+     * @param build_options 
+     * @return std::shared_future<bool> 
+     */
+    std::shared_future<bool> BuildProgramAsync(
+        const std::string &program_name, const std::set<std::string> &build_options);
+
+    /**
+     * @brief Get a kernel of a program variant
      * 
      * @param program_name 
+     * @param build_options 
      * @param kernel_name 
      * @return cl_kernel 
      */
-    cl_kernel GetKernel(const std::string &program_name, const std::string &kernel_name);
+    cl_kernel GetKernel(
+        const std::string &program_name, const std::set<std::string> &build_options, const std::string &kernel_name);
+
+    /**
+     * @brief Get the hash of the source or binary a built program variant comes from
+     * 
+     * @param program_name 
+     * @param build_options 
+     * @return uint64_t The hash, 0 if the variant is not built
+     */
+    uint64_t GetContentHash(const std::string &program_name, const std::set<std::string> &build_options);
+
+    /**
+     * @brief Register the source of a program kept in memory, it is used instead of a file of the same name
+     *
+     * A name keeps its source once registered, embedded programs are registered by the library itself.
+     *
+     * @param program_name
+     * @param source
+     * @return true The source is registered or was registered before
+     * @return false The name is registered or embedded with a different source
+     */
+    bool AddSource(const std::string &program_name, const std::string &source);
+
+    /**
+     * @brief Set the directory of the program binary cache
+     * 
+     * @param directory The cache directory, empty to disable the cache
+     */
+    void SetCacheDirectory(const std::string &directory);
+
+    /**
+     * @brief Set the observer of the builds and kernel creations, it must be set before the first build
+     *
+     * @param observer
+     */
+    void SetObserver(BuildObserver observer);
+
+    /**
+     * @brief Normalize build options, every entry is trimmed and the entries are deduplicated and sorted
+     * 
+     * @param build_options 
+     * @return std::string The options joined by spaces
+     */
+    static std::string NormalizeBuildOptions(const std::set<std::string> &build_options);
+
+    /**
+     * @brief Get the key of a program variant
+     * 
+     * @param program_name 
+     * @param build_options Normalized build options
+     * @return std::string 
+     */
+    static std::string GetVariantKey(const std::string &program_name, const std::string &build_options);
 
 private:
+    using ProgramPtr = std::unique_ptr<_cl_program, decltype(&clReleaseProgram)>;
+
+    /**
+     * @brief Get the entry of a program variant, the entry is created if it does not exist
+     * 
+     * @param variant_key 
+     * @param created Whether the entry was created, the caller must then compile it
+     * @return std::shared_ptr<ProgramWithKernels> 
+     */
+    std::shared_ptr<ProgramWithKernels> AcquireProgram(const std::string &variant_key, bool &created);
+
+    /**
+     * @brief Compile a program variant and fulfill its entry, the entry is fulfilled on every path
+     * 
+     * @param program_with_kernels 
+     * @param variant_key 
+     * @param program_name 
+     * @param build_options Normalized build options
+     */
+    void CompileProgram(const std::shared_ptr<ProgramWithKernels> &program_with_kernels,
+        const std::string &variant_key,
+        const std::string &program_name,
+        const std::string &build_options);
+
+    /**
+     * @brief Build a program resolved by its name, as a registered or embedded program or as a .cl or .bin file
+     * 
+     * @param program_name 
+     * @param build_options 
+     * @param content_hash The hash of the source or binary the program is built from
+     * @return ProgramPtr The built program, nullptr on failure
+     */
+    ProgramPtr BuildProgramByName(
+        const std::string &program_name, const std::string &build_options, uint64_t &content_hash);
+
     /**
      * @brief Build a program with source
      * 
      * @param program_name 
      * @param build_options 
-     * @return true 
-     * @return false 
+     * @param content_hash The hash of the source
+     * @return ProgramPtr The built program, nullptr on failure
+     */
+    ProgramPtr BuildProgramWithSource(
+        const std::string &program_name, const std::string &build_options, uint64_t &content_hash);
+
+    /**
+     * @brief Read the source of a program, from the registered and embedded sources first and then from the file
+     *
+     * @param program_name
+     * @param source
+     * @return true
+     * @return false
+     */
+    bool ReadSource(const std::string &program_name, std::string &source);
+
+    /**
+     * @brief Read the binary of a program, from the embedded binaries first and then from the file
+     *
+     * @param program_name
+     * @param binary
+     * @return true
+     * @return false
      */
-    bool BuildProgramWithSource(const std::string &program_name, const std::string &build_options);
+    bool ReadBinary(const std::string &program_name, std::vector<uint8_t> &binary);
 
     /**
      * @brief Build a program with binary
      * 
      * @param program_name 
      * @param build_options 
-     * @return true 
-     * @return false 
+     * @param content_hash The hash of the binary
+     * @return ProgramPtr The built program, nullptr on failure
+     */
+    ProgramPtr BuildProgramWithBinary(
+        const std::string &program_name, const std::string &build_options, uint64_t &content_hash);
+
+    /**
+     * @brief Build a program with the binaries of the program cache
+     * 
+     * @param program_name 
+     * @param cache_key 
+     * @param build_options 
+     * @return ProgramPtr The built program, nullptr on failure
      */
-    bool BuildProgramWithBinary(const std::string &program_name, const std::string &build_options);
+    ProgramPtr BuildProgramWithCache(
+        const std::string &program_name, const std::string &cache_key, const std::string &build_options);
 
     /**
      * @brief Print the build log
@@ -126,10 +281,14 @@ private:
      */
     bool PrintBuildLog(cl_program program);
 
-    cl_device_id device_;
+    std::vector<cl_device_id> devices_;
     cl_context context_;
-    std::unordered_map<std::string, ProgramWithKernels> programs_with_kernels_;
+    ProgramCache program_cache_;
+    std::unordered_map<std::string, std::shared_ptr<ProgramWithKernels>> programs_with_kernels_;
+    std::unordered_map<std::string, std::string> sources_;
+    BuildObserver observer_;
     std::mutex mutex_;
+    std::unique_ptr<ThreadPool> thread_pool_;
 };
 
 }  // namespace TinyOCL
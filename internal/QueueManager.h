@@ -0,0 +1,140 @@
+#ifndef __TINYOCL_QUEUEMANAGER_H__
+#define __TINYOCL_QUEUEMANAGER_H__
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <CL/cl.h>
+#include "TinyOCL.h"
+
+namespace TinyOCL {
+/**
+ * @brief QueueManager is a class that manages OpenCL command queues.
+ * 
+ * The default queue is always in-order and lives as long as the QueueManager, the other queues of the pool are
+ * recreated by Configure.
+ * 
+ */
+class QueueManager final {
+public:
+    /**
+     * @brief Construct a new QueueManager object
+     * 
+     * @param context OpenCL context
+     * @param device OpenCL device
+     */
+    explicit QueueManager(cl_context context, cl_device_id device);
+
+    /**
+     * @brief Destroy the QueueManager object
+     * 
+     */
+    ~QueueManager() = default;
+
+    /**
+     * @brief Delete default constructor
+     * 
+     */
+    QueueManager() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     * 
+     */
+    QueueManager(const QueueManager &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     * 
+     * @return QueueManager& 
+     */
+    QueueManager &operator=(const QueueManager &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     * 
+     */
+    QueueManager(QueueManager &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     * 
+     * @return QueueManager& 
+     */
+    QueueManager &operator=(QueueManager &&) = delete;
+
+    /**
+     * @brief Create the default queue and the queue pool
+     * 
+     * @param config Queue pool configuration
+     * @return true 
+     * @return false 
+     */
+    bool Configure(const QueuePoolConfig &config);
+
+    /**
+     * @brief Get the default queue
+     * 
+     * @return cl_command_queue 
+     */
+    cl_command_queue GetDefaultQueue() const;
+
+    /**
+     * @brief Get a queue of the pool, the index wraps around the number of queues of the type
+     * 
+     * Copy queues fall back to compute queues when the pool has none.
+     * 
+     * @param type Queue type
+     * @param index Queue index
+     * @return cl_command_queue The queue, retained for the caller
+     */
+    cl_command_queue GetQueue(QueueType type, uint32_t index);
+
+    /**
+     * @brief Get the number of queues of a type
+     * 
+     * @param type Queue type
+     * @return uint32_t 
+     */
+    uint32_t GetQueueCount(QueueType type);
+
+    /**
+     * @brief Wait for all the queues to finish
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool Finish();
+
+    /**
+     * @brief Enqueue a marker on the default queue and every queue of the pool, and flush them
+     * 
+     * @param markers The marker events are appended to it
+     * @return true 
+     * @return false 
+     */
+    bool EnqueueMarkers(std::vector<cl_event> &markers);
+
+    using QueuePtr = std::unique_ptr<_cl_command_queue, decltype(&clReleaseCommandQueue)>;
+
+    /**
+     * @brief Create a queue which is not part of the pool, it is owned by the caller
+     * 
+     * @param out_of_order Whether to enable out-of-order execution
+     * @return QueuePtr 
+     */
+    QueuePtr CreateQueue(bool out_of_order);
+
+private:
+
+    cl_context context_;
+    cl_device_id device_;
+    QueuePtr default_queue_{nullptr, clReleaseCommandQueue};
+    std::vector<QueuePtr> compute_queues_;
+    std::vector<QueuePtr> copy_queues_;
+    std::mutex mutex_;
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_QUEUEMANAGER_H__
@@ -0,0 +1,86 @@
+#ifndef __TINYOCL_THREADPOOL_H__
+#define __TINYOCL_THREADPOOL_H__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace TinyOCL {
+/**
+ * @brief ThreadPool is a class that runs tasks on a fixed number of worker threads.
+ * 
+ */
+class ThreadPool final {
+public:
+    /**
+     * @brief Construct a new ThreadPool object
+     * 
+     * @param num_threads The number of worker threads, at least one thread is created
+     */
+    explicit ThreadPool(uint32_t num_threads);
+
+    /**
+     * @brief Destroy the ThreadPool object, the queued tasks are completed first
+     * 
+     */
+    ~ThreadPool();
+
+    /**
+     * @brief Delete default constructor
+     * 
+     */
+    ThreadPool() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     * 
+     */
+    ThreadPool(const ThreadPool &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     * 
+     * @return ThreadPool& 
+     */
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     * 
+     */
+    ThreadPool(ThreadPool &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     * 
+     * @return ThreadPool& 
+     */
+    ThreadPool &operator=(ThreadPool &&) = delete;
+
+    /**
+     * @brief Queue a task
+     * 
+     * @param task 
+     */
+    void Submit(std::function<void()> task);
+
+private:
+    /**
+     * @brief The loop of a worker thread
+     * 
+     */
+    void Work();
+
+    std::vector<std::thread> threads_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stop_{false};
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_THREADPOOL_H__
@@ -0,0 +1,140 @@
+#ifndef __TINYOCL_WORKSTEALINGPOOL_H__
+#define __TINYOCL_WORKSTEALINGPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace TinyOCL {
+/**
+ * @brief WorkStealingPool is a class that runs tasks on worker threads with one task deque per worker.
+ *
+ * A task submitted by a worker is pushed to the back of its own deque and the worker pops from the back, so the
+ * latest task runs next while its data is still in cache. Tasks submitted by other threads are spread over the
+ * deques. An idle worker steals from the front of the other deques before it sleeps.
+ *
+ */
+class WorkStealingPool final {
+public:
+    /**
+     * @brief Construct a new WorkStealingPool object
+     *
+     * @param num_threads The number of worker threads, at least one thread is created
+     */
+    explicit WorkStealingPool(uint32_t num_threads);
+
+    /**
+     * @brief Destroy the WorkStealingPool object, the queued tasks are completed first
+     *
+     */
+    ~WorkStealingPool();
+
+    /**
+     * @brief Delete default constructor
+     *
+     */
+    WorkStealingPool() = delete;
+
+    /**
+     * @brief Delete copy constructor
+     *
+     */
+    WorkStealingPool(const WorkStealingPool &) = delete;
+
+    /**
+     * @brief Delete copy assignment operator
+     *
+     * @return WorkStealingPool&
+     */
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    /**
+     * @brief Delete move constructor
+     *
+     */
+    WorkStealingPool(WorkStealingPool &&) = delete;
+
+    /**
+     * @brief Delete move assignment operator
+     *
+     * @return WorkStealingPool&
+     */
+    WorkStealingPool &operator=(WorkStealingPool &&) = delete;
+
+    /**
+     * @brief Queue a task
+     *
+     * @param task
+     */
+    void Submit(std::function<void()> task);
+
+    /**
+     * @brief Get the number of worker threads
+     *
+     * @return uint32_t
+     */
+    uint32_t GetThreadCount() const;
+
+    /**
+     * @brief Get the number of tasks run by another worker than the one they were queued to
+     *
+     * @return uint64_t
+     */
+    uint64_t GetStolenCount() const;
+
+private:
+    /**
+     * @brief Worker is the task deque of a worker thread.
+     *
+     */
+    struct Worker final {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    /**
+     * @brief Take the latest task of a worker's own deque
+     *
+     * @param index The worker index
+     * @param task
+     * @return true
+     * @return false The deque is empty
+     */
+    bool Pop(uint32_t index, std::function<void()> &task);
+
+    /**
+     * @brief Take the oldest task of another worker's deque
+     *
+     * @param index The index of the stealing worker
+     * @param task
+     * @return true
+     * @return false All the other deques are empty
+     */
+    bool Steal(uint32_t index, std::function<void()> &task);
+
+    /**
+     * @brief The loop of a worker thread
+     *
+     * @param index The worker index
+     */
+    void Work(uint32_t index);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    // The tasks queued and not taken yet, counted before they are pushed so that a sleeping worker never misses one.
+    std::atomic<size_t> queued_{0};
+    std::atomic<uint32_t> next_worker_{0};
+    std::atomic<uint64_t> stolen_{0};
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stop_{false};
+};
+
+}  // namespace TinyOCL
+
+#endif  //__TINYOCL_WORKSTEALINGPOOL_H__
@@ -8,7 +8,10 @@
 #ifndef __TINYOCL_UTILS_H__
 #define __TINYOCL_UTILS_H__
 
+#include <cstdint>
 #include <iostream>
+#include <string>
+#include <vector>
 #include <CL/cl.h>
 
 #ifndef CHECK_OPENCL_ERROR
@@ -38,4 +41,72 @@
 #define CHECK_OPENCL_ERROR_RETURN_NULL(ret, msg) CHECK_OPENCL_ERROR(ret, msg, nullptr)
 #endif  // CHECK_OPENCL_ERROR_RETURN_NULL
 
+namespace TinyOCL {
+/**
+ * @brief Get a string parameter of a device
+ *
+ * @param device
+ * @param param
+ * @return std::string The value, empty on failure
+ */
+inline std::string GetDeviceString(cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    cl_int ret = clGetDeviceInfo(device, param, 0, nullptr, &size);
+    CHECK_OPENCL_ERROR(ret, "Failed to get device info size", "");
+    std::vector<char> value(size + 1, '\0');
+    ret = clGetDeviceInfo(device, param, size, value.data(), nullptr);
+    CHECK_OPENCL_ERROR(ret, "Failed to get device info", "");
+    return value.data();
+}
+
+/**
+ * @brief Get a string parameter of a platform
+ *
+ * @param platform
+ * @param param
+ * @return std::string The value, empty on failure
+ */
+inline std::string GetPlatformString(cl_platform_id platform, cl_platform_info param)
+{
+    size_t size = 0;
+    cl_int ret = clGetPlatformInfo(platform, param, 0, nullptr, &size);
+    CHECK_OPENCL_ERROR(ret, "Failed to get platform info size", "");
+    std::vector<char> value(size + 1, '\0');
+    ret = clGetPlatformInfo(platform, param, size, value.data(), nullptr);
+    CHECK_OPENCL_ERROR(ret, "Failed to get platform info", "");
+    return value.data();
+}
+
+/**
+ * @brief Hash data with 64-bit FNV-1a
+ *
+ * @param data
+ * @param size
+ * @param hash The hash to continue from
+ * @return uint64_t
+ */
+inline uint64_t Fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Hash a string with 64-bit FNV-1a
+ *
+ * @param data
+ * @param hash The hash to continue from
+ * @return uint64_t
+ */
+inline uint64_t Fnv1a(const std::string &data, uint64_t hash = 14695981039346656037ULL)
+{
+    return Fnv1a(data.data(), data.size(), hash);
+}
+}  // namespace TinyOCL
+
 #endif  // __TINYOCL_UTILS_H__
\ No newline at end of file
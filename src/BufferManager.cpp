@@ -5,32 +5,128 @@
  * @Last Modified time: 2024-06-17 03:52:20
  */
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include "utils.h"
 #include "BufferManager.h"
 
 namespace TinyOCL {
 
-BufferManager::BufferManager(cl_context context, cl_command_queue queue) : context_(context), queue_(queue) {}
+BufferManager::BufferManager(cl_context context, cl_command_queue queue, size_t alignment)
+    : context_(context), queue_(queue), alignment_(std::max<size_t>(alignment, 1))
+{
+}
 
 BufferManager::~BufferManager()
 {
     std::lock_guard<std::mutex> lock(mutex_);
     std::cout << "Release " << buffers_.size() << " buffers" << std::endl;
-    for (auto buffer : buffers_) {
-        clReleaseMemObject(buffer);
-        std::cout << "Release buffer " << buffer << std::endl;
+    for (const auto &buffer : buffers_) {
+        Destroy(buffer.second);
+        std::cout << "Release buffer " << buffer.first << std::endl;
+    }
+    TrimLocked(0);
+}
+
+cl_mem BufferManager::Create(size_t size, BufferMode mode, void **host_ptr)
+{
+    if (size == 0) {
+        std::cout << "Invalid buffer size: " << size << std::endl;
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t size_class = config_.enable ? GetSizeClass(size) : size;
+    auto free_list_iter = free_lists_.find({size_class, mode});
+    BufferBlock block;
+    if (free_list_iter != free_lists_.end() && TakeIdle(free_list_iter->second, &block)) {
+        statistics_.hits++;
+        statistics_.cached_buffers--;
+        statistics_.cached_bytes -= block.capacity;
+        statistics_.in_use_buffers++;
+        statistics_.in_use_bytes += block.capacity;
+        buffers_.emplace(block.buffer, block);
+        *host_ptr = block.host_ptr;
+        return block.buffer;
+    }
+    statistics_.misses++;
+
+    if (!Allocate(size_class, mode, &block)) {
+        return nullptr;
     }
+    statistics_.in_use_buffers++;
+    statistics_.in_use_bytes += block.capacity;
+    statistics_.peak_bytes = std::max(statistics_.peak_bytes, statistics_.in_use_bytes + statistics_.cached_bytes);
+    buffers_.emplace(block.buffer, block);
+    *host_ptr = block.host_ptr;
+    return block.buffer;
 }
 
-cl_mem BufferManager::Create(size_t size)
+cl_mem BufferManager::CreateUnpooled(size_t size, BufferMode mode, void **host_ptr)
 {
+    if (size == 0) {
+        std::cout << "Invalid buffer size: " << size << std::endl;
+        return nullptr;
+    }
+    BufferBlock block;
+    if (!Allocate(size, mode, &block)) {
+        return nullptr;
+    }
+    block.pooled = false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace(block.buffer, block);
+    *host_ptr = block.host_ptr;
+    return block.buffer;
+}
+
+cl_mem BufferManager::CreateSubBuffer(cl_mem parent, size_t origin, size_t size)
+{
+    if (origin % alignment_ != 0) {
+        std::cout << "Sub-buffer origin " << origin << " is not aligned to " << alignment_ << " bytes" << std::endl;
+        return nullptr;
+    }
+    cl_int ret;
+    const cl_buffer_region region = {origin, size};
+    BufferBlock block;
+    block.capacity = size;
+    block.pooled = false;
+    // The sub-buffer inherits the flags of the parent and shares its mapping, so it is never unmapped itself.
+    block.buffer = clCreateSubBuffer(parent, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &ret);
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to create sub-buffer");
     std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace(block.buffer, block);
+    return block.buffer;
+}
+
+cl_mem BufferManager::Wrap(void *host_ptr, size_t size, cl_mem_flags flags)
+{
+    if (host_ptr == nullptr || size == 0) {
+        std::cout << "Invalid host memory: " << host_ptr << ", size " << size << std::endl;
+        return nullptr;
+    }
+    // Runtimes fall back to a hidden copy for misaligned host memory, which defeats the purpose of wrapping it.
+    if (reinterpret_cast<uintptr_t>(host_ptr) % alignment_ != 0) {
+        std::cout << "Host memory " << host_ptr << " is not aligned to " << alignment_ << " bytes" << std::endl;
+        return nullptr;
+    }
     cl_int ret;
-    cl_mem buffer = clCreateBuffer(context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, nullptr, &ret);
-    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to create buffer");
-    buffers_.emplace(buffer);
-    return buffer;
+    BufferBlock block;
+    block.capacity = size;
+    block.mode = BufferMode::MapOnDemand;
+    block.pooled = false;
+    block.buffer = clCreateBuffer(context_, flags | CL_MEM_USE_HOST_PTR, size, host_ptr, &ret);
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to create buffer from host memory");
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace(block.buffer, block);
+    return block.buffer;
+}
+
+size_t BufferManager::GetAlignment() const { return alignment_; }
+
+void BufferManager::SetReleaseMarker(ReleaseMarker marker)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    release_marker_ = std::move(marker);
 }
 
 void BufferManager::Release(cl_mem buffer)
@@ -40,8 +136,149 @@ void BufferManager::Release(cl_mem buffer)
     if (buffers_iter == buffers_.end()) {
         return;
     }
-    buffers_.erase(buffer);
-    clReleaseMemObject(buffer);
+    BufferBlock block = buffers_iter->second;
+    buffers_.erase(buffers_iter);
+    if (!block.pooled) {
+        Destroy(block);
+        return;
+    }
+    statistics_.in_use_buffers--;
+    statistics_.in_use_bytes -= block.capacity;
+    if (!config_.enable || statistics_.cached_bytes + block.capacity > config_.max_cached_bytes) {
+        statistics_.evictions++;
+        Destroy(block);
+        return;
+    }
+    // Commands enqueued before the release may still use the buffer, it is only reused after they complete.
+    bool marked = false;
+    if (release_marker_) {
+        marked = release_marker_(block.release_markers);
+    } else {
+        cl_event marker = nullptr;
+        marked = clEnqueueMarkerWithWaitList(queue_, 0, nullptr, &marker) == CL_SUCCESS;
+        if (marked) {
+            block.release_markers.emplace_back(marker);
+            clFlush(queue_);
+        }
+    }
+    if (!marked) {
+        std::cout << "Failed to enqueue release marker, destroy buffer " << block.buffer << std::endl;
+        statistics_.evictions++;
+        Destroy(block);
+        return;
+    }
+    free_lists_[{block.capacity, block.mode}].emplace_back(std::move(block));
+    statistics_.cached_buffers++;
+    statistics_.cached_bytes += block.capacity;
+}
+
+void BufferManager::SetConfig(const BufferPoolConfig &config)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_ = config;
+    std::sort(config_.size_classes.begin(), config_.size_classes.end());
+    // Cached buffers were bucketed with the old size classes, drop them rather than mixing both.
+    TrimLocked(0);
+}
+
+void BufferManager::Trim(size_t max_cached_bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    TrimLocked(max_cached_bytes);
+}
+
+void BufferManager::Flush() { Trim(0); }
+
+BufferPoolStatistics BufferManager::GetStatistics()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
+
+size_t BufferManager::GetSizeClass(size_t size) const
+{
+    if (!config_.size_classes.empty()) {
+        auto size_class_iter = std::lower_bound(config_.size_classes.begin(), config_.size_classes.end(), size);
+        return size_class_iter == config_.size_classes.end() ? size : *size_class_iter;
+    }
+    size_t size_class = 1;
+    while (size_class < size && size_class != 0) {
+        size_class <<= 1;
+    }
+    return size_class == 0 ? size : size_class;
+}
+
+bool BufferManager::TakeIdle(std::vector<BufferBlock> &free_list, BufferBlock *block)
+{
+    // The most recently released buffers are the most likely to be still in use, look at the oldest first.
+    for (auto block_iter = free_list.begin(); block_iter != free_list.end(); ++block_iter) {
+        auto &markers = block_iter->release_markers;
+        while (!markers.empty()) {
+            cl_int status = CL_QUEUED;
+            cl_int ret = clGetEventInfo(
+                markers.back(), CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+            // A negative status is an error code, the marker terminated and so did the commands before it.
+            if (ret != CL_SUCCESS || status > CL_COMPLETE) {
+                break;
+            }
+            clReleaseEvent(markers.back());
+            markers.pop_back();
+        }
+        if (markers.empty()) {
+            *block = std::move(*block_iter);
+            free_list.erase(block_iter);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BufferManager::Allocate(size_t capacity, BufferMode mode, BufferBlock *block)
+{
+    cl_int ret;
+    block->capacity = capacity;
+    block->mode = mode;
+    // Device only buffers leave the placement to the runtime, the others are allocated in host accessible memory.
+    const cl_mem_flags flags =
+        mode == BufferMode::DeviceOnly ? CL_MEM_READ_WRITE : CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR;
+    block->buffer = clCreateBuffer(context_, flags, capacity, nullptr, &ret);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to create buffer");
+    if (mode == BufferMode::HostVisiblePersistent) {
+        block->host_ptr = clEnqueueMapBuffer(
+            queue_, block->buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, capacity, 0, nullptr, nullptr, &ret);
+        if (ret != CL_SUCCESS) {
+            std::cout << "OpenCL error: Failed to map buffer (" << ret << ")" << std::endl;
+            clReleaseMemObject(block->buffer);
+            return false;
+        }
+    }
+    return true;
+}
+
+void BufferManager::Destroy(const BufferBlock &block)
+{
+    for (cl_event marker : block.release_markers) {
+        clReleaseEvent(marker);
+    }
+    if (block.host_ptr != nullptr) {
+        cl_int ret = clEnqueueUnmapMemObject(queue_, block.buffer, block.host_ptr, 0, nullptr, nullptr);
+        CHECK_OPENCL_ERROR_NO_RETURN(ret, "Failed to unmap buffer");
+    }
+    clReleaseMemObject(block.buffer);
+}
+
+void BufferManager::TrimLocked(size_t max_cached_bytes)
+{
+    for (auto free_list_iter = free_lists_.rbegin(); free_list_iter != free_lists_.rend(); ++free_list_iter) {
+        auto &free_list = free_list_iter->second;
+        while (!free_list.empty() && statistics_.cached_bytes > max_cached_bytes) {
+            Destroy(free_list.back());
+            statistics_.cached_buffers--;
+            statistics_.cached_bytes -= free_list.back().capacity;
+            statistics_.evictions++;
+            free_list.pop_back();
+        }
+    }
 }
 
-}  // namespace TinyOCL
\ No newline at end of file
+}  // namespace TinyOCL
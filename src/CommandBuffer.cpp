@@ -0,0 +1,175 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "utils.h"
+#include "CommandBuffer.h"
+
+namespace TinyOCL {
+
+CommandBuffer::CommandBuffer(cl_command_queue queue) : queue_(queue) {}
+
+CommandBuffer::~CommandBuffer()
+{
+    if (command_buffer_ != nullptr) {
+        release_(command_buffer_);
+    }
+}
+
+bool CommandBuffer::IsSupported(cl_command_queue queue)
+{
+    cl_device_id device = nullptr;
+    cl_int ret = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get queue device");
+    return HasExtension(device, "cl_khr_command_buffer");
+}
+
+bool CommandBuffer::Init()
+{
+    if (!IsSupported(queue_)) {
+        return false;
+    }
+    cl_device_id device = nullptr;
+    cl_int ret = clGetCommandQueueInfo(queue_, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get queue device");
+    cl_platform_id platform = nullptr;
+    ret = clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(cl_platform_id), &platform, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get device platform");
+    create_ = reinterpret_cast<CreateCommandBufferFn>(
+        clGetExtensionFunctionAddressForPlatform(platform, "clCreateCommandBufferKHR"));
+    command_ndrange_kernel_ = reinterpret_cast<CommandNDRangeKernelFn>(
+        clGetExtensionFunctionAddressForPlatform(platform, "clCommandNDRangeKernelKHR"));
+    finalize_ = reinterpret_cast<FinalizeCommandBufferFn>(
+        clGetExtensionFunctionAddressForPlatform(platform, "clFinalizeCommandBufferKHR"));
+    enqueue_ = reinterpret_cast<EnqueueCommandBufferFn>(
+        clGetExtensionFunctionAddressForPlatform(platform, "clEnqueueCommandBufferKHR"));
+    release_ = reinterpret_cast<ReleaseCommandBufferFn>(
+        clGetExtensionFunctionAddressForPlatform(platform, "clReleaseCommandBufferKHR"));
+    if (!create_ || !command_ndrange_kernel_ || !finalize_ || !enqueue_ || !release_) {
+        std::cout << "Failed to load cl_khr_command_buffer entry points" << std::endl;
+        return false;
+    }
+    cl_ulong capabilities = 0;
+    ret = clGetDeviceInfo(device, kDeviceCommandBufferCapabilities, sizeof(capabilities), &capabilities, nullptr);
+    simultaneous_use_ = ret == CL_SUCCESS && (capabilities & kCapabilitySimultaneousUse) != 0;
+    if (SupportsMutableArguments(device)) {
+        update_mutable_commands_ = reinterpret_cast<UpdateMutableCommandsFn>(
+            clGetExtensionFunctionAddressForPlatform(platform, "clUpdateMutableCommandsKHR"));
+        mutable_ = update_mutable_commands_ != nullptr;
+    }
+    const cl_ulong flags = (simultaneous_use_ ? kFlagSimultaneousUse : 0) | (mutable_ ? kFlagMutable : 0);
+    const cl_ulong properties[] = {kCommandBufferFlags, flags, 0};
+    command_buffer_ = create_(1, &queue_, flags != 0 ? properties : nullptr, &ret);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to create command buffer");
+    return true;
+}
+
+bool CommandBuffer::RecordKernel(cl_kernel kernel,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    const std::vector<uint32_t> &dependencies)
+{
+    std::vector<SyncPoint> wait_list;
+    wait_list.reserve(dependencies.size());
+    for (uint32_t dependency : dependencies) {
+        if (dependency >= sync_points_.size()) {
+            std::cout << "Invalid command buffer dependency: " << dependency << std::endl;
+            return false;
+        }
+        wait_list.emplace_back(sync_points_[dependency]);
+    }
+    SyncPoint sync_point = 0;
+    MutableCommand mutable_command = nullptr;
+    const cl_ulong properties[] = {kMutableDispatchUpdatableFields, kMutableDispatchArguments, 0};
+    cl_int ret = command_ndrange_kernel_(command_buffer_,
+        nullptr,
+        mutable_ ? properties : nullptr,
+        kernel,
+        global_size.size(),
+        nullptr,
+        global_size.data(),
+        local_size.empty() ? nullptr : local_size.data(),
+        wait_list.size(),
+        wait_list.empty() ? nullptr : wait_list.data(),
+        &sync_point,
+        mutable_ ? &mutable_command : nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to record kernel into command buffer");
+    sync_points_.emplace_back(sync_point);
+    mutable_commands_.emplace_back(mutable_command);
+    return true;
+}
+
+bool CommandBuffer::Finalize()
+{
+    cl_int ret = finalize_(command_buffer_);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to finalize command buffer");
+    return true;
+}
+
+bool CommandBuffer::Enqueue(const std::vector<cl_event> &wait_events, cl_event *event)
+{
+    cl_int ret = enqueue_(
+        1, &queue_, command_buffer_, wait_events.size(), wait_events.empty() ? nullptr : wait_events.data(), event);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to enqueue command buffer");
+    return true;
+}
+
+bool CommandBuffer::IsSimultaneousUse() const { return simultaneous_use_; }
+
+bool CommandBuffer::IsMutable() const { return mutable_; }
+
+bool CommandBuffer::UpdateKernelArg(uint32_t command, cl_uint index, size_t size, const void *value)
+{
+    if (!mutable_ || command >= mutable_commands_.size()) {
+        std::cout << "Invalid mutable command: " << command << std::endl;
+        return false;
+    }
+    const MutableDispatchArg arg = {index, size, value};
+    MutableDispatchConfig config = {};
+    config.command = mutable_commands_[command];
+    config.num_args = 1;
+    config.arg_list = &arg;
+    const cl_uint config_type = kStructureTypeMutableDispatchConfig;
+    const void *configs[] = {&config};
+    cl_int ret = update_mutable_commands_(command_buffer_, 1, &config_type, configs);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to update command buffer kernel argument");
+    return true;
+}
+
+bool CommandBuffer::HasExtension(cl_device_id device, const char *name)
+{
+    size_t size = 0;
+    cl_int ret = clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, nullptr, &size);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get device extensions size");
+    std::string extensions(size, '\0');
+    ret = clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, size, extensions.data(), nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get device extensions");
+    extensions.resize(std::strlen(extensions.c_str()));
+    return (" " + extensions + " ").find(" " + std::string(name) + " ") != std::string::npos;
+}
+
+bool CommandBuffer::SupportsMutableArguments(cl_device_id device)
+{
+    if (!HasExtension(device, "cl_khr_command_buffer_mutable_dispatch")) {
+        return false;
+    }
+    // Extension versions are only reported from OpenCL 3.0 on, older devices keep recording the buffer again.
+    size_t size = 0;
+    if (clGetDeviceInfo(device, kDeviceExtensionsWithVersion, 0, nullptr, &size) != CL_SUCCESS) {
+        return false;
+    }
+    std::vector<ExtensionVersion> versions(size / sizeof(ExtensionVersion));
+    cl_int ret = clGetDeviceInfo(
+        device, kDeviceExtensionsWithVersion, versions.size() * sizeof(ExtensionVersion), versions.data(), nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get device extension versions");
+    bool supported = false;
+    for (const auto &version : versions) {
+        if (std::strncmp(version.name, "cl_khr_command_buffer_mutable_dispatch", sizeof(version.name)) == 0) {
+            supported = version.version >= kMutableDispatchMinVersion;
+        }
+    }
+    cl_ulong capabilities = 0;
+    ret = clGetDeviceInfo(device, kDeviceMutableDispatchCapabilities, sizeof(capabilities), &capabilities, nullptr);
+    return supported && ret == CL_SUCCESS && (capabilities & kMutableDispatchArguments) != 0;
+}
+
+}  // namespace TinyOCL
@@ -0,0 +1,87 @@
+#include <iostream>
+#include "utils.h"
+#include "DeviceScheduler.h"
+
+namespace TinyOCL {
+
+DeviceScheduler::DeviceScheduler(uint32_t num_devices)
+    : num_devices_(num_devices), outstanding_(std::make_shared<Counters>(num_devices))
+{}
+
+void DeviceScheduler::SetPolicy(SchedulePolicy policy) { policy_.store(policy); }
+
+uint32_t DeviceScheduler::GetDeviceCount() const { return num_devices_; }
+
+Placement DeviceScheduler::Schedule(int32_t affinity)
+{
+    Placement placement;
+    if (num_devices_ <= 1) {
+        return placement;
+    }
+    if (affinity >= 0) {
+        placement.device = static_cast<uint32_t>(affinity) % num_devices_;
+        return placement;
+    }
+    switch (policy_.load()) {
+        case SchedulePolicy::RoundRobin:
+            placement.device = next_device_.fetch_add(1) % num_devices_;
+            break;
+        case SchedulePolicy::LeastOutstanding: {
+            uint32_t least_outstanding = UINT32_MAX;
+            for (uint32_t device = 0; device < num_devices_; device++) {
+                uint32_t outstanding = (*outstanding_)[device].load();
+                if (outstanding < least_outstanding) {
+                    least_outstanding = outstanding;
+                    placement.device = device;
+                }
+            }
+            (*outstanding_)[placement.device]++;
+            placement.tracked = true;
+            break;
+        }
+        default:
+            break;
+    }
+    return placement;
+}
+
+void DeviceScheduler::Track(const Placement &placement, cl_event event)
+{
+    if (!placement.tracked) {
+        return;
+    }
+    if (event == nullptr) {
+        (*outstanding_)[placement.device]--;
+        return;
+    }
+    auto context = new (std::nothrow) CompletionContext{outstanding_, placement.device};
+    if (context == nullptr) {
+        (*outstanding_)[placement.device]--;
+        return;
+    }
+    cl_int ret = clSetEventCallback(event, CL_COMPLETE, OnComplete, context);
+    if (ret != CL_SUCCESS) {
+        std::cout << "OpenCL error: Failed to set event callback (" << ret << ")" << std::endl;
+        (*outstanding_)[placement.device]--;
+        delete context;
+    }
+}
+
+uint32_t DeviceScheduler::GetOutstanding(uint32_t device) const
+{
+    if (device >= num_devices_) {
+        return 0;
+    }
+    return (*outstanding_)[device].load();
+}
+
+void CL_CALLBACK DeviceScheduler::OnComplete(cl_event event, cl_int status, void *user_data)
+{
+    (void)event;
+    (void)status;
+    auto context = static_cast<CompletionContext *>(user_data);
+    (*context->outstanding)[context->device]--;
+    delete context;
+}
+
+}  // namespace TinyOCL
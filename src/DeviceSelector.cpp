@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include "utils.h"
+#include "DeviceSelector.h"
+
+namespace TinyOCL {
+namespace {
+std::string ToLower(std::string value)
+{
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+    return value;
+}
+
+bool Contains(const std::string &value, const std::string &part)
+{
+    return part.empty() || ToLower(value).find(ToLower(part)) != std::string::npos;
+}
+
+cl_device_type GetClDeviceType(DeviceType type)
+{
+    switch (type) {
+        case DeviceType::Accelerator:
+            return CL_DEVICE_TYPE_ACCELERATOR;
+        case DeviceType::CPU:
+            return CL_DEVICE_TYPE_CPU;
+        default:
+            return CL_DEVICE_TYPE_GPU;
+    }
+}
+}  // namespace
+
+DeviceSelector::DeviceSelector(const DeviceSelection &selection) : selection_(selection) { ApplyEnvironment(); }
+
+void DeviceSelector::ApplyEnvironment()
+{
+    const char *types = std::getenv("TINYOCL_DEVICE_TYPE");
+    if (types != nullptr) {
+        std::vector<DeviceType> device_types;
+        std::istringstream type_stream(types);
+        std::string type;
+        bool valid = true;
+        while (std::getline(type_stream, type, ',')) {
+            type = ToLower(type);
+            if (type == "gpu") {
+                device_types.emplace_back(DeviceType::GPU);
+            } else if (type == "accelerator") {
+                device_types.emplace_back(DeviceType::Accelerator);
+            } else if (type == "cpu") {
+                device_types.emplace_back(DeviceType::CPU);
+            } else {
+                valid = false;
+            }
+        }
+        if (valid && !device_types.empty()) {
+            selection_.types = device_types;
+        } else {
+            std::cout << "Ignore invalid TINYOCL_DEVICE_TYPE: " << types << std::endl;
+        }
+    }
+    const char *vendor = std::getenv("TINYOCL_DEVICE_VENDOR");
+    if (vendor != nullptr) {
+        selection_.vendor = vendor;
+    }
+    const char *name = std::getenv("TINYOCL_DEVICE_NAME");
+    if (name != nullptr) {
+        selection_.name = name;
+    }
+    const char *min_compute_units = std::getenv("TINYOCL_DEVICE_MIN_COMPUTE_UNITS");
+    if (min_compute_units != nullptr) {
+        // strtoull skips spaces and accepts a sign, only plain decimal numbers are taken.
+        char *end = nullptr;
+        errno = 0;
+        const unsigned long long value = std::strtoull(min_compute_units, &end, 10);
+        if (std::isdigit(static_cast<unsigned char>(min_compute_units[0])) && *end == '\0' && errno == 0 &&
+            value <= UINT32_MAX) {
+            selection_.min_compute_units = static_cast<uint32_t>(value);
+        } else {
+            std::cout << "Ignore invalid TINYOCL_DEVICE_MIN_COMPUTE_UNITS: " << min_compute_units << std::endl;
+        }
+    }
+}
+
+bool DeviceSelector::Select(std::vector<cl_device_id> &devices) const
+{
+    cl_uint num_platforms = 0;
+    cl_int ret = clGetPlatformIDs(0, nullptr, &num_platforms);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get number of platforms");
+    if (num_platforms == 0) {
+        std::cout << "No OpenCL platforms found" << std::endl;
+        return false;
+    }
+    std::vector<cl_platform_id> platforms(num_platforms);
+    ret = clGetPlatformIDs(num_platforms, platforms.data(), nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get platform IDs");
+
+    for (DeviceType type : selection_.types) {
+        for (cl_platform_id platform : platforms) {
+            cl_uint num_devices = 0;
+            // Platforms without devices of the type report CL_DEVICE_NOT_FOUND.
+            ret = clGetDeviceIDs(platform, GetClDeviceType(type), 0, nullptr, &num_devices);
+            if (ret != CL_SUCCESS || num_devices == 0) {
+                continue;
+            }
+            std::vector<cl_device_id> platform_devices(num_devices);
+            ret = clGetDeviceIDs(platform, GetClDeviceType(type), num_devices, platform_devices.data(), nullptr);
+            CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get device IDs");
+            std::vector<cl_device_id> matched_devices;
+            std::vector<DeviceInfo> matched_infos;
+            for (cl_device_id device : platform_devices) {
+                DeviceInfo info;
+                if (!GetDeviceInfo(device, info)) {
+                    return false;
+                }
+                if (!Matches(info)) {
+                    std::cout << "Skip " << GetTypeName(type) << " device " << info.name << " (" << info.vendor
+                              << ", " << info.compute_units << " compute units)" << std::endl;
+                    continue;
+                }
+                matched_devices.emplace_back(device);
+                matched_infos.emplace_back(info);
+            }
+            if (matched_devices.empty()) {
+                continue;
+            }
+            std::cout << "Selected " << matched_devices.size() << " " << GetTypeName(type)
+                      << " device(s) on platform " << matched_infos[0].platform << std::endl;
+            for (size_t i = 0; i < matched_infos.size(); i++) {
+                std::cout << "  " << i << ": " << matched_infos[i].name << " (" << matched_infos[i].vendor << ", "
+                          << matched_infos[i].compute_units << " compute units)" << std::endl;
+            }
+            devices = matched_devices;
+            return true;
+        }
+        std::cout << "No " << GetTypeName(type) << " devices match the device selection" << std::endl;
+    }
+    std::cout << "No OpenCL devices match the device selection" << std::endl;
+    return false;
+}
+
+bool DeviceSelector::Matches(const DeviceInfo &info) const
+{
+    if (!Contains(info.vendor, selection_.vendor) && !Contains(info.platform, selection_.vendor)) {
+        return false;
+    }
+    return Contains(info.name, selection_.name) && info.compute_units >= selection_.min_compute_units;
+}
+
+bool DeviceSelector::GetDeviceInfo(cl_device_id device, DeviceInfo &info)
+{
+    info.name = GetDeviceString(device, CL_DEVICE_NAME);
+    info.vendor = GetDeviceString(device, CL_DEVICE_VENDOR);
+    cl_platform_id platform = nullptr;
+    cl_int ret = clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get device platform");
+    info.platform = GetPlatformString(platform, CL_PLATFORM_NAME);
+    cl_device_type type = 0;
+    ret = clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(type), &type, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get device type");
+    if (type & CL_DEVICE_TYPE_GPU) {
+        info.type = DeviceType::GPU;
+    } else if (type & CL_DEVICE_TYPE_ACCELERATOR) {
+        info.type = DeviceType::Accelerator;
+    } else {
+        info.type = DeviceType::CPU;
+    }
+    cl_uint compute_units = 0;
+    ret = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get device compute units");
+    info.compute_units = compute_units;
+    return true;
+}
+
+const char *DeviceSelector::GetTypeName(DeviceType type)
+{
+    switch (type) {
+        case DeviceType::Accelerator:
+            return "ACCELERATOR";
+        case DeviceType::CPU:
+            return "CPU";
+        default:
+            return "GPU";
+    }
+}
+
+}  // namespace TinyOCL
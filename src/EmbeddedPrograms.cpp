@@ -0,0 +1,15 @@
+#include "EmbeddedPrograms.h"
+
+namespace TinyOCL {
+
+const EmbeddedProgram *FindEmbeddedProgram(const std::string &program_name)
+{
+    for (const EmbeddedProgram *program = kEmbeddedPrograms; program->name != nullptr; program++) {
+        if (program_name == program->name) {
+            return program;
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace TinyOCL
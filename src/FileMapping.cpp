@@ -0,0 +1,137 @@
+#include <cstdint>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "FileMapping.h"
+
+namespace TinyOCL {
+
+FileMapping::~FileMapping() { Close(); }
+
+bool FileMapping::Open(const std::string &path, size_t offset, size_t size)
+{
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cout << "Failed to open file: " << path << std::endl;
+        return false;
+    }
+    file_ = file;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        std::cout << "Failed to get file size: " << path << std::endl;
+        Close();
+        return false;
+    }
+    const size_t total_size = static_cast<size_t>(file_size.QuadPart);
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    const size_t granularity = system_info.dwAllocationGranularity;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "Failed to open file: " << path << std::endl;
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        std::cout << "Failed to get file size: " << path << std::endl;
+        close(fd);
+        return false;
+    }
+    const size_t total_size = static_cast<size_t>(file_stat.st_size);
+    const size_t granularity = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    if (size == 0 && offset < total_size) {
+        size = total_size - offset;
+    }
+    if (size == 0 || offset > total_size || size > total_size - offset) {
+        std::cout << "Invalid file range: offset " << offset << ", size " << size << ", file size " << total_size
+                  << std::endl;
+#ifdef _WIN32
+        Close();
+#else
+        close(fd);
+#endif
+        return false;
+    }
+    // The mapping has to start at a multiple of the allocation granularity.
+    const size_t map_offset = offset / granularity * granularity;
+    page_offset_ = offset - map_offset;
+    mapped_size_ = page_offset_ + size;
+#ifdef _WIN32
+    mapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_ != nullptr) {
+        base_ = MapViewOfFile(mapping_,
+            FILE_MAP_READ,
+            static_cast<DWORD>(static_cast<uint64_t>(map_offset) >> 32),
+            static_cast<DWORD>(map_offset & 0xFFFFFFFF),
+            mapped_size_);
+    }
+    if (base_ == nullptr) {
+        std::cout << "Failed to map file: " << path << std::endl;
+        Close();
+        return false;
+    }
+#else
+    void *base = mmap(nullptr, mapped_size_, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(map_offset));
+    // The mapping keeps the file referenced after the descriptor is closed.
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cout << "Failed to map file: " << path << std::endl;
+        mapped_size_ = 0;
+        return false;
+    }
+    base_ = base;
+#endif
+    size_ = size;
+    return true;
+}
+
+void *FileMapping::GetData() const
+{
+    return base_ == nullptr ? nullptr : static_cast<char *>(base_) + page_offset_;
+}
+
+size_t FileMapping::GetSize() const { return size_; }
+
+void CL_CALLBACK FileMapping::OnBufferDestroyed(cl_mem buffer, void *user_data)
+{
+    (void)buffer;
+    delete static_cast<FileMapping *>(user_data);
+}
+
+void FileMapping::Close()
+{
+#ifdef _WIN32
+    if (base_ != nullptr) {
+        UnmapViewOfFile(base_);
+    }
+    if (mapping_ != nullptr) {
+        CloseHandle(mapping_);
+    }
+    if (file_ != nullptr) {
+        CloseHandle(file_);
+    }
+    mapping_ = nullptr;
+    file_ = nullptr;
+#else
+    if (base_ != nullptr) {
+        munmap(base_, mapped_size_);
+    }
+#endif
+    base_ = nullptr;
+    mapped_size_ = 0;
+    page_offset_ = 0;
+    size_ = 0;
+}
+
+}  // namespace TinyOCL
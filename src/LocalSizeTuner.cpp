@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include "utils.h"
+#include "LocalSizeTuner.h"
+
+namespace TinyOCL {
+namespace {
+constexpr char kFileName[] = "local_sizes.txt";
+
+std::string FormatKey(uint64_t key)
+{
+    char key_str[17];
+    std::snprintf(key_str, sizeof(key_str), "%016llx", static_cast<unsigned long long>(key));
+    return key_str;
+}
+
+std::string FormatLocalSize(const std::vector<size_t> &local_size)
+{
+    if (local_size.empty()) {
+        return "-";
+    }
+    std::string value;
+    for (size_t size : local_size) {
+        value += (value.empty() ? "" : ",") + std::to_string(size);
+    }
+    return value;
+}
+
+bool ParseLocalSize(const std::string &value, std::vector<size_t> *local_size)
+{
+    local_size->clear();
+    if (value == "-") {
+        return true;
+    }
+    std::stringstream stream(value);
+    std::string size;
+    while (std::getline(stream, size, ',')) {
+        char *end = nullptr;
+        unsigned long long parsed = std::strtoull(size.c_str(), &end, 10);
+        if (size.empty() || *end != '\0' || parsed == 0) {
+            return false;
+        }
+        local_size->emplace_back(parsed);
+    }
+    return !local_size->empty() && local_size->size() <= 3;
+}
+}  // namespace
+
+LocalSizeTuner::LocalSizeTuner(const std::vector<cl_device_id> &devices) : devices_(devices)
+{
+    for (cl_device_id device : devices_) {
+        std::string signature = GetDeviceString(device, CL_DEVICE_NAME);
+        signature += '\0' + GetDeviceString(device, CL_DEVICE_VENDOR);
+        signature += '\0' + GetDeviceString(device, CL_DRIVER_VERSION);
+        device_seeds_.emplace_back(Fnv1a(signature));
+    }
+    const char *directory = std::getenv("TINYOCL_PROGRAM_CACHE_DIR");
+    if (directory != nullptr) {
+        SetDirectory(directory);
+    }
+}
+
+void LocalSizeTuner::SetDirectory(const std::string &directory)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    path_.clear();
+    if (directory.empty()) {
+        return;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        std::cout << "Failed to create local size cache directory: " << directory << std::endl;
+        return;
+    }
+    path_ = (std::filesystem::path(directory) / kFileName).string();
+    std::unordered_map<uint64_t, std::vector<size_t>> stored;
+    std::ifstream file(path_);
+    std::string line;
+    size_t num_lines = 0;
+    while (std::getline(file, line)) {
+        num_lines++;
+        std::stringstream stream(line);
+        std::string key;
+        std::string value;
+        std::vector<size_t> local_size;
+        if (!(stream >> key >> value) || key.size() != 16 || !ParseLocalSize(value, &local_size)) {
+            continue;
+        }
+        // Later lines are newer results of the same key.
+        stored[std::strtoull(key.c_str(), nullptr, 16)] = std::move(local_size);
+    }
+    file.close();
+    const size_t num_stored = stored.size();
+    // The local sizes tuned in this process win over the stored ones.
+    local_sizes_.merge(stored);
+    empty_.store(local_sizes_.empty());
+    // Store appends, so retuned keys and broken lines pile up, the file is compacted once they outnumber the entries.
+    if (num_lines > 2 * num_stored) {
+        Compact();
+    }
+}
+
+uint64_t LocalSizeTuner::GetSeed(uint32_t device, const std::string &kernel_key) const
+{
+    return Fnv1a(kernel_key, device < device_seeds_.size() ? device_seeds_[device] : Fnv1a(""));
+}
+
+uint64_t LocalSizeTuner::GetKey(uint64_t seed, const std::vector<size_t> &global_size)
+{
+    for (size_t size : global_size) {
+        const uint64_t value = size;
+        seed = Fnv1a(&value, sizeof(value), seed);
+    }
+    return seed;
+}
+
+int32_t LocalSizeTuner::GetDeviceIndex(cl_device_id device) const
+{
+    auto iter = std::find(devices_.begin(), devices_.end(), device);
+    return iter == devices_.end() ? -1 : static_cast<int32_t>(iter - devices_.begin());
+}
+
+bool LocalSizeTuner::IsEmpty() const { return empty_.load(std::memory_order_relaxed); }
+
+bool LocalSizeTuner::Find(uint64_t key, std::vector<size_t> *local_size) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto iter = local_sizes_.find(key);
+    if (iter == local_sizes_.end()) {
+        return false;
+    }
+    *local_size = iter->second;
+    return true;
+}
+
+void LocalSizeTuner::Store(uint64_t key, const std::vector<size_t> &local_size)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    local_sizes_[key] = local_size;
+    empty_.store(false);
+    if (path_.empty()) {
+        return;
+    }
+    std::ofstream file(path_, std::ios::app);
+    file << FormatKey(key) << ' ' << FormatLocalSize(local_size) << '\n';
+    if (!file.good()) {
+        std::cout << "Failed to write local size cache: " << path_ << std::endl;
+    }
+}
+
+void LocalSizeTuner::Compact()
+{
+    // Written aside and renamed so that a reader never sees a partial file.
+    const std::string temp_path = path_ + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        for (const auto &[key, local_size] : local_sizes_) {
+            file << FormatKey(key) << ' ' << FormatLocalSize(local_size) << '\n';
+        }
+        if (!file.good()) {
+            std::cout << "Failed to write local size cache: " << temp_path << std::endl;
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path_, error);
+    if (error) {
+        std::cout << "Failed to replace local size cache: " << path_ << std::endl;
+        std::filesystem::remove(temp_path, error);
+    }
+}
+
+std::vector<std::vector<size_t>> LocalSizeTuner::GetCandidates(
+    uint32_t device, cl_kernel kernel, const std::vector<size_t> &global_size) const
+{
+    std::vector<std::vector<size_t>> candidates;
+    if (device >= devices_.size() || global_size.empty() || global_size.size() > 3) {
+        return candidates;
+    }
+    size_t kernel_max = 0;
+    size_t multiple = 1;
+    size_t device_max = 0;
+    std::vector<size_t> item_max(3, 0);
+    cl_int ret = clGetKernelWorkGroupInfo(
+        kernel, devices_[device], CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_max), &kernel_max, nullptr);
+    CHECK_OPENCL_ERROR(ret, "Failed to get kernel work group size", candidates);
+    ret = clGetKernelWorkGroupInfo(kernel,
+        devices_[device],
+        CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+        sizeof(multiple),
+        &multiple,
+        nullptr);
+    CHECK_OPENCL_ERROR(ret, "Failed to get preferred work group size multiple", candidates);
+    ret = clGetDeviceInfo(devices_[device], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(device_max), &device_max, nullptr);
+    CHECK_OPENCL_ERROR(ret, "Failed to get device max work group size", candidates);
+    ret = clGetDeviceInfo(
+        devices_[device], CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(size_t) * 3, item_max.data(), nullptr);
+    CHECK_OPENCL_ERROR(ret, "Failed to get device max work item sizes", candidates);
+    const size_t max_size = std::min(kernel_max, device_max);
+    multiple = std::max<size_t>(multiple, 1);
+
+    // Powers of two and multiples of the preferred multiple which divide the global size of each dimension.
+    std::vector<std::vector<size_t>> sizes(global_size.size());
+    for (size_t dim = 0; dim < global_size.size(); ++dim) {
+        const size_t limit = std::min({global_size[dim], item_max[dim], max_size});
+        for (size_t size = 1; size <= limit; ++size) {
+            const bool power_of_two = (size & (size - 1)) == 0;
+            if ((power_of_two || size % multiple == 0) && global_size[dim] % size == 0) {
+                sizes[dim].emplace_back(size);
+            }
+        }
+    }
+    const size_t total_global =
+        std::accumulate(global_size.begin(), global_size.end(), size_t(1), std::multiplies<size_t>());
+    std::vector<size_t> candidate(global_size.size());
+    std::function<void(size_t, size_t)> expand = [&](size_t dim, size_t total) {
+        if (dim == global_size.size()) {
+            if (total % multiple == 0 || total == total_global) {
+                candidates.emplace_back(candidate);
+            }
+            return;
+        }
+        for (size_t size : sizes[dim]) {
+            if (total * size > max_size) {
+                break;
+            }
+            candidate[dim] = size;
+            expand(dim + 1, total * size);
+        }
+    };
+    expand(0, 1);
+    // Larger work groups are usually faster, keep those when there are too many candidates.
+    auto total_size = [](const std::vector<size_t> &local_size) {
+        return std::accumulate(local_size.begin(), local_size.end(), size_t(1), std::multiplies<size_t>());
+    };
+    std::stable_sort(candidates.begin(), candidates.end(), [&](const auto &a, const auto &b) {
+        return total_size(a) > total_size(b);
+    });
+    if (candidates.size() > kMaxCandidates) {
+        candidates.resize(kMaxCandidates);
+    }
+    return candidates;
+}
+
+}  // namespace TinyOCL
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include "utils.h"
+#include "Profiler.h"
+
+namespace TinyOCL {
+namespace {
+uint64_t GetPercentile(const std::vector<uint64_t> &sorted_samples, uint32_t percent)
+{
+    if (sorted_samples.empty()) {
+        return 0;
+    }
+    size_t rank = (sorted_samples.size() * percent + 99) / 100;
+    return sorted_samples[std::max<size_t>(rank, 1) - 1];
+}
+
+std::string EscapeJson(const std::string &value)
+{
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            escaped += ' ';
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+}  // namespace
+
+Profiler::Profiler() : state_(std::make_shared<State>()) {}
+
+void Profiler::Enable(bool enable) { enabled_.store(enable); }
+
+bool Profiler::IsEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+void Profiler::Track(const std::string &name, cl_command_queue queue, cl_event event)
+{
+    if (event == nullptr) {
+        return;
+    }
+    auto *context = new (std::nothrow) CompletionContext{state_, name, queue};
+    if (context == nullptr) {
+        return;
+    }
+    cl_int ret = clSetEventCallback(event, CL_COMPLETE, OnComplete, context);
+    if (ret != CL_SUCCESS) {
+        std::cout << "OpenCL error: Failed to set profiling callback (" << ret << ")" << std::endl;
+        delete context;
+    }
+}
+
+std::vector<KernelProfile> Profiler::GetProfiles() const
+{
+    std::vector<KernelProfile> profiles;
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        for (const auto &[name, aggregate] : state_->aggregates) {
+            std::vector<uint64_t> samples = aggregate.samples;
+            std::sort(samples.begin(), samples.end());
+            KernelProfile profile;
+            profile.name = name;
+            profile.count = aggregate.count;
+            profile.total_ns = aggregate.total_ns;
+            profile.p50_ns = GetPercentile(samples, 50);
+            profile.p95_ns = GetPercentile(samples, 95);
+            profile.p99_ns = GetPercentile(samples, 99);
+            profile.average_queue_delay_ns = aggregate.count > 0 ? aggregate.total_queue_delay_ns / aggregate.count : 0;
+            profiles.emplace_back(std::move(profile));
+        }
+    }
+    std::sort(profiles.begin(), profiles.end(), [](const KernelProfile &a, const KernelProfile &b) {
+        return a.total_ns > b.total_ns;
+    });
+    return profiles;
+}
+
+bool Profiler::DumpChromeTrace(const std::string &path) const
+{
+    std::vector<Record> records;
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        records = state_->records;
+    }
+    std::sort(records.begin(), records.end(), [](const Record &a, const Record &b) { return a.start < b.start; });
+    cl_ulong base = records.empty() ? 0 : records.front().queued;
+    for (const auto &record : records) {
+        base = std::min(base, record.queued);
+    }
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) {
+        std::cout << "Failed to open trace file: " << path << std::endl;
+        return false;
+    }
+    // Chrome trace timestamps are in microseconds.
+    file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (size_t i = 0; i < records.size(); ++i) {
+        const Record &record = records[i];
+        file << (i == 0 ? "" : ",") << "\n{\"name\":\"" << EscapeJson(record.name)
+             << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << record.queue
+             << ",\"ts\":" << (record.start - base) / 1000.0 << ",\"dur\":" << (record.end - record.start) / 1000.0
+             << ",\"args\":{\"queued_us\":" << (record.queued - base) / 1000.0
+             << ",\"submit_us\":" << (record.submit - base) / 1000.0 << "}}";
+    }
+    file << "\n]}\n";
+    if (!file.good()) {
+        std::cout << "Failed to write trace file: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Profiler::Reset()
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->aggregates.clear();
+    state_->records.clear();
+    state_->num_records = 0;
+}
+
+void CL_CALLBACK Profiler::OnComplete(cl_event event, cl_int status, void *user_data)
+{
+    std::unique_ptr<CompletionContext> context(static_cast<CompletionContext *>(user_data));
+    if (status != CL_COMPLETE) {
+        return;
+    }
+    Record record;
+    const cl_profiling_info params[] = {
+        CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END};
+    cl_ulong *values[] = {&record.queued, &record.submit, &record.start, &record.end};
+    for (size_t i = 0; i < 4; ++i) {
+        cl_int ret = clGetEventProfilingInfo(event, params[i], sizeof(cl_ulong), values[i], nullptr);
+        if (ret != CL_SUCCESS) {
+            return;
+        }
+    }
+    if (record.end < record.start || record.start < record.queued) {
+        return;
+    }
+
+    State &state = *context->state;
+    std::lock_guard<std::mutex> lock(state.mutex);
+    auto queue_id = state.queue_ids.emplace(context->queue, state.queue_ids.size()).first;
+    record.queue = queue_id->second;
+    Aggregate &aggregate = state.aggregates[context->name];
+    const uint64_t duration = record.end - record.start;
+    if (aggregate.samples.size() < kMaxSamples) {
+        aggregate.samples.emplace_back(duration);
+    } else {
+        aggregate.samples[aggregate.count % kMaxSamples] = duration;
+    }
+    aggregate.count++;
+    aggregate.total_ns += duration;
+    aggregate.total_queue_delay_ns += record.start - record.queued;
+    record.name = std::move(context->name);
+    if (state.records.size() < kMaxRecords) {
+        state.records.emplace_back(std::move(record));
+    } else {
+        state.records[state.num_records % kMaxRecords] = std::move(record);
+    }
+    state.num_records++;
+}
+
+}  // namespace TinyOCL
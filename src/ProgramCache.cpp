@@ -0,0 +1,212 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include "utils.h"
+#include "ProgramCache.h"
+
+#ifndef TINYOCL_VERSION_STRING
+#define TINYOCL_VERSION_STRING "unknown"
+#endif
+
+namespace TinyOCL {
+namespace {
+constexpr char kMagic[8] = {'T', 'O', 'C', 'L', 'B', 'I', 'N', '1'};
+}  // namespace
+
+ProgramCache::ProgramCache(const std::vector<cl_device_id> &devices) : devices_(devices)
+{
+    device_signature_ = TINYOCL_VERSION_STRING;
+    for (cl_device_id device : devices_) {
+        device_signature_ += '\0' + GetDeviceString(device, CL_DEVICE_NAME);
+        device_signature_ += '\0' + GetDeviceString(device, CL_DEVICE_VENDOR);
+        device_signature_ += '\0' + GetDeviceString(device, CL_DRIVER_VERSION);
+        device_signature_ += '\0' + GetDeviceString(device, CL_DEVICE_VERSION);
+    }
+    const char *directory = std::getenv("TINYOCL_PROGRAM_CACHE_DIR");
+    if (directory != nullptr) {
+        SetDirectory(directory);
+    }
+}
+
+void ProgramCache::SetDirectory(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    directory_ = directory;
+    if (directory_.empty()) {
+        return;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    if (error) {
+        std::cout << "Failed to create program cache directory: " << directory_ << std::endl;
+        directory_.clear();
+    }
+}
+
+bool ProgramCache::IsEnabled()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !directory_.empty();
+}
+
+std::string ProgramCache::GetKey(const std::string &source, const std::string &build_options) const
+{
+    // Two differently seeded hashes make accidental collisions irrelevant in practice.
+    std::string data = source + '\0' + build_options + '\0' + device_signature_;
+    char key[33];
+    std::snprintf(key,
+        sizeof(key),
+        "%016llx%016llx",
+        static_cast<unsigned long long>(Fnv1a(data)),
+        static_cast<unsigned long long>(Fnv1a(data, Fnv1a(device_signature_))));
+    return key;
+}
+
+bool ProgramCache::Load(const std::string &key, std::vector<std::vector<uint8_t>> &binaries)
+{
+    std::string path = GetPath(key);
+    if (path.empty()) {
+        return false;
+    }
+    std::error_code error;
+    const uint64_t file_size = std::filesystem::file_size(path, error);
+    if (error) {
+        return false;
+    }
+    if (!ReadEntry(path, file_size, binaries)) {
+        // A malformed entry is a miss, it is replaced once the program is built from source.
+        binaries.clear();
+        Remove(key);
+        return false;
+    }
+    return true;
+}
+
+bool ProgramCache::ReadEntry(const std::string &path, uint64_t file_size, std::vector<std::vector<uint8_t>> &binaries)
+{
+    std::ifstream cache_file(path, std::ifstream::in | std::ifstream::binary);
+    if (!cache_file.is_open()) {
+        return false;
+    }
+    char magic[sizeof(kMagic)];
+    uint64_t num_binaries = 0;
+    if (!cache_file.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+        !cache_file.read(reinterpret_cast<char *>(&num_binaries), sizeof(num_binaries)) ||
+        num_binaries != devices_.size()) {
+        std::cout << "Invalid program cache entry: " << path << std::endl;
+        return false;
+    }
+    uint64_t remaining = file_size - sizeof(kMagic) - sizeof(num_binaries);
+    binaries.resize(num_binaries);
+    for (auto &binary : binaries) {
+        uint64_t binary_size = 0;
+        if (!cache_file.read(reinterpret_cast<char *>(&binary_size), sizeof(binary_size)) || binary_size == 0) {
+            std::cout << "Invalid program cache entry: " << path << std::endl;
+            return false;
+        }
+        remaining -= sizeof(binary_size);
+        // The size is checked against the file before anything is allocated for it.
+        if (binary_size > remaining) {
+            std::cout << "Truncated program cache entry: " << path << std::endl;
+            return false;
+        }
+        binary.resize(binary_size);
+        if (!cache_file.read(reinterpret_cast<char *>(binary.data()), binary_size)) {
+            std::cout << "Truncated program cache entry: " << path << std::endl;
+            return false;
+        }
+        remaining -= binary_size;
+    }
+    return true;
+}
+
+bool ProgramCache::Store(const std::string &key, cl_program program)
+{
+    std::string path = GetPath(key);
+    if (path.empty()) {
+        return false;
+    }
+    cl_uint num_devices;
+    cl_int ret = clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(num_devices), &num_devices, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get program number of devices");
+    if (num_devices != devices_.size()) {
+        return false;
+    }
+    std::vector<size_t> binary_sizes(num_devices);
+    ret = clGetProgramInfo(
+        program, CL_PROGRAM_BINARY_SIZES, binary_sizes.size() * sizeof(size_t), binary_sizes.data(), nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get program binary sizes");
+    std::vector<std::vector<uint8_t>> binaries(num_devices);
+    std::vector<uint8_t *> binary_ptrs(num_devices);
+    for (cl_uint i = 0; i < num_devices; i++) {
+        if (binary_sizes[i] == 0) {
+            std::cout << "Program binary is not available" << std::endl;
+            return false;
+        }
+        binaries[i].resize(binary_sizes[i]);
+        binary_ptrs[i] = binaries[i].data();
+    }
+    ret = clGetProgramInfo(
+        program, CL_PROGRAM_BINARIES, binary_ptrs.size() * sizeof(uint8_t *), binary_ptrs.data(), nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get program binaries");
+
+    static std::atomic<uint32_t> counter{0};
+    std::string temp_path = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+        "_" + std::to_string(counter++);
+    {
+        std::ofstream cache_file(temp_path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+        if (!cache_file.is_open()) {
+            std::cout << "Failed to open program cache entry: " << temp_path << std::endl;
+            return false;
+        }
+        uint64_t num_binaries = num_devices;
+        cache_file.write(kMagic, sizeof(kMagic));
+        cache_file.write(reinterpret_cast<const char *>(&num_binaries), sizeof(num_binaries));
+        for (const auto &binary : binaries) {
+            uint64_t binary_size = binary.size();
+            cache_file.write(reinterpret_cast<const char *>(&binary_size), sizeof(binary_size));
+            cache_file.write(reinterpret_cast<const char *>(binary.data()), binary.size());
+        }
+        if (!cache_file.flush()) {
+            std::cout << "Failed to write program cache entry: " << temp_path << std::endl;
+            cache_file.close();
+            std::remove(temp_path.c_str());
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::cout << "Failed to commit program cache entry: " << path << std::endl;
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void ProgramCache::Remove(const std::string &key)
+{
+    std::string path = GetPath(key);
+    if (path.empty()) {
+        return;
+    }
+    std::error_code error;
+    std::filesystem::remove(path, error);
+}
+
+std::string ProgramCache::GetPath(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (directory_.empty()) {
+        return "";
+    }
+    return (std::filesystem::path(directory_) / (key + ".bin")).string();
+}
+
+}  // namespace TinyOCL
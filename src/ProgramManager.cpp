@@ -5,41 +5,240 @@
  * @Last Modified time: 2024-06-24 23:57:37
  */
 
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <regex>
+#include <utility>
 #include "utils.h"
+#include "EmbeddedPrograms.h"
 #include "ProgramManager.h"
 
 namespace TinyOCL {
 
-ProgramManager::ProgramManager(cl_device_id device, cl_context context) : device_(device), context_(context) {}
+ProgramManager::ProgramManager(const std::vector<cl_device_id> &devices, cl_context context)
+    : devices_(devices), context_(context), program_cache_(devices)
+{}
 
-bool ProgramManager::BuildProgram(const std::string &program_name, const std::set<std::string> &build_options)
+void ProgramManager::SetCacheDirectory(const std::string &directory) { program_cache_.SetDirectory(directory); }
+
+void ProgramManager::SetObserver(BuildObserver observer) { observer_ = std::move(observer); }
+
+bool ProgramManager::AddSource(const std::string &program_name, const std::string &source)
 {
+    // Built variants are keyed by name, so a name must keep its source once it may have been built.
+    const EmbeddedProgram *embedded_program = FindEmbeddedProgram(program_name);
+    if (embedded_program != nullptr) {
+        if (embedded_program->binary ||
+            source != std::string(reinterpret_cast<const char *>(embedded_program->data), embedded_program->size)) {
+            std::cout << "Program " << program_name << " is embedded with a different source" << std::endl;
+            return false;
+        }
+        return true;
+    }
     std::lock_guard<std::mutex> lock(mutex_);
-    auto program_iter = programs_with_kernels_.find(program_name);
-    if (program_iter != programs_with_kernels_.end()) {
+    auto source_iter = sources_.find(program_name);
+    if (source_iter != sources_.end()) {
+        if (source_iter->second != source) {
+            std::cout << "Program " << program_name << " is registered with a different source" << std::endl;
+            return false;
+        }
         return true;
     }
+    sources_.emplace(program_name, source);
+    return true;
+}
+
+std::string ProgramManager::NormalizeBuildOptions(const std::set<std::string> &build_options)
+{
+    // Entries are kept whole, an option and its argument such as "-D NAME=1" or "-I dir" must stay together.
+    std::set<std::string> options;
+    for (const std::string &build_option : build_options) {
+        const size_t begin = build_option.find_first_not_of(" \t\n\r\f\v");
+        if (begin == std::string::npos) {
+            continue;
+        }
+        const size_t end = build_option.find_last_not_of(" \t\n\r\f\v");
+        options.emplace(build_option.substr(begin, end - begin + 1));
+    }
     std::string build_options_str = "";
-    for (const std::string &option : build_options) {
+    for (const std::string &option : options) {
         build_options_str += build_options_str.empty() ? option : " " + option;
     }
+    return build_options_str;
+}
+
+std::string ProgramManager::GetVariantKey(const std::string &program_name, const std::string &build_options)
+{
+    return build_options.empty() ? program_name : program_name + '\0' + build_options;
+}
+
+bool ProgramManager::BuildProgram(const std::string &program_name, const std::set<std::string> &build_options)
+{
+    const std::string build_options_str = NormalizeBuildOptions(build_options);
+    const std::string variant_key = GetVariantKey(program_name, build_options_str);
+    bool created = false;
+    std::shared_ptr<ProgramWithKernels> program_with_kernels = AcquireProgram(variant_key, created);
+    if (created) {
+        CompileProgram(program_with_kernels, variant_key, program_name, build_options_str);
+    }
+    return program_with_kernels->ready.get();
+}
+
+std::shared_future<bool> ProgramManager::BuildProgramAsync(
+    const std::string &program_name, const std::set<std::string> &build_options)
+{
+    const std::string build_options_str = NormalizeBuildOptions(build_options);
+    const std::string variant_key = GetVariantKey(program_name, build_options_str);
+    bool created = false;
+    std::shared_ptr<ProgramWithKernels> program_with_kernels = AcquireProgram(variant_key, created);
+    if (!created) {
+        return program_with_kernels->ready;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!thread_pool_) {
+            thread_pool_.reset(new (std::nothrow) ThreadPool(std::thread::hardware_concurrency()));
+        }
+        if (thread_pool_) {
+            thread_pool_->Submit([this, program_with_kernels, variant_key, program_name, build_options_str]() {
+                CompileProgram(program_with_kernels, variant_key, program_name, build_options_str);
+            });
+            return program_with_kernels->ready;
+        }
+    }
+    std::cout << "Failed to create ThreadPool, build program synchronously" << std::endl;
+    CompileProgram(program_with_kernels, variant_key, program_name, build_options_str);
+    return program_with_kernels->ready;
+}
+
+std::shared_ptr<ProgramWithKernels> ProgramManager::AcquireProgram(const std::string &variant_key, bool &created)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto program_iter = programs_with_kernels_.find(variant_key);
+    if (program_iter != programs_with_kernels_.end()) {
+        created = false;
+        return program_iter->second;
+    }
+    auto program_with_kernels = std::make_shared<ProgramWithKernels>();
+    program_with_kernels->ready = program_with_kernels->built.get_future().share();
+    programs_with_kernels_.emplace(variant_key, program_with_kernels);
+    created = true;
+    return program_with_kernels;
+}
+
+void ProgramManager::CompileProgram(const std::shared_ptr<ProgramWithKernels> &program_with_kernels,
+    const std::string &variant_key,
+    const std::string &program_name,
+    const std::string &build_options)
+{
+    const auto start = std::chrono::steady_clock::now();
+    ProgramPtr program(nullptr, clReleaseProgram);
+    uint64_t content_hash = 0;
+    // This runs on the worker threads, an exception must not leave the variant unfulfilled and its waiters blocked.
+    try {
+        program = BuildProgramByName(program_name, build_options, content_hash);
+        if (observer_) {
+            observer_("build " + program_name + (build_options.empty() ? "" : " " + build_options), start, !!program);
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Failed to build program " << program_name << ": " << e.what() << std::endl;
+        program.reset();
+    } catch (...) {
+        std::cout << "Failed to build program " << program_name << std::endl;
+        program.reset();
+    }
+    if (!program) {
+        // Forget the failed variant so that a later request builds it again.
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto program_iter = programs_with_kernels_.find(variant_key);
+            if (program_iter != programs_with_kernels_.end() && program_iter->second == program_with_kernels) {
+                programs_with_kernels_.erase(program_iter);
+            }
+        }
+        program_with_kernels->built.set_value(false);
+        return;
+    }
+    program_with_kernels->program.reset(program.release());
+    program_with_kernels->content_hash = content_hash;
+    program_with_kernels->built.set_value(true);
+}
+
+ProgramManager::ProgramPtr ProgramManager::BuildProgramByName(
+    const std::string &program_name, const std::string &build_options, uint64_t &content_hash)
+{
     std::regex source_regex(R"(.*\.cl)");
     std::regex binary_regex(R"(.*\.bin)");
-    if (std::regex_match(program_name, source_regex)) {
-        return BuildProgramWithSource(program_name, build_options_str);
-    } else if (std::regex_match(program_name, binary_regex)) {
-        return BuildProgramWithBinary(program_name, build_options_str);
-    } else {
-        std::cout << "Invalid program name: " << program_name << std::endl;
-        return false;
+    // Registered and embedded programs are resolved by name first, other names are files told apart by extension.
+    const EmbeddedProgram *embedded_program = FindEmbeddedProgram(program_name);
+    bool registered = embedded_program != nullptr && !embedded_program->binary;
+    if (!registered) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        registered = sources_.find(program_name) != sources_.end();
+    }
+    if (registered || (embedded_program == nullptr && std::regex_match(program_name, source_regex))) {
+        return BuildProgramWithSource(program_name, build_options, content_hash);
+    }
+    if (embedded_program != nullptr || std::regex_match(program_name, binary_regex)) {
+        return BuildProgramWithBinary(program_name, build_options, content_hash);
+    }
+    std::cout << "Invalid program name: " << program_name << std::endl;
+    return ProgramPtr(nullptr, clReleaseProgram);
+}
+
+ProgramManager::ProgramPtr ProgramManager::BuildProgramWithSource(
+    const std::string &program_name, const std::string &build_options, uint64_t &content_hash)
+{
+    std::string program_source;
+    if (!ReadSource(program_name, program_source)) {
+        return ProgramPtr(nullptr, clReleaseProgram);
+    }
+    content_hash = Fnv1a(program_source);
+
+    std::string cache_key;
+    if (program_cache_.IsEnabled()) {
+        cache_key = program_cache_.GetKey(program_source, build_options);
+        ProgramPtr program = BuildProgramWithCache(program_name, cache_key, build_options);
+        if (program) {
+            return program;
+        }
+    }
+
+    cl_int ret;
+    constexpr int num_programs = 1;
+    const char *program_sources[num_programs] = {program_source.data()};
+    const size_t program_sizes[num_programs] = {program_source.size()};
+    ProgramPtr program(
+        clCreateProgramWithSource(context_, 1, program_sources, program_sizes, &ret), clReleaseProgram);
+    CHECK_OPENCL_ERROR(ret, "Failed to create program with source", ProgramPtr(nullptr, clReleaseProgram));
+    ret = clBuildProgram(program.get(), devices_.size(), devices_.data(), build_options.c_str(), nullptr, nullptr);
+    if (ret != CL_SUCCESS) {
+        std::cout << "Failed to build program: " << program_name << std::endl;
+        PrintBuildLog(program.get());
+        return ProgramPtr(nullptr, clReleaseProgram);
     }
+    if (!cache_key.empty() && !program_cache_.Store(cache_key, program.get())) {
+        std::cout << "Failed to store program cache entry: " << program_name << std::endl;
+    }
+    return program;
 }
 
-bool ProgramManager::BuildProgramWithSource(const std::string &program_name, const std::string &build_options)
+bool ProgramManager::ReadSource(const std::string &program_name, std::string &source)
 {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto source_iter = sources_.find(program_name);
+        if (source_iter != sources_.end()) {
+            source = source_iter->second;
+            return true;
+        }
+    }
+    const EmbeddedProgram *embedded_program = FindEmbeddedProgram(program_name);
+    if (embedded_program != nullptr) {
+        source.assign(reinterpret_cast<const char *>(embedded_program->data), embedded_program->size);
+        return true;
+    }
     std::ifstream program_file(program_name, std::ifstream::in | std::ifstream::binary);
     if (!program_file.is_open()) {
         std::cout << "Failed to open program file: " << program_name << std::endl;
@@ -52,35 +251,21 @@ bool ProgramManager::BuildProgramWithSource(const std::string &program_name, con
         std::cout << "Empty program file: " << program_name << std::endl;
         return false;
     }
-    std::vector<char> program_source(program_size + 1);
-    program_source[program_size] = '\0';
-    if (!program_file.read(program_source.data(), program_size)) {
+    source.resize(program_size);
+    if (!program_file.read(&source[0], program_size)) {
         std::cout << "Failed to read program file: " << program_name << std::endl;
         return false;
     }
-    program_file.close();
-
-    cl_int ret;
-    constexpr int num_programs = 1;
-    const char *program_sources[num_programs] = {program_source.data()};
-    const size_t program_sizes[num_programs] = {program_size};
-    std::unique_ptr<_cl_program, decltype(&clReleaseProgram)> program(
-        clCreateProgramWithSource(context_, 1, program_sources, program_sizes, &ret), clReleaseProgram);
-    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to create program with source");
-    ret = clBuildProgram(program.get(), 1, &device_, build_options.c_str(), nullptr, nullptr);
-    if (ret != CL_SUCCESS) {
-        std::cout << "Failed to build program: " << program_name << std::endl;
-        PrintBuildLog(program.get());
-        return false;
-    }
-    ProgramWithKernels program_with_kernels;
-    program_with_kernels.program.reset(program.release());
-    programs_with_kernels_.emplace(program_name, std::move(program_with_kernels));
     return true;
 }
 
-bool ProgramManager::BuildProgramWithBinary(const std::string &program_name, const std::string &build_options)
+bool ProgramManager::ReadBinary(const std::string &program_name, std::vector<uint8_t> &binary)
 {
+    const EmbeddedProgram *embedded_program = FindEmbeddedProgram(program_name);
+    if (embedded_program != nullptr) {
+        binary.assign(embedded_program->data, embedded_program->data + embedded_program->size);
+        return true;
+    }
     std::ifstream program_file(program_name, std::ifstream::in | std::ifstream::binary);
     if (!program_file.is_open()) {
         std::cout << "Failed to open program file: " << program_name << std::endl;
@@ -93,68 +278,150 @@ bool ProgramManager::BuildProgramWithBinary(const std::string &program_name, con
         std::cout << "Empty program file: " << program_name << std::endl;
         return false;
     }
-    std::vector<uint8_t> program_binary(program_size);
-    if (!program_file.read(reinterpret_cast<char *>(program_binary.data()), program_size)) {
+    binary.resize(program_size);
+    if (!program_file.read(reinterpret_cast<char *>(binary.data()), program_size)) {
         std::cout << "Failed to read program file: " << program_name << std::endl;
         return false;
     }
-    program_file.close();
+    return true;
+}
+
+ProgramManager::ProgramPtr ProgramManager::BuildProgramWithBinary(
+    const std::string &program_name, const std::string &build_options, uint64_t &content_hash)
+{
+    std::vector<uint8_t> program_binary;
+    if (!ReadBinary(program_name, program_binary)) {
+        return ProgramPtr(nullptr, clReleaseProgram);
+    }
+    content_hash = Fnv1a(program_binary.data(), program_binary.size());
+    const size_t program_size = program_binary.size();
 
     cl_int ret;
-    constexpr int num_programs = 1;
-    const uint8_t *program_binaries[num_programs] = {program_binary.data()};
-    const size_t program_sizes[num_programs] = {program_size};
-    std::unique_ptr<_cl_program, decltype(&clReleaseProgram)> program(
-        clCreateProgramWithBinary(context_, 1, &device_, program_sizes, program_binaries, nullptr, &ret),
+    // The same binary is loaded for every device, the devices of one context are expected to be identical.
+    std::vector<const uint8_t *> program_binaries(devices_.size(), program_binary.data());
+    const std::vector<size_t> program_sizes(devices_.size(), program_size);
+    ProgramPtr program(
+        clCreateProgramWithBinary(context_,
+            devices_.size(),
+            devices_.data(),
+            program_sizes.data(),
+            program_binaries.data(),
+            nullptr,
+            &ret),
         clReleaseProgram);
-    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to create program with binary");
-    ret = clBuildProgram(program.get(), 1, &device_, build_options.c_str(), nullptr, nullptr);
+    CHECK_OPENCL_ERROR(ret, "Failed to create program with binary", ProgramPtr(nullptr, clReleaseProgram));
+    ret = clBuildProgram(program.get(), devices_.size(), devices_.data(), build_options.c_str(), nullptr, nullptr);
     if (ret != CL_SUCCESS) {
         std::cout << "Failed to build program: " << program_name << std::endl;
         PrintBuildLog(program.get());
-        return false;
+        return ProgramPtr(nullptr, clReleaseProgram);
     }
-    ProgramWithKernels program_with_kernels;
-    program_with_kernels.program.reset(program.release());
-    programs_with_kernels_.emplace(program_name, std::move(program_with_kernels));
-    return true;
+    return program;
+}
+
+ProgramManager::ProgramPtr ProgramManager::BuildProgramWithCache(
+    const std::string &program_name, const std::string &cache_key, const std::string &build_options)
+{
+    std::vector<std::vector<uint8_t>> binaries;
+    if (!program_cache_.Load(cache_key, binaries)) {
+        return ProgramPtr(nullptr, clReleaseProgram);
+    }
+    std::vector<const uint8_t *> program_binaries;
+    std::vector<size_t> program_sizes;
+    for (const auto &binary : binaries) {
+        program_binaries.emplace_back(binary.data());
+        program_sizes.emplace_back(binary.size());
+    }
+    cl_int ret;
+    std::vector<cl_int> binary_status(devices_.size(), CL_SUCCESS);
+    ProgramPtr program(
+        clCreateProgramWithBinary(context_,
+            devices_.size(),
+            devices_.data(),
+            program_sizes.data(),
+            program_binaries.data(),
+            binary_status.data(),
+            &ret),
+        clReleaseProgram);
+    if (ret == CL_SUCCESS) {
+        ret = clBuildProgram(program.get(), devices_.size(), devices_.data(), build_options.c_str(), nullptr, nullptr);
+    }
+    if (ret != CL_SUCCESS) {
+        // A driver update may reject binaries of the same device name and version, rebuild them from source.
+        std::cout << "Discard program cache entry of " << program_name << " (" << ret << ")" << std::endl;
+        program_cache_.Remove(cache_key);
+        return ProgramPtr(nullptr, clReleaseProgram);
+    }
+    return program;
 }
 
 bool ProgramManager::PrintBuildLog(cl_program program)
 {
-    size_t build_log_size;
-    cl_int ret = clGetProgramBuildInfo(program, device_, CL_PROGRAM_BUILD_LOG, 0, nullptr, &build_log_size);
-    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get program build log size");
-    if (build_log_size == 0) {
-        std::cout << "Build log is empty" << std::endl;
-        return false;
+    for (cl_device_id device : devices_) {
+        size_t build_log_size;
+        cl_int ret = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &build_log_size);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get program build log size");
+        if (build_log_size == 0) {
+            std::cout << "Build log is empty" << std::endl;
+            continue;
+        }
+        std::vector<char> build_log(build_log_size + 1);
+        build_log[build_log_size] = '\0';
+        ret = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, build_log_size, build_log.data(), nullptr);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get program build log");
+        std::cout << "Build log: " << build_log.data() << std::endl;
     }
-    std::vector<char> build_log(build_log_size + 1);
-    build_log[build_log_size] = '\0';
-    ret = clGetProgramBuildInfo(program, device_, CL_PROGRAM_BUILD_LOG, build_log_size, build_log.data(), nullptr);
-    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get program build log");
-    std::cout << "Build log: " << build_log.data() << std::endl;
     return true;
 }
 
-cl_kernel ProgramManager::GetKernel(const std::string &program_name, const std::string &kernel_name)
+cl_kernel ProgramManager::GetKernel(
+    const std::string &program_name, const std::set<std::string> &build_options, const std::string &kernel_name)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto program_iter = programs_with_kernels_.find(program_name);
-    if (program_iter == programs_with_kernels_.end()) {
-        std::cout << "Program not found: " << program_name << std::endl;
+    std::shared_ptr<ProgramWithKernels> program_with_kernels;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto program_iter =
+            programs_with_kernels_.find(GetVariantKey(program_name, NormalizeBuildOptions(build_options)));
+        if (program_iter == programs_with_kernels_.end()) {
+            std::cout << "Program not found: " << program_name << std::endl;
+            return nullptr;
+        }
+        program_with_kernels = program_iter->second;
+    }
+    // Only waits when the variant is still being compiled.
+    if (!program_with_kernels->ready.get()) {
+        std::cout << "Program not built: " << program_name << std::endl;
         return nullptr;
     }
-    auto kernel_iter = program_iter->second.kernels.find(kernel_name);
-    if (kernel_iter != program_iter->second.kernels.end()) {
+    std::lock_guard<std::mutex> lock(program_with_kernels->mutex);
+    auto kernel_iter = program_with_kernels->kernels.find(kernel_name);
+    if (kernel_iter != program_with_kernels->kernels.end()) {
         return kernel_iter->second.get();
     }
+    const auto start = std::chrono::steady_clock::now();
     cl_int ret;
-    program_iter->second.kernels.emplace(kernel_name,
-        std::unique_ptr<_cl_kernel, decltype(&clReleaseKernel)>(
-            clCreateKernel(program_iter->second.program.get(), kernel_name.c_str(), &ret), clReleaseKernel));
+    std::unique_ptr<_cl_kernel, decltype(&clReleaseKernel)> kernel(
+        clCreateKernel(program_with_kernels->program.get(), kernel_name.c_str(), &ret), clReleaseKernel);
+    if (observer_) {
+        observer_("kernel " + program_name + ":" + kernel_name, start, ret == CL_SUCCESS);
+    }
     CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to create kernel");
-    return program_iter->second.kernels.at(kernel_name).get();
+    return program_with_kernels->kernels.emplace(kernel_name, std::move(kernel)).first->second.get();
+}
+
+uint64_t ProgramManager::GetContentHash(const std::string &program_name, const std::set<std::string> &build_options)
+{
+    std::shared_ptr<ProgramWithKernels> program_with_kernels;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto program_iter =
+            programs_with_kernels_.find(GetVariantKey(program_name, NormalizeBuildOptions(build_options)));
+        if (program_iter == programs_with_kernels_.end()) {
+            return 0;
+        }
+        program_with_kernels = program_iter->second;
+    }
+    return program_with_kernels->ready.get() ? program_with_kernels->content_hash : 0;
 }
 
 }  // namespace TinyOCL
\ No newline at end of file
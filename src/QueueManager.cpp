@@ -0,0 +1,141 @@
+#include <iostream>
+#include "utils.h"
+#include "QueueManager.h"
+
+namespace TinyOCL {
+
+QueueManager::QueueManager(cl_context context, cl_device_id device) : context_(context), device_(device) {}
+
+bool QueueManager::Configure(const QueuePoolConfig &config)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!default_queue_) {
+        default_queue_ = CreateQueue(false);
+        if (!default_queue_) {
+            return false;
+        }
+    }
+    // Queues handed out before stay alive through their own reference.
+    compute_queues_.clear();
+    copy_queues_.clear();
+    for (uint32_t i = 1; i < config.compute_queues; i++) {
+        QueuePtr queue = CreateQueue(config.out_of_order);
+        if (!queue) {
+            return false;
+        }
+        compute_queues_.emplace_back(std::move(queue));
+    }
+    for (uint32_t i = 0; i < config.copy_queues; i++) {
+        QueuePtr queue = CreateQueue(config.out_of_order);
+        if (!queue) {
+            return false;
+        }
+        copy_queues_.emplace_back(std::move(queue));
+    }
+    return true;
+}
+
+cl_command_queue QueueManager::GetDefaultQueue() const { return default_queue_.get(); }
+
+cl_command_queue QueueManager::GetQueue(QueueType type, uint32_t index)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    cl_command_queue queue = default_queue_.get();
+    if (type == QueueType::Copy && !copy_queues_.empty()) {
+        queue = copy_queues_[index % copy_queues_.size()].get();
+    } else {
+        index %= compute_queues_.size() + 1;
+        if (index > 0) {
+            queue = compute_queues_[index - 1].get();
+        }
+    }
+    if (queue != nullptr) {
+        clRetainCommandQueue(queue);
+    }
+    return queue;
+}
+
+uint32_t QueueManager::GetQueueCount(QueueType type)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (type == QueueType::Copy) {
+        return copy_queues_.size();
+    }
+    return compute_queues_.size() + 1;
+}
+
+bool QueueManager::Finish()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool result = true;
+    auto finish = [&result](cl_command_queue queue) {
+        cl_int ret = clFinish(queue);
+        CHECK_OPENCL_ERROR_NO_RETURN(ret, "Failed to finish command queue");
+        result = result && ret == CL_SUCCESS;
+    };
+    if (default_queue_) {
+        finish(default_queue_.get());
+    }
+    for (const auto &queue : compute_queues_) {
+        finish(queue.get());
+    }
+    for (const auto &queue : copy_queues_) {
+        finish(queue.get());
+    }
+    return result;
+}
+
+bool QueueManager::EnqueueMarkers(std::vector<cl_event> &markers)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool result = true;
+    auto enqueue_marker = [&result, &markers](cl_command_queue queue) {
+        cl_event marker = nullptr;
+        cl_int ret = clEnqueueMarkerWithWaitList(queue, 0, nullptr, &marker);
+        CHECK_OPENCL_ERROR_NO_RETURN(ret, "Failed to enqueue marker");
+        if (ret != CL_SUCCESS) {
+            result = false;
+            return;
+        }
+        markers.emplace_back(marker);
+        // Nothing forces the queue to submit the marker otherwise, it would never complete.
+        clFlush(queue);
+    };
+    if (default_queue_) {
+        enqueue_marker(default_queue_.get());
+    }
+    for (const auto &queue : compute_queues_) {
+        enqueue_marker(queue.get());
+    }
+    for (const auto &queue : copy_queues_) {
+        enqueue_marker(queue.get());
+    }
+    return result;
+}
+
+QueueManager::QueuePtr QueueManager::CreateQueue(bool out_of_order)
+{
+    cl_int ret;
+    // Timestamps are always recorded, whatever the profiling option: Kernel::Tune and the streaming statistics read
+    // them as well, and profiling can be turned on at runtime without recreating the queues.
+    cl_command_queue_properties queue_properties = CL_QUEUE_PROFILING_ENABLE;
+    if (out_of_order) {
+        cl_command_queue_properties supported_properties = 0;
+        ret = clGetDeviceInfo(device_,
+            CL_DEVICE_QUEUE_ON_HOST_PROPERTIES,
+            sizeof(supported_properties),
+            &supported_properties,
+            nullptr);
+        if (ret == CL_SUCCESS && (supported_properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0) {
+            queue_properties |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+        } else {
+            std::cout << "Out-of-order queue is not supported, use in-order queue" << std::endl;
+        }
+    }
+    cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, queue_properties, 0};
+    QueuePtr queue(clCreateCommandQueueWithProperties(context_, device_, properties, &ret), clReleaseCommandQueue);
+    CHECK_OPENCL_ERROR(ret, "Failed to create command queue", QueuePtr(nullptr, clReleaseCommandQueue));
+    return queue;
+}
+
+}  // namespace TinyOCL
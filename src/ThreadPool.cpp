@@ -0,0 +1,51 @@
+#include "ThreadPool.h"
+
+namespace TinyOCL {
+
+ThreadPool::ThreadPool(uint32_t num_threads)
+{
+    num_threads = num_threads == 0 ? 1 : num_threads;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        threads_.emplace_back(&ThreadPool::Work, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.emplace(std::move(task));
+    }
+    condition_.notify_one();
+}
+
+void ThreadPool::Work()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+        task();
+    }
+}
+
+}  // namespace TinyOCL
@@ -5,314 +5,4311 @@
  * @Last Modified time: 2024-06-17 22:52:37
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 #include <CL/cl.h>
 #include "utils.h"
+#include "AlgorithmKernels.h"
 #include "BufferManager.h"
+#include "CommandBuffer.h"
+#include "DeviceScheduler.h"
+#include "DeviceSelector.h"
+#include "FileMapping.h"
+#include "LocalSizeTuner.h"
+#include "Profiler.h"
 #include "ProgramManager.h"
+#include "QueueManager.h"
+#include "ThreadPool.h"
 #include "TinyOCL.h"
+#include "WorkStealingPool.h"
 
 namespace TinyOCL {
-class Kernel::KernelImpl final {
-public:
-    explicit KernelImpl(cl_command_queue queue, cl_kernel kernel);
-    ~KernelImpl() = default;
-    KernelImpl() = delete;
-    KernelImpl(const KernelImpl &) = delete;
-    KernelImpl &operator=(const KernelImpl &) = delete;
-    KernelImpl(KernelImpl &&) = delete;
-    KernelImpl &operator=(KernelImpl &&) = delete;
+namespace {
+std::vector<cl_event> GetClEvents(const std::vector<Event> &events)
+{
+    std::vector<cl_event> cl_events;
+    cl_events.reserve(events.size());
+    for (const auto &event : events) {
+        if (event.IsValid()) {
+            cl_events.emplace_back(event.GetClEvent());
+        }
+    }
+    return cl_events;
+}
 
-    bool SetArg(cl_uint index, size_t size, const void *value) const;
-    bool Run(const std::vector<size_t> &global_size, const std::vector<size_t> &local_size, bool async) const;
+size_t DivideUp(size_t value, size_t divisor) { return (value + divisor - 1) / divisor; }
 
-private:
-    cl_command_queue queue_;
-    cl_kernel kernel_;
+// The algorithm kernels index elements with 32-bit integers.
+constexpr size_t kMaxAlgorithmElements = size_t(1) << 31;
+// The reductions and histograms launch this many work groups per compute unit and loop over the rest.
+constexpr uint32_t kGroupsPerComputeUnit = 4;
+// The largest work group size the algorithm kernels are built for.
+constexpr uint32_t kMaxAlgorithmWorkGroupSize = 256;
+
+// In-memory sources passed to CreateKernelFromSource are registered under a name derived from their content.
+std::string GetSourceProgramName(const std::string &source)
+{
+    std::ostringstream name_stream;
+    name_stream << "<source:" << std::hex << std::hash<std::string>{}(source) << ">";
+    return name_stream.str();
+}
+
+// The options of the instance returned by Executor::GetInstance, they are read once when it initializes.
+struct DefaultOptionsState {
+    std::mutex mutex;
+    ExecutorOptions options;
+    bool used = false;
 };
 
-Kernel::KernelImpl::KernelImpl(cl_command_queue queue, cl_kernel kernel) : queue_(queue), kernel_(kernel) {}
+DefaultOptionsState &GetDefaultOptionsState()
+{
+    static DefaultOptionsState state;
+    return state;
+}
+
+// The threads started by Executor::Warmup, they are joined at exit so that none of them outlives the instance.
+struct WarmupThreads {
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+
+    void Join()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &thread : threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+        threads.clear();
+    }
+
+    ~WarmupThreads() { Join(); }
+};
 
-bool Kernel::KernelImpl::SetArg(cl_uint index, size_t size, const void *value) const
+WarmupThreads &GetWarmupThreads()
 {
-    cl_int ret = clSetKernelArg(kernel_, index, size, value);
-    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to set kernel argument");
-    return true;
+    static WarmupThreads warmup_threads;
+    return warmup_threads;
 }
 
-bool Kernel::KernelImpl::Run(
-    const std::vector<size_t> &global_size, const std::vector<size_t> &local_size, bool async) const
+// Constructed right after the instance, so it is destroyed before it and waits for the warmups still using it.
+struct WarmupJoiner {
+    ~WarmupJoiner() { GetWarmupThreads().Join(); }
+};
+}  // namespace
+
+Event::Event(cl_event event) : event_(event) {}
+
+Event::~Event()
 {
-    cl_int ret = clEnqueueNDRangeKernel(
-        queue_, kernel_, global_size.size(), nullptr, global_size.data(), local_size.data(), 0, nullptr, nullptr);
-    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to enqueue kernel");
-    if (!async) {
-        ret = clFinish(queue_);
-        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to finish command queue");
+    if (event_ != nullptr) {
+        clReleaseEvent(event_);
     }
-    return true;
 }
 
-Kernel::Kernel(KernelImpl *impl) { impl_.reset(impl); }
-
-bool Kernel::SetArgImpl(uint32_t index, size_t size, const void *value) const
+Event::Event(const Event &other) : event_(other.event_)
 {
-    if (impl_ == nullptr) {
-        return false;
+    if (event_ != nullptr) {
+        clRetainEvent(event_);
     }
-    return impl_->SetArg(index, size, value);
 }
 
-bool Kernel::RunImpl(const std::vector<size_t> &global_size, const std::vector<size_t> &local_size, bool async) const
+Event &Event::operator=(const Event &other)
 {
-    if (impl_ == nullptr) {
-        return false;
+    if (this != &other) {
+        Event copy(other);
+        std::swap(event_, copy.event_);
     }
-    return impl_->Run(global_size, local_size, async);
+    return *this;
 }
 
-class Buffer::BufferImpl final {
-public:
-    explicit BufferImpl(BufferManager *manager, cl_command_queue command_queue, size_t size);
-    ~BufferImpl();
-    BufferImpl() = delete;
-    BufferImpl(const BufferImpl &) = delete;
-    BufferImpl &operator=(const BufferImpl &) = delete;
-    BufferImpl(BufferImpl &&) = delete;
-    BufferImpl &operator=(BufferImpl &&) = delete;
+Event::Event(Event &&other) noexcept : event_(other.event_) { other.event_ = nullptr; }
 
-    cl_mem GetClMem() const;
-    void *GetHostPtr() const;
-    size_t GetSize() const;
-    bool Memcpy(void *host_ptr, size_t size, MemcpyKind kind) const;
+Event &Event::operator=(Event &&other) noexcept
+{
+    if (this != &other) {
+        if (event_ != nullptr) {
+            clReleaseEvent(event_);
+        }
+        event_ = other.event_;
+        other.event_ = nullptr;
+    }
+    return *this;
+}
 
-private:
-    BufferManager *manager_;
-    cl_command_queue command_queue_;
-    cl_mem buffer_;
-    size_t size_;
-    void *host_ptr_;
-};
+cl_event Event::GetClEvent() const { return event_; }
+
+bool Event::IsValid() const { return event_ != nullptr; }
 
-Buffer::BufferImpl::BufferImpl(BufferManager *manager, cl_command_queue command_queue, size_t size)
-    : manager_(manager), command_queue_(command_queue), size_(size)
+bool Event::IsComplete() const
 {
-    cl_int ret;
-    buffer_ = manager_->Create(size);
-    if (buffer_ == nullptr) {
-        std::cout << "Failed to create buffer" << std::endl;
-        return;
+    if (event_ == nullptr) {
+        return true;
     }
-    host_ptr_ = clEnqueueMapBuffer(
-        command_queue_, buffer_, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size_, 0, nullptr, nullptr, &ret);
-    CHECK_OPENCL_ERROR_NO_RETURN(ret, "Failed to map buffer");
+    cl_int status;
+    cl_int ret = clGetEventInfo(event_, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get event status");
+    return status <= CL_COMPLETE;
 }
 
-Buffer::BufferImpl::~BufferImpl()
+bool Event::Wait() const
 {
-    if (buffer_ == nullptr) {
-        return;
+    if (event_ == nullptr) {
+        return true;
     }
-    if (host_ptr_ != nullptr) {
-        cl_int ret = clEnqueueUnmapMemObject(command_queue_, buffer_, host_ptr_, 0, nullptr, nullptr);
-        CHECK_OPENCL_ERROR_NO_RETURN(ret, "Failed to unmap buffer");
+    cl_int ret = clWaitForEvents(1, &event_);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to wait for event");
+    return true;
+}
+
+bool Event::WaitAll(const std::vector<Event> &events)
+{
+    std::vector<cl_event> cl_events = GetClEvents(events);
+    if (cl_events.empty()) {
+        return true;
     }
-    manager_->Release(buffer_);
+    cl_int ret = clWaitForEvents(cl_events.size(), cl_events.data());
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to wait for events");
+    return true;
 }
 
-cl_mem Buffer::BufferImpl::GetClMem() const { return buffer_; }
+class Queue::QueueImpl final {
+public:
+    explicit QueueImpl(cl_command_queue queue, QueueType type);
+    ~QueueImpl();
+    QueueImpl() = delete;
+    QueueImpl(const QueueImpl &) = delete;
+    QueueImpl &operator=(const QueueImpl &) = delete;
+    QueueImpl(QueueImpl &&) = delete;
+    QueueImpl &operator=(QueueImpl &&) = delete;
 
-void *Buffer::BufferImpl::GetHostPtr() const { return host_ptr_; }
+    cl_command_queue GetClCommandQueue() const;
+    QueueType GetType() const;
+    bool Flush() const;
+    bool Finish() const;
 
-size_t Buffer::BufferImpl::GetSize() const { return size_; }
+private:
+    cl_command_queue queue_;
+    QueueType type_;
+};
+
+Queue::QueueImpl::QueueImpl(cl_command_queue queue, QueueType type) : queue_(queue), type_(type) {}
 
-bool Buffer::BufferImpl::Memcpy(void *host_ptr, size_t size, MemcpyKind kind) const
+Queue::QueueImpl::~QueueImpl()
 {
-    cl_int ret;
-    if (kind == MemcpyKind::HostToDevice) {
-        ret = clEnqueueWriteBuffer(command_queue_, buffer_, CL_TRUE, 0, size, host_ptr, 0, nullptr, nullptr);
-    } else if (kind == MemcpyKind::DeviceToHost) {
-        ret = clEnqueueReadBuffer(command_queue_, buffer_, CL_TRUE, 0, size, host_ptr, 0, nullptr, nullptr);
-    } else {
-        std::cout << "Invalid memcpy kind" << std::endl;
-        return false;
+    if (queue_ != nullptr) {
+        clReleaseCommandQueue(queue_);
     }
-    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to copy buffer");
+}
+
+cl_command_queue Queue::QueueImpl::GetClCommandQueue() const { return queue_; }
+
+QueueType Queue::QueueImpl::GetType() const { return type_; }
+
+bool Queue::QueueImpl::Flush() const
+{
+    cl_int ret = clFlush(queue_);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to flush command queue");
     return true;
 }
 
-Buffer::Buffer(BufferImpl *impl) { impl_.reset(impl); }
+bool Queue::QueueImpl::Finish() const
+{
+    cl_int ret = clFinish(queue_);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to finish command queue");
+    return true;
+}
 
-cl_mem Buffer::GetClMem() const
+Queue::Queue(QueueImpl *impl) { impl_.reset(impl); }
+
+Queue::~Queue() = default;
+
+cl_command_queue Queue::GetClCommandQueue() const
 {
     if (impl_ == nullptr) {
         return nullptr;
     }
-    return impl_->GetClMem();
+    return impl_->GetClCommandQueue();
 }
 
-void *Buffer::GetHostPtrImpl() const
+QueueType Queue::GetType() const
 {
     if (impl_ == nullptr) {
-        return nullptr;
+        return QueueType::Compute;
     }
-    return impl_->GetHostPtr();
+    return impl_->GetType();
 }
 
-size_t Buffer::GetSize() const
+bool Queue::Flush() const
 {
     if (impl_ == nullptr) {
-        return 0;
+        return false;
     }
-    return impl_->GetSize();
+    return impl_->Flush();
 }
 
-bool Buffer::Memcpy(void *host_ptr, size_t size, MemcpyKind kind) const
+bool Queue::Finish() const
 {
     if (impl_ == nullptr) {
         return false;
     }
-    return impl_->Memcpy(host_ptr, size, kind);
+    return impl_->Finish();
 }
 
-class Executor::ExecutorImpl final {
+class Kernel::KernelImpl final {
 public:
-    ExecutorImpl();
-    ~ExecutorImpl() = default;
-    ExecutorImpl(const ExecutorImpl &) = delete;
-    ExecutorImpl &operator=(const ExecutorImpl &) = delete;
-    ExecutorImpl(ExecutorImpl &&) = delete;
-    ExecutorImpl &operator=(ExecutorImpl &&) = delete;
+    // A bound argument value, cl_mem and cl_sampler values are retained by their holder through RetainArg.
+    struct ArgValue {
+        std::vector<uint8_t> bytes;
+        KernelArgKind kind{KernelArgKind::Value};
+    };
 
-    std::shared_ptr<Kernel> CreateKernel(const std::string &program_name,
-        const std::string &kernel_name,
-        const std::set<std::string> &build_options) const;
+    explicit KernelImpl(const std::vector<cl_command_queue> &queues,
+        DeviceScheduler *scheduler,
+        Profiler *profiler,
+        LocalSizeTuner *tuner,
+        cl_kernel kernel,
+        const std::string &name,
+        const std::string &variant_key,
+        uint64_t program_hash);
+    ~KernelImpl();
+    KernelImpl() = delete;
+    KernelImpl(const KernelImpl &) = delete;
+    KernelImpl &operator=(const KernelImpl &) = delete;
+    KernelImpl(KernelImpl &&) = delete;
+    KernelImpl &operator=(KernelImpl &&) = delete;
 
-    std::shared_ptr<Buffer> CreateBuffer(size_t size) const;
+    bool Run(const KernelArg *args,
+        size_t num_args,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        bool async) const;
+    bool RunAsync(cl_command_queue queue,
+        const KernelArg *args,
+        size_t num_args,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    void SetDeviceAffinity(int32_t device);
+    bool SetPersistentArg(cl_uint index, const KernelArg &arg);
+    void ClearPersistentArgs();
+    cl_kernel CreateBoundKernel(const KernelArg *args, size_t num_args, std::vector<ArgValue> &bound_args) const;
+    static void RetainArg(const ArgValue &value, bool retain);
+    bool Tune(const KernelArg *args, size_t num_args, const std::vector<size_t> &global_size) const;
+    std::vector<size_t> GetTunedLocalSize(const std::vector<size_t> &global_size, uint32_t device) const;
+    const std::string &GetName() const;
 
 private:
-    bool Init();
+    using KernelPtr = std::unique_ptr<_cl_kernel, decltype(&clReleaseKernel)>;
+    using PersistentArgs = std::map<cl_uint, ArgValue>;
 
-    std::vector<cl_device_id> devices_;
-    std::unique_ptr<_cl_context, decltype(&clReleaseContext)> context_{nullptr, clReleaseContext};
-    std::unique_ptr<_cl_command_queue, decltype(&clReleaseCommandQueue)> command_queue_{nullptr, clReleaseCommandQueue};
-    std::unique_ptr<ProgramManager> program_manager_;
-    std::unique_ptr<BufferManager> buffer_manager_;
+    struct Instance {
+        ~Instance();
+        KernelPtr kernel{nullptr, clReleaseKernel};
+        // The value last bound to each argument index, empty when unknown or a local memory argument. Cached cl_mem
+        // and cl_sampler handles are retained, so that a released handle cannot be reused by the next object and
+        // compare equal to the cached one.
+        std::vector<ArgValue> bound_args;
+        // The last queue not owned by the Executor the instance was enqueued on, and the index of its device.
+        cl_command_queue queue{nullptr};
+        int32_t device{-1};
+    };
+
+    Instance *AcquireInstance() const;
+    void RecycleInstance(Instance *instance) const;
+    Instance *CreateInstance() const;
+    bool BindArgs(Instance *instance, const KernelArg *args, size_t num_args) const;
+    static bool BindArg(Instance *instance, cl_uint index, const KernelArg &arg);
+    bool FindTunedLocalSize(Instance *instance,
+        cl_command_queue queue,
+        int32_t device,
+        const std::vector<size_t> &global_size,
+        std::vector<size_t> *local_size) const;
+    static bool Benchmark(cl_kernel kernel,
+        cl_command_queue queue,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        uint64_t *duration);
+    bool Enqueue(cl_command_queue queue,
+        int32_t device,
+        const KernelArg *args,
+        size_t num_args,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<cl_event> &wait_events,
+        cl_event *event) const;
+    bool EnqueueScheduled(const KernelArg *args,
+        size_t num_args,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<cl_event> &wait_events,
+        cl_event *event,
+        cl_command_queue *queue) const;
+
+    static constexpr size_t kMaxIdleInstances = 8;
+    static constexpr uint32_t kTuningRuns = 5;
+
+    std::vector<cl_command_queue> queues_;
+    DeviceScheduler *scheduler_;
+    Profiler *profiler_;
+    LocalSizeTuner *tuner_;
+    std::string name_;
+    // The hash of the program variant and kernel on each device, the tuned local sizes are looked up from it.
+    std::vector<uint64_t> tuning_seeds_;
+    // Owned by the ProgramManager, only used as the template of the instances and never bound or enqueued.
+    cl_kernel kernel_;
+    // Kernel instances not used by any launch, taken and put back with atomic exchanges.
+    mutable std::array<std::atomic<Instance *>, kMaxIdleInstances> idle_instances_;
+    std::atomic<int32_t> affinity_{-1};
+    // Replaced as a whole so that the launches in flight keep binding a consistent snapshot.
+    std::shared_ptr<const PersistentArgs> persistent_args_;
+    std::mutex persistent_args_mutex_;
 };
 
-Executor::ExecutorImpl::ExecutorImpl()
+Kernel::KernelImpl::KernelImpl(const std::vector<cl_command_queue> &queues,
+    DeviceScheduler *scheduler,
+    Profiler *profiler,
+    LocalSizeTuner *tuner,
+    cl_kernel kernel,
+    const std::string &name,
+    const std::string &variant_key,
+    uint64_t program_hash)
+    : queues_(queues),
+      scheduler_(scheduler),
+      profiler_(profiler),
+      tuner_(tuner),
+      name_(name),
+      kernel_(kernel),
+      persistent_args_(std::make_shared<PersistentArgs>())
 {
-    if (!Init()) {
-        std::cout << "Failed to initialize Executor" << std::endl;
+    // The content hash keeps the local sizes tuned for an older source or binary of the same name from being used.
+    const std::string kernel_key = variant_key + '\0' + name_ + '\0' + std::to_string(program_hash);
+    for (uint32_t device = 0; device < queues_.size(); ++device) {
+        tuning_seeds_.emplace_back(tuner_->GetSeed(device, kernel_key));
+    }
+    for (auto &instance : idle_instances_) {
+        instance.store(nullptr);
     }
 }
 
-bool Executor::ExecutorImpl::Init()
+Kernel::KernelImpl::~KernelImpl()
 {
-    cl_uint num_platforms;
-    cl_int ret;
-    ret = clGetPlatformIDs(0, nullptr, &num_platforms);
-    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get number of platforms");
-    if (num_platforms == 0) {
-        std::cout << "No OpenCL platforms found" << std::endl;
+    for (auto &instance : idle_instances_) {
+        delete instance.exchange(nullptr);
+    }
+}
+
+bool Kernel::KernelImpl::Run(const KernelArg *args,
+    size_t num_args,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    bool async) const
+{
+    cl_command_queue queue = nullptr;
+    if (!EnqueueScheduled(args, num_args, global_size, local_size, {}, nullptr, &queue)) {
         return false;
     }
-    std::vector<cl_platform_id> platforms(num_platforms);
-    ret = clGetPlatformIDs(num_platforms, platforms.data(), nullptr);
-    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get platform IDs");
+    if (!async) {
+        cl_int ret = clFinish(queue);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to finish command queue");
+    }
+    return true;
+}
 
-    for (const auto &platform : platforms) {
-        cl_uint num_devices;
-        ret = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 0, nullptr, &num_devices);
-        if (num_devices == 0) {
-            continue;
-        }
-        devices_.resize(num_devices);
-        ret = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, num_devices, devices_.data(), nullptr);
-        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get device IDs");
-        std::cout << "GPU device found" << std::endl;
-        context_.reset(clCreateContext(nullptr, num_devices, devices_.data(), nullptr, nullptr, &ret));
-        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to create context");
+bool Kernel::KernelImpl::RunAsync(cl_command_queue queue,
+    const KernelArg *args,
+    size_t num_args,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    cl_event out_event = nullptr;
+    cl_event *event_ptr = event != nullptr ? &out_event : nullptr;
+    bool ret = queue != nullptr
+        ? Enqueue(queue, -1, args, num_args, global_size, local_size, GetClEvents(wait_events), event_ptr)
+        : EnqueueScheduled(args, num_args, global_size, local_size, GetClEvents(wait_events), event_ptr, &queue);
+    if (!ret) {
+        return false;
+    }
+    if (event != nullptr) {
+        *event = Event(out_event);
+    }
+    return true;
+}
 
-        cl_command_queue_properties properties[] = {0};
-        command_queue_.reset(clCreateCommandQueueWithProperties(context_.get(), devices_[0], properties, &ret));
-        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to create command queue");
+void Kernel::KernelImpl::SetDeviceAffinity(int32_t device) { affinity_.store(device); }
 
-        program_manager_.reset(new (std::nothrow) ProgramManager(devices_[0], context_.get()));
-        if (!program_manager_) {
-            std::cout << "Failed to create ProgramManager" << std::endl;
-            return false;
-        }
+bool Kernel::KernelImpl::SetPersistentArg(cl_uint index, const KernelArg &arg)
+{
+    if (arg.value == nullptr || arg.size == 0) {
+        std::cout << "Invalid persistent argument: " << index << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(persistent_args_mutex_);
+    auto persistent_args = std::make_shared<PersistentArgs>(*std::atomic_load(&persistent_args_));
+    const auto *bytes = static_cast<const uint8_t *>(arg.value);
+    ArgValue &persistent_arg = (*persistent_args)[index];
+    persistent_arg.bytes.assign(bytes, bytes + arg.size);
+    persistent_arg.kind = arg.kind;
+    std::atomic_store(&persistent_args_, std::shared_ptr<const PersistentArgs>(std::move(persistent_args)));
+    return true;
+}
 
-        buffer_manager_.reset(new (std::nothrow) BufferManager(context_.get(), command_queue_.get()));
-        if (!buffer_manager_) {
-            std::cout << "Failed to create BufferManager" << std::endl;
-            return false;
+void Kernel::KernelImpl::ClearPersistentArgs()
+{
+    std::lock_guard<std::mutex> lock(persistent_args_mutex_);
+    std::atomic_store(&persistent_args_, std::shared_ptr<const PersistentArgs>(std::make_shared<PersistentArgs>()));
+}
+
+cl_kernel Kernel::KernelImpl::CreateBoundKernel(
+    const KernelArg *args, size_t num_args, std::vector<ArgValue> &bound_args) const
+{
+    std::unique_ptr<Instance> instance(CreateInstance());
+    if (!instance || !BindArgs(instance.get(), args, num_args)) {
+        return nullptr;
+    }
+    cl_uint num_kernel_args = 0;
+    cl_int ret = clGetKernelInfo(
+        instance->kernel.get(), CL_KERNEL_NUM_ARGS, sizeof(num_kernel_args), &num_kernel_args, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to get number of kernel arguments");
+    if (instance->bound_args.size() != num_kernel_args) {
+        std::cout << "Invalid number of kernel arguments: " << instance->bound_args.size() << ", expected "
+                  << num_kernel_args << std::endl;
+        return nullptr;
+    }
+    // The retained handles move along with the values.
+    bound_args = std::move(instance->bound_args);
+    instance->bound_args.clear();
+    return instance->kernel.release();
+}
+
+bool Kernel::KernelImpl::Tune(const KernelArg *args, size_t num_args, const std::vector<size_t> &global_size) const
+{
+    Instance *instance = AcquireInstance();
+    if (instance == nullptr) {
+        return false;
+    }
+    if (!BindArgs(instance, args, num_args)) {
+        RecycleInstance(instance);
+        return false;
+    }
+    bool ret = true;
+    for (uint32_t device = 0; device < queues_.size(); ++device) {
+        // An empty local size lets the driver pick one, which is kept when nothing beats it.
+        std::vector<std::vector<size_t>> candidates =
+            tuner_->GetCandidates(device, instance->kernel.get(), global_size);
+        candidates.insert(candidates.begin(), std::vector<size_t>());
+        const std::vector<size_t> *best = nullptr;
+        uint64_t best_duration = UINT64_MAX;
+        for (const auto &candidate : candidates) {
+            uint64_t duration = 0;
+            if (Benchmark(instance->kernel.get(), queues_[device], global_size, candidate, &duration) &&
+                duration < best_duration) {
+                best = &candidate;
+                best_duration = duration;
+            }
         }
-        return true;
+        if (best == nullptr) {
+            std::cout << "Failed to tune kernel: " << name_ << std::endl;
+            ret = false;
+            continue;
+        }
+        tuner_->Store(LocalSizeTuner::GetKey(tuning_seeds_[device], global_size), *best);
     }
-    std::cout << "No GPU devices found" << std::endl;
-    return false;
+    RecycleInstance(instance);
+    return ret;
 }
 
-std::shared_ptr<Kernel> Executor::ExecutorImpl::CreateKernel(
-    const std::string &program_name, const std::string &kernel_name, const std::set<std::string> &build_options) const
+std::vector<size_t> Kernel::KernelImpl::GetTunedLocalSize(const std::vector<size_t> &global_size, uint32_t device) const
 {
-    if (!program_manager_) {
-        return nullptr;
+    std::vector<size_t> local_size;
+    if (device < tuning_seeds_.size()) {
+        tuner_->Find(LocalSizeTuner::GetKey(tuning_seeds_[device], global_size), &local_size);
     }
+    return local_size;
+}
 
-    if (!program_manager_->BuildProgram(program_name, build_options)) {
-        return nullptr;
-    };
-    cl_kernel kernel = program_manager_->GetKernel(program_name, kernel_name);
-    if (!kernel) {
-        return nullptr;
+const std::string &Kernel::KernelImpl::GetName() const { return name_; }
+
+bool Kernel::KernelImpl::FindTunedLocalSize(Instance *instance,
+    cl_command_queue queue,
+    int32_t device,
+    const std::vector<size_t> &global_size,
+    std::vector<size_t> *local_size) const
+{
+    if (tuner_->IsEmpty()) {
+        return false;
     }
-    std::unique_ptr<Kernel::KernelImpl> kernel_impl(new (std::nothrow) Kernel::KernelImpl(command_queue_.get(), kernel));
-    if (!kernel_impl) {
-        return nullptr;
+    if (device < 0) {
+        auto iter = std::find(queues_.begin(), queues_.end(), queue);
+        device = iter != queues_.end() ? static_cast<int32_t>(iter - queues_.begin()) : -1;
     }
-    return std::make_shared<Kernel>(kernel_impl.release());
+    // Other queues are looked up once per instance, the launches of a stream keep reusing the same queue.
+    if (device < 0 && queue == instance->queue) {
+        device = instance->device;
+    } else if (device < 0) {
+        cl_device_id queue_device = nullptr;
+        cl_int ret = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(queue_device), &queue_device, nullptr);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get queue device");
+        device = tuner_->GetDeviceIndex(queue_device);
+        instance->queue = queue;
+        instance->device = device;
+    }
+    if (device < 0 || static_cast<size_t>(device) >= tuning_seeds_.size()) {
+        return false;
+    }
+    return tuner_->Find(LocalSizeTuner::GetKey(tuning_seeds_[device], global_size), local_size);
 }
 
-std::shared_ptr<Buffer> Executor::ExecutorImpl::CreateBuffer(size_t size) const
+bool Kernel::KernelImpl::Benchmark(cl_kernel kernel,
+    cl_command_queue queue,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    uint64_t *duration)
 {
-    if (!buffer_manager_) {
-        return nullptr;
+    // The first launch is a warmup, candidates the kernel cannot run with fail to enqueue and are skipped.
+    std::vector<cl_event> events;
+    cl_int ret = CL_SUCCESS;
+    for (uint32_t i = 0; i <= kTuningRuns && ret == CL_SUCCESS; ++i) {
+        cl_event event = nullptr;
+        ret = clEnqueueNDRangeKernel(queue,
+            kernel,
+            global_size.size(),
+            nullptr,
+            global_size.data(),
+            local_size.empty() ? nullptr : local_size.data(),
+            0,
+            nullptr,
+            i == 0 ? nullptr : &event);
+        if (event != nullptr) {
+            events.emplace_back(event);
+        }
     }
-    std::unique_ptr<Buffer::BufferImpl> buffer_impl(
-        new (std::nothrow) Buffer::BufferImpl(buffer_manager_.get(), command_queue_.get(), size));
-    if (!buffer_impl) {
-        return nullptr;
+    if (ret == CL_SUCCESS) {
+        ret = clWaitForEvents(events.size(), events.data());
     }
-    return std::make_shared<Buffer>(buffer_impl.release());
+    std::vector<uint64_t> durations;
+    for (cl_event event : events) {
+        cl_ulong start = 0;
+        cl_ulong end = 0;
+        if (ret == CL_SUCCESS) {
+            ret = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+        }
+        if (ret == CL_SUCCESS) {
+            ret = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+        }
+        durations.emplace_back(end - start);
+        clReleaseEvent(event);
+    }
+    if (ret != CL_SUCCESS || durations.empty()) {
+        return false;
+    }
+    std::nth_element(durations.begin(), durations.begin() + durations.size() / 2, durations.end());
+    *duration = durations[durations.size() / 2];
+    return true;
 }
 
-Executor &Executor::GetInstance()
+Kernel::KernelImpl::Instance *Kernel::KernelImpl::AcquireInstance() const
 {
-    static Executor instance;
-    return instance;
+    for (auto &idle_instance : idle_instances_) {
+        if (idle_instance.load(std::memory_order_relaxed) == nullptr) {
+            continue;
+        }
+        Instance *instance = idle_instance.exchange(nullptr, std::memory_order_acquire);
+        if (instance != nullptr) {
+            return instance;
+        }
+    }
+    return CreateInstance();
 }
 
-Executor::Executor() : impl_(std::make_unique<ExecutorImpl>()) {}
+void Kernel::KernelImpl::RecycleInstance(Instance *instance) const
+{
+    for (auto &idle_instance : idle_instances_) {
+        Instance *expected = nullptr;
+        if (idle_instance.compare_exchange_strong(expected, instance, std::memory_order_release)) {
+            return;
+        }
+    }
+    delete instance;
+}
 
-std::shared_ptr<Kernel> Executor::CreateKernel(
-    const std::string &program_name, const std::string &kernel_name, const std::set<std::string> &build_options) const
+Kernel::KernelImpl::Instance *Kernel::KernelImpl::CreateInstance() const
 {
-    if (!impl_) {
+    std::unique_ptr<Instance> instance(new (std::nothrow) Instance());
+    if (!instance) {
         return nullptr;
     }
-    return impl_->CreateKernel(program_name, kernel_name, build_options);
+    cl_int ret = CL_SUCCESS;
+    instance->kernel.reset(clCloneKernel(kernel_, &ret));
+    if (ret == CL_SUCCESS && instance->kernel) {
+        return instance.release();
+    }
+    // clCloneKernel is not available before OpenCL 2.1, create the kernel from its program instead.
+    cl_program program = nullptr;
+    ret = clGetKernelInfo(kernel_, CL_KERNEL_PROGRAM, sizeof(cl_program), &program, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to get kernel program");
+    size_t name_size = 0;
+    ret = clGetKernelInfo(kernel_, CL_KERNEL_FUNCTION_NAME, 0, nullptr, &name_size);
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to get kernel name size");
+    std::string name(name_size, '\0');
+    ret = clGetKernelInfo(kernel_, CL_KERNEL_FUNCTION_NAME, name_size, name.data(), nullptr);
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to get kernel name");
+    instance->kernel.reset(clCreateKernel(program, name.c_str(), &ret));
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to create kernel instance");
+    return instance.release();
 }
 
-std::shared_ptr<Buffer> Executor::CreateBuffer(size_t size) const
+bool Kernel::KernelImpl::BindArgs(Instance *instance, const KernelArg *args, size_t num_args) const
 {
-    if (!impl_) {
-        return nullptr;
+    std::shared_ptr<const PersistentArgs> persistent_args = std::atomic_load(&persistent_args_);
+    auto persistent = persistent_args->begin();
+    cl_uint index = 0;
+    size_t next = 0;
+    while (next < num_args || persistent != persistent_args->end()) {
+        bool ret = true;
+        if (persistent != persistent_args->end() && (persistent->first == index || next == num_args)) {
+            index = persistent->first;
+            const ArgValue &persistent_arg = persistent->second;
+            ret = BindArg(instance,
+                index,
+                KernelArg{persistent_arg.bytes.size(), persistent_arg.bytes.data(), persistent_arg.kind});
+            ++persistent;
+        } else {
+            ret = BindArg(instance, index, args[next]);
+            ++next;
+        }
+        if (!ret) {
+            return false;
+        }
+        ++index;
+    }
+    return true;
+}
+
+bool Kernel::KernelImpl::BindArg(Instance *instance, cl_uint index, const KernelArg &arg)
+{
+    if (instance->bound_args.size() <= index) {
+        instance->bound_args.resize(index + 1);
+    }
+    ArgValue &bound = instance->bound_args[index];
+    if (arg.value != nullptr && bound.kind == arg.kind && bound.bytes.size() == arg.size &&
+        std::memcmp(bound.bytes.data(), arg.value, arg.size) == 0) {
+        return true;
+    }
+    RetainArg(bound, false);
+    bound.bytes.clear();
+    bound.kind = KernelArgKind::Value;
+    cl_int ret = clSetKernelArg(instance->kernel.get(), index, arg.size, arg.value);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to set kernel argument");
+    // Local memory arguments have no value and are always set again.
+    if (arg.value != nullptr) {
+        const auto *bytes = static_cast<const uint8_t *>(arg.value);
+        bound.bytes.assign(bytes, bytes + arg.size);
+        bound.kind = arg.kind;
+        RetainArg(bound, true);
+    }
+    return true;
+}
+
+void Kernel::KernelImpl::RetainArg(const ArgValue &value, bool retain)
+{
+    if (value.kind == KernelArgKind::Value || value.bytes.size() != sizeof(void *)) {
+        return;
+    }
+    void *handle = nullptr;
+    std::memcpy(&handle, value.bytes.data(), sizeof(handle));
+    if (handle == nullptr) {
+        return;
+    }
+    if (value.kind == KernelArgKind::MemObject && retain) {
+        clRetainMemObject(static_cast<cl_mem>(handle));
+    } else if (value.kind == KernelArgKind::MemObject) {
+        clReleaseMemObject(static_cast<cl_mem>(handle));
+    } else if (retain) {
+        clRetainSampler(static_cast<cl_sampler>(handle));
+    } else {
+        clReleaseSampler(static_cast<cl_sampler>(handle));
+    }
+}
+
+Kernel::KernelImpl::Instance::~Instance()
+{
+    for (const auto &bound : bound_args) {
+        RetainArg(bound, false);
+    }
+}
+
+bool Kernel::KernelImpl::Enqueue(cl_command_queue queue,
+    int32_t device,
+    const KernelArg *args,
+    size_t num_args,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    const std::vector<cl_event> &wait_events,
+    cl_event *event) const
+{
+    if (!local_size.empty() && local_size.size() != global_size.size()) {
+        std::cout << "Invalid local size dimension: " << local_size.size() << std::endl;
+        return false;
+    }
+    Instance *instance = AcquireInstance();
+    if (instance == nullptr) {
+        return false;
+    }
+    if (!BindArgs(instance, args, num_args)) {
+        RecycleInstance(instance);
+        return false;
+    }
+    std::vector<size_t> tuned_local_size;
+    const bool tuned =
+        local_size.empty() && FindTunedLocalSize(instance, queue, device, global_size, &tuned_local_size);
+    const std::vector<size_t> &launch_local_size = tuned ? tuned_local_size : local_size;
+    // Profiled launches always need an event to read the timestamps from.
+    const bool profiling = profiler_->IsEnabled();
+    cl_event profiled_event = nullptr;
+    if (profiling && event == nullptr) {
+        event = &profiled_event;
+    }
+    // The arguments are captured at enqueue time, so the instance can be reused as soon as it is enqueued.
+    auto enqueue = [&](const size_t *launch_local) {
+        return clEnqueueNDRangeKernel(queue,
+            instance->kernel.get(),
+            global_size.size(),
+            nullptr,
+            global_size.data(),
+            launch_local,
+            wait_events.size(),
+            wait_events.empty() ? nullptr : wait_events.data(),
+            event);
+    };
+    cl_int ret = enqueue(launch_local_size.empty() ? nullptr : launch_local_size.data());
+    // A stored local size may not fit this launch, the driver choice always does.
+    if (ret != CL_SUCCESS && tuned && !tuned_local_size.empty()) {
+        std::cout << "Tuned local size rejected, use the driver choice: " << name_ << " (" << ret << ")" << std::endl;
+        ret = enqueue(nullptr);
+    }
+    RecycleInstance(instance);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to enqueue kernel");
+    if (profiling) {
+        profiler_->Track(name_, queue, *event);
+    }
+    if (profiled_event != nullptr) {
+        clReleaseEvent(profiled_event);
+    }
+    return true;
+}
+
+bool Kernel::KernelImpl::EnqueueScheduled(const KernelArg *args,
+    size_t num_args,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    const std::vector<cl_event> &wait_events,
+    cl_event *event,
+    cl_command_queue *queue) const
+{
+    Placement placement = scheduler_->Schedule(affinity_.load());
+    *queue = queues_[placement.device];
+    if (!placement.tracked) {
+        return Enqueue(*queue, placement.device, args, num_args, global_size, local_size, wait_events, event);
+    }
+    // Tracked launches always need an event to know when the device is done with them.
+    cl_event tracked_event = nullptr;
+    bool ret =
+        Enqueue(*queue, placement.device, args, num_args, global_size, local_size, wait_events, &tracked_event);
+    scheduler_->Track(placement, ret ? tracked_event : nullptr);
+    if (!ret) {
+        return false;
+    }
+    if (event != nullptr) {
+        *event = tracked_event;
+    } else {
+        clReleaseEvent(tracked_event);
+    }
+    return true;
+}
+
+Kernel::Kernel(KernelImpl *impl) { impl_.reset(impl); }
+
+bool Kernel::RunImpl(const KernelArg *args,
+    size_t num_args,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    bool async) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Run(args, num_args, global_size, local_size, async);
+}
+
+bool Kernel::RunAsyncImpl(const Queue *queue,
+    const KernelArg *args,
+    size_t num_args,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->RunAsync(queue != nullptr ? queue->GetClCommandQueue() : nullptr,
+        args,
+        num_args,
+        global_size,
+        local_size,
+        wait_events,
+        event);
+}
+
+void Kernel::SetDeviceAffinity(int32_t device) const
+{
+    if (impl_ == nullptr) {
+        return;
+    }
+    impl_->SetDeviceAffinity(device);
+}
+
+bool Kernel::SetPersistentArgImpl(uint32_t index, const KernelArg &arg) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->SetPersistentArg(index, arg);
+}
+
+void Kernel::ClearPersistentArgs() const
+{
+    if (impl_ == nullptr) {
+        return;
+    }
+    impl_->ClearPersistentArgs();
+}
+
+bool Kernel::TuneImpl(const KernelArg *args, size_t num_args, const std::vector<size_t> &global_size) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Tune(args, num_args, global_size);
+}
+
+std::vector<size_t> Kernel::GetTunedLocalSize(const std::vector<size_t> &global_size, uint32_t device) const
+{
+    if (impl_ == nullptr) {
+        return {};
+    }
+    return impl_->GetTunedLocalSize(global_size, device);
+}
+
+BufferMapping::BufferMapping(cl_command_queue queue, cl_mem buffer, void *ptr, size_t size)
+    : queue_(queue), buffer_(buffer), ptr_(ptr), size_(size)
+{
+    if (ptr_ != nullptr) {
+        clRetainCommandQueue(queue_);
+        clRetainMemObject(buffer_);
+    }
+}
+
+BufferMapping::~BufferMapping() { Unmap(); }
+
+BufferMapping::BufferMapping(BufferMapping &&other) noexcept
+    : queue_(other.queue_), buffer_(other.buffer_), ptr_(other.ptr_), size_(other.size_)
+{
+    other.queue_ = nullptr;
+    other.buffer_ = nullptr;
+    other.ptr_ = nullptr;
+    other.size_ = 0;
+}
+
+BufferMapping &BufferMapping::operator=(BufferMapping &&other) noexcept
+{
+    if (this != &other) {
+        Unmap();
+        std::swap(queue_, other.queue_);
+        std::swap(buffer_, other.buffer_);
+        std::swap(ptr_, other.ptr_);
+        std::swap(size_, other.size_);
+    }
+    return *this;
+}
+
+size_t BufferMapping::GetSize() const { return size_; }
+
+bool BufferMapping::IsValid() const { return ptr_ != nullptr; }
+
+bool BufferMapping::Unmap()
+{
+    if (ptr_ == nullptr) {
+        return true;
+    }
+    // Kernels may run on other queues, so the unmap has to complete before the region is released to them.
+    cl_event event = nullptr;
+    cl_int ret = clEnqueueUnmapMemObject(queue_, buffer_, ptr_, 0, nullptr, &event);
+    if (ret == CL_SUCCESS) {
+        ret = clWaitForEvents(1, &event);
+        clReleaseEvent(event);
+    }
+    // The buffer and the queue are held by the mapping until the unmap is done, whatever released them meanwhile.
+    clReleaseMemObject(buffer_);
+    clReleaseCommandQueue(queue_);
+    queue_ = nullptr;
+    buffer_ = nullptr;
+    ptr_ = nullptr;
+    size_ = 0;
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to unmap buffer");
+    return true;
+}
+
+class Buffer::BufferImpl final {
+public:
+    explicit BufferImpl(
+        BufferManager *manager, Profiler *profiler, cl_command_queue command_queue, size_t size, BufferMode mode);
+    explicit BufferImpl(BufferManager *manager,
+        Profiler *profiler,
+        cl_command_queue command_queue,
+        cl_mem buffer,
+        size_t size,
+        BufferMode mode,
+        void *host_ptr);
+    ~BufferImpl();
+    BufferImpl() = delete;
+    BufferImpl(const BufferImpl &) = delete;
+    BufferImpl &operator=(const BufferImpl &) = delete;
+    BufferImpl(BufferImpl &&) = delete;
+    BufferImpl &operator=(BufferImpl &&) = delete;
+
+    cl_mem GetClMem() const;
+    void *GetHostPtr() const;
+    size_t GetSize() const;
+    BufferMode GetMode() const;
+    BufferMapping Map(size_t offset, size_t size, MapAccess access) const;
+    bool Memcpy(cl_command_queue queue,
+        void *host_ptr,
+        size_t size,
+        size_t offset,
+        MemcpyKind kind,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    bool MemcpyRect(void *host_ptr,
+        const BufferRect &rect,
+        MemcpyKind kind,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    bool CopyFrom(const BufferImpl &src,
+        size_t size,
+        size_t src_offset,
+        size_t dst_offset,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    bool Fill(const void *pattern,
+        size_t pattern_size,
+        size_t offset,
+        size_t size,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+
+private:
+    static bool CheckRange(size_t buffer_size, size_t size, size_t offset);
+    static void CL_CALLBACK OnPeriodUploaded(cl_event event, cl_int status, void *user_data);
+    bool FillByCopies(const void *pattern,
+        size_t pattern_size,
+        size_t offset,
+        size_t size,
+        const std::vector<cl_event> &wait_events,
+        cl_event *out_event) const;
+    void Complete(cl_command_queue queue, const char *name, cl_event out_event, Event *event) const;
+
+    BufferManager *manager_;
+    Profiler *profiler_;
+    cl_command_queue command_queue_;
+    cl_mem buffer_;
+    size_t size_;
+    BufferMode mode_;
+    void *host_ptr_;
+};
+
+Buffer::BufferImpl::BufferImpl(
+    BufferManager *manager, Profiler *profiler, cl_command_queue command_queue, size_t size, BufferMode mode)
+    : manager_(manager),
+      profiler_(profiler),
+      command_queue_(command_queue),
+      size_(size),
+      mode_(mode),
+      host_ptr_(nullptr)
+{
+    buffer_ = manager_->Create(size, mode, &host_ptr_);
+    if (buffer_ == nullptr) {
+        std::cout << "Failed to create buffer" << std::endl;
+        return;
+    }
+}
+
+Buffer::BufferImpl::BufferImpl(BufferManager *manager,
+    Profiler *profiler,
+    cl_command_queue command_queue,
+    cl_mem buffer,
+    size_t size,
+    BufferMode mode,
+    void *host_ptr)
+    : manager_(manager),
+      profiler_(profiler),
+      command_queue_(command_queue),
+      buffer_(buffer),
+      size_(size),
+      mode_(mode),
+      host_ptr_(host_ptr)
+{
+}
+
+Buffer::BufferImpl::~BufferImpl()
+{
+    if (buffer_ == nullptr) {
+        return;
+    }
+    // The buffer stays mapped, BufferManager unmaps it when it is finally destroyed.
+    manager_->Release(buffer_);
+}
+
+cl_mem Buffer::BufferImpl::GetClMem() const { return buffer_; }
+
+void *Buffer::BufferImpl::GetHostPtr() const { return host_ptr_; }
+
+size_t Buffer::BufferImpl::GetSize() const { return size_; }
+
+BufferMode Buffer::BufferImpl::GetMode() const { return mode_; }
+
+BufferMapping Buffer::BufferImpl::Map(size_t offset, size_t size, MapAccess access) const
+{
+    if (mode_ == BufferMode::DeviceOnly) {
+        std::cout << "Device only buffers cannot be mapped" << std::endl;
+        return BufferMapping();
+    }
+    if (size == 0 || !CheckRange(size_, size, offset)) {
+        return BufferMapping();
+    }
+    cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE;
+    if (access == MapAccess::Read) {
+        flags = CL_MAP_READ;
+    } else if (access == MapAccess::Write) {
+        flags = CL_MAP_WRITE;
+    } else if (access == MapAccess::WriteInvalidate) {
+        flags = CL_MAP_WRITE_INVALIDATE_REGION;
+    }
+    cl_int ret;
+    void *ptr = clEnqueueMapBuffer(command_queue_, buffer_, CL_TRUE, flags, offset, size, 0, nullptr, nullptr, &ret);
+    CHECK_OPENCL_ERROR(ret, "Failed to map buffer", BufferMapping());
+    return BufferMapping(command_queue_, buffer_, ptr, size);
+}
+
+bool Buffer::BufferImpl::Memcpy(cl_command_queue queue,
+    void *host_ptr,
+    size_t size,
+    size_t offset,
+    MemcpyKind kind,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    cl_int ret;
+    if (queue == nullptr) {
+        queue = command_queue_;
+    }
+    if (!CheckRange(size_, size, offset)) {
+        return false;
+    }
+    std::vector<cl_event> cl_wait_events = GetClEvents(wait_events);
+    const cl_uint num_wait_events = cl_wait_events.size();
+    const cl_event *wait_list = cl_wait_events.empty() ? nullptr : cl_wait_events.data();
+    const cl_bool blocking = event == nullptr ? CL_TRUE : CL_FALSE;
+    cl_event out_event = nullptr;
+    cl_event *event_ptr = event == nullptr && !profiler_->IsEnabled() ? nullptr : &out_event;
+    if (kind == MemcpyKind::HostToDevice) {
+        ret = clEnqueueWriteBuffer(
+            queue, buffer_, blocking, offset, size, host_ptr, num_wait_events, wait_list, event_ptr);
+    } else if (kind == MemcpyKind::DeviceToHost) {
+        ret = clEnqueueReadBuffer(
+            queue, buffer_, blocking, offset, size, host_ptr, num_wait_events, wait_list, event_ptr);
+    } else {
+        std::cout << "Invalid memcpy kind" << std::endl;
+        return false;
+    }
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to copy buffer");
+    Complete(queue, kind == MemcpyKind::HostToDevice ? "MemcpyHostToDevice" : "MemcpyDeviceToHost", out_event, event);
+    return true;
+}
+
+bool Buffer::BufferImpl::MemcpyRect(void *host_ptr,
+    const BufferRect &rect,
+    MemcpyKind kind,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    cl_int ret;
+    // The runtime checks the region against the pitches and the size of the buffer.
+    std::vector<cl_event> cl_wait_events = GetClEvents(wait_events);
+    const cl_uint num_wait_events = cl_wait_events.size();
+    const cl_event *wait_list = cl_wait_events.empty() ? nullptr : cl_wait_events.data();
+    const cl_bool blocking = event == nullptr ? CL_TRUE : CL_FALSE;
+    cl_event out_event = nullptr;
+    cl_event *event_ptr = event == nullptr && !profiler_->IsEnabled() ? nullptr : &out_event;
+    if (kind == MemcpyKind::HostToDevice) {
+        ret = clEnqueueWriteBufferRect(command_queue_,
+            buffer_,
+            blocking,
+            rect.buffer_origin.data(),
+            rect.host_origin.data(),
+            rect.region.data(),
+            rect.buffer_row_pitch,
+            rect.buffer_slice_pitch,
+            rect.host_row_pitch,
+            rect.host_slice_pitch,
+            host_ptr,
+            num_wait_events,
+            wait_list,
+            event_ptr);
+    } else if (kind == MemcpyKind::DeviceToHost) {
+        ret = clEnqueueReadBufferRect(command_queue_,
+            buffer_,
+            blocking,
+            rect.buffer_origin.data(),
+            rect.host_origin.data(),
+            rect.region.data(),
+            rect.buffer_row_pitch,
+            rect.buffer_slice_pitch,
+            rect.host_row_pitch,
+            rect.host_slice_pitch,
+            host_ptr,
+            num_wait_events,
+            wait_list,
+            event_ptr);
+    } else {
+        std::cout << "Invalid memcpy kind" << std::endl;
+        return false;
+    }
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to copy buffer rect");
+    Complete(command_queue_,
+        kind == MemcpyKind::HostToDevice ? "MemcpyRectHostToDevice" : "MemcpyRectDeviceToHost",
+        out_event,
+        event);
+    return true;
+}
+
+bool Buffer::BufferImpl::CopyFrom(const BufferImpl &src,
+    size_t size,
+    size_t src_offset,
+    size_t dst_offset,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (!CheckRange(src.size_, size, src_offset) || !CheckRange(size_, size, dst_offset)) {
+        return false;
+    }
+    if (&src == this && src_offset < dst_offset + size && dst_offset < src_offset + size) {
+        std::cout << "Overlapping copy in the same buffer" << std::endl;
+        return false;
+    }
+    std::vector<cl_event> cl_wait_events = GetClEvents(wait_events);
+    // clEnqueueCopyBuffer has no blocking flag, a blocking copy waits for its event.
+    cl_event out_event = nullptr;
+    cl_int ret = clEnqueueCopyBuffer(command_queue_,
+        src.buffer_,
+        buffer_,
+        src_offset,
+        dst_offset,
+        size,
+        cl_wait_events.size(),
+        cl_wait_events.empty() ? nullptr : cl_wait_events.data(),
+        &out_event);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to copy buffer");
+    if (event == nullptr) {
+        ret = clWaitForEvents(1, &out_event);
+        if (ret != CL_SUCCESS) {
+            clReleaseEvent(out_event);
+        }
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to wait for buffer copy");
+    }
+    Complete(command_queue_, "MemcpyDeviceToDevice", out_event, event);
+    return true;
+}
+
+bool Buffer::BufferImpl::Fill(const void *pattern,
+    size_t pattern_size,
+    size_t offset,
+    size_t size,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (pattern == nullptr || pattern_size == 0 || offset % pattern_size != 0 || size % pattern_size != 0) {
+        std::cout << "Invalid fill pattern size: " << pattern_size << std::endl;
+        return false;
+    }
+    if (!CheckRange(size_, size, offset)) {
+        return false;
+    }
+    std::vector<cl_event> cl_wait_events = GetClEvents(wait_events);
+    cl_event out_event = nullptr;
+    cl_int ret = CL_SUCCESS;
+    // clEnqueueFillBuffer only takes power of two patterns up to the size of a double16.
+    const bool device_fill = pattern_size <= 128 && (pattern_size & (pattern_size - 1)) == 0;
+    if (device_fill) {
+        ret = clEnqueueFillBuffer(command_queue_,
+            buffer_,
+            pattern,
+            pattern_size,
+            offset,
+            size,
+            cl_wait_events.size(),
+            cl_wait_events.empty() ? nullptr : cl_wait_events.data(),
+            &out_event);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to fill buffer");
+    } else if (!FillByCopies(pattern, pattern_size, offset, size, cl_wait_events, &out_event)) {
+        return false;
+    }
+    if (event == nullptr) {
+        ret = clWaitForEvents(1, &out_event);
+        if (ret != CL_SUCCESS) {
+            clReleaseEvent(out_event);
+        }
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to wait for buffer fill");
+    }
+    Complete(command_queue_, "FillBuffer", out_event, event);
+    return true;
+}
+
+void CL_CALLBACK Buffer::BufferImpl::OnPeriodUploaded(cl_event event, cl_int status, void *user_data)
+{
+    (void)event;
+    (void)status;
+    delete static_cast<std::vector<uint8_t> *>(user_data);
+}
+
+bool Buffer::BufferImpl::FillByCopies(const void *pattern,
+    size_t pattern_size,
+    size_t offset,
+    size_t size,
+    const std::vector<cl_event> &wait_events,
+    cl_event *out_event) const
+{
+    // One period is written from a copy of the pattern, which is freed once the write is done.
+    const auto *bytes = static_cast<const uint8_t *>(pattern);
+    auto *period = new (std::nothrow) std::vector<uint8_t>(bytes, bytes + pattern_size);
+    if (period == nullptr) {
+        std::cout << "Failed to allocate fill pattern" << std::endl;
+        return false;
+    }
+    cl_event filled_event = nullptr;
+    cl_int ret = clEnqueueWriteBuffer(command_queue_,
+        buffer_,
+        CL_FALSE,
+        offset,
+        pattern_size,
+        period->data(),
+        wait_events.size(),
+        wait_events.empty() ? nullptr : wait_events.data(),
+        &filled_event);
+    if (ret != CL_SUCCESS) {
+        delete period;
+    }
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to write fill pattern");
+    ret = clSetEventCallback(filled_event, CL_COMPLETE, OnPeriodUploaded, period);
+    if (ret != CL_SUCCESS) {
+        std::cout << "OpenCL error: Failed to set fill pattern callback (" << ret << ")" << std::endl;
+        clWaitForEvents(1, &filled_event);
+        delete period;
+    }
+    // Every copy doubles the filled part, its source and destination never overlap.
+    size_t filled = pattern_size;
+    while (filled < size) {
+        const size_t copy_size = std::min(filled, size - filled);
+        cl_event copy_event = nullptr;
+        ret = clEnqueueCopyBuffer(
+            command_queue_, buffer_, buffer_, offset, offset + filled, copy_size, 1, &filled_event, &copy_event);
+        clReleaseEvent(filled_event);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to copy fill pattern");
+        filled_event = copy_event;
+        filled += copy_size;
+    }
+    *out_event = filled_event;
+    return true;
+}
+
+bool Buffer::BufferImpl::CheckRange(size_t buffer_size, size_t size, size_t offset)
+{
+    if (offset > buffer_size || size > buffer_size - offset) {
+        std::cout << "Copy range out of buffer: offset " << offset << ", size " << size << ", buffer size "
+                  << buffer_size << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Buffer::BufferImpl::Complete(cl_command_queue queue, const char *name, cl_event out_event, Event *event) const
+{
+    if (profiler_->IsEnabled()) {
+        profiler_->Track(name, queue, out_event);
+    }
+    if (event != nullptr) {
+        *event = Event(out_event);
+    } else if (out_event != nullptr) {
+        clReleaseEvent(out_event);
+    }
+}
+
+Buffer::Buffer(BufferImpl *impl) { impl_.reset(impl); }
+
+cl_mem Buffer::GetClMem() const
+{
+    if (impl_ == nullptr) {
+        return nullptr;
+    }
+    return impl_->GetClMem();
+}
+
+void *Buffer::GetHostPtrImpl() const
+{
+    if (impl_ == nullptr) {
+        return nullptr;
+    }
+    return impl_->GetHostPtr();
+}
+
+size_t Buffer::GetSize() const
+{
+    if (impl_ == nullptr) {
+        return 0;
+    }
+    return impl_->GetSize();
+}
+
+BufferMode Buffer::GetMode() const
+{
+    if (impl_ == nullptr) {
+        return BufferMode::HostVisiblePersistent;
+    }
+    return impl_->GetMode();
+}
+
+BufferMapping Buffer::Map(size_t offset, size_t size, MapAccess access) const
+{
+    if (impl_ == nullptr) {
+        return BufferMapping();
+    }
+    return impl_->Map(offset, size, access);
+}
+
+bool Buffer::Memcpy(void *host_ptr, size_t size, MemcpyKind kind) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Memcpy(nullptr, host_ptr, size, 0, kind, {}, nullptr);
+}
+
+bool Buffer::Memcpy(void *host_ptr,
+    size_t size,
+    MemcpyKind kind,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Memcpy(nullptr, host_ptr, size, 0, kind, wait_events, event);
+}
+
+bool Buffer::Memcpy(const Queue &queue,
+    void *host_ptr,
+    size_t size,
+    MemcpyKind kind,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Memcpy(queue.GetClCommandQueue(), host_ptr, size, 0, kind, wait_events, event);
+}
+
+bool Buffer::Memcpy(void *host_ptr,
+    size_t size,
+    size_t offset,
+    MemcpyKind kind,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Memcpy(nullptr, host_ptr, size, offset, kind, wait_events, event);
+}
+
+bool Buffer::Memcpy(const Queue &queue,
+    void *host_ptr,
+    size_t size,
+    size_t offset,
+    MemcpyKind kind,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Memcpy(queue.GetClCommandQueue(), host_ptr, size, offset, kind, wait_events, event);
+}
+
+bool Buffer::MemcpyRect(void *host_ptr,
+    const BufferRect &rect,
+    MemcpyKind kind,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->MemcpyRect(host_ptr, rect, kind, wait_events, event);
+}
+
+bool Buffer::Fill(const void *pattern,
+    size_t pattern_size,
+    size_t offset,
+    size_t size,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Fill(pattern, pattern_size, offset, size, wait_events, event);
+}
+
+bool Buffer::CopyFrom(const Buffer &src,
+    size_t size,
+    size_t src_offset,
+    size_t dst_offset,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr || src.impl_ == nullptr) {
+        return false;
+    }
+    return impl_->CopyFrom(*src.impl_, size, src_offset, dst_offset, wait_events, event);
+}
+
+class BufferArena::BufferArenaImpl final {
+public:
+    explicit BufferArenaImpl(BufferManager *manager,
+        Profiler *profiler,
+        cl_command_queue command_queue,
+        cl_mem buffer,
+        size_t capacity,
+        BufferMode mode,
+        void *host_ptr);
+    ~BufferArenaImpl();
+    BufferArenaImpl() = delete;
+    BufferArenaImpl(const BufferArenaImpl &) = delete;
+    BufferArenaImpl &operator=(const BufferArenaImpl &) = delete;
+    BufferArenaImpl(BufferArenaImpl &&) = delete;
+    BufferArenaImpl &operator=(BufferArenaImpl &&) = delete;
+
+    std::shared_ptr<Buffer> Allocate(size_t size) const;
+    void Reset() const;
+    size_t GetCapacity() const;
+    size_t GetUsedSize() const;
+
+private:
+    BufferManager *manager_;
+    Profiler *profiler_;
+    cl_command_queue command_queue_;
+    cl_mem buffer_;
+    size_t capacity_;
+    BufferMode mode_;
+    void *host_ptr_;
+    mutable std::atomic<size_t> offset_{0};
+};
+
+BufferArena::BufferArenaImpl::BufferArenaImpl(BufferManager *manager,
+    Profiler *profiler,
+    cl_command_queue command_queue,
+    cl_mem buffer,
+    size_t capacity,
+    BufferMode mode,
+    void *host_ptr)
+    : manager_(manager),
+      profiler_(profiler),
+      command_queue_(command_queue),
+      buffer_(buffer),
+      capacity_(capacity),
+      mode_(mode),
+      host_ptr_(host_ptr)
+{
+}
+
+BufferArena::BufferArenaImpl::~BufferArenaImpl() { manager_->Release(buffer_); }
+
+std::shared_ptr<Buffer> BufferArena::BufferArenaImpl::Allocate(size_t size) const
+{
+    if (size == 0) {
+        std::cout << "Invalid buffer size: " << size << std::endl;
+        return nullptr;
+    }
+    const size_t alignment = manager_->GetAlignment();
+    size_t offset = offset_.load(std::memory_order_relaxed);
+    size_t origin;
+    do {
+        origin = (offset + alignment - 1) / alignment * alignment;
+        if (origin > capacity_ || size > capacity_ - origin) {
+            std::cout << "BufferArena is full: " << size << " bytes requested, " << capacity_ - offset
+                      << " bytes left" << std::endl;
+            return nullptr;
+        }
+    } while (!offset_.compare_exchange_weak(offset, origin + size, std::memory_order_relaxed));
+
+    cl_mem buffer = manager_->CreateSubBuffer(buffer_, origin, size);
+    if (buffer == nullptr) {
+        return nullptr;
+    }
+    std::unique_ptr<Buffer::BufferImpl> buffer_impl(new (std::nothrow) Buffer::BufferImpl(manager_,
+        profiler_,
+        command_queue_,
+        buffer,
+        size,
+        mode_,
+        host_ptr_ == nullptr ? nullptr : static_cast<char *>(host_ptr_) + origin));
+    if (!buffer_impl) {
+        manager_->Release(buffer);
+        return nullptr;
+    }
+    return std::make_shared<Buffer>(buffer_impl.release());
+}
+
+void BufferArena::BufferArenaImpl::Reset() const { offset_.store(0, std::memory_order_relaxed); }
+
+size_t BufferArena::BufferArenaImpl::GetCapacity() const { return capacity_; }
+
+size_t BufferArena::BufferArenaImpl::GetUsedSize() const { return offset_.load(std::memory_order_relaxed); }
+
+BufferArena::BufferArena(BufferArenaImpl *impl) { impl_.reset(impl); }
+
+BufferArena::~BufferArena() = default;
+
+std::shared_ptr<Buffer> BufferArena::Allocate(size_t size) const
+{
+    if (impl_ == nullptr) {
+        return nullptr;
+    }
+    return impl_->Allocate(size);
+}
+
+void BufferArena::Reset() const
+{
+    if (impl_ == nullptr) {
+        return;
+    }
+    impl_->Reset();
+}
+
+size_t BufferArena::GetCapacity() const
+{
+    if (impl_ == nullptr) {
+        return 0;
+    }
+    return impl_->GetCapacity();
+}
+
+size_t BufferArena::GetUsedSize() const
+{
+    if (impl_ == nullptr) {
+        return 0;
+    }
+    return impl_->GetUsedSize();
+}
+
+class StreamingPipeline::StreamingPipelineImpl final {
+public:
+    explicit StreamingPipelineImpl(const StreamConfig &config,
+        std::shared_ptr<Queue> upload_queue,
+        std::shared_ptr<Queue> compute_queue,
+        std::shared_ptr<Queue> download_queue,
+        std::vector<std::shared_ptr<Buffer>> inputs,
+        std::vector<std::shared_ptr<Buffer>> outputs);
+    ~StreamingPipelineImpl() = default;
+    StreamingPipelineImpl() = delete;
+    StreamingPipelineImpl(const StreamingPipelineImpl &) = delete;
+    StreamingPipelineImpl &operator=(const StreamingPipelineImpl &) = delete;
+    StreamingPipelineImpl(StreamingPipelineImpl &&) = delete;
+    StreamingPipelineImpl &operator=(StreamingPipelineImpl &&) = delete;
+
+    bool Run(const void *input, size_t input_size, void *output, size_t output_size, const StreamLaunch &launch) const;
+    StreamStatistics GetStatistics() const;
+
+private:
+    static uint64_t GetDuration(const Event &event);
+
+    StreamConfig config_;
+    std::shared_ptr<Queue> upload_queue_;
+    std::shared_ptr<Queue> compute_queue_;
+    std::shared_ptr<Queue> download_queue_;
+    std::vector<std::shared_ptr<Buffer>> inputs_;
+    std::vector<std::shared_ptr<Buffer>> outputs_;
+    mutable StreamStatistics statistics_;
+    // The staging buffers are shared by all the chunks, so only one Run is in flight at a time.
+    mutable std::mutex mutex_;
+};
+
+StreamingPipeline::StreamingPipelineImpl::StreamingPipelineImpl(const StreamConfig &config,
+    std::shared_ptr<Queue> upload_queue,
+    std::shared_ptr<Queue> compute_queue,
+    std::shared_ptr<Queue> download_queue,
+    std::vector<std::shared_ptr<Buffer>> inputs,
+    std::vector<std::shared_ptr<Buffer>> outputs)
+    : config_(config),
+      upload_queue_(std::move(upload_queue)),
+      compute_queue_(std::move(compute_queue)),
+      download_queue_(std::move(download_queue)),
+      inputs_(std::move(inputs)),
+      outputs_(std::move(outputs))
+{
+}
+
+bool StreamingPipeline::StreamingPipelineImpl::Run(
+    const void *input, size_t input_size, void *output, size_t output_size, const StreamLaunch &launch) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (input == nullptr || output == nullptr || input_size == 0 || !launch) {
+        std::cout << "Invalid stream input or output" << std::endl;
+        return false;
+    }
+    const size_t num_chunks = (input_size + config_.chunk_size - 1) / config_.chunk_size;
+    if (output_size > num_chunks * config_.output_chunk_size ||
+        output_size <= (num_chunks - 1) * config_.output_chunk_size) {
+        std::cout << "Output size " << output_size << " does not match " << num_chunks << " chunks" << std::endl;
+        return false;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const size_t num_stages = inputs_.size();
+    std::vector<Event> uploads(num_chunks);
+    std::vector<Event> computes(num_chunks);
+    std::vector<Event> downloads(num_chunks);
+    bool ret = true;
+    for (size_t i = 0; i < num_chunks && ret; ++i) {
+        const size_t stage = i % num_stages;
+        StreamChunk chunk;
+        chunk.index = i;
+        chunk.input_offset = i * config_.chunk_size;
+        chunk.input_size = std::min(config_.chunk_size, input_size - chunk.input_offset);
+        chunk.output_offset = i * config_.output_chunk_size;
+        chunk.output_size = std::min(config_.output_chunk_size, output_size - chunk.output_offset);
+
+        // The staging buffers of a stage are free again once the previous chunk of the stage has been computed and
+        // downloaded, which is the only synchronization between the queues.
+        std::vector<Event> upload_wait;
+        std::vector<Event> compute_wait;
+        if (i >= num_stages) {
+            upload_wait.emplace_back(computes[i - num_stages]);
+            compute_wait.emplace_back(downloads[i - num_stages]);
+        }
+        ret = inputs_[stage]->Memcpy(*upload_queue_,
+            const_cast<uint8_t *>(static_cast<const uint8_t *>(input) + chunk.input_offset),
+            chunk.input_size,
+            0,
+            MemcpyKind::HostToDevice,
+            upload_wait,
+            &uploads[i]);
+        compute_wait.emplace_back(uploads[i]);
+        ret = ret && launch(*compute_queue_, *inputs_[stage], *outputs_[stage], chunk, compute_wait, &computes[i]);
+        if (ret && !computes[i].IsValid()) {
+            std::cout << "The stream launch of chunk " << i << " did not set its event" << std::endl;
+            ret = false;
+        }
+        ret = ret && outputs_[stage]->Memcpy(*download_queue_,
+            static_cast<uint8_t *>(output) + chunk.output_offset,
+            chunk.output_size,
+            0,
+            MemcpyKind::DeviceToHost,
+            {computes[i]},
+            &downloads[i]);
+        upload_queue_->Flush();
+        compute_queue_->Flush();
+        download_queue_->Flush();
+    }
+    // Wait even after a failure, the host memory must not be accessed by the device once Run returns.
+    std::vector<Event> events;
+    events.insert(events.end(), uploads.begin(), uploads.end());
+    events.insert(events.end(), computes.begin(), computes.end());
+    events.insert(events.end(), downloads.begin(), downloads.end());
+    ret = Event::WaitAll(events) && ret;
+
+    statistics_ = StreamStatistics();
+    statistics_.chunks = num_chunks;
+    statistics_.input_bytes = input_size;
+    statistics_.output_bytes = output_size;
+    statistics_.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < num_chunks; ++i) {
+        statistics_.upload_ns += GetDuration(uploads[i]);
+        statistics_.compute_ns += GetDuration(computes[i]);
+        statistics_.download_ns += GetDuration(downloads[i]);
+    }
+    return ret;
+}
+
+StreamStatistics StreamingPipeline::StreamingPipelineImpl::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
+
+uint64_t StreamingPipeline::StreamingPipelineImpl::GetDuration(const Event &event)
+{
+    if (!event.IsValid()) {
+        return 0;
+    }
+    cl_ulong start = 0;
+    cl_ulong end = 0;
+    cl_event cl_event = event.GetClEvent();
+    if (clGetEventProfilingInfo(cl_event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr) != CL_SUCCESS ||
+        clGetEventProfilingInfo(cl_event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr) != CL_SUCCESS) {
+        return 0;
+    }
+    return end > start ? end - start : 0;
+}
+
+StreamingPipeline::StreamingPipeline(StreamingPipelineImpl *impl) { impl_.reset(impl); }
+
+StreamingPipeline::~StreamingPipeline() = default;
+
+bool StreamingPipeline::Run(
+    const void *input, size_t input_size, void *output, size_t output_size, const StreamLaunch &launch) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Run(input, input_size, output, output_size, launch);
+}
+
+StreamStatistics StreamingPipeline::GetStatistics() const
+{
+    if (impl_ == nullptr) {
+        return StreamStatistics();
+    }
+    return impl_->GetStatistics();
+}
+
+class Algorithms::AlgorithmsImpl final {
+public:
+    /**
+     * @brief The embedded kernels built for one work group size
+     *
+     */
+    struct Kernels {
+        std::shared_ptr<Kernel> transform_buffer;
+        std::shared_ptr<Kernel> transform_scalar;
+        std::shared_ptr<Kernel> reduce;
+        std::shared_ptr<Kernel> scan_blocks_float;
+        std::shared_ptr<Kernel> add_block_offsets_float;
+        std::shared_ptr<Kernel> scan_blocks_uint;
+        std::shared_ptr<Kernel> add_block_offsets_uint;
+        std::shared_ptr<Kernel> compact_scatter;
+        std::shared_ptr<Kernel> radix_count;
+        std::shared_ptr<Kernel> radix_scatter;
+        std::shared_ptr<Kernel> histogram;
+    };
+
+    explicit AlgorithmsImpl(BufferManager *manager,
+        std::shared_ptr<Queue> queue,
+        Kernels kernels,
+        uint32_t work_group_size,
+        uint32_t compute_units);
+    ~AlgorithmsImpl();
+    AlgorithmsImpl() = delete;
+    AlgorithmsImpl(const AlgorithmsImpl &) = delete;
+    AlgorithmsImpl &operator=(const AlgorithmsImpl &) = delete;
+    AlgorithmsImpl(AlgorithmsImpl &&) = delete;
+    AlgorithmsImpl &operator=(AlgorithmsImpl &&) = delete;
+
+    bool Transform(const Buffer &a,
+        const Buffer *b,
+        float scalar,
+        const Buffer &output,
+        size_t count,
+        TransformOp op,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    bool Reduce(const Buffer &input,
+        size_t count,
+        ReduceOp op,
+        const Buffer &result,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    bool Reduce(const Buffer &input, size_t count, ReduceOp op, float *result) const;
+    bool Scan(const Buffer &input,
+        const Buffer &output,
+        size_t count,
+        bool inclusive,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    bool RadixSort(const Buffer &keys,
+        const Buffer *values,
+        size_t count,
+        uint32_t key_bits,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    bool Histogram(const Buffer &input,
+        size_t count,
+        float lower,
+        float upper,
+        const Buffer &bins,
+        uint32_t num_bins,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    bool StreamCompact(const Buffer &input,
+        const Buffer &flags,
+        size_t count,
+        const Buffer &output,
+        const Buffer &output_count,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    uint32_t GetWorkGroupSize() const;
+
+private:
+    /**
+     * @brief The scratch buffers, the scans take two slots per level from kScanLevels on
+     *
+     */
+    enum ScratchSlot : uint32_t {
+        kReduceResult,
+        kCompactPositions,
+        kRadixCounts,
+        kRadixOffsets,
+        kRadixKeys,
+        kRadixValues,
+        kScanLevels,
+    };
+
+    bool EnqueueReduce(cl_mem input,
+        size_t count,
+        ReduceOp op,
+        cl_mem result,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    bool EnqueueScan(const Kernel &scan_blocks,
+        const Kernel &add_block_offsets,
+        cl_mem input,
+        cl_mem output,
+        size_t count,
+        bool inclusive,
+        bool predicate,
+        uint32_t level,
+        const std::vector<Event> &wait_events,
+        Event *event) const;
+    cl_mem ReserveScratch(uint32_t slot, size_t size) const;
+    size_t GetNumGroups(size_t count) const;
+    bool Complete(Event &done, Event *event) const;
+    static bool CheckCount(size_t count);
+    static bool CheckBuffer(const Buffer &buffer, size_t size);
+
+    BufferManager *manager_;
+    std::shared_ptr<Queue> queue_;
+    Kernels kernels_;
+    uint32_t work_group_size_;
+    uint32_t tile_size_;
+    uint32_t max_groups_;
+    // The scratch buffers are unpooled, so a replaced scratch buffer is only freed once the commands using it are done.
+    mutable std::map<uint32_t, std::pair<cl_mem, size_t>> scratch_;
+    // The commands of a call share the scratch buffers and rely on the in-order queue, so calls enqueue one at a time.
+    mutable std::mutex mutex_;
+};
+
+Algorithms::AlgorithmsImpl::AlgorithmsImpl(BufferManager *manager,
+    std::shared_ptr<Queue> queue,
+    Kernels kernels,
+    uint32_t work_group_size,
+    uint32_t compute_units)
+    : manager_(manager),
+      queue_(std::move(queue)),
+      kernels_(std::move(kernels)),
+      work_group_size_(work_group_size),
+      tile_size_(work_group_size * kAlgorithmsElementsPerWorkItem),
+      max_groups_(std::max<uint32_t>(compute_units, 1) * kGroupsPerComputeUnit)
+{
+}
+
+Algorithms::AlgorithmsImpl::~AlgorithmsImpl()
+{
+    for (const auto &scratch : scratch_) {
+        manager_->Release(scratch.second.first);
+    }
+}
+
+bool Algorithms::AlgorithmsImpl::Transform(const Buffer &a,
+    const Buffer *b,
+    float scalar,
+    const Buffer &output,
+    size_t count,
+    TransformOp op,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (!CheckCount(count) || !CheckBuffer(a, count * sizeof(float)) ||
+        (b != nullptr && !CheckBuffer(*b, count * sizeof(float))) || !CheckBuffer(output, count * sizeof(float))) {
+        return false;
+    }
+    const size_t global_size = DivideUp(DivideUp(count, kAlgorithmsElementsPerWorkItem), work_group_size_) *
+                               work_group_size_;
+    Event done;
+    const bool ret = b != nullptr
+        ? kernels_.transform_buffer->RunAsync(*queue_,
+              {global_size},
+              {work_group_size_},
+              wait_events,
+              &done,
+              a.GetClMem(),
+              b->GetClMem(),
+              output.GetClMem(),
+              static_cast<cl_uint>(count),
+              static_cast<cl_int>(op))
+        : kernels_.transform_scalar->RunAsync(*queue_,
+              {global_size},
+              {work_group_size_},
+              wait_events,
+              &done,
+              a.GetClMem(),
+              scalar,
+              output.GetClMem(),
+              static_cast<cl_uint>(count),
+              static_cast<cl_int>(op));
+    return ret && Complete(done, event);
+}
+
+bool Algorithms::AlgorithmsImpl::Reduce(const Buffer &input,
+    size_t count,
+    ReduceOp op,
+    const Buffer &result,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (!CheckCount(count) || !CheckBuffer(input, count * sizeof(float)) || !CheckBuffer(result, sizeof(float))) {
+        return false;
+    }
+    Event done;
+    return EnqueueReduce(input.GetClMem(), count, op, result.GetClMem(), wait_events, &done) && Complete(done, event);
+}
+
+bool Algorithms::AlgorithmsImpl::Reduce(const Buffer &input, size_t count, ReduceOp op, float *result) const
+{
+    if (result == nullptr || !CheckCount(count) || !CheckBuffer(input, count * sizeof(float))) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    cl_mem result_buffer = ReserveScratch(kReduceResult, sizeof(float));
+    if (result_buffer == nullptr || !EnqueueReduce(input.GetClMem(), count, op, result_buffer, {}, nullptr)) {
+        return false;
+    }
+    cl_int ret = clEnqueueReadBuffer(
+        queue_->GetClCommandQueue(), result_buffer, CL_TRUE, 0, sizeof(float), result, 0, nullptr, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to read reduction result");
+    return true;
+}
+
+bool Algorithms::AlgorithmsImpl::Scan(const Buffer &input,
+    const Buffer &output,
+    size_t count,
+    bool inclusive,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (!CheckCount(count) || !CheckBuffer(input, count * sizeof(float)) ||
+        !CheckBuffer(output, count * sizeof(float))) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    Event done;
+    return EnqueueScan(*kernels_.scan_blocks_float,
+               *kernels_.add_block_offsets_float,
+               input.GetClMem(),
+               output.GetClMem(),
+               count,
+               inclusive,
+               false,
+               0,
+               wait_events,
+               &done) &&
+           Complete(done, event);
+}
+
+bool Algorithms::AlgorithmsImpl::RadixSort(const Buffer &keys,
+    const Buffer *values,
+    size_t count,
+    uint32_t key_bits,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (!CheckCount(count) || !CheckBuffer(keys, count * sizeof(uint32_t)) ||
+        (values != nullptr && !CheckBuffer(*values, count * sizeof(uint32_t)))) {
+        return false;
+    }
+    if (key_bits == 0 || key_bits > 32) {
+        std::cout << "Invalid number of key bits: " << key_bits << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t num_tiles = DivideUp(count, tile_size_);
+    const size_t num_counts = num_tiles << kAlgorithmsRadixBits;
+    cl_mem counts = ReserveScratch(kRadixCounts, num_counts * sizeof(uint32_t));
+    cl_mem offsets = ReserveScratch(kRadixOffsets, num_counts * sizeof(uint32_t));
+    cl_mem scratch_keys = ReserveScratch(kRadixKeys, count * sizeof(uint32_t));
+    cl_mem scratch_values = values != nullptr ? ReserveScratch(kRadixValues, count * sizeof(uint32_t)) : nullptr;
+    if (counts == nullptr || offsets == nullptr || scratch_keys == nullptr ||
+        (values != nullptr && scratch_values == nullptr)) {
+        return false;
+    }
+    // Every pass sorts stably by the next digit, ping-ponging between the buffers and the scratch buffers.
+    const uint32_t num_passes = DivideUp(key_bits, kAlgorithmsRadixBits);
+    const size_t global_size = num_tiles * work_group_size_;
+    cl_mem src_keys = keys.GetClMem();
+    cl_mem src_values = values != nullptr ? values->GetClMem() : nullptr;
+    cl_mem dst_keys = scratch_keys;
+    cl_mem dst_values = scratch_values;
+    Event done;
+    for (uint32_t pass = 0; pass < num_passes; ++pass) {
+        const cl_uint shift = pass * kAlgorithmsRadixBits;
+        if (!kernels_.radix_count->RunAsync(*queue_,
+                {global_size},
+                {work_group_size_},
+                pass == 0 ? wait_events : std::vector<Event>(),
+                nullptr,
+                src_keys,
+                static_cast<cl_uint>(count),
+                shift,
+                counts) ||
+            !EnqueueScan(*kernels_.scan_blocks_uint,
+                *kernels_.add_block_offsets_uint,
+                counts,
+                offsets,
+                num_counts,
+                false,
+                false,
+                0,
+                {},
+                nullptr) ||
+            !kernels_.radix_scatter->RunAsync(*queue_,
+                {global_size},
+                {work_group_size_},
+                {},
+                &done,
+                src_keys,
+                src_values,
+                static_cast<cl_uint>(count),
+                shift,
+                offsets,
+                dst_keys,
+                dst_values,
+                static_cast<cl_uint>(values != nullptr))) {
+            return false;
+        }
+        std::swap(src_keys, dst_keys);
+        std::swap(src_values, dst_values);
+    }
+    if (num_passes % 2 != 0) {
+        // An odd number of passes leaves the sorted keys in the scratch buffers.
+        cl_event copy_event = nullptr;
+        cl_int ret = clEnqueueCopyBuffer(queue_->GetClCommandQueue(),
+            scratch_keys,
+            keys.GetClMem(),
+            0,
+            0,
+            count * sizeof(uint32_t),
+            0,
+            nullptr,
+            values != nullptr ? nullptr : &copy_event);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to copy sorted keys");
+        if (values != nullptr) {
+            ret = clEnqueueCopyBuffer(queue_->GetClCommandQueue(),
+                scratch_values,
+                values->GetClMem(),
+                0,
+                0,
+                count * sizeof(uint32_t),
+                0,
+                nullptr,
+                &copy_event);
+            CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to copy sorted values");
+        }
+        done = Event(copy_event);
+    }
+    return Complete(done, event);
+}
+
+bool Algorithms::AlgorithmsImpl::Histogram(const Buffer &input,
+    size_t count,
+    float lower,
+    float upper,
+    const Buffer &bins,
+    uint32_t num_bins,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (!CheckCount(count) || !CheckBuffer(input, count * sizeof(float)) ||
+        !CheckBuffer(bins, static_cast<size_t>(num_bins) * sizeof(uint32_t))) {
+        return false;
+    }
+    const float scale = static_cast<float>(num_bins) / (upper - lower);
+    if (num_bins == 0 || !(upper > lower) || !std::isfinite(scale)) {
+        std::cout << "Invalid histogram range [" << lower << ", " << upper << ") or " << num_bins << " bins"
+                  << std::endl;
+        return false;
+    }
+    const cl_uint zero = 0;
+    std::vector<cl_event> cl_wait_events = GetClEvents(wait_events);
+    cl_int ret = clEnqueueFillBuffer(queue_->GetClCommandQueue(),
+        bins.GetClMem(),
+        &zero,
+        sizeof(zero),
+        0,
+        static_cast<size_t>(num_bins) * sizeof(uint32_t),
+        cl_wait_events.size(),
+        cl_wait_events.empty() ? nullptr : cl_wait_events.data(),
+        nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to clear histogram bins");
+    Event done;
+    return kernels_.histogram->RunAsync(*queue_,
+               {GetNumGroups(count) * work_group_size_},
+               {work_group_size_},
+               {},
+               &done,
+               input.GetClMem(),
+               static_cast<cl_uint>(count),
+               static_cast<cl_uint>(num_bins),
+               lower,
+               scale,
+               bins.GetClMem()) &&
+           Complete(done, event);
+}
+
+bool Algorithms::AlgorithmsImpl::StreamCompact(const Buffer &input,
+    const Buffer &flags,
+    size_t count,
+    const Buffer &output,
+    const Buffer &output_count,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (!CheckCount(count) || !CheckBuffer(input, count * sizeof(uint32_t)) ||
+        !CheckBuffer(flags, count * sizeof(uint32_t)) || !CheckBuffer(output, count * sizeof(uint32_t)) ||
+        !CheckBuffer(output_count, sizeof(uint32_t))) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    cl_mem positions = ReserveScratch(kCompactPositions, count * sizeof(uint32_t));
+    if (positions == nullptr) {
+        return false;
+    }
+    // The exclusive scan of the flags turned into 0 and 1 is the output position of every kept element.
+    const size_t global_size = DivideUp(DivideUp(count, kAlgorithmsElementsPerWorkItem), work_group_size_) *
+                               work_group_size_;
+    Event done;
+    return EnqueueScan(*kernels_.scan_blocks_uint,
+               *kernels_.add_block_offsets_uint,
+               flags.GetClMem(),
+               positions,
+               count,
+               false,
+               true,
+               0,
+               wait_events,
+               nullptr) &&
+           kernels_.compact_scatter->RunAsync(*queue_,
+               {global_size},
+               {work_group_size_},
+               {},
+               &done,
+               input.GetClMem(),
+               flags.GetClMem(),
+               positions,
+               static_cast<cl_uint>(count),
+               output.GetClMem(),
+               output_count.GetClMem()) &&
+           Complete(done, event);
+}
+
+uint32_t Algorithms::AlgorithmsImpl::GetWorkGroupSize() const { return work_group_size_; }
+
+bool Algorithms::AlgorithmsImpl::EnqueueReduce(cl_mem input,
+    size_t count,
+    ReduceOp op,
+    cl_mem result,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    const float identity = op == ReduceOp::Sum ? 0.0f
+                           : op == ReduceOp::Min ? std::numeric_limits<float>::infinity()
+                                                 : -std::numeric_limits<float>::infinity();
+    std::vector<cl_event> cl_wait_events = GetClEvents(wait_events);
+    cl_int ret = clEnqueueFillBuffer(queue_->GetClCommandQueue(),
+        result,
+        &identity,
+        sizeof(identity),
+        0,
+        sizeof(identity),
+        cl_wait_events.size(),
+        cl_wait_events.empty() ? nullptr : cl_wait_events.data(),
+        nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to initialize reduction result");
+    return kernels_.reduce->RunAsync(*queue_,
+        {GetNumGroups(count) * work_group_size_},
+        {work_group_size_},
+        {},
+        event,
+        input,
+        static_cast<cl_uint>(count),
+        static_cast<cl_int>(op),
+        result);
+}
+
+bool Algorithms::AlgorithmsImpl::EnqueueScan(const Kernel &scan_blocks,
+    const Kernel &add_block_offsets,
+    cl_mem input,
+    cl_mem output,
+    size_t count,
+    bool inclusive,
+    bool predicate,
+    uint32_t level,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    const size_t num_blocks = DivideUp(count, tile_size_);
+    const size_t global_size = num_blocks * work_group_size_;
+    // float and uint32_t elements are both 4 bytes, so both scans share the scratch buffers.
+    cl_mem block_sums = ReserveScratch(kScanLevels + 2 * level, num_blocks * sizeof(uint32_t));
+    if (block_sums == nullptr ||
+        !scan_blocks.RunAsync(*queue_,
+            {global_size},
+            {work_group_size_},
+            wait_events,
+            num_blocks == 1 ? event : nullptr,
+            input,
+            output,
+            static_cast<cl_uint>(count),
+            block_sums,
+            static_cast<cl_uint>(inclusive),
+            static_cast<cl_uint>(predicate))) {
+        return false;
+    }
+    if (num_blocks == 1) {
+        return true;
+    }
+    // The tile totals are scanned by the same kernels one level up and added to the tiles of this level.
+    cl_mem block_offsets = ReserveScratch(kScanLevels + 2 * level + 1, num_blocks * sizeof(uint32_t));
+    return block_offsets != nullptr &&
+           EnqueueScan(scan_blocks,
+               add_block_offsets,
+               block_sums,
+               block_offsets,
+               num_blocks,
+               false,
+               false,
+               level + 1,
+               {},
+               nullptr) &&
+           add_block_offsets.RunAsync(*queue_,
+               {global_size},
+               {work_group_size_},
+               {},
+               event,
+               output,
+               static_cast<cl_uint>(count),
+               block_offsets);
+}
+
+cl_mem Algorithms::AlgorithmsImpl::ReserveScratch(uint32_t slot, size_t size) const
+{
+    auto scratch_iter = scratch_.find(slot);
+    if (scratch_iter != scratch_.end()) {
+        if (scratch_iter->second.second >= size) {
+            return scratch_iter->second.first;
+        }
+        manager_->Release(scratch_iter->second.first);
+        scratch_.erase(scratch_iter);
+    }
+    void *host_ptr = nullptr;
+    cl_mem buffer = manager_->CreateUnpooled(size, BufferMode::DeviceOnly, &host_ptr);
+    if (buffer == nullptr) {
+        std::cout << "Failed to create algorithm scratch buffer of " << size << " bytes" << std::endl;
+        return nullptr;
+    }
+    scratch_.emplace(slot, std::make_pair(buffer, size));
+    return buffer;
+}
+
+size_t Algorithms::AlgorithmsImpl::GetNumGroups(size_t count) const
+{
+    // Enough work groups to fill the device, every work item then folds several float4 in registers.
+    const size_t num_groups = DivideUp(DivideUp(count, kAlgorithmsElementsPerWorkItem), work_group_size_);
+    return std::max<size_t>(1, std::min<size_t>(num_groups, max_groups_));
+}
+
+bool Algorithms::AlgorithmsImpl::Complete(Event &done, Event *event) const
+{
+    if (event == nullptr) {
+        return done.Wait();
+    }
+    *event = std::move(done);
+    return queue_->Flush();
+}
+
+bool Algorithms::AlgorithmsImpl::CheckCount(size_t count)
+{
+    if (count == 0 || count > kMaxAlgorithmElements) {
+        std::cout << "Invalid element count: " << count << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Algorithms::AlgorithmsImpl::CheckBuffer(const Buffer &buffer, size_t size)
+{
+    if (buffer.GetClMem() == nullptr || buffer.GetSize() < size) {
+        std::cout << "Buffer of " << buffer.GetSize() << " bytes is smaller than " << size << " bytes" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+Algorithms::Algorithms(AlgorithmsImpl *impl) { impl_.reset(impl); }
+
+Algorithms::~Algorithms() = default;
+
+bool Algorithms::Transform(const Buffer &a,
+    const Buffer &b,
+    const Buffer &output,
+    size_t count,
+    TransformOp op,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Transform(a, &b, 0.0f, output, count, op, wait_events, event);
+}
+
+bool Algorithms::Transform(const Buffer &a,
+    float b,
+    const Buffer &output,
+    size_t count,
+    TransformOp op,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Transform(a, nullptr, b, output, count, op, wait_events, event);
+}
+
+bool Algorithms::Reduce(const Buffer &input,
+    size_t count,
+    ReduceOp op,
+    const Buffer &result,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Reduce(input, count, op, result, wait_events, event);
+}
+
+bool Algorithms::Reduce(const Buffer &input, size_t count, ReduceOp op, float *result) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Reduce(input, count, op, result);
+}
+
+bool Algorithms::InclusiveScan(const Buffer &input,
+    const Buffer &output,
+    size_t count,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Scan(input, output, count, true, wait_events, event);
+}
+
+bool Algorithms::ExclusiveScan(const Buffer &input,
+    const Buffer &output,
+    size_t count,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Scan(input, output, count, false, wait_events, event);
+}
+
+bool Algorithms::RadixSort(const Buffer &keys,
+    size_t count,
+    uint32_t key_bits,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->RadixSort(keys, nullptr, count, key_bits, wait_events, event);
+}
+
+bool Algorithms::RadixSortByKey(const Buffer &keys,
+    const Buffer &values,
+    size_t count,
+    uint32_t key_bits,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->RadixSort(keys, &values, count, key_bits, wait_events, event);
+}
+
+bool Algorithms::Histogram(const Buffer &input,
+    size_t count,
+    float lower,
+    float upper,
+    const Buffer &bins,
+    uint32_t num_bins,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Histogram(input, count, lower, upper, bins, num_bins, wait_events, event);
+}
+
+bool Algorithms::StreamCompact(const Buffer &input,
+    const Buffer &flags,
+    size_t count,
+    const Buffer &output,
+    const Buffer &output_count,
+    const std::vector<Event> &wait_events,
+    Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->StreamCompact(input, flags, count, output, output_count, wait_events, event);
+}
+
+uint32_t Algorithms::GetWorkGroupSize() const
+{
+    if (impl_ == nullptr) {
+        return 0;
+    }
+    return impl_->GetWorkGroupSize();
+}
+
+class CommandGraph::CommandGraphImpl final {
+public:
+    explicit CommandGraphImpl(cl_command_queue queue, Profiler *profiler);
+    ~CommandGraphImpl();
+    CommandGraphImpl() = delete;
+    CommandGraphImpl(const CommandGraphImpl &) = delete;
+    CommandGraphImpl &operator=(const CommandGraphImpl &) = delete;
+    CommandGraphImpl(CommandGraphImpl &&) = delete;
+    CommandGraphImpl &operator=(CommandGraphImpl &&) = delete;
+
+    bool RecordKernel(const Kernel::KernelImpl &kernel,
+        const KernelArg *args,
+        size_t num_args,
+        const std::vector<size_t> &global_size,
+        const std::vector<size_t> &local_size,
+        const std::vector<uint32_t> &dependencies,
+        uint32_t *node);
+    bool RecordMemcpy(cl_mem buffer,
+        void *host_ptr,
+        size_t size,
+        MemcpyKind kind,
+        const std::vector<uint32_t> &dependencies,
+        uint32_t *node);
+    bool Finalize();
+    bool Replay(const std::vector<GraphArgPatch> &patches, const std::vector<Event> &wait_events, Event *event);
+    bool IsCommandBuffer() const;
+
+private:
+    struct Node {
+        // nullptr for the copies.
+        std::unique_ptr<_cl_kernel, decltype(&clReleaseKernel)> kernel{nullptr, clReleaseKernel};
+        std::vector<size_t> global_size;
+        std::vector<size_t> local_size;
+        cl_mem buffer{nullptr};
+        void *host_ptr{nullptr};
+        size_t size{0};
+        MemcpyKind kind{MemcpyKind::HostToDevice};
+        std::vector<uint32_t> dependencies;
+        // The arguments currently set on the kernel, its cl_mem and cl_sampler arguments are retained.
+        std::vector<Kernel::KernelImpl::ArgValue> args;
+        // The name of the node in the profiles.
+        std::string name;
+    };
+
+    bool CheckRecording(const std::vector<uint32_t> &dependencies) const;
+    bool ApplyPatches(const std::vector<GraphArgPatch> &patches);
+    bool PatchCommandBuffer(const GraphArgPatch &patch);
+    bool CanEnqueueCommandBuffer();
+    bool BuildCommandBuffer();
+    bool Enqueue(const std::vector<cl_event> &wait_events, cl_event *event) const;
+
+    cl_command_queue queue_;
+    Profiler *profiler_;
+    std::vector<Node> nodes_;
+    bool finalized_{false};
+    bool use_command_buffer_{false};
+    // Updated in place by patches when it is mutable, recorded again otherwise.
+    std::unique_ptr<CommandBuffer> command_buffer_;
+    // The last replay of the command buffer, which cannot be enqueued again while it is pending unless it is created
+    // for simultaneous use.
+    Event last_replay_;
+    std::mutex mutex_;
+};
+
+CommandGraph::CommandGraphImpl::CommandGraphImpl(cl_command_queue queue, Profiler *profiler)
+    : queue_(queue), profiler_(profiler)
+{
+}
+
+CommandGraph::CommandGraphImpl::~CommandGraphImpl()
+{
+    for (const auto &node : nodes_) {
+        for (const auto &arg : node.args) {
+            Kernel::KernelImpl::RetainArg(arg, false);
+        }
+    }
+}
+
+bool CommandGraph::CommandGraphImpl::RecordKernel(const Kernel::KernelImpl &kernel,
+    const KernelArg *args,
+    size_t num_args,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    const std::vector<uint32_t> &dependencies,
+    uint32_t *node)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!CheckRecording(dependencies)) {
+        return false;
+    }
+    if (global_size.empty() || (!local_size.empty() && local_size.size() != global_size.size())) {
+        std::cout << "Invalid work size dimension: " << global_size.size() << ", " << local_size.size() << std::endl;
+        return false;
+    }
+    Node kernel_node;
+    kernel_node.kernel.reset(kernel.CreateBoundKernel(args, num_args, kernel_node.args));
+    if (!kernel_node.kernel) {
+        return false;
+    }
+    kernel_node.global_size = global_size;
+    kernel_node.local_size = local_size;
+    kernel_node.dependencies = dependencies;
+    kernel_node.name = kernel.GetName();
+    if (node != nullptr) {
+        *node = nodes_.size();
+    }
+    nodes_.emplace_back(std::move(kernel_node));
+    return true;
+}
+
+bool CommandGraph::CommandGraphImpl::RecordMemcpy(cl_mem buffer,
+    void *host_ptr,
+    size_t size,
+    MemcpyKind kind,
+    const std::vector<uint32_t> &dependencies,
+    uint32_t *node)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!CheckRecording(dependencies)) {
+        return false;
+    }
+    if (buffer == nullptr || host_ptr == nullptr || size == 0) {
+        std::cout << "Invalid memcpy node" << std::endl;
+        return false;
+    }
+    if (kind != MemcpyKind::HostToDevice && kind != MemcpyKind::DeviceToHost) {
+        std::cout << "Invalid memcpy kind" << std::endl;
+        return false;
+    }
+    Node memcpy_node;
+    memcpy_node.buffer = buffer;
+    memcpy_node.host_ptr = host_ptr;
+    memcpy_node.size = size;
+    memcpy_node.kind = kind;
+    memcpy_node.dependencies = dependencies;
+    memcpy_node.name = kind == MemcpyKind::HostToDevice ? "MemcpyHostToDevice" : "MemcpyDeviceToHost";
+    if (node != nullptr) {
+        *node = nodes_.size();
+    }
+    nodes_.emplace_back(std::move(memcpy_node));
+    return true;
+}
+
+bool CommandGraph::CommandGraphImpl::Finalize()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finalized_) {
+        return true;
+    }
+    if (nodes_.empty()) {
+        std::cout << "Empty command graph" << std::endl;
+        return false;
+    }
+    finalized_ = true;
+    // Host copies cannot be recorded into a command buffer.
+    bool kernels_only = true;
+    for (const auto &node : nodes_) {
+        kernels_only = kernels_only && node.kernel != nullptr;
+    }
+    use_command_buffer_ = kernels_only && CommandBuffer::IsSupported(queue_) && BuildCommandBuffer();
+    return true;
+}
+
+bool CommandGraph::CommandGraphImpl::Replay(
+    const std::vector<GraphArgPatch> &patches, const std::vector<Event> &wait_events, Event *event)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!finalized_) {
+        std::cout << "Command graph is not finalized" << std::endl;
+        return false;
+    }
+    if (!ApplyPatches(patches)) {
+        return false;
+    }
+    std::vector<cl_event> cl_wait_events = GetClEvents(wait_events);
+    cl_event out_event = nullptr;
+    if (CanEnqueueCommandBuffer()) {
+        if (!command_buffer_->Enqueue(cl_wait_events, &out_event)) {
+            return false;
+        }
+        // The commands of a command buffer have no events of their own, the whole replay is profiled.
+        if (profiler_->IsEnabled()) {
+            profiler_->Track("CommandGraph", queue_, out_event);
+        }
+        last_replay_ = Event(out_event);
+        if (event != nullptr) {
+            *event = last_replay_;
+        }
+        return true;
+    }
+    if (!Enqueue(cl_wait_events, event != nullptr ? &out_event : nullptr)) {
+        return false;
+    }
+    if (event != nullptr) {
+        *event = Event(out_event);
+    }
+    return true;
+}
+
+bool CommandGraph::CommandGraphImpl::IsCommandBuffer() const { return use_command_buffer_; }
+
+bool CommandGraph::CommandGraphImpl::CheckRecording(const std::vector<uint32_t> &dependencies) const
+{
+    if (finalized_) {
+        std::cout << "Command graph is finalized" << std::endl;
+        return false;
+    }
+    for (uint32_t dependency : dependencies) {
+        if (dependency >= nodes_.size()) {
+            std::cout << "Invalid command graph dependency: " << dependency << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CommandGraph::CommandGraphImpl::ApplyPatches(const std::vector<GraphArgPatch> &patches)
+{
+    for (const auto &patch : patches) {
+        if (patch.node >= nodes_.size() || nodes_[patch.node].kernel == nullptr) {
+            std::cout << "Invalid command graph patch node: " << patch.node << std::endl;
+            return false;
+        }
+        Node &node = nodes_[patch.node];
+        if (node.args.size() <= patch.index) {
+            node.args.resize(patch.index + 1);
+        }
+        Kernel::KernelImpl::ArgValue &current = node.args[patch.index];
+        // The recorded handle is retained, so equal bytes are the same object and the patch changes nothing.
+        if (patch.arg.value != nullptr && current.bytes.size() == patch.arg.size &&
+            std::memcmp(current.bytes.data(), patch.arg.value, patch.arg.size) == 0) {
+            continue;
+        }
+        cl_int ret = clSetKernelArg(node.kernel.get(), patch.index, patch.arg.size, patch.arg.value);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to patch kernel argument");
+        // The type of an argument does not change, patches built without MakeKernelArg keep the recorded kind.
+        const KernelArgKind kind = patch.arg.kind != KernelArgKind::Value ? patch.arg.kind : current.kind;
+        Kernel::KernelImpl::RetainArg(current, false);
+        current.bytes.clear();
+        current.kind = KernelArgKind::Value;
+        if (patch.arg.value != nullptr) {
+            const auto *bytes = static_cast<const uint8_t *>(patch.arg.value);
+            current.bytes.assign(bytes, bytes + patch.arg.size);
+            current.kind = kind;
+            Kernel::KernelImpl::RetainArg(current, true);
+        }
+        if (command_buffer_ && !PatchCommandBuffer(patch)) {
+            command_buffer_.reset();
+        }
+    }
+    return true;
+}
+
+bool CommandGraph::CommandGraphImpl::PatchCommandBuffer(const GraphArgPatch &patch)
+{
+    // A pending command buffer may only be updated when it is created for simultaneous use, the update then applies
+    // to the following enqueues. The graph holds kernel launches only, so the node is also the recorded command.
+    if (!command_buffer_->IsMutable() || (!command_buffer_->IsSimultaneousUse() && !last_replay_.IsComplete())) {
+        return false;
+    }
+    return command_buffer_->UpdateKernelArg(patch.node, patch.index, patch.arg.size, patch.arg.value);
+}
+
+bool CommandGraph::CommandGraphImpl::CanEnqueueCommandBuffer()
+{
+    if (!use_command_buffer_) {
+        return false;
+    }
+    if (command_buffer_) {
+        return command_buffer_->IsSimultaneousUse() || last_replay_.IsComplete();
+    }
+    return last_replay_.IsComplete() && BuildCommandBuffer();
+}
+
+bool CommandGraph::CommandGraphImpl::BuildCommandBuffer()
+{
+    std::unique_ptr<CommandBuffer> command_buffer(new (std::nothrow) CommandBuffer(queue_));
+    if (!command_buffer || !command_buffer->Init()) {
+        return false;
+    }
+    for (const auto &node : nodes_) {
+        if (!command_buffer->RecordKernel(node.kernel.get(), node.global_size, node.local_size, node.dependencies)) {
+            return false;
+        }
+    }
+    if (!command_buffer->Finalize()) {
+        return false;
+    }
+    command_buffer_ = std::move(command_buffer);
+    return true;
+}
+
+bool CommandGraph::CommandGraphImpl::Enqueue(const std::vector<cl_event> &wait_events, cl_event *event) const
+{
+    // The queue is in-order, so the nodes only wait for the replay to start and the last node ends it.
+    const bool profiling = profiler_->IsEnabled();
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        const Node &node = nodes_[i];
+        const cl_uint num_wait_events = i == 0 ? wait_events.size() : 0;
+        const cl_event *wait_list = num_wait_events > 0 ? wait_events.data() : nullptr;
+        const bool last = i + 1 == nodes_.size();
+        cl_event node_event = nullptr;
+        cl_event *event_ptr = profiling || (last && event != nullptr) ? &node_event : nullptr;
+        cl_int ret;
+        if (node.kernel != nullptr) {
+            ret = clEnqueueNDRangeKernel(queue_,
+                node.kernel.get(),
+                node.global_size.size(),
+                nullptr,
+                node.global_size.data(),
+                node.local_size.empty() ? nullptr : node.local_size.data(),
+                num_wait_events,
+                wait_list,
+                event_ptr);
+        } else if (node.kind == MemcpyKind::HostToDevice) {
+            ret = clEnqueueWriteBuffer(
+                queue_, node.buffer, CL_FALSE, 0, node.size, node.host_ptr, num_wait_events, wait_list, event_ptr);
+        } else {
+            ret = clEnqueueReadBuffer(
+                queue_, node.buffer, CL_FALSE, 0, node.size, node.host_ptr, num_wait_events, wait_list, event_ptr);
+        }
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to replay command graph");
+        if (profiling) {
+            profiler_->Track(node.name, queue_, node_event);
+        }
+        if (last && event != nullptr) {
+            *event = node_event;
+        } else if (node_event != nullptr) {
+            clReleaseEvent(node_event);
+        }
+    }
+    return true;
+}
+
+CommandGraph::CommandGraph(CommandGraphImpl *impl) { impl_.reset(impl); }
+
+CommandGraph::~CommandGraph() = default;
+
+bool CommandGraph::RecordKernelImpl(const Kernel &kernel,
+    const KernelArg *args,
+    size_t num_args,
+    const std::vector<size_t> &global_size,
+    const std::vector<size_t> &local_size,
+    const std::vector<uint32_t> &dependencies,
+    uint32_t *node) const
+{
+    if (impl_ == nullptr || kernel.impl_ == nullptr) {
+        return false;
+    }
+    return impl_->RecordKernel(*kernel.impl_, args, num_args, global_size, local_size, dependencies, node);
+}
+
+bool CommandGraph::RecordMemcpy(const Buffer &buffer,
+    void *host_ptr,
+    size_t size,
+    MemcpyKind kind,
+    const std::vector<uint32_t> &dependencies,
+    uint32_t *node) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->RecordMemcpy(buffer.GetClMem(), host_ptr, size, kind, dependencies, node);
+}
+
+bool CommandGraph::Finalize() const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Finalize();
+}
+
+bool CommandGraph::Replay(
+    const std::vector<GraphArgPatch> &patches, const std::vector<Event> &wait_events, Event *event) const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->Replay(patches, wait_events, event);
+}
+
+bool CommandGraph::IsCommandBuffer() const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->IsCommandBuffer();
+}
+
+class Task::TaskImpl final {
+public:
+    explicit TaskImpl(TaskFunction function) : function_(std::move(function)) {}
+    ~TaskImpl() = default;
+    TaskImpl() = delete;
+    TaskImpl(const TaskImpl &) = delete;
+    TaskImpl &operator=(const TaskImpl &) = delete;
+    TaskImpl(TaskImpl &&) = delete;
+    TaskImpl &operator=(TaskImpl &&) = delete;
+
+    bool IsComplete() const;
+    bool Wait() const;
+
+private:
+    friend class TaskRuntime::TaskRuntimeImpl;
+
+    TaskFunction function_;
+    // The unresolved dependencies, plus one held by Submit until all of them are registered.
+    std::atomic<uint32_t> pending_{1};
+    std::atomic<bool> dependency_failed_{false};
+    mutable std::mutex mutex_;
+    mutable std::condition_variable condition_;
+    bool complete_{false};
+    bool success_{false};
+    std::vector<std::shared_ptr<TaskImpl>> dependents_;
+};
+
+bool Task::TaskImpl::IsComplete() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return complete_;
+}
+
+bool Task::TaskImpl::Wait() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this] { return complete_; });
+    return success_;
+}
+
+Task::Task(std::shared_ptr<TaskImpl> impl) : impl_(std::move(impl)) {}
+
+bool Task::IsValid() const { return impl_ != nullptr; }
+
+bool Task::IsComplete() const
+{
+    if (impl_ == nullptr) {
+        return true;
+    }
+    return impl_->IsComplete();
+}
+
+bool Task::Wait() const
+{
+    if (impl_ == nullptr) {
+        return true;
+    }
+    return impl_->Wait();
+}
+
+class TaskRuntime::TaskRuntimeImpl final {
+public:
+    explicit TaskRuntimeImpl(uint32_t num_threads);
+    ~TaskRuntimeImpl();
+    TaskRuntimeImpl() = delete;
+    TaskRuntimeImpl(const TaskRuntimeImpl &) = delete;
+    TaskRuntimeImpl &operator=(const TaskRuntimeImpl &) = delete;
+    TaskRuntimeImpl(TaskRuntimeImpl &&) = delete;
+    TaskRuntimeImpl &operator=(TaskRuntimeImpl &&) = delete;
+
+    bool IsValid() const { return pool_ != nullptr; }
+    Task Submit(TaskFunction function,
+        const std::vector<std::shared_ptr<Task::TaskImpl>> &tasks,
+        const std::vector<Event> &events);
+    bool WaitAll();
+    TaskRuntimeStatistics GetStatistics() const;
+
+private:
+    /**
+     * @brief EventContext is the user data of the event callbacks, it keeps the task alive.
+     *
+     */
+    struct EventContext final {
+        TaskRuntimeImpl *runtime;
+        std::shared_ptr<Task::TaskImpl> task;
+    };
+
+    void Release(const std::shared_ptr<Task::TaskImpl> &task);
+    void Run(const std::shared_ptr<Task::TaskImpl> &task);
+    void Complete(const std::shared_ptr<Task::TaskImpl> &task, bool success);
+    static bool SetCompletionCallback(
+        cl_event event, void(CL_CALLBACK *callback)(cl_event, cl_int, void *), void *context);
+    static void CL_CALLBACK OnDependencyComplete(cl_event event, cl_int status, void *user_data);
+    static void CL_CALLBACK OnTaskEventComplete(cl_event event, cl_int status, void *user_data);
+
+    std::unique_ptr<WorkStealingPool> pool_;
+    std::atomic<uint64_t> submitted_{0};
+    std::atomic<uint64_t> completed_{0};
+    std::atomic<uint64_t> failed_{0};
+    std::atomic<uint64_t> event_dependencies_{0};
+    // The runtime lives until the last task has completed, tasks in flight only use it before they are counted.
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    uint64_t outstanding_{0};
+    bool failed_since_wait_{false};
+};
+
+TaskRuntime::TaskRuntimeImpl::TaskRuntimeImpl(uint32_t num_threads)
+{
+    pool_.reset(new (std::nothrow) WorkStealingPool(num_threads));
+    if (!pool_) {
+        std::cout << "Failed to create WorkStealingPool" << std::endl;
+    }
+}
+
+TaskRuntime::TaskRuntimeImpl::~TaskRuntimeImpl()
+{
+    WaitAll();
+    pool_.reset();
+}
+
+Task TaskRuntime::TaskRuntimeImpl::Submit(
+    TaskFunction function, const std::vector<std::shared_ptr<Task::TaskImpl>> &tasks, const std::vector<Event> &events)
+{
+    std::shared_ptr<Task::TaskImpl> task(new (std::nothrow) Task::TaskImpl(std::move(function)));
+    if (!task) {
+        return Task();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outstanding_++;
+    }
+    submitted_++;
+    for (const auto &dependency : tasks) {
+        if (dependency == nullptr) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(dependency->mutex_);
+        if (dependency->complete_) {
+            task->dependency_failed_ = task->dependency_failed_ || !dependency->success_;
+            continue;
+        }
+        task->pending_++;
+        dependency->dependents_.emplace_back(task);
+    }
+    for (const Event &event : events) {
+        if (!event.IsValid()) {
+            continue;
+        }
+        auto context = new (std::nothrow) EventContext{this, task};
+        if (context == nullptr) {
+            task->dependency_failed_ = true;
+            continue;
+        }
+        task->pending_++;
+        event_dependencies_++;
+        if (!SetCompletionCallback(event.GetClEvent(), OnDependencyComplete, context)) {
+            task->dependency_failed_ = true;
+            task->pending_--;
+            delete context;
+        }
+    }
+    Release(task);
+    return Task(task);
+}
+
+bool TaskRuntime::TaskRuntimeImpl::WaitAll()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this] { return outstanding_ == 0; });
+    bool ret = !failed_since_wait_;
+    failed_since_wait_ = false;
+    return ret;
+}
+
+TaskRuntimeStatistics TaskRuntime::TaskRuntimeImpl::GetStatistics() const
+{
+    TaskRuntimeStatistics statistics;
+    statistics.submitted = submitted_.load();
+    statistics.completed = completed_.load();
+    statistics.failed = failed_.load();
+    statistics.stolen = pool_ ? pool_->GetStolenCount() : 0;
+    statistics.event_dependencies = event_dependencies_.load();
+    return statistics;
+}
+
+void TaskRuntime::TaskRuntimeImpl::Release(const std::shared_ptr<Task::TaskImpl> &task)
+{
+    if (--task->pending_ == 0) {
+        pool_->Submit([this, task]() { Run(task); });
+    }
+}
+
+void TaskRuntime::TaskRuntimeImpl::Run(const std::shared_ptr<Task::TaskImpl> &task)
+{
+    if (task->dependency_failed_) {
+        Complete(task, false);
+        return;
+    }
+    Event event;
+    bool ret = task->function_ ? task->function_(event) : true;
+    if (!ret || !event.IsValid()) {
+        Complete(task, ret);
+        return;
+    }
+    // The device work completes the task from the event callback, the worker moves on to the next task.
+    auto context = new (std::nothrow) EventContext{this, task};
+    if (context == nullptr) {
+        Complete(task, false);
+        return;
+    }
+    if (!SetCompletionCallback(event.GetClEvent(), OnTaskEventComplete, context)) {
+        delete context;
+        Complete(task, false);
+    }
+}
+
+void TaskRuntime::TaskRuntimeImpl::Complete(const std::shared_ptr<Task::TaskImpl> &task, bool success)
+{
+    // The captures of the function are released as soon as the task is done.
+    task->function_ = nullptr;
+    std::vector<std::shared_ptr<Task::TaskImpl>> dependents;
+    {
+        std::lock_guard<std::mutex> lock(task->mutex_);
+        task->complete_ = true;
+        task->success_ = success;
+        dependents.swap(task->dependents_);
+    }
+    task->condition_.notify_all();
+    for (const auto &dependent : dependents) {
+        if (!success) {
+            dependent->dependency_failed_ = true;
+        }
+        Release(dependent);
+    }
+    if (success) {
+        completed_++;
+    } else {
+        failed_++;
+    }
+    // Notified under the lock, the runtime may be destroyed as soon as the lock is released.
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_since_wait_ = failed_since_wait_ || !success;
+    outstanding_--;
+    condition_.notify_all();
+}
+
+bool TaskRuntime::TaskRuntimeImpl::SetCompletionCallback(
+    cl_event event, void(CL_CALLBACK *callback)(cl_event, cl_int, void *), void *context)
+{
+    // A command may not be submitted to the device before its queue is flushed, the callback would never be called.
+    // User events have no queue.
+    cl_command_queue queue = nullptr;
+    cl_int ret = clGetEventInfo(event, CL_EVENT_COMMAND_QUEUE, sizeof(queue), &queue, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get event command queue");
+    if (queue != nullptr) {
+        ret = clFlush(queue);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to flush command queue");
+    }
+    ret = clSetEventCallback(event, CL_COMPLETE, callback, context);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to set event callback");
+    return true;
+}
+
+void CL_CALLBACK TaskRuntime::TaskRuntimeImpl::OnDependencyComplete(cl_event event, cl_int status, void *user_data)
+{
+    (void)event;
+    auto context = static_cast<EventContext *>(user_data);
+    if (status != CL_COMPLETE) {
+        context->task->dependency_failed_ = true;
+    }
+    context->runtime->Release(context->task);
+    delete context;
+}
+
+void CL_CALLBACK TaskRuntime::TaskRuntimeImpl::OnTaskEventComplete(cl_event event, cl_int status, void *user_data)
+{
+    (void)event;
+    auto context = static_cast<EventContext *>(user_data);
+    context->runtime->Complete(context->task, status == CL_COMPLETE);
+    delete context;
+}
+
+TaskRuntime::TaskRuntime(TaskRuntimeImpl *impl) { impl_.reset(impl); }
+
+TaskRuntime::~TaskRuntime() = default;
+
+Task TaskRuntime::Submit(TaskFunction function, const std::vector<Task> &tasks, const std::vector<Event> &events) const
+{
+    if (impl_ == nullptr) {
+        return Task();
+    }
+    std::vector<std::shared_ptr<Task::TaskImpl>> task_impls;
+    for (const Task &task : tasks) {
+        task_impls.emplace_back(task.impl_);
+    }
+    return impl_->Submit(std::move(function), task_impls, events);
+}
+
+bool TaskRuntime::WaitAll() const
+{
+    if (impl_ == nullptr) {
+        return false;
+    }
+    return impl_->WaitAll();
+}
+
+TaskRuntimeStatistics TaskRuntime::GetStatistics() const
+{
+    if (impl_ == nullptr) {
+        return TaskRuntimeStatistics();
+    }
+    return impl_->GetStatistics();
+}
+
+class Executor::ExecutorImpl final {
+public:
+    explicit ExecutorImpl(const ExecutorOptions &options);
+    ~ExecutorImpl();
+    ExecutorImpl(const ExecutorImpl &) = delete;
+    ExecutorImpl &operator=(const ExecutorImpl &) = delete;
+    ExecutorImpl(ExecutorImpl &&) = delete;
+    ExecutorImpl &operator=(ExecutorImpl &&) = delete;
+
+    std::shared_ptr<Kernel> CreateKernel(const std::string &program_name,
+        const std::string &kernel_name,
+        const std::set<std::string> &build_options) const;
+
+    std::shared_ptr<Kernel> CreateKernelFromSource(const std::string &source,
+        const std::string &kernel_name,
+        const std::set<std::string> &build_options) const;
+
+    bool AddProgramSource(const std::string &program_name, const std::string &source) const;
+
+    std::vector<std::shared_future<bool>> PrecompileAsync(const std::vector<ProgramSpec> &programs) const;
+    std::shared_future<bool> Prebuild(const WarmupConfig &config) const;
+    std::vector<StartupTiming> GetStartupTimings() const;
+
+    std::shared_ptr<Buffer> CreateBuffer(size_t size, BufferMode mode) const;
+    std::shared_ptr<Buffer> WrapHostMemory(void *host_ptr, size_t size) const;
+    std::shared_ptr<BufferArena> CreateBufferArena(size_t capacity, BufferMode mode) const;
+    std::shared_ptr<Buffer> MapFile(const std::string &path, size_t offset, size_t size) const;
+
+    void ConfigureBufferPool(const BufferPoolConfig &config) const;
+    void TrimBufferPool(size_t max_cached_bytes) const;
+    BufferPoolStatistics GetBufferPoolStatistics() const;
+
+    bool ConfigureQueues(const QueuePoolConfig &config) const;
+    std::shared_ptr<Queue> GetQueue(QueueType type, uint32_t index, uint32_t device) const;
+    bool Finish() const;
+
+    void EnableProfiling(bool enable) const;
+    std::vector<KernelProfile> GetKernelProfiles() const;
+    bool DumpChromeTrace(const std::string &path) const;
+    void ResetProfiling() const;
+
+    std::shared_ptr<CommandGraph> CreateCommandGraph(uint32_t device) const;
+    std::shared_ptr<StreamingPipeline> CreateStreamingPipeline(const StreamConfig &config) const;
+    std::shared_ptr<Algorithms> CreateAlgorithms(uint32_t device) const;
+    std::shared_ptr<TaskRuntime> CreateTaskRuntime(const TaskRuntimeConfig &config) const;
+
+    bool IsInitialized() const { return initialized_; }
+    uint32_t GetDeviceCount() const;
+    bool GetDeviceInfo(uint32_t device, DeviceInfo &info) const;
+    void SetSchedulePolicy(SchedulePolicy policy) const;
+    void SetProgramCacheDirectory(const std::string &directory) const;
+
+private:
+    bool Init();
+    bool PartitionDevices();
+    void RecordStartup(const std::string &stage, std::chrono::steady_clock::time_point start, bool success) const;
+    size_t GetBaseAddressAlignment() const;
+    std::shared_ptr<Buffer> CreateWrappedBuffer(cl_mem buffer, size_t size) const;
+    bool CreateAlgorithmKernels(uint32_t device,
+        uint32_t work_group_size,
+        Algorithms::AlgorithmsImpl::Kernels &kernels,
+        bool &fits) const;
+
+    // Programs built on demand keep being recorded, the startup of a long-running process is far below this.
+    static constexpr size_t kMaxStartupTimings = 1024;
+
+    ExecutorOptions options_;
+    bool initialized_{false};
+    // Declared before the managers, their worker threads record the builds until they are destroyed.
+    std::chrono::steady_clock::time_point init_start_;
+    mutable std::mutex startup_mutex_;
+    mutable std::vector<StartupTiming> startup_timings_;
+    std::vector<cl_device_id> devices_;
+    std::vector<std::unique_ptr<_cl_device_id, decltype(&clReleaseDevice)>> sub_devices_;
+    std::unique_ptr<_cl_context, decltype(&clReleaseContext)> context_{nullptr, clReleaseContext};
+    std::vector<std::unique_ptr<QueueManager>> queue_managers_;
+    std::unique_ptr<DeviceScheduler> scheduler_;
+    std::unique_ptr<Profiler> profiler_;
+    std::unique_ptr<LocalSizeTuner> tuner_;
+    std::unique_ptr<ProgramManager> program_manager_;
+    std::unique_ptr<BufferManager> buffer_manager_;
+    mutable std::mutex prebuild_mutex_;
+    mutable std::unique_ptr<ThreadPool> prebuild_pool_;
+};
+
+Executor::ExecutorImpl::ExecutorImpl(const ExecutorOptions &options) : options_(options)
+{
+    initialized_ = Init();
+    if (!initialized_) {
+        std::cout << "Failed to initialize Executor" << std::endl;
+    }
+}
+
+Executor::ExecutorImpl::~ExecutorImpl()
+{
+    // Pending prebuilds use the managers, the pool completes them before it is destroyed.
+    prebuild_pool_.reset();
+    // The managers release their OpenCL objects, the commands using them must complete first.
+    if (!queue_managers_.empty()) {
+        Finish();
+    }
+}
+
+bool Executor::ExecutorImpl::Init()
+{
+    init_start_ = std::chrono::steady_clock::now();
+    DeviceSelector selector(options_.device_selection);
+    bool selected = selector.Select(devices_);
+    RecordStartup("platform query", init_start_, selected);
+    if (!selected) {
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool partitioned = PartitionDevices();
+    if (!partitioned || !sub_devices_.empty()) {
+        RecordStartup("partition devices", start, partitioned);
+    }
+    if (!partitioned) {
+        return false;
+    }
+    start = std::chrono::steady_clock::now();
+    cl_int ret;
+    context_.reset(clCreateContext(nullptr, devices_.size(), devices_.data(), nullptr, nullptr, &ret));
+    RecordStartup("context", start, ret == CL_SUCCESS);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to create context");
+
+    start = std::chrono::steady_clock::now();
+    for (cl_device_id device : devices_) {
+        std::unique_ptr<QueueManager> queue_manager(new (std::nothrow) QueueManager(context_.get(), device));
+        if (!queue_manager) {
+            std::cout << "Failed to create QueueManager" << std::endl;
+            return false;
+        }
+        if (!queue_manager->Configure(options_.queues)) {
+            std::cout << "Failed to create command queues" << std::endl;
+            return false;
+        }
+        queue_managers_.emplace_back(std::move(queue_manager));
+    }
+    RecordStartup("queues", start, true);
+
+    start = std::chrono::steady_clock::now();
+    scheduler_.reset(new (std::nothrow) DeviceScheduler(devices_.size()));
+    if (!scheduler_) {
+        std::cout << "Failed to create DeviceScheduler" << std::endl;
+        return false;
+    }
+    scheduler_->SetPolicy(options_.schedule_policy);
+
+    profiler_.reset(new (std::nothrow) Profiler());
+    if (!profiler_) {
+        std::cout << "Failed to create Profiler" << std::endl;
+        return false;
+    }
+    profiler_->Enable(options_.profiling);
+
+    tuner_.reset(new (std::nothrow) LocalSizeTuner(devices_));
+    if (!tuner_) {
+        std::cout << "Failed to create LocalSizeTuner" << std::endl;
+        return false;
+    }
+
+    program_manager_.reset(new (std::nothrow) ProgramManager(devices_, context_.get()));
+    if (!program_manager_) {
+        std::cout << "Failed to create ProgramManager" << std::endl;
+        return false;
+    }
+    program_manager_->SetObserver(
+        [this](const std::string &stage, std::chrono::steady_clock::time_point stage_start, bool success) {
+            RecordStartup(stage, stage_start, success);
+        });
+
+    buffer_manager_.reset(new (std::nothrow) BufferManager(
+        context_.get(), queue_managers_[0]->GetDefaultQueue(), GetBaseAddressAlignment()));
+    if (!buffer_manager_) {
+        std::cout << "Failed to create BufferManager" << std::endl;
+        return false;
+    }
+    buffer_manager_->SetConfig(options_.buffer_pool);
+    buffer_manager_->SetReleaseMarker([this](std::vector<cl_event> &markers) {
+        bool result = true;
+        for (const auto &queue_manager : queue_managers_) {
+            result = queue_manager->EnqueueMarkers(markers) && result;
+        }
+        return result;
+    });
+    if (!options_.program_cache_directory.empty()) {
+        SetProgramCacheDirectory(options_.program_cache_directory);
+    }
+    RecordStartup("managers", start, true);
+    return true;
+}
+
+void Executor::ExecutorImpl::RecordStartup(
+    const std::string &stage, std::chrono::steady_clock::time_point start, bool success) const
+{
+    const auto end = std::chrono::steady_clock::now();
+    StartupTiming timing;
+    timing.stage = stage;
+    timing.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - init_start_).count();
+    timing.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    timing.success = success;
+    std::lock_guard<std::mutex> lock(startup_mutex_);
+    if (startup_timings_.size() < kMaxStartupTimings) {
+        startup_timings_.emplace_back(std::move(timing));
+    }
+}
+
+bool Executor::ExecutorImpl::PartitionDevices()
+{
+    // Splitting the first device into sub-devices allows multi-device scheduling to be exercised on a single CPU
+    // device, TINYOCL_PARTITION_EQUALLY=<compute units> overrides the options.
+    int compute_units = static_cast<int>(options_.partition_compute_units);
+    const char *partition = std::getenv("TINYOCL_PARTITION_EQUALLY");
+    if (partition != nullptr) {
+        compute_units = std::atoi(partition);
+    }
+    if (compute_units <= 0) {
+        return true;
+    }
+    const cl_device_partition_property properties[] = {
+        CL_DEVICE_PARTITION_EQUALLY, static_cast<cl_device_partition_property>(compute_units), 0};
+    cl_uint num_sub_devices;
+    cl_int ret = clCreateSubDevices(devices_[0], properties, 0, nullptr, &num_sub_devices);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get number of sub-devices");
+    std::vector<cl_device_id> sub_devices(num_sub_devices);
+    ret = clCreateSubDevices(devices_[0], properties, num_sub_devices, sub_devices.data(), nullptr);
+    CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to create sub-devices");
+    for (cl_device_id sub_device : sub_devices) {
+        sub_devices_.emplace_back(sub_device, clReleaseDevice);
+    }
+    devices_ = sub_devices;
+    std::cout << "Partition device into " << num_sub_devices << " sub-devices" << std::endl;
+    return true;
+}
+
+std::shared_ptr<Kernel> Executor::ExecutorImpl::CreateKernel(
+    const std::string &program_name, const std::string &kernel_name, const std::set<std::string> &build_options) const
+{
+    if (!program_manager_) {
+        return nullptr;
+    }
+
+    if (!program_manager_->BuildProgram(program_name, build_options)) {
+        return nullptr;
+    };
+    cl_kernel kernel = program_manager_->GetKernel(program_name, build_options, kernel_name);
+    if (!kernel) {
+        return nullptr;
+    }
+    std::vector<cl_command_queue> queues;
+    for (const auto &queue_manager : queue_managers_) {
+        queues.emplace_back(queue_manager->GetDefaultQueue());
+    }
+    std::unique_ptr<Kernel::KernelImpl> kernel_impl(
+        new (std::nothrow) Kernel::KernelImpl(queues,
+            scheduler_.get(),
+            profiler_.get(),
+            tuner_.get(),
+            kernel,
+            kernel_name,
+            ProgramManager::GetVariantKey(program_name, ProgramManager::NormalizeBuildOptions(build_options)),
+            program_manager_->GetContentHash(program_name, build_options)));
+    if (!kernel_impl) {
+        return nullptr;
+    }
+    return std::make_shared<Kernel>(kernel_impl.release());
+}
+
+std::shared_ptr<Kernel> Executor::ExecutorImpl::CreateKernelFromSource(
+    const std::string &source, const std::string &kernel_name, const std::set<std::string> &build_options) const
+{
+    const std::string program_name = GetSourceProgramName(source);
+    if (!AddProgramSource(program_name, source)) {
+        return nullptr;
+    }
+    return CreateKernel(program_name, kernel_name, build_options);
+}
+
+bool Executor::ExecutorImpl::AddProgramSource(const std::string &program_name, const std::string &source) const
+{
+    if (!program_manager_) {
+        return false;
+    }
+    if (source.empty()) {
+        std::cout << "Empty program source: " << program_name << std::endl;
+        return false;
+    }
+    return program_manager_->AddSource(program_name, source);
+}
+
+std::vector<std::shared_future<bool>> Executor::ExecutorImpl::PrecompileAsync(
+    const std::vector<ProgramSpec> &programs) const
+{
+    std::vector<std::shared_future<bool>> futures;
+    for (const auto &program : programs) {
+        if (!program_manager_) {
+            std::promise<bool> failed;
+            failed.set_value(false);
+            futures.emplace_back(failed.get_future().share());
+            continue;
+        }
+        futures.emplace_back(program_manager_->BuildProgramAsync(program.program_name, program.build_options));
+    }
+    return futures;
+}
+
+std::shared_future<bool> Executor::ExecutorImpl::Prebuild(const WarmupConfig &config) const
+{
+    auto prebuilt = std::make_shared<std::promise<bool>>();
+    std::shared_future<bool> future = prebuilt->get_future().share();
+    if (!program_manager_) {
+        prebuilt->set_value(false);
+        return future;
+    }
+    std::lock_guard<std::mutex> lock(prebuild_mutex_);
+    if (!prebuild_pool_) {
+        prebuild_pool_.reset(new (std::nothrow) ThreadPool(1));
+        if (!prebuild_pool_) {
+            std::cout << "Failed to create ThreadPool" << std::endl;
+            prebuilt->set_value(false);
+            return future;
+        }
+    }
+    prebuild_pool_->Submit([this, config, prebuilt]() {
+        // All the variants are submitted before waiting, so they build in parallel on the worker threads.
+        std::vector<std::shared_future<bool>> builds = PrecompileAsync(config.programs);
+        std::vector<std::shared_future<bool>> kernel_builds;
+        for (const auto &kernel : config.kernels) {
+            kernel_builds.emplace_back(program_manager_->BuildProgramAsync(kernel.program_name, kernel.build_options));
+        }
+        bool ret = true;
+        for (const auto &build : builds) {
+            ret = build.get() && ret;
+        }
+        for (size_t i = 0; i < config.kernels.size(); i++) {
+            const KernelSpec &kernel = config.kernels[i];
+            if (!kernel_builds[i].get() ||
+                program_manager_->GetKernel(kernel.program_name, kernel.build_options, kernel.kernel_name) == nullptr) {
+                std::cout << "Failed to prebuild kernel " << kernel.program_name << ":" << kernel.kernel_name
+                          << std::endl;
+                ret = false;
+            }
+        }
+        prebuilt->set_value(ret);
+    });
+    return future;
+}
+
+std::vector<StartupTiming> Executor::ExecutorImpl::GetStartupTimings() const
+{
+    std::lock_guard<std::mutex> lock(startup_mutex_);
+    return startup_timings_;
+}
+
+std::shared_ptr<Buffer> Executor::ExecutorImpl::CreateBuffer(size_t size, BufferMode mode) const
+{
+    if (!buffer_manager_) {
+        return nullptr;
+    }
+    std::unique_ptr<Buffer::BufferImpl> buffer_impl(
+        new (std::nothrow) Buffer::BufferImpl(
+        buffer_manager_.get(), profiler_.get(), queue_managers_[0]->GetDefaultQueue(), size, mode));
+    if (!buffer_impl) {
+        return nullptr;
+    }
+    return std::make_shared<Buffer>(buffer_impl.release());
+}
+
+std::shared_ptr<Buffer> Executor::ExecutorImpl::WrapHostMemory(void *host_ptr, size_t size) const
+{
+    if (!buffer_manager_) {
+        return nullptr;
+    }
+    cl_mem buffer = buffer_manager_->Wrap(host_ptr, size, CL_MEM_READ_WRITE);
+    if (buffer == nullptr) {
+        return nullptr;
+    }
+    return CreateWrappedBuffer(buffer, size);
+}
+
+std::shared_ptr<BufferArena> Executor::ExecutorImpl::CreateBufferArena(size_t capacity, BufferMode mode) const
+{
+    if (!buffer_manager_) {
+        return nullptr;
+    }
+    void *host_ptr = nullptr;
+    cl_mem buffer = buffer_manager_->CreateUnpooled(capacity, mode, &host_ptr);
+    if (buffer == nullptr) {
+        return nullptr;
+    }
+    std::unique_ptr<BufferArena::BufferArenaImpl> arena_impl(
+        new (std::nothrow) BufferArena::BufferArenaImpl(buffer_manager_.get(),
+        profiler_.get(),
+        queue_managers_[0]->GetDefaultQueue(),
+        buffer,
+        capacity,
+        mode,
+        host_ptr));
+    if (!arena_impl) {
+        buffer_manager_->Release(buffer);
+        return nullptr;
+    }
+    return std::make_shared<BufferArena>(arena_impl.release());
+}
+
+std::shared_ptr<Buffer> Executor::ExecutorImpl::MapFile(const std::string &path, size_t offset, size_t size) const
+{
+    if (!buffer_manager_) {
+        return nullptr;
+    }
+    std::unique_ptr<FileMapping> mapping(new (std::nothrow) FileMapping());
+    if (!mapping || !mapping->Open(path, offset, size)) {
+        return nullptr;
+    }
+    cl_mem buffer =
+        buffer_manager_->Wrap(mapping->GetData(), mapping->GetSize(), CL_MEM_READ_ONLY | CL_MEM_HOST_READ_ONLY);
+    if (buffer == nullptr) {
+        return nullptr;
+    }
+    // The file stays mapped until the runtime has finished with the buffer, not just until the Buffer is released.
+    cl_int ret = clSetMemObjectDestructorCallback(buffer, FileMapping::OnBufferDestroyed, mapping.get());
+    if (ret != CL_SUCCESS) {
+        std::cout << "OpenCL error: Failed to set buffer destructor callback (" << ret << ")" << std::endl;
+        buffer_manager_->Release(buffer);
+        return nullptr;
+    }
+    const size_t mapped_size = mapping->GetSize();
+    mapping.release();
+    return CreateWrappedBuffer(buffer, mapped_size);
+}
+
+std::shared_ptr<Buffer> Executor::ExecutorImpl::CreateWrappedBuffer(cl_mem buffer, size_t size) const
+{
+    std::unique_ptr<Buffer::BufferImpl> buffer_impl(new (std::nothrow) Buffer::BufferImpl(buffer_manager_.get(),
+        profiler_.get(),
+        queue_managers_[0]->GetDefaultQueue(),
+        buffer,
+        size,
+        BufferMode::MapOnDemand,
+        nullptr));
+    if (!buffer_impl) {
+        buffer_manager_->Release(buffer);
+        return nullptr;
+    }
+    return std::make_shared<Buffer>(buffer_impl.release());
+}
+
+size_t Executor::ExecutorImpl::GetBaseAddressAlignment() const
+{
+    size_t alignment = 1;
+    for (cl_device_id device : devices_) {
+        cl_uint bits = 0;
+        cl_int ret = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(bits), &bits, nullptr);
+        CHECK_OPENCL_ERROR_NO_RETURN(ret, "Failed to get device base address alignment");
+        alignment = std::max<size_t>(alignment, bits / 8);
+    }
+    return alignment;
+}
+
+void Executor::ExecutorImpl::ConfigureBufferPool(const BufferPoolConfig &config) const
+{
+    if (!buffer_manager_) {
+        return;
+    }
+    buffer_manager_->SetConfig(config);
+}
+
+void Executor::ExecutorImpl::TrimBufferPool(size_t max_cached_bytes) const
+{
+    if (!buffer_manager_) {
+        return;
+    }
+    buffer_manager_->Trim(max_cached_bytes);
+}
+
+BufferPoolStatistics Executor::ExecutorImpl::GetBufferPoolStatistics() const
+{
+    if (!buffer_manager_) {
+        return BufferPoolStatistics();
+    }
+    return buffer_manager_->GetStatistics();
+}
+
+bool Executor::ExecutorImpl::ConfigureQueues(const QueuePoolConfig &config) const
+{
+    if (queue_managers_.empty()) {
+        return false;
+    }
+    for (const auto &queue_manager : queue_managers_) {
+        if (!queue_manager->Configure(config)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<Queue> Executor::ExecutorImpl::GetQueue(QueueType type, uint32_t index, uint32_t device) const
+{
+    if (device >= queue_managers_.size()) {
+        std::cout << "Invalid device index: " << device << std::endl;
+        return nullptr;
+    }
+    cl_command_queue queue = queue_managers_[device]->GetQueue(type, index);
+    if (queue == nullptr) {
+        return nullptr;
+    }
+    std::unique_ptr<Queue::QueueImpl> queue_impl(new (std::nothrow) Queue::QueueImpl(queue, type));
+    if (!queue_impl) {
+        clReleaseCommandQueue(queue);
+        return nullptr;
+    }
+    return std::make_shared<Queue>(queue_impl.release());
+}
+
+bool Executor::ExecutorImpl::Finish() const
+{
+    if (queue_managers_.empty()) {
+        return false;
+    }
+    bool ret = true;
+    for (const auto &queue_manager : queue_managers_) {
+        ret = queue_manager->Finish() && ret;
+    }
+    return ret;
+}
+
+void Executor::ExecutorImpl::EnableProfiling(bool enable) const
+{
+    if (!profiler_) {
+        return;
+    }
+    profiler_->Enable(enable);
+}
+
+std::vector<KernelProfile> Executor::ExecutorImpl::GetKernelProfiles() const
+{
+    if (!profiler_) {
+        return {};
+    }
+    return profiler_->GetProfiles();
+}
+
+bool Executor::ExecutorImpl::DumpChromeTrace(const std::string &path) const
+{
+    if (!profiler_) {
+        return false;
+    }
+    return profiler_->DumpChromeTrace(path);
+}
+
+void Executor::ExecutorImpl::ResetProfiling() const
+{
+    if (!profiler_) {
+        return;
+    }
+    profiler_->Reset();
+}
+
+std::shared_ptr<CommandGraph> Executor::ExecutorImpl::CreateCommandGraph(uint32_t device) const
+{
+    if (device >= queue_managers_.size()) {
+        std::cout << "Invalid device index: " << device << std::endl;
+        return nullptr;
+    }
+    std::unique_ptr<CommandGraph::CommandGraphImpl> graph_impl(
+        new (std::nothrow) CommandGraph::CommandGraphImpl(queue_managers_[device]->GetDefaultQueue(), profiler_.get()));
+    if (!graph_impl) {
+        return nullptr;
+    }
+    return std::make_shared<CommandGraph>(graph_impl.release());
+}
+
+std::shared_ptr<StreamingPipeline> Executor::ExecutorImpl::CreateStreamingPipeline(const StreamConfig &config) const
+{
+    StreamConfig stream_config = config;
+    if (stream_config.output_chunk_size == 0) {
+        stream_config.output_chunk_size = stream_config.chunk_size;
+    }
+    if (stream_config.chunk_size == 0 || stream_config.num_stages == 0) {
+        std::cout << "Invalid stream chunk size or number of stages" << std::endl;
+        return nullptr;
+    }
+    if (stream_config.device >= queue_managers_.size()) {
+        std::cout << "Invalid device index: " << stream_config.device << std::endl;
+        return nullptr;
+    }
+    // The pool queues fall back to the default queue, which would serialize the stages, so the pipeline owns its own.
+    auto create_queue = [this, &stream_config](QueueType type) -> std::shared_ptr<Queue> {
+        QueueManager::QueuePtr queue = queue_managers_[stream_config.device]->CreateQueue(false);
+        if (!queue) {
+            return nullptr;
+        }
+        std::unique_ptr<Queue::QueueImpl> queue_impl(new (std::nothrow) Queue::QueueImpl(queue.get(), type));
+        if (!queue_impl) {
+            return nullptr;
+        }
+        queue.release();
+        return std::make_shared<Queue>(queue_impl.release());
+    };
+    std::shared_ptr<Queue> upload_queue = create_queue(QueueType::Copy);
+    std::shared_ptr<Queue> compute_queue = create_queue(QueueType::Compute);
+    std::shared_ptr<Queue> download_queue = create_queue(QueueType::Copy);
+    if (!upload_queue || !compute_queue || !download_queue) {
+        std::cout << "Failed to create stream queues" << std::endl;
+        return nullptr;
+    }
+    std::vector<std::shared_ptr<Buffer>> inputs;
+    std::vector<std::shared_ptr<Buffer>> outputs;
+    for (uint32_t stage = 0; stage < stream_config.num_stages; ++stage) {
+        inputs.emplace_back(CreateBuffer(stream_config.chunk_size, BufferMode::DeviceOnly));
+        outputs.emplace_back(CreateBuffer(stream_config.output_chunk_size, BufferMode::DeviceOnly));
+        if (!inputs.back() || !inputs.back()->GetClMem() || !outputs.back() || !outputs.back()->GetClMem()) {
+            std::cout << "Failed to create stream staging buffers" << std::endl;
+            return nullptr;
+        }
+    }
+    std::unique_ptr<StreamingPipeline::StreamingPipelineImpl> pipeline_impl(
+        new (std::nothrow) StreamingPipeline::StreamingPipelineImpl(stream_config,
+        std::move(upload_queue),
+        std::move(compute_queue),
+        std::move(download_queue),
+        std::move(inputs),
+        std::move(outputs)));
+    if (!pipeline_impl) {
+        return nullptr;
+    }
+    return std::make_shared<StreamingPipeline>(pipeline_impl.release());
+}
+
+std::shared_ptr<TaskRuntime> Executor::ExecutorImpl::CreateTaskRuntime(const TaskRuntimeConfig &config) const
+{
+    uint32_t num_threads = config.num_threads == 0 ? std::thread::hardware_concurrency() : config.num_threads;
+    std::unique_ptr<TaskRuntime::TaskRuntimeImpl> runtime_impl(
+        new (std::nothrow) TaskRuntime::TaskRuntimeImpl(num_threads));
+    if (!runtime_impl || !runtime_impl->IsValid()) {
+        return nullptr;
+    }
+    return std::make_shared<TaskRuntime>(runtime_impl.release());
+}
+
+std::shared_ptr<Algorithms> Executor::ExecutorImpl::CreateAlgorithms(uint32_t device) const
+{
+    if (device >= queue_managers_.size()) {
+        std::cout << "Invalid device index: " << device << std::endl;
+        return nullptr;
+    }
+    size_t max_work_group_size = 0;
+    cl_ulong local_memory_size = 0;
+    cl_uint compute_units = 0;
+    cl_int ret = clGetDeviceInfo(
+        devices_[device], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to get device max work group size");
+    ret = clGetDeviceInfo(
+        devices_[device], CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_memory_size), &local_memory_size, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to get device local memory size");
+    ret = clGetDeviceInfo(
+        devices_[device], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, nullptr);
+    CHECK_OPENCL_ERROR_RETURN_NULL(ret, "Failed to get device compute units");
+    std::shared_ptr<Queue> queue = GetQueue(QueueType::Compute, 0, device);
+    if (!queue) {
+        return nullptr;
+    }
+    // The largest power of two work group size the device, its local memory and every kernel allow.
+    for (uint32_t work_group_size = kMaxAlgorithmWorkGroupSize; work_group_size >= (1u << kAlgorithmsRadixBits);
+         work_group_size /= 2) {
+        if (work_group_size > max_work_group_size ||
+            work_group_size * kAlgorithmsLocalMemoryPerWorkItem > local_memory_size) {
+            continue;
+        }
+        Algorithms::AlgorithmsImpl::Kernels kernels;
+        bool fits = true;
+        if (!CreateAlgorithmKernels(device, work_group_size, kernels, fits)) {
+            return nullptr;
+        }
+        if (!fits) {
+            continue;
+        }
+        std::unique_ptr<Algorithms::AlgorithmsImpl> algorithms_impl(new (std::nothrow) Algorithms::AlgorithmsImpl(
+            buffer_manager_.get(), std::move(queue), std::move(kernels), work_group_size, compute_units));
+        if (!algorithms_impl) {
+            return nullptr;
+        }
+        return std::make_shared<Algorithms>(algorithms_impl.release());
+    }
+    std::cout << "No work group size fits the algorithm kernels" << std::endl;
+    return nullptr;
+}
+
+bool Executor::ExecutorImpl::CreateAlgorithmKernels(uint32_t device,
+    uint32_t work_group_size,
+    Algorithms::AlgorithmsImpl::Kernels &kernels,
+    bool &fits) const
+{
+    const std::set<std::string> build_options = {"-DWG_SIZE=" + std::to_string(work_group_size)};
+    const std::pair<const char *, std::shared_ptr<Kernel> *> entries[] = {
+        {"TransformBuffer", &kernels.transform_buffer},
+        {"TransformScalar", &kernels.transform_scalar},
+        {"Reduce", &kernels.reduce},
+        {"ScanBlocksFloat", &kernels.scan_blocks_float},
+        {"AddBlockOffsetsFloat", &kernels.add_block_offsets_float},
+        {"ScanBlocksUint", &kernels.scan_blocks_uint},
+        {"AddBlockOffsetsUint", &kernels.add_block_offsets_uint},
+        {"CompactScatter", &kernels.compact_scatter},
+        {"RadixCount", &kernels.radix_count},
+        {"RadixScatter", &kernels.radix_scatter},
+        {"Histogram", &kernels.histogram},
+    };
+    for (const auto &entry : entries) {
+        *entry.second = CreateKernel(kAlgorithmsProgramName, entry.first, build_options);
+        if (!*entry.second) {
+            return false;
+        }
+        // Kernels using many registers may not run the work group size the device reports.
+        cl_kernel kernel = program_manager_->GetKernel(kAlgorithmsProgramName, build_options, entry.first);
+        size_t kernel_work_group_size = 0;
+        cl_int ret = clGetKernelWorkGroupInfo(kernel,
+            devices_[device],
+            CL_KERNEL_WORK_GROUP_SIZE,
+            sizeof(kernel_work_group_size),
+            &kernel_work_group_size,
+            nullptr);
+        CHECK_OPENCL_ERROR_RETURN_FALSE(ret, "Failed to get kernel work group size");
+        if (kernel_work_group_size < work_group_size) {
+            fits = false;
+            return true;
+        }
+    }
+    return true;
+}
+
+uint32_t Executor::ExecutorImpl::GetDeviceCount() const { return devices_.size(); }
+
+bool Executor::ExecutorImpl::GetDeviceInfo(uint32_t device, DeviceInfo &info) const
+{
+    if (device >= devices_.size()) {
+        std::cout << "Invalid device index: " << device << std::endl;
+        return false;
+    }
+    return DeviceSelector::GetDeviceInfo(devices_[device], info);
+}
+
+void Executor::ExecutorImpl::SetSchedulePolicy(SchedulePolicy policy) const
+{
+    if (!scheduler_) {
+        return;
+    }
+    scheduler_->SetPolicy(policy);
+}
+
+void Executor::ExecutorImpl::SetProgramCacheDirectory(const std::string &directory) const
+{
+    if (!program_manager_) {
+        return;
+    }
+    program_manager_->SetCacheDirectory(directory);
+    tuner_->SetDirectory(directory);
+}
+
+Executor &Executor::GetInstance()
+{
+    static Executor instance([]() {
+        DefaultOptionsState &state = GetDefaultOptionsState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.used = true;
+        return state.options;
+    }());
+    static WarmupJoiner warmup_joiner;
+    return instance;
+}
+
+std::shared_ptr<Executor> Executor::Create(const ExecutorOptions &options)
+{
+    if (options.device_selection.types.empty()) {
+        std::cout << "The device selection has no device types" << std::endl;
+        return nullptr;
+    }
+    std::shared_ptr<Executor> executor(new (std::nothrow) Executor(options));
+    if (!executor || !executor->impl_ || !executor->impl_->IsInitialized()) {
+        return nullptr;
+    }
+    return executor;
+}
+
+std::shared_future<bool> Executor::Warmup(const WarmupConfig &config)
+{
+    auto warmed_up = std::make_shared<std::promise<bool>>();
+    std::shared_future<bool> future = warmed_up->get_future().share();
+    WarmupThreads &warmup_threads = GetWarmupThreads();
+    std::lock_guard<std::mutex> lock(warmup_threads.mutex);
+    warmup_threads.threads.emplace_back([config, warmed_up]() {
+        Executor &executor = GetInstance();
+        if (!executor.impl_ || !executor.impl_->IsInitialized()) {
+            warmed_up->set_value(false);
+            return;
+        }
+        warmed_up->set_value(executor.impl_->Prebuild(config).get());
+    });
+    return future;
+}
+
+bool Executor::SetDefaultOptions(const ExecutorOptions &options)
+{
+    if (options.device_selection.types.empty()) {
+        std::cout << "The device selection has no device types" << std::endl;
+        return false;
+    }
+    DefaultOptionsState &state = GetDefaultOptionsState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.used) {
+        std::cout << "The default options must be set before the Executor instance is initialized" << std::endl;
+        return false;
+    }
+    state.options = options;
+    return true;
+}
+
+bool Executor::SetDeviceSelection(const DeviceSelection &selection)
+{
+    if (selection.types.empty()) {
+        std::cout << "The device selection has no device types" << std::endl;
+        return false;
+    }
+    DefaultOptionsState &state = GetDefaultOptionsState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.used) {
+        std::cout << "The device selection must be set before the Executor instance is initialized" << std::endl;
+        return false;
+    }
+    state.options.device_selection = selection;
+    return true;
+}
+
+Executor::Executor(const ExecutorOptions &options) : impl_(std::make_unique<ExecutorImpl>(options)) {}
+
+Executor::~Executor() = default;
+
+std::shared_ptr<Kernel> Executor::CreateKernel(
+    const std::string &program_name, const std::string &kernel_name, const std::set<std::string> &build_options) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->CreateKernel(program_name, kernel_name, build_options);
+}
+
+std::shared_ptr<Kernel> Executor::CreateKernelFromSource(
+    const std::string &source, const std::string &kernel_name, const std::set<std::string> &build_options) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->CreateKernelFromSource(source, kernel_name, build_options);
+}
+
+bool Executor::AddProgramSource(const std::string &program_name, const std::string &source) const
+{
+    if (!impl_) {
+        return false;
+    }
+    return impl_->AddProgramSource(program_name, source);
+}
+
+std::vector<std::shared_future<bool>> Executor::PrecompileAsync(const std::vector<ProgramSpec> &programs) const
+{
+    if (!impl_) {
+        std::vector<std::shared_future<bool>> futures;
+        for (size_t i = 0; i < programs.size(); i++) {
+            std::promise<bool> failed;
+            failed.set_value(false);
+            futures.emplace_back(failed.get_future().share());
+        }
+        return futures;
+    }
+    return impl_->PrecompileAsync(programs);
+}
+
+std::shared_future<bool> Executor::Prebuild(const WarmupConfig &config) const
+{
+    if (!impl_) {
+        std::promise<bool> failed;
+        failed.set_value(false);
+        return failed.get_future().share();
+    }
+    return impl_->Prebuild(config);
+}
+
+std::vector<StartupTiming> Executor::GetStartupTimings() const
+{
+    if (!impl_) {
+        return {};
+    }
+    return impl_->GetStartupTimings();
+}
+
+std::shared_ptr<Buffer> Executor::CreateBuffer(size_t size) const
+{
+    return CreateBuffer(size, BufferMode::HostVisiblePersistent);
+}
+
+std::shared_ptr<Buffer> Executor::CreateBuffer(size_t size, BufferMode mode) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->CreateBuffer(size, mode);
+}
+
+std::shared_ptr<Buffer> Executor::WrapHostMemory(void *host_ptr, size_t size) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->WrapHostMemory(host_ptr, size);
+}
+
+std::shared_ptr<BufferArena> Executor::CreateBufferArena(size_t capacity, BufferMode mode) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->CreateBufferArena(capacity, mode);
+}
+
+std::shared_ptr<Buffer> Executor::MapFile(const std::string &path, size_t offset, size_t size) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->MapFile(path, offset, size);
+}
+
+void Executor::ConfigureBufferPool(const BufferPoolConfig &config) const
+{
+    if (!impl_) {
+        return;
+    }
+    impl_->ConfigureBufferPool(config);
+}
+
+void Executor::TrimBufferPool(size_t max_cached_bytes) const
+{
+    if (!impl_) {
+        return;
+    }
+    impl_->TrimBufferPool(max_cached_bytes);
+}
+
+BufferPoolStatistics Executor::GetBufferPoolStatistics() const
+{
+    if (!impl_) {
+        return BufferPoolStatistics();
+    }
+    return impl_->GetBufferPoolStatistics();
+}
+
+bool Executor::ConfigureQueues(const QueuePoolConfig &config) const
+{
+    if (!impl_) {
+        return false;
+    }
+    return impl_->ConfigureQueues(config);
+}
+
+std::shared_ptr<Queue> Executor::GetQueue(QueueType type, uint32_t index, uint32_t device) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->GetQueue(type, index, device);
+}
+
+bool Executor::Finish() const
+{
+    if (!impl_) {
+        return false;
+    }
+    return impl_->Finish();
+}
+
+void Executor::EnableProfiling(bool enable) const
+{
+    if (!impl_) {
+        return;
+    }
+    impl_->EnableProfiling(enable);
+}
+
+std::vector<KernelProfile> Executor::GetKernelProfiles() const
+{
+    if (!impl_) {
+        return {};
+    }
+    return impl_->GetKernelProfiles();
+}
+
+bool Executor::DumpChromeTrace(const std::string &path) const
+{
+    if (!impl_) {
+        return false;
+    }
+    return impl_->DumpChromeTrace(path);
+}
+
+void Executor::ResetProfiling() const
+{
+    if (!impl_) {
+        return;
+    }
+    impl_->ResetProfiling();
+}
+
+std::shared_ptr<CommandGraph> Executor::CreateCommandGraph(uint32_t device) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->CreateCommandGraph(device);
+}
+
+std::shared_ptr<StreamingPipeline> Executor::CreateStreamingPipeline(const StreamConfig &config) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->CreateStreamingPipeline(config);
+}
+
+std::shared_ptr<Algorithms> Executor::CreateAlgorithms(uint32_t device) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->CreateAlgorithms(device);
+}
+
+std::shared_ptr<TaskRuntime> Executor::CreateTaskRuntime(const TaskRuntimeConfig &config) const
+{
+    if (!impl_) {
+        return nullptr;
+    }
+    return impl_->CreateTaskRuntime(config);
+}
+
+uint32_t Executor::GetDeviceCount() const
+{
+    if (!impl_) {
+        return 0;
+    }
+    return impl_->GetDeviceCount();
+}
+
+bool Executor::GetDeviceInfo(uint32_t device, DeviceInfo &info) const
+{
+    if (!impl_) {
+        return false;
+    }
+    return impl_->GetDeviceInfo(device, info);
+}
+
+void Executor::SetSchedulePolicy(SchedulePolicy policy) const
+{
+    if (!impl_) {
+        return;
+    }
+    impl_->SetSchedulePolicy(policy);
+}
+
+void Executor::SetProgramCacheDirectory(const std::string &directory) const
+{
+    if (!impl_) {
+        return;
     }
-    return impl_->CreateBuffer(size);
+    impl_->SetProgramCacheDirectory(directory);
 }
 
-}  // namespace TinyOCL
\ No newline at end of file
+}  // namespace TinyOCL
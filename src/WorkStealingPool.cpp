@@ -0,0 +1,99 @@
+#include <utility>
+#include "WorkStealingPool.h"
+
+namespace TinyOCL {
+namespace {
+// The pool and index of the worker running on the current thread, tasks it submits go to its own deque.
+thread_local const WorkStealingPool *current_pool = nullptr;
+thread_local uint32_t current_index = 0;
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(uint32_t num_threads)
+{
+    num_threads = num_threads == 0 ? 1 : num_threads;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        workers_.emplace_back(std::make_unique<Worker>());
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        threads_.emplace_back(&WorkStealingPool::Work, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::Submit(std::function<void()> task)
+{
+    uint32_t index = current_pool == this ? current_index : next_worker_++ % workers_.size();
+    queued_++;
+    {
+        std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+        workers_[index]->tasks.emplace_back(std::move(task));
+    }
+    {
+        // Taking the lock orders the count before the predicate check of a worker going to sleep.
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+    condition_.notify_one();
+}
+
+uint32_t WorkStealingPool::GetThreadCount() const { return static_cast<uint32_t>(threads_.size()); }
+
+uint64_t WorkStealingPool::GetStolenCount() const { return stolen_.load(); }
+
+bool WorkStealingPool::Pop(uint32_t index, std::function<void()> &task)
+{
+    std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+    if (workers_[index]->tasks.empty()) {
+        return false;
+    }
+    task = std::move(workers_[index]->tasks.back());
+    workers_[index]->tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::Steal(uint32_t index, std::function<void()> &task)
+{
+    for (size_t i = 1; i < workers_.size(); i++) {
+        Worker &victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) {
+            continue;
+        }
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        stolen_++;
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::Work(uint32_t index)
+{
+    current_pool = this;
+    current_index = index;
+    while (true) {
+        std::function<void()> task;
+        if (Pop(index, task) || Steal(index, task)) {
+            queued_--;
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return stop_ || queued_.load() > 0; });
+        if (stop_ && queued_.load() == 0) {
+            return;
+        }
+    }
+}
+
+}  // namespace TinyOCL
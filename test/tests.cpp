@@ -7,6 +7,14 @@
 
 #include <gtest/gtest.h>
 #include <TinyOCL.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <thread>
 #include <vector>
 
 TEST(TinyOCLTest, TestExecutorCreateKernel1)
@@ -33,6 +41,46 @@ TEST(TinyOCLTest, TestExecutorCreateKernel4)
     EXPECT_EQ(kernel, nullptr);
 }
 
+TEST(TinyOCLTest, TestEmbeddedPrograms)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    // Embedded programs do not depend on the working directory.
+    const std::filesystem::path working_directory = std::filesystem::current_path();
+    std::filesystem::current_path(std::filesystem::temp_directory_path());
+    auto embedded_kernel = executor.CreateKernel("cl/calc.cl", "sub", {"-DTEST_EMBEDDED_PROGRAMS"});
+    std::filesystem::current_path(working_directory);
+    EXPECT_NE(embedded_kernel, nullptr);
+
+    const std::string source = "__kernel void add(__global const float *a, __global const float *b, "
+                               "__global float *result)\n"
+                               "{\n"
+                               "    int gid = get_global_id(0);\n"
+                               "    result[gid] = a[gid] + b[gid];\n"
+                               "}\n";
+    auto kernel = executor.CreateKernelFromSource(source, "add", {});
+    ASSERT_NE(kernel, nullptr);
+    EXPECT_NE(executor.CreateKernelFromSource(source, "add", {}), nullptr);
+    EXPECT_EQ(executor.CreateKernelFromSource("", "add", {}), nullptr);
+    auto input = executor.CreateBuffer(16 * sizeof(float));
+    auto output = executor.CreateBuffer(16 * sizeof(float));
+    ASSERT_TRUE(input && output);
+    std::vector<float> host_input(16, 1.5f);
+    EXPECT_TRUE(input->Memcpy(host_input.data(), 16 * sizeof(float), TinyOCL::MemcpyKind::HostToDevice));
+    EXPECT_TRUE(kernel->Run({16}, {}, true, input->GetClMem(), input->GetClMem(), output->GetClMem()));
+    std::vector<float> host_output(16, 0.0f);
+    EXPECT_TRUE(output->Memcpy(host_output.data(), 16 * sizeof(float), TinyOCL::MemcpyKind::DeviceToHost));
+    for (float value : host_output) {
+        EXPECT_EQ(value, 3.0f);
+    }
+
+    // Registered names need no extension and keep their source.
+    EXPECT_TRUE(executor.AddProgramSource("test/registered", source));
+    EXPECT_TRUE(executor.AddProgramSource("test/registered", source));
+    EXPECT_FALSE(executor.AddProgramSource("test/registered", source + "\n"));
+    EXPECT_FALSE(executor.AddProgramSource("cl/calc.cl", source));
+    EXPECT_NE(executor.CreateKernel("test/registered", "add", {}), nullptr);
+}
+
 TEST(TinyOCLTest, TestExecutorCreateBuffer1)
 {
     auto buffer = TinyOCL::Executor::GetInstance().CreateBuffer(10 * sizeof(float));
@@ -71,6 +119,1397 @@ TEST(TinyOCLTest, TestBuffer)
     }
 }
 
+TEST(TinyOCLTest, TestBufferPool)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    executor.ConfigureBufferPool(TinyOCL::BufferPoolConfig());
+    auto stats0 = executor.GetBufferPoolStatistics();
+    EXPECT_EQ(stats0.cached_buffers, 0);
+
+    auto buffer = executor.CreateBuffer(1000);
+    EXPECT_NE(buffer, nullptr);
+    EXPECT_EQ(buffer->GetSize(), 1000);
+    cl_mem mem = buffer->GetClMem();
+    int *data = buffer->GetHostPtr<int *>();
+    buffer.reset();
+
+    auto stats1 = executor.GetBufferPoolStatistics();
+    EXPECT_EQ(stats1.cached_buffers, 1);
+    EXPECT_EQ(stats1.cached_bytes, 1024);
+
+    auto buffer1 = executor.CreateBuffer(900);
+    EXPECT_EQ(buffer1->GetClMem(), mem);
+    EXPECT_EQ(buffer1->GetHostPtr<int *>(), data);
+    auto stats2 = executor.GetBufferPoolStatistics();
+    EXPECT_EQ(stats2.hits, stats1.hits + 1);
+    EXPECT_EQ(stats2.cached_buffers, 0);
+    buffer1.reset();
+
+    // A buffer released while a copy into it is still queued is not handed out again before the copy completes.
+    auto queue = executor.GetQueue(TinyOCL::QueueType::Compute, 0);
+    ASSERT_NE(queue, nullptr);
+    cl_context context = nullptr;
+    ASSERT_EQ(clGetCommandQueueInfo(
+                  queue->GetClCommandQueue(), CL_QUEUE_CONTEXT, sizeof(context), &context, nullptr),
+        CL_SUCCESS);
+    TinyOCL::Event gate(clCreateUserEvent(context, nullptr));
+    ASSERT_TRUE(gate.IsValid());
+    std::vector<int> host(250, 1);
+    auto pending = executor.CreateBuffer(1000);
+    cl_mem pending_mem = pending->GetClMem();
+    TinyOCL::Event copy;
+    EXPECT_TRUE(pending->Memcpy(host.data(), 1000, TinyOCL::MemcpyKind::HostToDevice, {gate}, &copy));
+    pending.reset();
+    auto buffer3 = executor.CreateBuffer(1000);
+    EXPECT_NE(buffer3->GetClMem(), pending_mem);
+    EXPECT_EQ(clSetUserEventStatus(gate.GetClEvent(), CL_COMPLETE), CL_SUCCESS);
+    EXPECT_TRUE(copy.Wait());
+    EXPECT_TRUE(executor.Finish());
+    auto buffer4 = executor.CreateBuffer(1000);
+    EXPECT_EQ(buffer4->GetClMem(), pending_mem);
+    buffer3.reset();
+    buffer4.reset();
+
+    executor.TrimBufferPool();
+    auto stats3 = executor.GetBufferPoolStatistics();
+    EXPECT_EQ(stats3.cached_buffers, 0);
+    EXPECT_EQ(stats3.cached_bytes, 0);
+
+    TinyOCL::BufferPoolConfig config;
+    config.max_cached_bytes = 0;
+    executor.ConfigureBufferPool(config);
+    auto buffer2 = executor.CreateBuffer(1000);
+    buffer2.reset();
+    EXPECT_EQ(executor.GetBufferPoolStatistics().cached_buffers, 0);
+    executor.ConfigureBufferPool(TinyOCL::BufferPoolConfig());
+}
+
+TEST(TinyOCLTest, TestBufferMode)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    size_t size = 16 * sizeof(int);
+    auto buffer = executor.CreateBuffer(size, TinyOCL::BufferMode::MapOnDemand);
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_EQ(buffer->GetMode(), TinyOCL::BufferMode::MapOnDemand);
+    EXPECT_EQ(buffer->GetHostPtr<int *>(), nullptr);
+    {
+        TinyOCL::BufferMapping mapping = buffer->Map(0, size, TinyOCL::MapAccess::WriteInvalidate);
+        ASSERT_TRUE(mapping.IsValid());
+        EXPECT_EQ(mapping.GetSize(), size);
+        int *data = mapping.GetPtr<int *>();
+        for (int i = 0; i < 16; i++) {
+            data[i] = i;
+        }
+    }
+    EXPECT_FALSE(buffer->Map(size - sizeof(int), 2 * sizeof(int), TinyOCL::MapAccess::Read).IsValid());
+    std::vector<int> host(16, 0);
+    EXPECT_TRUE(buffer->Memcpy(host.data(), size, TinyOCL::MemcpyKind::DeviceToHost));
+    for (int i = 0; i < 16; i++) {
+        EXPECT_EQ(host[i], i);
+    }
+
+    auto device_buffer = executor.CreateBuffer(size, TinyOCL::BufferMode::DeviceOnly);
+    ASSERT_NE(device_buffer, nullptr);
+    EXPECT_EQ(device_buffer->GetHostPtr<int *>(), nullptr);
+    EXPECT_FALSE(device_buffer->Map(0, size, TinyOCL::MapAccess::Read).IsValid());
+    EXPECT_TRUE(device_buffer->Memcpy(host.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+    cl_mem mem = device_buffer->GetClMem();
+    device_buffer.reset();
+
+    // A released buffer is only reused by buffers of the same mode.
+    auto host_buffer = executor.CreateBuffer(size);
+    EXPECT_NE(host_buffer->GetClMem(), mem);
+    EXPECT_NE(host_buffer->GetHostPtr<int *>(), nullptr);
+    auto device_buffer1 = executor.CreateBuffer(size, TinyOCL::BufferMode::DeviceOnly);
+    EXPECT_EQ(device_buffer1->GetClMem(), mem);
+
+    // A mapping keeps its buffer alive after the Buffer is destroyed.
+    auto mapped_buffer = executor.CreateBuffer(size, TinyOCL::BufferMode::MapOnDemand);
+    ASSERT_NE(mapped_buffer, nullptr);
+    TinyOCL::BufferMapping mapping = mapped_buffer->Map(0, size, TinyOCL::MapAccess::Write);
+    ASSERT_TRUE(mapping.IsValid());
+    mapped_buffer.reset();
+    mapping.GetPtr<int *>()[0] = 1;
+    EXPECT_TRUE(mapping.Unmap());
+    EXPECT_FALSE(mapping.IsValid());
+}
+
+TEST(TinyOCLTest, TestWrapHostMemory)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    constexpr size_t kSize = 4096;
+    std::unique_ptr<int, decltype(&std::free)> memory(static_cast<int *>(std::aligned_alloc(kSize, kSize)), std::free);
+    ASSERT_NE(memory, nullptr);
+    int *data = memory.get();
+    for (size_t i = 0; i < kSize / sizeof(int); i++) {
+        data[i] = static_cast<int>(i);
+    }
+    EXPECT_EQ(executor.WrapHostMemory(reinterpret_cast<char *>(data) + 1, kSize - 1), nullptr);
+    auto buffer = executor.WrapHostMemory(data, kSize);
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_EQ(buffer->GetSize(), kSize);
+
+    std::vector<int> host(4, 0);
+    EXPECT_TRUE(
+        buffer->Memcpy(host.data(), 4 * sizeof(int), 4 * sizeof(int), TinyOCL::MemcpyKind::DeviceToHost, {}, nullptr));
+    EXPECT_EQ(host, std::vector<int>({4, 5, 6, 7}));
+    int value = -1;
+    EXPECT_TRUE(buffer->Memcpy(&value, sizeof(int), 0, TinyOCL::MemcpyKind::HostToDevice, {}, nullptr));
+    {
+        TinyOCL::BufferMapping mapping = buffer->Map(0, sizeof(int), TinyOCL::MapAccess::Read);
+        ASSERT_TRUE(mapping.IsValid());
+        EXPECT_EQ(mapping.GetPtr<int *>()[0], -1);
+    }
+}
+
+TEST(TinyOCLTest, TestMapFile)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    std::string path = (std::filesystem::temp_directory_path() / "tinyocl_map_file.bin").string();
+    std::vector<int> content(2048);
+    for (size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<int>(i);
+    }
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(content.data()), content.size() * sizeof(int));
+    }
+
+    auto buffer = executor.MapFile(path, 4096, 0);
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_EQ(buffer->GetSize(), 4096);
+    std::vector<int> host(1024, 0);
+    EXPECT_TRUE(buffer->Memcpy(host.data(), 4096, TinyOCL::MemcpyKind::DeviceToHost));
+    EXPECT_EQ(host[0], 1024);
+    EXPECT_EQ(host[1023], 2047);
+    EXPECT_EQ(executor.MapFile(path, 1, 0), nullptr);
+    EXPECT_EQ(executor.MapFile(path, 4096, 8192), nullptr);
+    buffer.reset();
+    std::filesystem::remove(path);
+}
+
+TEST(TinyOCLTest, TestBufferArena)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto arena = executor.CreateBufferArena(4096, TinyOCL::BufferMode::HostVisiblePersistent);
+    ASSERT_NE(arena, nullptr);
+    EXPECT_EQ(arena->GetCapacity(), 4096);
+    {
+        auto buffer0 = arena->Allocate(10 * sizeof(int));
+        auto buffer1 = arena->Allocate(10 * sizeof(int));
+        ASSERT_NE(buffer0, nullptr);
+        ASSERT_NE(buffer1, nullptr);
+        EXPECT_NE(buffer0->GetClMem(), buffer1->GetClMem());
+        EXPECT_GT(arena->GetUsedSize(), 20 * sizeof(int));
+        EXPECT_EQ(arena->Allocate(4096), nullptr);
+
+        std::vector<int> host0(10, 1);
+        std::vector<int> host1(10, 2);
+        EXPECT_TRUE(buffer0->Memcpy(host0.data(), 10 * sizeof(int), TinyOCL::MemcpyKind::HostToDevice));
+        EXPECT_TRUE(buffer1->Memcpy(host1.data(), 10 * sizeof(int), TinyOCL::MemcpyKind::HostToDevice));
+        EXPECT_EQ(buffer0->GetHostPtr<int *>()[9], 1);
+        EXPECT_EQ(buffer1->GetHostPtr<int *>()[0], 2);
+    }
+    arena->Reset();
+    EXPECT_EQ(arena->GetUsedSize(), 0);
+    EXPECT_NE(arena->Allocate(4096), nullptr);
+}
+
+TEST(TinyOCLTest, TestTypedBuffer)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto buffer = executor.CreateTypedBuffer<float>(16);
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_EQ(buffer->GetCount(), 16);
+    EXPECT_EQ(buffer->GetBuffer()->GetSize(), 16 * sizeof(float));
+
+    TinyOCL::Event fill;
+    EXPECT_TRUE(buffer->Fill(1.5f, {}, &fill));
+    std::vector<float> upload = {2.0f, 3.0f};
+    EXPECT_TRUE(buffer->Upload(upload, 4, {fill}));
+    std::vector<float> download(16, 0.0f);
+    EXPECT_TRUE(buffer->Download(download));
+    for (size_t i = 0; i < download.size(); i++) {
+        EXPECT_EQ(download[i], i == 4 ? 2.0f : (i == 5 ? 3.0f : 1.5f));
+    }
+    TinyOCL::HostSpan<float> host = buffer->GetHostSpan();
+    EXPECT_EQ(host.size(), 16);
+    EXPECT_EQ(host.data()[5], 3.0f);
+    EXPECT_FALSE(buffer->Upload(upload, 15));
+
+    // Patterns clEnqueueFillBuffer does not take are written once and doubled on the device.
+    struct Pixel {
+        uint8_t r, g, b;
+    };
+    auto pixels = executor.CreateTypedBuffer<Pixel>(5, TinyOCL::BufferMode::DeviceOnly);
+    ASSERT_NE(pixels, nullptr);
+    TinyOCL::Event pixel_fill;
+    EXPECT_TRUE(pixels->Fill(Pixel{1, 2, 3}, {}, &pixel_fill));
+    EXPECT_TRUE(pixel_fill.IsValid());
+    std::array<Pixel, 5> pixel_data{};
+    EXPECT_TRUE(pixels->Download(pixel_data, 0, {pixel_fill}));
+    for (const auto &pixel : pixel_data) {
+        EXPECT_EQ(pixel.r, 1);
+        EXPECT_EQ(pixel.g, 2);
+        EXPECT_EQ(pixel.b, 3);
+    }
+}
+
+TEST(TinyOCLTest, TestEventChain)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    size_t size = 16 * sizeof(float);
+    auto buffer0 = executor.CreateBuffer(size);
+    auto buffer1 = executor.CreateBuffer(size);
+    auto buffer2 = executor.CreateBuffer(size);
+    std::vector<float> host0(16, 1.0f);
+    std::vector<float> host1(16, 2.0f);
+    std::vector<float> host2(16, 0.0f);
+
+    TinyOCL::Event write0;
+    TinyOCL::Event write1;
+    EXPECT_TRUE(buffer0->Memcpy(host0.data(), size, TinyOCL::MemcpyKind::HostToDevice, {}, &write0));
+    EXPECT_TRUE(buffer1->Memcpy(host1.data(), size, TinyOCL::MemcpyKind::HostToDevice, {}, &write1));
+    EXPECT_TRUE(write0.IsValid());
+
+    TinyOCL::Event run;
+    bool ret = kernel->RunAsync(
+        {16}, {}, {write0, write1}, &run, buffer0->GetClMem(), buffer1->GetClMem(), buffer2->GetClMem());
+    EXPECT_TRUE(ret);
+
+    TinyOCL::Event read;
+    EXPECT_TRUE(buffer2->Memcpy(host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost, {run}, &read));
+    EXPECT_TRUE(read.Wait());
+    EXPECT_TRUE(read.IsComplete());
+    EXPECT_TRUE(TinyOCL::Event::WaitAll({write0, write1, run, read}));
+    for (int i = 0; i < 16; i++) {
+        EXPECT_EQ(host2[i], 3.0f);
+    }
+}
+
+TEST(TinyOCLTest, TestBufferPartialCopy)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    size_t size = 16 * sizeof(int);
+    auto buffer0 = executor.CreateBuffer(size);
+    auto buffer1 = executor.CreateBuffer(size);
+    std::vector<int> host0(16);
+    for (int i = 0; i < 16; i++) {
+        host0[i] = i;
+    }
+    std::vector<int> host1(16, 0);
+    EXPECT_TRUE(buffer0->Memcpy(host0.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+    EXPECT_TRUE(buffer1->Memcpy(host1.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+
+    TinyOCL::Event write;
+    int value = 100;
+    EXPECT_TRUE(buffer0->Memcpy(&value, sizeof(int), 4 * sizeof(int), TinyOCL::MemcpyKind::HostToDevice, {}, &write));
+    EXPECT_FALSE(buffer0->Memcpy(&value, sizeof(int), size, TinyOCL::MemcpyKind::HostToDevice, {}, nullptr));
+    TinyOCL::Event copy;
+    EXPECT_TRUE(buffer1->CopyFrom(*buffer0, 8 * sizeof(int), 0, 8 * sizeof(int), {write}, &copy));
+    EXPECT_TRUE(buffer1->Memcpy(host1.data(), size, TinyOCL::MemcpyKind::DeviceToHost, {copy}, nullptr));
+    for (int i = 0; i < 16; i++) {
+        EXPECT_EQ(host1[i], i < 8 ? 0 : (i == 12 ? 100 : i - 8));
+    }
+
+    // Read the 2x2 tile at column 1, row 1 of buffer0 seen as a 4x4 image.
+    TinyOCL::BufferRect rect;
+    rect.buffer_origin = {sizeof(int), 1, 0};
+    rect.region = {2 * sizeof(int), 2, 1};
+    rect.buffer_row_pitch = 4 * sizeof(int);
+    std::vector<int> tile(4, 0);
+    EXPECT_TRUE(buffer0->MemcpyRect(tile.data(), rect, TinyOCL::MemcpyKind::DeviceToHost, {}, nullptr));
+    EXPECT_EQ(tile, std::vector<int>({5, 6, 9, 10}));
+}
+
+TEST(TinyOCLTest, TestConcurrentKernelRun)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    constexpr int kThreads = 4;
+    constexpr int kIterations = 16;
+    size_t size = 16 * sizeof(float);
+    std::vector<std::thread> threads;
+    std::vector<int> results(kThreads, 0);
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&, t]() {
+            auto input0 = executor.CreateBuffer(size);
+            auto input1 = executor.CreateBuffer(size);
+            auto output = executor.CreateBuffer(size);
+            std::vector<float> host0(16, static_cast<float>(t));
+            std::vector<float> host1(16, 1.0f);
+            std::vector<float> host2(16, 0.0f);
+            input0->Memcpy(host0.data(), size, TinyOCL::MemcpyKind::HostToDevice);
+            input1->Memcpy(host1.data(), size, TinyOCL::MemcpyKind::HostToDevice);
+            for (int i = 0; i < kIterations; i++) {
+                if (!kernel->Run({16}, {}, false, input0->GetClMem(), input1->GetClMem(), output->GetClMem())) {
+                    return;
+                }
+                output->Memcpy(host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost);
+                if (host2[0] != t + 1.0f || host2[15] != t + 1.0f) {
+                    return;
+                }
+            }
+            results[t] = 1;
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (int t = 0; t < kThreads; t++) {
+        EXPECT_EQ(results[t], 1);
+    }
+}
+
+TEST(TinyOCLTest, TestPersistentArgs)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    size_t size = 16 * sizeof(float);
+    auto input0 = executor.CreateBuffer(size);
+    auto input1 = executor.CreateBuffer(size);
+    auto output = executor.CreateBuffer(size);
+    std::vector<float> host0(16, 1.0f);
+    std::vector<float> host1(16, 2.0f);
+    std::vector<float> host2(16, 0.0f);
+    EXPECT_TRUE(input0->Memcpy(host0.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+    EXPECT_TRUE(input1->Memcpy(host1.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+
+    EXPECT_TRUE(kernel->SetPersistentArg(1, input1->GetClMem()));
+    EXPECT_TRUE(kernel->SetPersistentArg(2, output->GetClMem()));
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(kernel->Run({16}, {}, false, input0->GetClMem()));
+    }
+    EXPECT_TRUE(output->Memcpy(host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost));
+    EXPECT_EQ(host2[0], 3.0f);
+
+    EXPECT_TRUE(kernel->SetPersistentArg(0, input1->GetClMem()));
+    EXPECT_TRUE(kernel->Run({16}, {}, false));
+    EXPECT_TRUE(output->Memcpy(host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost));
+    EXPECT_EQ(host2[15], 4.0f);
+
+    kernel->ClearPersistentArgs();
+    EXPECT_TRUE(kernel->Run({16}, {}, false, input0->GetClMem(), input0->GetClMem(), output->GetClMem()));
+    EXPECT_TRUE(output->Memcpy(host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost));
+    EXPECT_EQ(host2[0], 2.0f);
+
+    // A buffer created after another one is released can get the same handle, it must still be bound again.
+    output.reset();
+    auto recycled = executor.CreateBuffer(size);
+    ASSERT_NE(recycled, nullptr);
+    EXPECT_TRUE(kernel->Run({16}, {}, false, input1->GetClMem(), input1->GetClMem(), recycled->GetClMem()));
+    EXPECT_TRUE(recycled->Memcpy(host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost));
+    EXPECT_EQ(host2[0], 4.0f);
+}
+
+TEST(TinyOCLTest, TestCommandGraph)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    auto graph = executor.CreateCommandGraph();
+    ASSERT_NE(graph, nullptr);
+    size_t size = 16 * sizeof(float);
+    auto input0 = executor.CreateBuffer(size);
+    auto input1 = executor.CreateBuffer(size);
+    auto input2 = executor.CreateBuffer(size);
+    auto output = executor.CreateBuffer(size);
+    std::vector<float> host0(16, 1.0f);
+    std::vector<float> host1(16, 2.0f);
+    std::vector<float> host2(16, 0.0f);
+    EXPECT_TRUE(input2->Memcpy(host1.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+
+    uint32_t write0 = 0;
+    uint32_t write1 = 0;
+    uint32_t run = 0;
+    EXPECT_TRUE(graph->RecordMemcpy(*input0, host0.data(), size, TinyOCL::MemcpyKind::HostToDevice, {}, &write0));
+    EXPECT_TRUE(graph->RecordMemcpy(*input1, host1.data(), size, TinyOCL::MemcpyKind::HostToDevice, {}, &write1));
+    EXPECT_TRUE(graph->RecordKernel(
+        *kernel, {16}, {}, {write0, write1}, &run, input0->GetClMem(), input1->GetClMem(), output->GetClMem()));
+    EXPECT_TRUE(graph->RecordMemcpy(*output, host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost, {run}, nullptr));
+    EXPECT_FALSE(graph->RecordKernel(*kernel, {16}, {}, {}, nullptr, input0->GetClMem()));
+    EXPECT_FALSE(graph->Replay({}, {}, nullptr));
+    EXPECT_TRUE(graph->Finalize());
+    EXPECT_FALSE(graph->RecordMemcpy(*output, host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost, {}, nullptr));
+
+    TinyOCL::Event replay;
+    EXPECT_TRUE(graph->Replay({}, {}, &replay));
+    EXPECT_TRUE(replay.Wait());
+    EXPECT_EQ(host2[0], 3.0f);
+
+    host0.assign(16, 5.0f);
+    EXPECT_TRUE(graph->Replay({}, {}, &replay));
+    EXPECT_TRUE(replay.Wait());
+    EXPECT_EQ(host2[15], 7.0f);
+
+    cl_mem patched = input2->GetClMem();
+    EXPECT_TRUE(graph->Replay({{run, 0, {sizeof(cl_mem), &patched}}}, {}, &replay));
+    EXPECT_TRUE(replay.Wait());
+    EXPECT_EQ(host2[0], 4.0f);
+    EXPECT_FALSE(graph->Replay({{write0, 0, {sizeof(cl_mem), &patched}}}, {}, nullptr));
+}
+
+TEST(TinyOCLTest, TestCommandGraphCommandBuffer)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto add = executor.CreateKernel("cl/calc.cl", "add", {});
+    auto sub = executor.CreateKernel("cl/calc.cl", "sub", {});
+    ASSERT_TRUE(add && sub);
+    size_t size = 16 * sizeof(float);
+    auto input0 = executor.CreateBuffer(size);
+    auto input1 = executor.CreateBuffer(size);
+    auto input2 = executor.CreateBuffer(size);
+    auto sum = executor.CreateBuffer(size);
+    auto output = executor.CreateBuffer(size);
+    ASSERT_TRUE(input0 && input1 && input2 && sum && output);
+    std::vector<float> host0(16, 1.0f);
+    std::vector<float> host1(16, 2.0f);
+    std::vector<float> host2(16, 5.0f);
+    EXPECT_TRUE(input0->Memcpy(host0.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+    EXPECT_TRUE(input1->Memcpy(host1.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+    EXPECT_TRUE(input2->Memcpy(host2.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+
+    // A graph of kernel launches only is replayed as a command buffer.
+    auto graph = executor.CreateCommandGraph();
+    ASSERT_NE(graph, nullptr);
+    uint32_t run_add = 0;
+    EXPECT_TRUE(graph->RecordKernel(
+        *add, {16}, {}, {}, &run_add, input0->GetClMem(), input1->GetClMem(), sum->GetClMem()));
+    EXPECT_TRUE(graph->RecordKernel(
+        *sub, {16}, {}, {run_add}, nullptr, sum->GetClMem(), input0->GetClMem(), output->GetClMem()));
+    EXPECT_TRUE(graph->Finalize());
+    if (!graph->IsCommandBuffer()) {
+        GTEST_SKIP() << "cl_khr_command_buffer is not supported";
+    }
+    auto read_output = [&output, size]() {
+        std::vector<float> host(16, 0.0f);
+        EXPECT_TRUE(output->Memcpy(host.data(), size, TinyOCL::MemcpyKind::DeviceToHost));
+        return host[15];
+    };
+    TinyOCL::Event replay;
+    EXPECT_TRUE(graph->Replay({}, {}, &replay));
+    EXPECT_TRUE(replay.Wait());
+    EXPECT_EQ(read_output(), 2.0f);
+
+    // Back to back replays are ordered by the queue, a patch updates or records the command buffer again.
+    EXPECT_TRUE(graph->Replay({}, {}, nullptr));
+    EXPECT_TRUE(graph->Replay({}, {}, &replay));
+    EXPECT_TRUE(replay.Wait());
+    EXPECT_EQ(read_output(), 2.0f);
+    cl_mem patched = input2->GetClMem();
+    EXPECT_TRUE(graph->Replay({{run_add, 1, {sizeof(cl_mem), &patched}}}, {}, &replay));
+    EXPECT_TRUE(replay.Wait());
+    EXPECT_EQ(read_output(), 5.0f);
+    EXPECT_TRUE(graph->Replay({{run_add, 1, TinyOCL::MakeKernelArg(patched)}}, {}, &replay));
+    EXPECT_TRUE(replay.Wait());
+    EXPECT_EQ(read_output(), 5.0f);
+    cl_mem restored = input1->GetClMem();
+    EXPECT_TRUE(graph->Replay({{run_add, 1, TinyOCL::MakeKernelArg(restored)}}, {}, &replay));
+    EXPECT_TRUE(replay.Wait());
+    EXPECT_EQ(read_output(), 2.0f);
+    EXPECT_TRUE(graph->IsCommandBuffer());
+}
+
+TEST(TinyOCLTest, TestProfiling)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    size_t size = 16 * sizeof(float);
+    auto input = executor.CreateBuffer(size);
+    auto output = executor.CreateBuffer(size);
+    std::vector<float> host(16, 1.0f);
+
+    executor.ResetProfiling();
+    executor.EnableProfiling(true);
+    EXPECT_TRUE(input->Memcpy(host.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+    for (int i = 0; i < 8; i++) {
+        EXPECT_TRUE(kernel->Run({16}, {}, true, input->GetClMem(), input->GetClMem(), output->GetClMem()));
+    }
+    EXPECT_TRUE(executor.Finish());
+    executor.EnableProfiling(false);
+    EXPECT_TRUE(kernel->Run({16}, {}, false, input->GetClMem(), input->GetClMem(), output->GetClMem()));
+
+    // The timestamps are collected by the event callbacks, which may run after Finish returns.
+    std::vector<TinyOCL::KernelProfile> profiles;
+    for (int retry = 0; retry < 100; retry++) {
+        profiles = executor.GetKernelProfiles();
+        if (profiles.size() == 2 && profiles[0].count + profiles[1].count == 9) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(profiles.size(), 2);
+    for (const auto &profile : profiles) {
+        EXPECT_EQ(profile.count, profile.name == "add" ? 8 : 1);
+        EXPECT_LE(profile.p50_ns, profile.p95_ns);
+        EXPECT_LE(profile.p95_ns, profile.p99_ns);
+        EXPECT_LE(profile.p99_ns, profile.total_ns);
+    }
+
+    std::string path = (std::filesystem::temp_directory_path() / "tinyocl_trace.json").string();
+    EXPECT_TRUE(executor.DumpChromeTrace(path));
+    std::ifstream trace(path);
+    std::string json((std::istreambuf_iterator<char>(trace)), std::istreambuf_iterator<char>());
+    EXPECT_NE(json.find("\"traceEvents\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"add\""), std::string::npos);
+    std::filesystem::remove(path);
+
+    executor.ResetProfiling();
+    EXPECT_TRUE(executor.GetKernelProfiles().empty());
+
+    // Graph replays are profiled per command, or as a whole when they run as a command buffer.
+    auto graph = executor.CreateCommandGraph();
+    ASSERT_NE(graph, nullptr);
+    EXPECT_TRUE(graph->RecordKernel(
+        *kernel, {16}, {}, {}, nullptr, input->GetClMem(), input->GetClMem(), output->GetClMem()));
+    EXPECT_TRUE(graph->Finalize());
+    executor.EnableProfiling(true);
+    TinyOCL::Event replay;
+    EXPECT_TRUE(graph->Replay({}, {}, &replay));
+    EXPECT_TRUE(replay.Wait());
+    executor.EnableProfiling(false);
+    const std::string graph_name = graph->IsCommandBuffer() ? "CommandGraph" : "add";
+    for (int retry = 0; retry < 100; retry++) {
+        profiles = executor.GetKernelProfiles();
+        if (!profiles.empty()) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(profiles.size(), 1);
+    EXPECT_EQ(profiles[0].name, graph_name);
+    EXPECT_EQ(profiles[0].count, 1);
+    executor.ResetProfiling();
+}
+
+TEST(TinyOCLTest, TestLocalSizeTuning)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "tinyocl_tuning";
+    std::filesystem::remove_all(directory);
+    executor.SetProgramCacheDirectory(directory.string());
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    size_t size = 1024 * sizeof(float);
+    auto input = executor.CreateBuffer(size);
+    auto output = executor.CreateBuffer(size);
+
+    EXPECT_TRUE(kernel->Tune({1024}, input->GetClMem(), input->GetClMem(), output->GetClMem()));
+    std::vector<size_t> local_size = kernel->GetTunedLocalSize({1024});
+    if (!local_size.empty()) {
+        ASSERT_EQ(local_size.size(), 1);
+        EXPECT_EQ(1024 % local_size[0], 0);
+    }
+    EXPECT_TRUE(kernel->GetTunedLocalSize({512}).empty());
+    EXPECT_TRUE(kernel->Run({1024}, {}, false, input->GetClMem(), input->GetClMem(), output->GetClMem()));
+    EXPECT_GT(std::filesystem::file_size(directory / "local_sizes.txt"), 0);
+
+    // Tuning again appends lines, loading the directory again compacts them to one line per key.
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(kernel->Tune({1024}, input->GetClMem(), input->GetClMem(), output->GetClMem()));
+    }
+    auto read_keys = [&directory]() {
+        std::ifstream file(directory / "local_sizes.txt");
+        std::vector<std::string> keys;
+        std::string key;
+        std::string value;
+        while (file >> key >> value) {
+            keys.emplace_back(key);
+        }
+        return keys;
+    };
+    const size_t num_lines = read_keys().size();
+    local_size = kernel->GetTunedLocalSize({1024});
+    executor.SetProgramCacheDirectory(directory.string());
+    std::vector<std::string> keys = read_keys();
+    EXPECT_EQ(keys.size() * 4, num_lines);
+    std::sort(keys.begin(), keys.end());
+    EXPECT_EQ(std::unique(keys.begin(), keys.end()), keys.end());
+    EXPECT_EQ(kernel->GetTunedLocalSize({1024}), local_size);
+
+    // The local sizes of a program file are tuned again under a new key once its content changes.
+    const std::filesystem::path program = directory / "tuning.cl";
+    std::filesystem::copy_file("cl/calc.cl", program);
+    TinyOCL::ExecutorOptions options;
+    options.program_cache_directory = directory.string();
+    auto tune_program = [&]() {
+        auto tuning_executor = TinyOCL::Executor::Create(options);
+        ASSERT_NE(tuning_executor, nullptr);
+        auto file_kernel = tuning_executor->CreateKernel(program.string(), "add", {});
+        ASSERT_NE(file_kernel, nullptr);
+        auto file_input = tuning_executor->CreateBuffer(size);
+        auto file_output = tuning_executor->CreateBuffer(size);
+        ASSERT_TRUE(file_input && file_output);
+        EXPECT_TRUE(
+            file_kernel->Tune({1024}, file_input->GetClMem(), file_input->GetClMem(), file_output->GetClMem()));
+    };
+    auto count_keys = [&read_keys]() {
+        std::vector<std::string> file_keys = read_keys();
+        std::sort(file_keys.begin(), file_keys.end());
+        return static_cast<size_t>(std::unique(file_keys.begin(), file_keys.end()) - file_keys.begin());
+    };
+    tune_program();
+    tune_program();
+    EXPECT_EQ(count_keys(), keys.size() * 2);
+    std::ofstream(program, std::ios::app) << "// changed\n";
+    tune_program();
+    EXPECT_EQ(count_keys(), keys.size() * 3);
+
+    executor.SetProgramCacheDirectory("");
+    std::filesystem::remove_all(directory);
+}
+
+TEST(TinyOCLTest, TestStreamingPipeline)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    auto default_queue = executor.GetQueue(TinyOCL::QueueType::Compute, 0);
+    ASSERT_NE(default_queue, nullptr);
+
+    // The pipeline overlaps the stages on its own queues, without configuring the queue pool.
+    TinyOCL::StreamConfig config;
+    config.chunk_size = 64 * sizeof(float);
+    auto pipeline = executor.CreateStreamingPipeline(config);
+    ASSERT_NE(pipeline, nullptr);
+    std::vector<float> input(1000);
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = static_cast<float>(i);
+    }
+    std::vector<float> output(input.size(), 0.0f);
+    cl_command_queue compute_queue = nullptr;
+    auto launch = [&kernel, &compute_queue](const TinyOCL::Queue &queue,
+                      const TinyOCL::Buffer &in,
+                      const TinyOCL::Buffer &out,
+                      const TinyOCL::StreamChunk &chunk,
+                      const std::vector<TinyOCL::Event> &wait_events,
+                      TinyOCL::Event *event) {
+        compute_queue = queue.GetClCommandQueue();
+        const size_t global_size = chunk.input_size / sizeof(float);
+        return kernel->RunAsync(
+            queue, {global_size}, {}, wait_events, event, in.GetClMem(), in.GetClMem(), out.GetClMem());
+    };
+    const size_t size = input.size() * sizeof(float);
+    EXPECT_TRUE(pipeline->Run(input.data(), size, output.data(), size, launch));
+    EXPECT_NE(compute_queue, nullptr);
+    EXPECT_NE(compute_queue, default_queue->GetClCommandQueue());
+    for (size_t i = 0; i < output.size(); i++) {
+        EXPECT_EQ(output[i], 2.0f * i);
+    }
+    TinyOCL::StreamStatistics statistics = pipeline->GetStatistics();
+    EXPECT_EQ(statistics.chunks, 16);
+    EXPECT_EQ(statistics.input_bytes, size);
+    EXPECT_FALSE(pipeline->Run(input.data(), size, output.data(), sizeof(float), launch));
+}
+
+TEST(TinyOCLTest, TestAlgorithms)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto algorithms = executor.CreateAlgorithms();
+    ASSERT_NE(algorithms, nullptr);
+    EXPECT_GT(algorithms->GetWorkGroupSize(), 0);
+    // Several tiles and a count which is not a multiple of 4.
+    const size_t count = 5003;
+    std::vector<float> host_a(count);
+    std::vector<uint32_t> host_keys(count);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < count; i++) {
+        host_a[i] = static_cast<float>(i % 100);
+        seed = seed * 1664525 + 1013904223;
+        host_keys[i] = seed;
+    }
+    auto a = executor.CreateTypedBuffer<float>(count);
+    auto b = executor.CreateTypedBuffer<float>(count);
+    auto output = executor.CreateTypedBuffer<float>(count);
+    ASSERT_TRUE(a && b && output);
+    EXPECT_TRUE(a->Upload(host_a));
+    EXPECT_TRUE(b->Fill(2.0f));
+
+    TinyOCL::Event event;
+    EXPECT_TRUE(algorithms->Transform(
+        *a->GetBuffer(), *b->GetBuffer(), *output->GetBuffer(), count, TinyOCL::TransformOp::Add, {}, &event));
+    EXPECT_TRUE(algorithms->Transform(
+        *output->GetBuffer(), 0.5f, *output->GetBuffer(), count, TinyOCL::TransformOp::Multiply, {event}));
+    std::vector<float> host_output(count);
+    EXPECT_TRUE(output->Download(host_output));
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(host_output[i], (host_a[i] + 2.0f) * 0.5f);
+    }
+
+    float sum = 0.0f;
+    float min = 0.0f;
+    float max = 0.0f;
+    EXPECT_TRUE(algorithms->Reduce(*a->GetBuffer(), count, TinyOCL::ReduceOp::Sum, &sum));
+    EXPECT_TRUE(algorithms->Reduce(*output->GetBuffer(), count, TinyOCL::ReduceOp::Min, &min));
+    EXPECT_TRUE(algorithms->Reduce(*output->GetBuffer(), count, TinyOCL::ReduceOp::Max, &max));
+    EXPECT_EQ(sum, std::accumulate(host_a.begin(), host_a.end(), 0.0f));
+    EXPECT_EQ(min, 1.0f);
+    EXPECT_EQ(max, 50.5f);
+
+    EXPECT_TRUE(algorithms->InclusiveScan(*b->GetBuffer(), *output->GetBuffer(), count));
+    EXPECT_TRUE(output->Download(host_output));
+    EXPECT_EQ(host_output[0], 2.0f);
+    EXPECT_EQ(host_output[count - 1], 2.0f * count);
+    EXPECT_TRUE(algorithms->ExclusiveScan(*b->GetBuffer(), *b->GetBuffer(), count));
+    EXPECT_TRUE(b->Download(host_output));
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(host_output[i], 2.0f * i);
+    }
+
+    auto keys = executor.CreateTypedBuffer<uint32_t>(count);
+    auto values = executor.CreateTypedBuffer<uint32_t>(count);
+    ASSERT_TRUE(keys && values);
+    EXPECT_TRUE(keys->Upload(host_keys));
+    EXPECT_TRUE(algorithms->RadixSort(*keys->GetBuffer(), count));
+    std::vector<uint32_t> sorted_keys(count);
+    EXPECT_TRUE(keys->Download(sorted_keys));
+    std::vector<uint32_t> expected_keys = host_keys;
+    std::sort(expected_keys.begin(), expected_keys.end());
+    EXPECT_EQ(sorted_keys, expected_keys);
+
+    // 12 key bits take an odd number of passes, equal keys keep the order of their values.
+    std::vector<uint32_t> host_values(count);
+    for (size_t i = 0; i < count; i++) {
+        host_keys[i] &= 0xFFF;
+        host_values[i] = static_cast<uint32_t>(i);
+    }
+    EXPECT_TRUE(keys->Upload(host_keys));
+    EXPECT_TRUE(values->Upload(host_values));
+    EXPECT_TRUE(algorithms->RadixSortByKey(*keys->GetBuffer(), *values->GetBuffer(), count, 12));
+    std::vector<uint32_t> sorted_values(count);
+    EXPECT_TRUE(keys->Download(sorted_keys));
+    EXPECT_TRUE(values->Download(sorted_values));
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(sorted_keys[i], host_keys[sorted_values[i]]);
+        if (i > 0) {
+            ASSERT_TRUE(sorted_keys[i - 1] < sorted_keys[i] ||
+                        (sorted_keys[i - 1] == sorted_keys[i] && sorted_values[i - 1] < sorted_values[i]));
+        }
+    }
+
+    auto bins = executor.CreateTypedBuffer<uint32_t>(10);
+    ASSERT_NE(bins, nullptr);
+    EXPECT_TRUE(algorithms->Histogram(*a->GetBuffer(), count, 0.0f, 50.0f, *bins->GetBuffer(), 10));
+    std::vector<uint32_t> host_bins(10);
+    EXPECT_TRUE(bins->Download(host_bins));
+    for (uint32_t bin = 0; bin < 10; bin++) {
+        EXPECT_EQ(host_bins[bin],
+            std::count_if(host_a.begin(), host_a.end(), [bin](float x) { return x >= bin * 5 && x < bin * 5 + 5; }));
+    }
+
+    // Keep the values whose index is a multiple of 3.
+    std::vector<uint32_t> host_flags(count);
+    for (size_t i = 0; i < count; i++) {
+        host_flags[i] = i % 3 == 0 ? 7 : 0;
+    }
+    auto flags = executor.CreateTypedBuffer<uint32_t>(count);
+    auto compacted = executor.CreateTypedBuffer<uint32_t>(count);
+    auto compacted_count = executor.CreateTypedBuffer<uint32_t>(1);
+    ASSERT_TRUE(flags && compacted && compacted_count);
+    EXPECT_TRUE(values->Upload(host_values));
+    EXPECT_TRUE(flags->Upload(host_flags));
+    EXPECT_TRUE(algorithms->StreamCompact(*values->GetBuffer(),
+        *flags->GetBuffer(),
+        count,
+        *compacted->GetBuffer(),
+        *compacted_count->GetBuffer()));
+    std::vector<uint32_t> host_compacted(count);
+    std::vector<uint32_t> host_compacted_count(1);
+    EXPECT_TRUE(compacted->Download(host_compacted));
+    EXPECT_TRUE(compacted_count->Download(host_compacted_count));
+    EXPECT_EQ(host_compacted_count[0], (count + 2) / 3);
+    for (uint32_t i = 0; i < host_compacted_count[0]; i++) {
+        ASSERT_EQ(host_compacted[i], i * 3);
+    }
+
+    EXPECT_FALSE(algorithms->Reduce(*a->GetBuffer(), count + 1, TinyOCL::ReduceOp::Sum, &sum));
+    EXPECT_FALSE(algorithms->Histogram(*a->GetBuffer(), count, 1.0f, 1.0f, *bins->GetBuffer(), 10));
+}
+
+TEST(TinyOCLTest, TestDeviceSelection)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    ASSERT_GT(executor.GetDeviceCount(), 0);
+    TinyOCL::DeviceInfo info;
+    EXPECT_TRUE(executor.GetDeviceInfo(0, info));
+    EXPECT_FALSE(info.name.empty());
+    EXPECT_FALSE(info.platform.empty());
+    EXPECT_GE(info.compute_units, 1);
+    EXPECT_FALSE(executor.GetDeviceInfo(executor.GetDeviceCount(), info));
+    // The devices are chosen once, when the Executor initializes.
+    EXPECT_FALSE(TinyOCL::Executor::SetDeviceSelection(TinyOCL::DeviceSelection()));
+}
+
+namespace {
+void SetEnvironment(const char *name, const char *value)
+{
+#ifdef _WIN32
+    _putenv_s(name, value == nullptr ? "" : value);
+#else
+    if (value == nullptr) {
+        unsetenv(name);
+    } else {
+        setenv(name, value, 1);
+    }
+#endif
+}
+
+std::shared_ptr<TinyOCL::Executor> CreateExecutor(const TinyOCL::DeviceSelection &selection)
+{
+    TinyOCL::ExecutorOptions options;
+    options.device_selection = selection;
+    return TinyOCL::Executor::Create(options);
+}
+}  // namespace
+
+TEST(TinyOCLTest, TestDeviceSelector)
+{
+    TinyOCL::DeviceInfo info;
+    ASSERT_TRUE(TinyOCL::Executor::GetInstance().GetDeviceInfo(0, info));
+    std::vector<TinyOCL::DeviceType> other_types;
+    for (auto type : {TinyOCL::DeviceType::GPU, TinyOCL::DeviceType::Accelerator, TinyOCL::DeviceType::CPU}) {
+        if (type != info.type) {
+            other_types.emplace_back(type);
+        }
+    }
+    TinyOCL::DeviceInfo selected;
+
+    // The types are tried in order, the devices of a later type are used when no earlier one matches.
+    TinyOCL::DeviceSelection selection;
+    selection.types = other_types;
+    selection.types.emplace_back(info.type);
+    selection.name = info.name;
+    auto executor = CreateExecutor(selection);
+    ASSERT_NE(executor, nullptr);
+    ASSERT_TRUE(executor->GetDeviceInfo(0, selected));
+    EXPECT_EQ(selected.type, info.type);
+    EXPECT_EQ(selected.name, info.name);
+    selection.types = other_types;
+    selection.types.insert(selection.types.begin(), info.type);
+    selection.name.clear();
+    executor = CreateExecutor(selection);
+    ASSERT_NE(executor, nullptr);
+    ASSERT_TRUE(executor->GetDeviceInfo(0, selected));
+    EXPECT_EQ(selected.type, info.type);
+
+    // The vendor and name filters match a case-insensitive part.
+    std::string vendor = info.vendor.substr(0, 3);
+    std::transform(vendor.begin(), vendor.end(), vendor.begin(), [](unsigned char c) { return std::toupper(c); });
+    selection = TinyOCL::DeviceSelection();
+    selection.vendor = vendor;
+    selection.name = info.name.substr(1);
+    executor = CreateExecutor(selection);
+    ASSERT_NE(executor, nullptr);
+    ASSERT_TRUE(executor->GetDeviceInfo(0, selected));
+    EXPECT_EQ(selected.vendor, info.vendor);
+    selection.vendor = "no such vendor";
+    EXPECT_EQ(CreateExecutor(selection), nullptr);
+    selection = TinyOCL::DeviceSelection();
+    selection.name = "no such device";
+    EXPECT_EQ(CreateExecutor(selection), nullptr);
+
+    selection = TinyOCL::DeviceSelection();
+    selection.min_compute_units = info.compute_units;
+    EXPECT_NE(CreateExecutor(selection), nullptr);
+    selection.min_compute_units = info.compute_units + 1;
+    executor = CreateExecutor(selection);
+    if (executor != nullptr) {
+        ASSERT_TRUE(executor->GetDeviceInfo(0, selected));
+        EXPECT_GT(selected.compute_units, info.compute_units);
+    }
+
+    // The environment overrides the selection, invalid values are ignored.
+    SetEnvironment("TINYOCL_DEVICE_NAME", "no such device");
+    EXPECT_EQ(CreateExecutor(TinyOCL::DeviceSelection()), nullptr);
+    SetEnvironment("TINYOCL_DEVICE_NAME", nullptr);
+    selection = TinyOCL::DeviceSelection();
+    selection.types = other_types;
+    SetEnvironment("TINYOCL_DEVICE_TYPE", "gpu,accelerator,cpu");
+    SetEnvironment("TINYOCL_DEVICE_VENDOR", info.vendor.c_str());
+    EXPECT_NE(CreateExecutor(selection), nullptr);
+    SetEnvironment("TINYOCL_DEVICE_TYPE", "gpu,dsp");
+    EXPECT_NE(CreateExecutor(TinyOCL::DeviceSelection()), nullptr);
+    SetEnvironment("TINYOCL_DEVICE_TYPE", nullptr);
+    SetEnvironment("TINYOCL_DEVICE_VENDOR", nullptr);
+    SetEnvironment("TINYOCL_DEVICE_MIN_COMPUTE_UNITS", "4294967295");
+    EXPECT_EQ(CreateExecutor(TinyOCL::DeviceSelection()), nullptr);
+    for (const char *invalid : {"", "many", "-1", "8 units", "99999999999"}) {
+        SetEnvironment("TINYOCL_DEVICE_MIN_COMPUTE_UNITS", invalid);
+        EXPECT_NE(CreateExecutor(TinyOCL::DeviceSelection()), nullptr) << invalid;
+    }
+    SetEnvironment("TINYOCL_DEVICE_MIN_COMPUTE_UNITS", nullptr);
+}
+
+TEST(TinyOCLTest, TestTaskRuntime)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    TinyOCL::TaskRuntimeConfig config;
+    config.num_threads = 4;
+    auto runtime = executor.CreateTaskRuntime(config);
+    ASSERT_NE(runtime, nullptr);
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    auto queue = executor.GetQueue(TinyOCL::QueueType::Compute, 0);
+
+    // Every request prepares its input on the host, adds on the device and checks the result on the host.
+    constexpr int kRequests = 16;
+    size_t size = 64 * sizeof(float);
+    std::vector<std::vector<float>> hosts(kRequests, std::vector<float>(64, 0.0f));
+    std::vector<std::shared_ptr<TinyOCL::Buffer>> buffers;
+    std::vector<int> results(kRequests, 0);
+    std::vector<TinyOCL::Task> checks;
+    for (int r = 0; r < kRequests; r++) {
+        auto input = executor.CreateBuffer(size, TinyOCL::BufferMode::DeviceOnly);
+        auto output = executor.CreateBuffer(size, TinyOCL::BufferMode::DeviceOnly);
+        buffers.emplace_back(input);
+        buffers.emplace_back(output);
+        auto prepare = runtime->Submit([&, r, input](TinyOCL::Event &event) {
+            std::fill(hosts[r].begin(), hosts[r].end(), static_cast<float>(r));
+            return input->Memcpy(*queue, hosts[r].data(), size, TinyOCL::MemcpyKind::HostToDevice, {}, &event);
+        });
+        auto compute = runtime->Submit(
+            [&, input, output](TinyOCL::Event &event) {
+                return kernel->RunAsync({64}, {}, {}, &event, input->GetClMem(), input->GetClMem(), output->GetClMem());
+            },
+            {prepare});
+        auto download = runtime->Submit(
+            [&, r, output](TinyOCL::Event &event) {
+                return output->Memcpy(*queue, hosts[r].data(), size, TinyOCL::MemcpyKind::DeviceToHost, {}, &event);
+            },
+            {compute});
+        checks.emplace_back(runtime->Submit(
+            [&, r](TinyOCL::Event &) {
+                results[r] = hosts[r][0] == 2.0f * r && hosts[r][63] == 2.0f * r ? 1 : 0;
+                return true;
+            },
+            {download}));
+    }
+    for (auto &check : checks) {
+        EXPECT_TRUE(check.Wait());
+    }
+    EXPECT_TRUE(runtime->WaitAll());
+    for (int r = 0; r < kRequests; r++) {
+        EXPECT_EQ(results[r], 1) << r;
+    }
+
+    // A task waits for an event without holding a worker.
+    cl_context context = nullptr;
+    ASSERT_EQ(clGetCommandQueueInfo(
+                  queue->GetClCommandQueue(), CL_QUEUE_CONTEXT, sizeof(context), &context, nullptr),
+        CL_SUCCESS);
+    TinyOCL::Event user_event(clCreateUserEvent(context, nullptr));
+    ASSERT_TRUE(user_event.IsValid());
+    auto waiting = runtime->Submit([](TinyOCL::Event &) { return true; }, {}, {user_event});
+    auto other = runtime->Submit([](TinyOCL::Event &) { return true; });
+    EXPECT_TRUE(other.Wait());
+    EXPECT_FALSE(waiting.IsComplete());
+    EXPECT_EQ(clSetUserEventStatus(user_event.GetClEvent(), CL_COMPLETE), CL_SUCCESS);
+    EXPECT_TRUE(waiting.Wait());
+
+    // A failed task fails its dependents without running them.
+    bool ran = false;
+    auto failed = runtime->Submit([](TinyOCL::Event &) { return false; });
+    auto skipped = runtime->Submit(
+        [&ran](TinyOCL::Event &) {
+            ran = true;
+            return true;
+        },
+        {failed});
+    EXPECT_FALSE(skipped.Wait());
+    EXPECT_FALSE(ran);
+    EXPECT_FALSE(runtime->WaitAll());
+    EXPECT_TRUE(runtime->WaitAll());
+
+    auto statistics = runtime->GetStatistics();
+    EXPECT_EQ(statistics.submitted, 4 * kRequests + 4);
+    EXPECT_EQ(statistics.completed, 4 * kRequests + 2);
+    EXPECT_EQ(statistics.failed, 2);
+    EXPECT_EQ(statistics.event_dependencies, 1);
+}
+
+TEST(TinyOCLTest, TestIndependentExecutors)
+{
+    TinyOCL::ExecutorOptions options0;
+    options0.queues.compute_queues = 2;
+    TinyOCL::ExecutorOptions options1;
+    options1.profiling = true;
+    options1.schedule_policy = TinyOCL::SchedulePolicy::RoundRobin;
+    for (int round = 0; round < 2; round++) {
+        auto executor0 = TinyOCL::Executor::Create(options0);
+        auto executor1 = TinyOCL::Executor::Create(options1);
+        ASSERT_NE(executor0, nullptr);
+        ASSERT_NE(executor1, nullptr);
+        EXPECT_NE(executor0->GetQueue(TinyOCL::QueueType::Compute, 0)->GetClCommandQueue(),
+            executor0->GetQueue(TinyOCL::QueueType::Compute, 1)->GetClCommandQueue());
+        EXPECT_EQ(executor1->GetQueue(TinyOCL::QueueType::Compute, 0)->GetClCommandQueue(),
+            executor1->GetQueue(TinyOCL::QueueType::Compute, 1)->GetClCommandQueue());
+        for (auto &executor : {executor0, executor1}) {
+            auto kernel = executor->CreateKernel("cl/calc.cl", "add", {});
+            ASSERT_NE(kernel, nullptr);
+            size_t size = 4 * sizeof(float);
+            auto buffer0 = executor->CreateBuffer(size);
+            auto buffer1 = executor->CreateBuffer(size);
+            auto buffer2 = executor->CreateBuffer(size);
+            float *data0 = buffer0->GetHostPtr<float *>();
+            float *data1 = buffer1->GetHostPtr<float *>();
+            float *data2 = buffer2->GetHostPtr<float *>();
+            for (int i = 0; i < 4; i++) {
+                data0[i] = i;
+                data1[i] = round;
+            }
+            EXPECT_TRUE(kernel->Run({4}, {}, false, buffer0->GetClMem(), buffer1->GetClMem(), buffer2->GetClMem()));
+            for (int i = 0; i < 4; i++) {
+                EXPECT_EQ(data2[i], i + round);
+            }
+        }
+        // Every executor has its own buffer pool and profiler.
+        EXPECT_EQ(executor0->GetBufferPoolStatistics().cached_buffers, 3);
+        EXPECT_EQ(executor1->GetBufferPoolStatistics().cached_buffers, 3);
+        EXPECT_TRUE(executor0->GetKernelProfiles().empty());
+        EXPECT_FALSE(executor1->GetKernelProfiles().empty());
+    }
+
+    TinyOCL::ExecutorOptions missing;
+    missing.device_selection.name = "no-such-device";
+    EXPECT_EQ(TinyOCL::Executor::Create(missing), nullptr);
+    TinyOCL::Executor::GetInstance();
+    EXPECT_FALSE(TinyOCL::Executor::SetDefaultOptions(TinyOCL::ExecutorOptions()));
+}
+
+TEST(TinyOCLTest, TestQueuePool)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    TinyOCL::QueuePoolConfig config;
+    config.compute_queues = 2;
+    config.copy_queues = 1;
+    config.out_of_order = true;
+    EXPECT_TRUE(executor.ConfigureQueues(config));
+
+    auto copy_queue = executor.GetQueue(TinyOCL::QueueType::Copy, 0);
+    auto compute_queue = executor.GetQueue(TinyOCL::QueueType::Compute, 1);
+    ASSERT_NE(copy_queue, nullptr);
+    ASSERT_NE(compute_queue, nullptr);
+    EXPECT_EQ(copy_queue->GetType(), TinyOCL::QueueType::Copy);
+    EXPECT_NE(copy_queue->GetClCommandQueue(), compute_queue->GetClCommandQueue());
+    auto default_queue = executor.GetQueue(TinyOCL::QueueType::Compute, 0);
+    EXPECT_NE(default_queue->GetClCommandQueue(), compute_queue->GetClCommandQueue());
+    EXPECT_EQ(executor.GetQueue(TinyOCL::QueueType::Compute, 2)->GetClCommandQueue(),
+        default_queue->GetClCommandQueue());
+
+    auto kernel = executor.CreateKernel("cl/calc.cl", "sub", {});
+    ASSERT_NE(kernel, nullptr);
+    size_t size = 8 * sizeof(float);
+    auto buffer0 = executor.CreateBuffer(size);
+    auto buffer1 = executor.CreateBuffer(size);
+    auto buffer2 = executor.CreateBuffer(size);
+    std::vector<float> host0(8, 5.0f);
+    std::vector<float> host1(8, 2.0f);
+    std::vector<float> host2(8, 0.0f);
+    TinyOCL::Event write0;
+    TinyOCL::Event write1;
+    EXPECT_TRUE(buffer0->Memcpy(*copy_queue, host0.data(), size, TinyOCL::MemcpyKind::HostToDevice, {}, &write0));
+    EXPECT_TRUE(buffer1->Memcpy(*copy_queue, host1.data(), size, TinyOCL::MemcpyKind::HostToDevice, {}, &write1));
+    TinyOCL::Event run;
+    EXPECT_TRUE(kernel->RunAsync(*compute_queue,
+        {8},
+        {},
+        {write0, write1},
+        &run,
+        buffer0->GetClMem(),
+        buffer1->GetClMem(),
+        buffer2->GetClMem()));
+    EXPECT_TRUE(buffer2->Memcpy(*copy_queue, host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost, {run}, nullptr));
+    EXPECT_TRUE(executor.Finish());
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ(host2[i], 3.0f);
+    }
+    EXPECT_TRUE(executor.ConfigureQueues(TinyOCL::QueuePoolConfig()));
+    EXPECT_TRUE(copy_queue->Finish());
+}
+
+TEST(TinyOCLTest, TestSchedulePolicy)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    uint32_t num_devices = executor.GetDeviceCount();
+    EXPECT_GE(num_devices, 1);
+    EXPECT_NE(executor.GetQueue(TinyOCL::QueueType::Compute, 0, num_devices - 1), nullptr);
+    EXPECT_EQ(executor.GetQueue(TinyOCL::QueueType::Compute, 0, num_devices), nullptr);
+
+    auto kernel = executor.CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    size_t size = 4 * sizeof(float);
+    auto buffer0 = executor.CreateBuffer(size);
+    auto buffer1 = executor.CreateBuffer(size);
+    auto buffer2 = executor.CreateBuffer(size);
+    float *data0 = buffer0->GetHostPtr<float *>();
+    float *data1 = buffer1->GetHostPtr<float *>();
+    float *data2 = buffer2->GetHostPtr<float *>();
+    for (int i = 0; i < 4; i++) {
+        data0[i] = i;
+        data1[i] = 1.0f;
+    }
+    for (auto policy : {TinyOCL::SchedulePolicy::RoundRobin,
+             TinyOCL::SchedulePolicy::LeastOutstanding,
+             TinyOCL::SchedulePolicy::FirstDevice}) {
+        executor.SetSchedulePolicy(policy);
+        for (uint32_t i = 0; i < 2 * num_devices; i++) {
+            EXPECT_TRUE(kernel->Run({4}, {}, false, buffer0->GetClMem(), buffer1->GetClMem(), buffer2->GetClMem()));
+            TinyOCL::Event event;
+            EXPECT_TRUE(kernel->RunAsync(
+                {4}, {}, {}, &event, buffer0->GetClMem(), buffer1->GetClMem(), buffer2->GetClMem()));
+            EXPECT_TRUE(event.Wait());
+        }
+    }
+    kernel->SetDeviceAffinity(num_devices - 1);
+    EXPECT_TRUE(kernel->Run({4}, {}, false, buffer0->GetClMem(), buffer1->GetClMem(), buffer2->GetClMem()));
+    kernel->SetDeviceAffinity(-1);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(data2[i], i + 1.0f);
+    }
+}
+
+TEST(TinyOCLTest, TestSchedulePlacement)
+{
+    // Sub-devices give several devices on a single device machine, the partition is optional for the driver.
+    TinyOCL::DeviceInfo info;
+    ASSERT_TRUE(TinyOCL::Executor::GetInstance().GetDeviceInfo(0, info));
+    TinyOCL::ExecutorOptions options;
+    options.partition_compute_units = std::max<uint32_t>(info.compute_units / 4, 1);
+    auto executor = info.compute_units >= 2 ? TinyOCL::Executor::Create(options) : nullptr;
+    if (executor == nullptr || executor->GetDeviceCount() < 2) {
+        GTEST_SKIP() << "Multiple devices are not available";
+    }
+    const uint32_t num_devices = executor->GetDeviceCount();
+    auto get_device = [](cl_command_queue queue) {
+        cl_device_id device = nullptr;
+        clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, nullptr);
+        return device;
+    };
+    std::vector<cl_device_id> devices;
+    for (uint32_t device = 0; device < num_devices; device++) {
+        auto queue = executor->GetQueue(TinyOCL::QueueType::Compute, 0, device);
+        ASSERT_NE(queue, nullptr);
+        devices.emplace_back(get_device(queue->GetClCommandQueue()));
+    }
+    auto get_event_device = [&get_device](const TinyOCL::Event &event) {
+        cl_command_queue queue = nullptr;
+        clGetEventInfo(event.GetClEvent(), CL_EVENT_COMMAND_QUEUE, sizeof(queue), &queue, nullptr);
+        return get_device(queue);
+    };
+
+    auto kernel = executor->CreateKernel("cl/calc.cl", "add", {});
+    ASSERT_NE(kernel, nullptr);
+    size_t size = 4 * sizeof(float);
+    auto buffer0 = executor->CreateBuffer(size);
+    auto buffer1 = executor->CreateBuffer(size);
+    auto buffer2 = executor->CreateBuffer(size);
+    ASSERT_TRUE(buffer0 && buffer1 && buffer2);
+    std::vector<float> host0 = {0.0f, 1.0f, 2.0f, 3.0f};
+    std::vector<float> host1(4, 1.0f);
+    EXPECT_TRUE(buffer0->Memcpy(host0.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+    EXPECT_TRUE(buffer1->Memcpy(host1.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+    auto run = [&]() {
+        TinyOCL::Event event;
+        EXPECT_TRUE(
+            kernel->RunAsync({4}, {}, {}, &event, buffer0->GetClMem(), buffer1->GetClMem(), buffer2->GetClMem()));
+        EXPECT_TRUE(event.Wait());
+        auto iter = std::find(devices.begin(), devices.end(), get_event_device(event));
+        EXPECT_NE(iter, devices.end());
+        return static_cast<uint32_t>(iter - devices.begin());
+    };
+
+    executor->SetSchedulePolicy(TinyOCL::SchedulePolicy::FirstDevice);
+    for (uint32_t i = 0; i < num_devices; i++) {
+        EXPECT_EQ(run(), 0);
+    }
+    // The launches cycle through the devices.
+    executor->SetSchedulePolicy(TinyOCL::SchedulePolicy::RoundRobin);
+    const uint32_t first = run();
+    for (uint32_t i = 1; i < 2 * num_devices; i++) {
+        EXPECT_EQ(run(), (first + i) % num_devices);
+    }
+    // The completions are counted by event callbacks, so only the device range is certain here.
+    executor->SetSchedulePolicy(TinyOCL::SchedulePolicy::LeastOutstanding);
+    EXPECT_LT(run(), num_devices);
+    // The affinity wins over the policy, the buffers of the context are used on every device.
+    for (uint32_t device = 0; device < num_devices; device++) {
+        kernel->SetDeviceAffinity(device);
+        std::vector<float> zero(4, 0.0f);
+        EXPECT_TRUE(buffer2->Memcpy(zero.data(), size, TinyOCL::MemcpyKind::HostToDevice));
+        EXPECT_EQ(run(), device);
+        std::vector<float> host2(4, 0.0f);
+        EXPECT_TRUE(buffer2->Memcpy(host2.data(), size, TinyOCL::MemcpyKind::DeviceToHost));
+        for (int i = 0; i < 4; i++) {
+            EXPECT_EQ(host2[i], i + 1.0f);
+        }
+    }
+}
+
+TEST(TinyOCLTest, TestProgramCache)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "tinyocl_program_cache_test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory / "programs");
+    executor.SetProgramCacheDirectory((directory / "cache").string());
+    auto write_program = [&directory](const std::string &name) {
+        std::filesystem::path path = directory / "programs" / name;
+        std::filesystem::copy_file("cl/calc.cl", path);
+        return path.string();
+    };
+    auto count_entries = [&directory]() {
+        size_t count = 0;
+        for (const auto &entry : std::filesystem::directory_iterator(directory / "cache")) {
+            count += entry.path().extension() == ".bin" ? 1 : 0;
+        }
+        return count;
+    };
+
+    EXPECT_NE(executor.CreateKernel(write_program("calc0.cl"), "add", {}), nullptr);
+    EXPECT_EQ(count_entries(), 1);
+    // Same source and options, loaded from the cache.
+    EXPECT_NE(executor.CreateKernel(write_program("calc1.cl"), "add", {}), nullptr);
+    EXPECT_EQ(count_entries(), 1);
+    // Different options, a new entry.
+    EXPECT_NE(executor.CreateKernel(write_program("calc2.cl"), "add", {"-DCACHE_TEST"}), nullptr);
+    EXPECT_EQ(count_entries(), 2);
+    // A corrupted entry falls back to source and is replaced.
+    for (const auto &entry : std::filesystem::directory_iterator(directory / "cache")) {
+        std::ofstream(entry.path(), std::ofstream::binary | std::ofstream::trunc) << "corrupted";
+    }
+    EXPECT_NE(executor.CreateKernel(write_program("calc3.cl"), "add", {}), nullptr);
+    EXPECT_EQ(count_entries(), 2);
+    // So is an entry announcing a binary larger than the file.
+    for (const auto &entry : std::filesystem::directory_iterator(directory / "cache")) {
+        const uint64_t header[] = {executor.GetDeviceCount(), uint64_t(1) << 60};
+        std::ofstream file(entry.path(), std::ofstream::binary | std::ofstream::trunc);
+        file.write("TOCLBIN1", 8);
+        file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    }
+    EXPECT_NE(executor.CreateKernel(write_program("calc4.cl"), "add", {}), nullptr);
+    EXPECT_NE(executor.CreateKernel(write_program("calc5.cl"), "add", {"-DCACHE_TEST"}), nullptr);
+    EXPECT_EQ(count_entries(), 2);
+    for (const auto &entry : std::filesystem::directory_iterator(directory / "cache")) {
+        EXPECT_GT(std::filesystem::file_size(entry.path()), 24);
+    }
+
+    executor.SetProgramCacheDirectory("");
+    std::filesystem::remove_all(directory);
+}
+
+TEST(TinyOCLTest, TestProgramVariants)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "tinyocl_variant_test.cl";
+    std::ofstream(path) << "#ifdef VARIANT_B\n"
+                           "__kernel void variant_b(__global float *a) { a[get_global_id(0)] = 2.0f; }\n"
+                           "#else\n"
+                           "__kernel void variant_a(__global float *a) { a[get_global_id(0)] = 1.0f; }\n"
+                           "#endif\n";
+    EXPECT_NE(executor.CreateKernel(path.string(), "variant_a", {}), nullptr);
+    EXPECT_NE(executor.CreateKernel(path.string(), "variant_b", {"-DVARIANT_B"}), nullptr);
+    EXPECT_NE(executor.CreateKernel(path.string(), "variant_b", {"-DVARIANT_B -DUNUSED"}), nullptr);
+    EXPECT_NE(executor.CreateKernel(path.string(), "variant_b", {"-DUNUSED", "-DVARIANT_B"}), nullptr);
+    EXPECT_NE(executor.CreateKernel(path.string(), "variant_a", {}), nullptr);
+
+    // An option and its argument stay together and only whole entries are sorted.
+    const std::set<std::string> options0 = {"-I /tmp", " -D VARIANT_B=1", "-D UNUSED=1 "};
+    const std::set<std::string> options1 = {"-D VARIANT_B=1", "-D UNUSED=2", "-I /tmp"};
+    EXPECT_NE(executor.CreateKernel(path.string(), "variant_b", options0), nullptr);
+    EXPECT_NE(executor.CreateKernel(path.string(), "variant_b", options1), nullptr);
+    auto timings = executor.GetStartupTimings();
+    auto built = [&timings, &path](const std::string &build_options) {
+        const std::string stage = "build " + path.string() + " " + build_options;
+        return std::count_if(timings.begin(), timings.end(), [&stage](const TinyOCL::StartupTiming &timing) {
+            return timing.stage == stage && timing.success;
+        });
+    };
+    EXPECT_EQ(built("-D UNUSED=1 -D VARIANT_B=1 -I /tmp"), 1);
+    EXPECT_EQ(built("-D UNUSED=2 -D VARIANT_B=1 -I /tmp"), 1);
+    std::filesystem::remove(path);
+}
+
+TEST(TinyOCLTest, TestPrecompileAsync)
+{
+    auto &executor = TinyOCL::Executor::GetInstance();
+    auto futures = executor.PrecompileAsync({{"cl/calc.cl", {"-DPRECOMPILE=1"}},
+        {"cl/calc.cl", {"-DPRECOMPILE=2"}},
+        {"cl/calc.cl", {"-DPRECOMPILE=1"}},
+        {"cl/calc1.cl", {}}});
+    ASSERT_EQ(futures.size(), 4);
+    // Unrelated programs stay available while the variants compile.
+    EXPECT_NE(executor.CreateKernel("cl/calc.cl", "add", {}), nullptr);
+    EXPECT_TRUE(futures[0].get());
+    EXPECT_TRUE(futures[1].get());
+    EXPECT_TRUE(futures[2].get());
+    EXPECT_FALSE(futures[3].get());
+    EXPECT_NE(executor.CreateKernel("cl/calc.cl", "sub", {"-DPRECOMPILE=2"}), nullptr);
+    EXPECT_EQ(executor.CreateKernel("cl/calc1.cl", "add", {}), nullptr);
+}
+
+TEST(TinyOCLTest, TestWarmup)
+{
+    TinyOCL::WarmupConfig config;
+    config.programs = {{"cl/calc.cl", {"-DWARMUP=1"}}};
+    config.kernels = {{"cl/calc.cl", "add", {"-DWARMUP=2"}}, {"cl/calc.cl", "sub", {"-DWARMUP=2"}}};
+    auto warmup = TinyOCL::Executor::Warmup(config);
+    auto &executor = TinyOCL::Executor::GetInstance();
+    EXPECT_TRUE(warmup.get());
+    EXPECT_NE(executor.CreateKernel("cl/calc.cl", "sub", {"-DWARMUP=2"}), nullptr);
+
+    auto timings = executor.GetStartupTimings();
+    auto find_stage = [&timings](const std::string &stage) {
+        return std::find_if(timings.begin(), timings.end(), [&stage](const TinyOCL::StartupTiming &timing) {
+            return timing.stage == stage && timing.success;
+        }) != timings.end();
+    };
+    for (const char *stage : {"platform query",
+             "context",
+             "queues",
+             "managers",
+             "build cl/calc.cl -DWARMUP=1",
+             "build cl/calc.cl -DWARMUP=2",
+             "kernel cl/calc.cl:add",
+             "kernel cl/calc.cl:sub"}) {
+        EXPECT_TRUE(find_stage(stage)) << stage;
+    }
+    EXPECT_EQ(timings[0].stage, "platform query");
+    EXPECT_EQ(timings[0].start_ns, 0);
+
+    TinyOCL::WarmupConfig missing;
+    missing.kernels = {{"cl/calc1.cl", "add", {}}};
+    EXPECT_FALSE(executor.Prebuild(missing).get());
+}
+
+TEST(TinyOCLTest, TestWarmupBeforeInstance)
+{
+    // The threadsafe style runs the statements in a new process, where the warmup initializes the instance.
+    testing::GTEST_FLAG(death_test_style) = "threadsafe";
+    TinyOCL::WarmupConfig config;
+    config.kernels = {{"cl/calc.cl", "add", {"-DWARMUP=3"}}};
+    EXPECT_EXIT(
+        {
+            auto warmup = TinyOCL::Executor::Warmup(config);
+            auto kernel = TinyOCL::Executor::GetInstance().CreateKernel("cl/calc.cl", "add", {"-DWARMUP=3"});
+            std::exit(warmup.get() && kernel != nullptr ? 0 : 1);
+        },
+        testing::ExitedWithCode(0),
+        "");
+    // A warmup still running at exit completes before the instance is destroyed.
+    EXPECT_EXIT(
+        {
+            TinyOCL::Executor::Warmup(config);
+            std::exit(0);
+        },
+        testing::ExitedWithCode(0),
+        "");
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);